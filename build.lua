@@ -116,7 +116,7 @@ if is_windows then
 else
 	ld = cc
 	cflags = cflags.." -D_GNU_SOURCE"
-	ldflags = ldflags.." -g -lc -lm "
+	ldflags = ldflags.." -g -lc -lm -ldl "
 
 	if options.lld then
 		ldflags = ldflags.." -fuse-ld=lld"
@@ -225,6 +225,10 @@ rule("run", {
 command("bin/lexgen"..exe_ext, "libCuik/meta/lexgen.c", cc.." $in -O1 -o $out")
 command("libCuik/lib/preproc/keywords.h libCuik/lib/preproc/dfa.h", "bin/lexgen"..exe_ext, "bin/lexgen"..exe_ext)
 
+-- peephole rules metaprogram
+command("bin/peepgen"..exe_ext, "tb/meta/peepgen.c", cc.." $in -O1 -o $out")
+command("tb/src/opt/peeps.h", "tb/src/opt/peeps.txt", "bin/peepgen"..exe_ext.." $in tb/src/opt/peeps.h", "bin/peepgen"..exe_ext)
+
 -- package freestanding headers into C file
 local x = {}
 if is_windows then
@@ -254,6 +258,8 @@ for i, f in ipairs(src) do
 	ninja:write("build "..out..": cc "..f)
 	if out == "bin/libcuik.o" then
 		ninja:write(" | libCuik/lib/preproc/keywords.h libCuik/lib/preproc/dfa.h\n")
+	elseif out == "bin/libtb.o" then
+		ninja:write(" | tb/src/opt/peeps.h\n")
 	else
 		ninja:write("\n")
 	end
@@ -30,7 +30,7 @@ enum {
 typedef struct TB_ArenaChunk TB_ArenaChunk;
 struct TB_ArenaChunk {
     TB_ArenaChunk* next;
-    size_t pad;
+    size_t size; // usually the arena's chunk_size, bigger for the oversized allocations
     char data[];
 };
 
@@ -42,6 +42,9 @@ typedef struct TB_Arena {
     // top of the allocation space
     char* watermark;
     char* high_point; // &top->data[chunk_size]
+
+    // only used to tally the allocations when profiling
+    const char* name;
 } TB_Arena;
 
 typedef struct TB_ArenaSavepoint {
@@ -54,7 +57,7 @@ typedef struct TB_ArenaSavepoint {
 #define TB_ARENA_ALLOC(arena, T) tb_arena_alloc(arena, sizeof(T))
 #define TB_ARENA_ARR_ALLOC(arena, count, T) tb_arena_alloc(arena, (count) * sizeof(T))
 
-TB_API void tb_arena_create(TB_Arena* restrict arena, size_t chunk_size);
+TB_API void tb_arena_create(TB_Arena* restrict arena, size_t chunk_size, const char* name);
 TB_API void tb_arena_destroy(TB_Arena* restrict arena);
 
 TB_API void* tb_arena_unaligned_alloc(TB_Arena* restrict arena, size_t size);
@@ -73,7 +73,7 @@ void cuik__vfree(void* ptr, size_t size) {
 ////////////////////////////////
 // TB_Arenas
 ////////////////////////////////
-void tb_arena_create(TB_Arena* restrict arena, size_t chunk_size) {
+void tb_arena_create(TB_Arena* restrict arena, size_t chunk_size, const char* name) {
     if (chunk_size == 0) {
         chunk_size = TB_ARENA_LARGE_CHUNK_SIZE;
     }
@@ -81,18 +81,22 @@ void tb_arena_create(TB_Arena* restrict arena, size_t chunk_size) {
     // allocate initial chunk
     TB_ArenaChunk* c = cuik__valloc(chunk_size);
     c->next = NULL;
+    c->size = chunk_size;
 
     arena->chunk_size = chunk_size;
     arena->watermark  = c->data;
     arena->high_point = &c->data[chunk_size - sizeof(TB_ArenaChunk)];
     arena->base = arena->top = c;
+    arena->name = name;
+
+    cuikperf_count("arena", name, chunk_size);
 }
 
 void tb_arena_destroy(TB_Arena* restrict arena) {
     TB_ArenaChunk* c = arena->base;
     while (c != NULL) {
         TB_ArenaChunk* next = c->next;
-        cuik__vfree(c, arena->chunk_size);
+        cuik__vfree(c, c->size);
         c = next;
     }
 }
@@ -103,12 +107,20 @@ void* tb_arena_unaligned_alloc(TB_Arena* restrict arena, size_t size) {
         arena->watermark += size;
         return ptr;
     } else {
-        // slow path, we need to allocate more
-        TB_ArenaChunk* c = cuik__valloc(arena->chunk_size);
+        // slow path, we need to allocate more (if it doesn't fit in a normal
+        // chunk we'll just make a big one for it)
+        size_t chunk_size = arena->chunk_size;
+        if (size > chunk_size - sizeof(TB_ArenaChunk)) {
+            chunk_size = (size + sizeof(TB_ArenaChunk) + arena->chunk_size - 1) & ~(arena->chunk_size - 1);
+        }
+
+        cuikperf_count("arena", arena->name, chunk_size);
+        TB_ArenaChunk* c = cuik__valloc(chunk_size);
         c->next = NULL;
+        c->size = chunk_size;
 
         arena->watermark  = c->data + size;
-        arena->high_point = &c->data[arena->chunk_size - sizeof(TB_ArenaChunk)];
+        arena->high_point = &c->data[chunk_size - sizeof(TB_ArenaChunk)];
 
         // append to top
         arena->top->next = c;
@@ -153,13 +165,14 @@ void tb_arena_restore(TB_Arena* arena, TB_ArenaSavepoint sp) {
     TB_ArenaChunk* c = sp.top->next;
     while (c != NULL) {
         TB_ArenaChunk* next = c->next;
-        cuik__vfree(c, arena->chunk_size);
+        cuik__vfree(c, c->size);
         c = next;
     }
 
+    sp.top->next = NULL;
     arena->top = sp.top;
     arena->watermark = sp.watermark;
-    arena->high_point = &sp.top->data[arena->chunk_size - sizeof(TB_ArenaChunk)];
+    arena->high_point = &sp.top->data[sp.top->size - sizeof(TB_ArenaChunk)];
 }
 
 void* tb_arena_alloc(TB_Arena* restrict arena, size_t size) {
@@ -175,14 +188,16 @@ void tb_arena_clear(TB_Arena* arena) {
     if (c == NULL) return;
 
     arena->watermark = c->data;
-    arena->high_point = &c->data[arena->chunk_size - sizeof(TB_ArenaChunk)];
+    arena->high_point = &c->data[c->size - sizeof(TB_ArenaChunk)];
     arena->base = arena->top = c;
 
     // remove extra chunks
+    TB_ArenaChunk* first = c;
     c = c->next;
+    first->next = NULL;
     while (c != NULL) {
         TB_ArenaChunk* next = c->next;
-        cuik__vfree(c, arena->chunk_size);
+        cuik__vfree(c, c->size);
         c = next;
     }
 }
@@ -195,7 +210,7 @@ size_t tb_arena_current_size(TB_Arena* arena) {
     size_t total = 0;
     TB_ArenaChunk* c = arena->base;
     while (c != arena->top) {
-        total += arena->chunk_size;
+        total += c->size;
         c = c->next;
     }
 
@@ -213,6 +228,7 @@ void futex_dec(Futex* f) {
 
 #ifdef __linux__
 #include <errno.h>
+#include <time.h>
 #include <linux/futex.h>
 #include <sys/syscall.h>
 #include <unistd.h>
@@ -251,6 +267,14 @@ void futex_wait(Futex* addr, Futex val) {
     }
 }
 
+void futex_wait_for(Futex* addr, Futex val, uint32_t us) {
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+    int ret = futex(addr, FUTEX_WAIT | FUTEX_PRIVATE_FLAG, val, &ts, NULL, 0);
+    if (ret == -1 && errno != EAGAIN && errno != ETIMEDOUT && errno != EINTR) {
+        __builtin_trap();
+    }
+}
+
 #undef futex
 #elif defined(__APPLE__)
 
@@ -323,6 +347,13 @@ void futex_wait(Futex* addr, Futex val) {
     }
 }
 
+void futex_wait_for(Futex* addr, Futex val, uint32_t us) {
+    int ret = __ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, addr, val, us);
+    if (ret < 0 && -ret != EINTR && -ret != EFAULT && -ret != ETIMEDOUT && -ret != ENOENT) {
+        printf("futex wait fail?\n");
+    }
+}
+
 #elif defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -346,6 +377,10 @@ void futex_wait(Futex* addr, Futex val) {
         if (*addr != val) break;
     }
 }
+
+void futex_wait_for(Futex* addr, Futex val, uint32_t us) {
+    WaitOnAddress(addr, (void *)&val, sizeof(val), (us + 999) / 1000);
+}
 #endif
 
 void futex_wait_eq(Futex* addr, Futex val) {
@@ -353,3 +388,17 @@ void futex_wait_eq(Futex* addr, Futex val) {
         futex_wait(addr, *addr);
     }
 }
+
+void futex_wait_eq_helping(Futex* addr, Futex val, bool (*help)(void* user_data), void* user_data) {
+    while (*addr != val) {
+        if (!help(user_data)) {
+            // there's nothing to steal right now but whatever we're waiting on
+            // might still queue more (nested) jobs, so we only nap for a bit
+            // before checking the queue again.
+            Futex old = *addr;
+            if (old != val) {
+                futex_wait_for(addr, old, 500);
+            }
+        }
+    }
+}
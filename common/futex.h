@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #ifdef __APPLE__
 typedef _Atomic int32_t Futex;
@@ -13,3 +14,9 @@ void futex_signal(Futex* f);
 void futex_broadcast(Futex* f);
 void futex_wait(Futex* f, Futex val); // leaves if *f != val
 void futex_wait_eq(Futex* f, Futex val); // leaves if *f == val
+void futex_wait_for(Futex* f, Futex val, uint32_t us); // leaves if *f != val or after the timeout (or spuriously)
+
+// same as futex_wait_eq but it'll run help(user_data) while waiting, help should
+// return false once it's got nothing to do and at that point we sleep for a short
+// while before trying it again.
+void futex_wait_eq_helping(Futex* f, Futex val, bool (*help)(void* user_data), void* user_data);
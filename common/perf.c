@@ -181,3 +181,11 @@ void cuikperf_region_end(void) {
     profiler->end_plot(profiler_userdata, nanos);
     if (should_lock_profiler) mtx_unlock(&timer_mutex);
 }
+
+void cuikperf_count(const char* category, const char* name, uint64_t amount) {
+    if (profiler == NULL || profiler->count == NULL) return;
+
+    if (should_lock_profiler) mtx_lock(&timer_mutex);
+    profiler->count(profiler_userdata, category, name, amount);
+    if (should_lock_profiler) mtx_unlock(&timer_mutex);
+}
@@ -16,6 +16,9 @@ typedef struct Cuik_IProfiler {
 
     void (*begin_plot)(void* user_data, uint64_t nanos, const char* label, const char* extra);
     void (*end_plot)(void* user_data, uint64_t nanos);
+
+    // optional, tallies up non-time stats (bytes allocated, files read...)
+    void (*count)(void* user_data, const char* category, const char* name, uint64_t amount);
 } Cuik_IProfiler;
 
 // DONT USE THIS :(((
@@ -33,6 +36,10 @@ uint64_t cuik_time_in_nanos(void);
 void cuikperf_region_start(const char* fmt, const char* extra);
 void cuikperf_region_end(void);
 
+// Reports some amount of a named resource (ignored unless the profiler
+// cares about it), the name only needs to live for the duration of the call.
+void cuikperf_count(const char* category, const char* name, uint64_t amount);
+
 // Usage:
 // CUIK_TIMED_BLOCK("Beans %d", 5) {
 //   ...
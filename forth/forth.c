@@ -811,7 +811,7 @@ static WordIndex load_forth(Dictionary* dict, const char* path) {
 
     // allocate some memory for it
     if (tb_arena_is_empty(&dict->data)) {
-        tb_arena_create(&dict->data, TB_ARENA_SMALL_CHUNK_SIZE);
+        tb_arena_create(&dict->data, TB_ARENA_SMALL_CHUNK_SIZE, "dict");
     }
 
     // parse
@@ -867,7 +867,7 @@ int main(int argc, const char** argv) {
 
     set_color(glClearColor, 0xFF1C1B1F);
 
-    tb_arena_create(&young_gen, TB_ARENA_LARGE_CHUNK_SIZE);
+    tb_arena_create(&young_gen, TB_ARENA_LARGE_CHUNK_SIZE, "young gen");
 
     Dictionary sandbox[2] = { 0 };
     int curr = 0; // which of the sandboxes we're in
@@ -335,7 +335,7 @@ static int jit_thread_routine(void* arg) {
 
     Env* env = arg;
     CUIK_TIMED_BLOCK("init") {
-        tb_arena_create(&jit.arena, TB_ARENA_LARGE_CHUNK_SIZE);
+        tb_arena_create(&jit.arena, TB_ARENA_LARGE_CHUNK_SIZE, "jit");
 
         TB_FeatureSet features = { 0 };
         jit.mod = tb_module_create_for_host(&features, true);
@@ -26,8 +26,9 @@ typedef struct Cuik_IThreadpool {
     //   arg_size from Cuik is always going to be less than 64bytes
     void (*submit)(void* user_data, Cuik_TaskFn fn, size_t arg_size, void* arg);
 
-    // tries to work one job before returning (can also not work at all)
-    void (*work_one_job)(void* user_data);
+    // tries to work one job before returning (can also not work at all),
+    // returns true if it ran something.
+    bool (*work_one_job)(void* user_data);
 } Cuik_IThreadpool;
 
 // for doing calls on the interfaces
@@ -80,9 +81,14 @@ CUIK_API Cuik_Target* cuik_target_host(void);
 ////////////////////////////////////////////
 CUIK_API void cuik_init(bool use_crash_handler);
 
-// This should be called before exiting
+// Frees the calling thread's resources, each thread that used Cuik should call
+// this before exiting.
 CUIK_API void cuik_free_thread_resources(void);
 
+// Frees the process-wide state (the atom table), this should be called once
+// before exiting, after every other thread is done with Cuik.
+CUIK_API void cuik_free_process_resources(void);
+
 #ifdef CUIK_ALLOW_THREADS
 CUIK_API Cuik_IThreadpool* cuik_threadpool_create(int threads);
 CUIK_API void cuik_threadpool_destroy(Cuik_IThreadpool* thread_pool);
@@ -102,6 +108,8 @@ CUIK_API CompilationUnit* cuik_create_compilation_unit(void);
 CUIK_API void cuik_lock_compilation_unit(CompilationUnit* restrict cu);
 CUIK_API void cuik_unlock_compilation_unit(CompilationUnit* restrict cu);
 CUIK_API void cuik_add_to_compilation_unit(CompilationUnit* restrict cu, TranslationUnit* restrict tu);
+// detaches the TU, it won't be freed with the compilation unit anymore
+CUIK_API void cuik_remove_from_compilation_unit(CompilationUnit* restrict cu, TranslationUnit* restrict tu);
 CUIK_API void cuik_destroy_compilation_unit(CompilationUnit* restrict cu);
 CUIK_API size_t cuik_num_of_translation_units_in_compilation_unit(CompilationUnit* restrict cu);
 
@@ -566,6 +566,11 @@ struct Stmt {
 
             Attribs attrs;
             uint32_t local_ordinal;
+
+            // top level only: the tokens [token_start, token_end) which make up the
+            // function definition or the initializer, -live hashes these to tell
+            // what changed between builds.
+            int token_start, token_end;
         } decl;
         struct StmtFor {
             Stmt* first;
@@ -24,6 +24,9 @@ struct Cuik_DriverArgs {
 
     #ifdef CUIK_USE_TB
     TB_OutputFlavor flavor;
+
+    // which ISA extensions the codegen is allowed to use (-march)
+    TB_FeatureSet features;
     #endif
 
     Cuik_Target* target;
@@ -33,6 +36,19 @@ struct Cuik_DriverArgs {
     const char* output_name;
     const char* entrypoint;
 
+    // precompiled and placed before every TU (optional)
+    const char* prefix_header;
+
+    // directory for the function-level codegen cache (optional)
+    const char* codegen_cache;
+
+    // -fprofile-generate writes the raw profile here, -fprofile-use reads it (optional)
+    const char* profile_generate;
+    const char* profile_use;
+
+    // aggregated profile written at exit, CSV if it ends in .csv otherwise JSON (optional)
+    const char* time_report;
+
     void* diag_userdata;
     Cuik_DiagCallback diag_callback;
 
@@ -59,6 +75,7 @@ struct Cuik_DriverArgs {
     bool preprocess      : 1;
     bool think           : 1;
     bool based           : 1;
+    bool lto             : 1;
 
     bool preserve_ast    : 1;
 };
@@ -164,6 +181,30 @@ CUIK_API void cuik_step_free(Cuik_BuildStep* s);
 
 CUIK_API bool cuik_driver_does_codegen(const Cuik_DriverArgs* args);
 
+////////////////////////////////
+// Live compilation
+////////////////////////////////
+// This is what -live uses when it's JITting, the compilation unit, TB module and
+// JIT stay alive between builds. Only the TUs which depend on a changed file are
+// reparsed and only the functions whose definitions changed are recompiled, the
+// old code jumps into the new code so nothing else in the JIT is touched.
+#ifdef CUIK_USE_TB
+typedef struct Cuik_Live Cuik_Live;
+
+CUIK_API Cuik_Live* cuik_live_create(Cuik_DriverArgs* args);
+CUIK_API void cuik_live_destroy(Cuik_Live* l);
+
+// rebuilds anything that depends on the changed files (changed_count = 0 means
+// rebuild everything). returns false on errors, the old code stays in place then.
+CUIK_API bool cuik_live_update(Cuik_Live* l, Cuik_IThreadpool* thread_pool, size_t changed_count, const char** changed);
+
+// the files which the build read (sources and non-system headers), canonical paths.
+CUIK_API const char** cuik_live_files(Cuik_Live* l, size_t* out_count);
+
+// calls main() and returns the exit code
+CUIK_API int cuik_live_run(Cuik_Live* l);
+#endif
+
 ////////////////////////////////
 // Scheduling
 ////////////////////////////////
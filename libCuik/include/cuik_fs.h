@@ -125,6 +125,7 @@ bool cuikfs_canonicalize(Cuik_Path* restrict output, const char* path, bool case
         }
 
         if (d) closedir(d);
+        output->length = rl;
         return true;
     } else {
         if (realpath(path, output->data) == NULL) {
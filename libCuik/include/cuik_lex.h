@@ -104,6 +104,9 @@ typedef struct {
     // a DynArray(uint32_t) sorted to make it possible to binary search
     //   [line] = file_pos
     uint32_t* line_map;
+
+    // if true, the content and line_map belong to a Cuik_FileCache
+    bool is_cached;
 } Cuik_FileEntry;
 
 typedef struct Token {
@@ -207,6 +210,46 @@ typedef struct Cuik_FileResult {
 typedef bool (*Cuikpp_LocateFile)(void* user_data, const Cuik_Path* restrict input, Cuik_Path* output, bool case_insensitive);
 typedef bool (*Cuikpp_GetFile)(void* user_data, const Cuik_Path* restrict input, Cuik_FileResult* out_result, bool case_insensitive);
 
+////////////////////////////////
+// Preprocessor file cache
+////////////////////////////////
+// This is shared across preprocessors (it's thread-safe), any files included through
+// it are read, canonicalized and lexed once and then reused by the rest of the
+// preprocessors. It must outlive any TokenStreams which were made using it.
+typedef struct Cuik_FileCache Cuik_FileCache;
+
+CUIK_API Cuik_FileCache* cuikpp_cache_create(void);
+CUIK_API void cuikpp_cache_destroy(Cuik_FileCache* cache);
+CUIK_API void cuikpp_cache_stats(Cuik_FileCache* cache, size_t* out_hits, size_t* out_misses);
+
+////////////////////////////////
+// Precompiled prefixes
+////////////////////////////////
+// A prefix is the state of a preprocessor after running a header (tokens, files,
+// macro invocations, defines and include guards). It can be saved to disk and
+// placed at the start of other TUs instead of preprocessing the header again,
+// think of it as a precompiled header which is force included.
+typedef struct Cuik_Prefix Cuik_Prefix;
+
+// hashes the configuration of a preprocessor which hasn't run yet (version, include
+// dirs and defines), prefixes can only be used by preprocessors with the same key.
+CUIK_API uint64_t cuikpp_config_hash(Cuik_CPP* ctx);
+
+// makes a prefix out of a preprocessor which has run but isn't finalized, key is
+// the config hash from before it ran.
+CUIK_API Cuik_Prefix* cuikpp_prefix_make(Cuik_CPP* ctx, uint64_t key);
+CUIK_API bool cuikpp_prefix_save(Cuik_Prefix* p, const char* path);
+
+// maps the prefix at path, returns NULL if it's missing, made with a different
+// config or if any of the files it read have changed (read through ctx's fs).
+CUIK_API Cuik_Prefix* cuikpp_prefix_load(Cuik_CPP* ctx, const char* path);
+CUIK_API void cuikpp_prefix_free(Cuik_Prefix* p);
+
+// called before cuikpp_run, the preprocessor will continue from the end of the
+// prefix. The prefix must outlive the token stream. Returns false if the config
+// doesn't match.
+CUIK_API bool cuikpp_prefix_apply(Cuik_CPP* ctx, Cuik_Prefix* p);
+
 typedef struct {
     const char* filepath;
     Cuik_Version version;
@@ -219,6 +262,9 @@ typedef struct {
     void* fs_data;
     Cuikpp_LocateFile locate;
     Cuikpp_GetFile fs;
+
+    // optional, the included files will go through it
+    Cuik_FileCache* cache;
 } Cuik_CPPDesc;
 
 // Initialize preprocessor, allocates memory which needs to be freed via cuikpp_free
@@ -30,6 +30,9 @@ struct Cuik_CPP {
     Cuikpp_GetFile fs;
     void* user_data;
 
+    // shared with other preprocessors (optional)
+    Cuik_FileCache* cache;
+
     // used to store macro expansion results
     size_t the_shtuffs_size;
     unsigned char* the_shtuffs;
@@ -65,10 +68,13 @@ struct Cuik_CPP {
     // how deep into directive scopes (#if, #ifndef, #ifdef) is it
     int depth;
 
+    // see cpp_symtab.h
     struct {
-        size_t exp, len;
-        String* keys;   // [1 << exp]
-        MacroDef* vals; // [1 << exp]
+        size_t exp, len, tombs;
+        uint8_t* tags;   // [1 << exp]
+        uint64_t* bloom; // [1 << exp] bytes
+        String* keys;    // [1 << exp]
+        MacroDef* vals;  // [1 << exp]
     } macros;
 
     // tells you if the current scope has had an entry evaluated,
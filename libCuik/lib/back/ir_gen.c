@@ -1508,18 +1508,12 @@ static void emit_location(TranslationUnit* tu, TB_Function* func, SourceLoc loc)
         return;
     }
 
-    // TODO(NeGate): Fix this up later!!!
-    static thread_local TB_SourceFile* last_file;
-    static thread_local const char* last_filepath;
-
+    // NOTE(NeGate): we used to cache the last file by the filename pointer here but
+    // those get freed with the TU and reused by the next one, TB caches it for us now.
     ResolvedSourceLoc rloc = cuikpp_find_location(&tu->tokens, loc);
     if (rloc.file->filename[0] != '<') {
-        if (rloc.file->filename != last_filepath) {
-            last_filepath = rloc.file->filename;
-            last_file = tb_get_source_file(tu->ir_mod, rloc.file->filename);
-        }
-
-        tb_inst_set_location(func, last_file, rloc.line, rloc.column);
+        TB_SourceFile* f = tb_get_source_file(tu->ir_mod, rloc.file->filename);
+        tb_inst_set_location(func, f, rloc.line, rloc.column);
     }
 }
 
@@ -1528,6 +1522,45 @@ static TB_Node* irgen_as_rvalue(TranslationUnit* tu, TB_Function* func, Cuik_Exp
     return cvt2rval(tu, func, &v);
 }
 
+// first subexpression of the tree rooted at i (they're stored in postfix)
+static ptrdiff_t subexpr_start(Subexpr* exprs, ptrdiff_t i) {
+    ptrdiff_t start = i;
+    int arity = cuik_get_expr_arity(&exprs[i]);
+    for (int k = 0; k < arity; k++) {
+        start = subexpr_start(exprs, start - 1);
+    }
+    return start;
+}
+
+// if (__builtin_expect(x, c)) and the negated forms, we just look at the
+// root of the condition since that's where the usual macros put it.
+static TB_BranchHint branch_hint(Cuik_Expr* e, ptrdiff_t i) {
+    Subexpr* exprs = e->exprs;
+    if (exprs[i].op == EXPR_LOGICAL_NOT) {
+        TB_BranchHint h = branch_hint(e, i - 1);
+        if (h == TB_BRANCH_HINT_NONE) return h;
+        return h == TB_BRANCH_HINT_LIKELY ? TB_BRANCH_HINT_UNLIKELY : TB_BRANCH_HINT_LIKELY;
+    }
+
+    if (exprs[i].op != EXPR_CALL || exprs[i].call.param_count != 2) {
+        return TB_BRANCH_HINT_NONE;
+    }
+
+    ptrdiff_t expected = i - 1;
+    ptrdiff_t target = subexpr_start(exprs, subexpr_start(exprs, expected) - 1) - 1;
+    if (exprs[target].op != EXPR_BUILTIN_SYMBOL ||
+        strcmp((const char*) exprs[target].builtin_sym.name, "__builtin_expect") != 0 ||
+        exprs[expected].op != EXPR_INT) {
+        return TB_BRANCH_HINT_NONE;
+    }
+
+    return exprs[expected].int_lit.lit ? TB_BRANCH_HINT_LIKELY : TB_BRANCH_HINT_UNLIKELY;
+}
+
+static TB_BranchHint cond_hint(Cuik_Expr* e) {
+    return branch_hint(e, e->count - 1);
+}
+
 static void irgen_stmt(TranslationUnit* tu, TB_Function* func, Stmt* restrict s) {
     if (s == NULL) return;
 
@@ -1724,7 +1757,7 @@ static void irgen_stmt(TranslationUnit* tu, TB_Function* func, Stmt* restrict s)
                 if_false = s->if_.next ? tb_inst_region(func) : exit;
 
                 // Cast to bool
-                tb_inst_if(func, cvt2rval(tu, func, &cond), if_true, if_false);
+                tb_inst_if_hint(func, cvt2rval(tu, func, &cond), if_true, if_false, cond_hint(s->if_.cond));
             }
 
             tb_inst_set_control(func, if_true);
@@ -1754,7 +1787,7 @@ static void irgen_stmt(TranslationUnit* tu, TB_Function* func, Stmt* restrict s)
 
             emit_location(tu, func, get_root_subexpr(s->while_.cond)->loc.start);
             TB_Node* cond = irgen_as_rvalue(tu, func, s->while_.cond);
-            tb_inst_if(func, cond, body, exit);
+            tb_inst_if_hint(func, cond, body, exit, cond_hint(s->while_.cond));
 
             tb_inst_set_control(func, body);
             if (s->while_.body) {
@@ -1782,7 +1815,7 @@ static void irgen_stmt(TranslationUnit* tu, TB_Function* func, Stmt* restrict s)
 
             fallthrough_label(func, latch);
             TB_Node* cond = irgen_as_rvalue(tu, func, s->do_while.cond);
-            tb_inst_if(func, cond, body, exit);
+            tb_inst_if_hint(func, cond, body, exit, cond_hint(s->do_while.cond));
             tb_inst_set_control(func, exit);
             break;
         }
@@ -1804,7 +1837,7 @@ static void irgen_stmt(TranslationUnit* tu, TB_Function* func, Stmt* restrict s)
 
             if (s->for_.cond) {
                 TB_Node* cond = irgen_as_rvalue(tu, func, s->for_.cond);
-                tb_inst_if(func, cond, body, exit);
+                tb_inst_if_hint(func, cond, body, exit, cond_hint(s->for_.cond));
             } else {
                 tb_inst_goto(func, body);
             }
@@ -2082,7 +2115,7 @@ void cuikcg_allocate_ir(TranslationUnit* restrict tu, Cuik_IThreadpool* restrict
         }
     }
 
-    if (thread_pool) futex_wait_eq(&remaining, 0);
+    if (thread_pool) futex_wait_eq_helping(&remaining, 0, thread_pool->work_one_job, thread_pool);
 }
 
 void cuikcg_allocate_ir2(TranslationUnit* tu, TB_Module* m) {
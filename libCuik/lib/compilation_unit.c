@@ -51,6 +51,26 @@ void cuik_add_to_compilation_unit(CompilationUnit* restrict cu, TranslationUnit*
     cuik_unlock_compilation_unit(cu);
 }
 
+void cuik_remove_from_compilation_unit(CompilationUnit* restrict cu, TranslationUnit* restrict tu) {
+    assert(tu->parent == cu && "the TU isn't attached to this compilation unit");
+    cuik_lock_compilation_unit(cu);
+
+    TranslationUnit* prev = NULL;
+    for (TranslationUnit* it = cu->head; it != tu; it = it->next) {
+        prev = it;
+    }
+
+    if (prev == NULL) cu->head = tu->next;
+    else prev->next = tu->next;
+    if (cu->tail == tu) cu->tail = prev;
+    cu->count -= 1;
+
+    tu->parent = NULL;
+    tu->next = NULL;
+
+    cuik_unlock_compilation_unit(cu);
+}
+
 void cuik_destroy_compilation_unit(CompilationUnit* restrict cu) {
     if (cu == NULL) {
         return;
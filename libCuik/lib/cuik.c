@@ -16,10 +16,13 @@ void cuik_init(bool use_crash_handler) {
 }
 
 void cuik_free_thread_resources(void) {
-    atoms_free();
     tb_arena_destroy(&thread_arena);
 }
 
+void cuik_free_process_resources(void) {
+    atoms_free();
+}
+
 Cuik_Target* cuik_target_host(void) {
     #if defined(_WIN32)
     return cuik_target_x64(CUIK_SYSTEM_WINDOWS, CUIK_ENV_MSVC);
@@ -28,8 +28,26 @@ static const char* report_names[]  = { NULL, "NOTE",     "WARN",     "ERROR"
 // From types.c, we should factor this out into a public cuik function
 size_t type_as_string(size_t max_len, char* buffer, Cuik_Type* type);
 
+// parallel passes can redirect a thread's diagnostics into a local buffer so
+// they can be stitched back together in a deterministic order later.
+static _Thread_local char** diag_redirect;
+
+static char* diag_alloc(Cuik_Diagnostics* d, size_t len) {
+    if (diag_redirect != NULL) {
+        if (*diag_redirect == NULL) {
+            *diag_redirect = dyn_array_create(char, 256);
+        }
+
+        size_t old = dyn_array_length(*diag_redirect);
+        dyn_array_put_uninit(*diag_redirect, len);
+        return &(*diag_redirect)[old];
+    }
+
+    return tb_arena_unaligned_alloc(&d->buffer, len);
+}
+
 static char* sprintf_callback(const char* buf, void* user, int len) {
-    void* dst = tb_arena_unaligned_alloc(user, len);
+    void* dst = diag_alloc(user, len);
     memcpy(dst, buf, len);
     return NULL;
 }
@@ -65,7 +83,7 @@ static int sprintfcb(Cuik_Diagnostics* d, char const *fmt, ...) {
 
     va_list ap;
     va_start(ap, fmt);
-    int r = stbsp_vsprintfcb(sprintf_callback, &d->buffer, tmp, fmt, ap);
+    int r = stbsp_vsprintfcb(sprintf_callback, d, tmp, fmt, ap);
     va_end(ap);
     return r;
 }
@@ -79,7 +97,7 @@ Cuik_Diagnostics* cuikdg_make(Cuik_DiagCallback callback, void* userdata) {
     Cuik_Diagnostics* d = cuik_calloc(1, sizeof(Cuik_Diagnostics));
     d->callback = callback;
     d->userdata = userdata;
-    tb_arena_create(&d->buffer, TB_ARENA_MEDIUM_CHUNK_SIZE);
+    tb_arena_create(&d->buffer, TB_ARENA_MEDIUM_CHUNK_SIZE, "diagnostics");
     return d;
 }
 
@@ -88,6 +106,21 @@ void cuikdg_free(Cuik_Diagnostics* diag) {
     cuik_free(diag);
 }
 
+char** cuikdg_redirect(char** buffer) {
+    char** old = diag_redirect;
+    diag_redirect = buffer;
+    return old;
+}
+
+void cuikdg_flush_redirect(TokenStream* tokens, char* buffer) {
+    // we go in small pieces so we never ask the arena for more than a chunk
+    size_t len = dyn_array_length(buffer);
+    for (size_t i = 0; i < len; i += 4096) {
+        size_t l = len - i < 4096 ? len - i : 4096;
+        memcpy(tb_arena_unaligned_alloc(&tokens->diag->buffer, l), &buffer[i], l);
+    }
+}
+
 Cuik_Parser* cuikdg_get_parser(Cuik_Diagnostics* diag) {
     return diag->parser;
 }
@@ -240,7 +273,7 @@ static void diag(DiagType type, TokenStream* tokens, SourceRange loc, const char
     } else {
         sprintfcb(d, "%s%s\x1b[0m: ", report_colors[type], report_names[type]);
     }
-    stbsp_vsprintfcb(sprintf_callback, &d->buffer, tmp, fmt, ap);
+    stbsp_vsprintfcb(sprintf_callback, d, tmp, fmt, ap);
 
     // location summary
     if (loc_start.raw != 0) {
@@ -274,7 +307,7 @@ static void diag(DiagType type, TokenStream* tokens, SourceRange loc, const char
     if (loc_start.raw != 0) {
         sprintfcb(tokens->diag, "     |\n");
     } else {
-        *(char*)tb_arena_unaligned_alloc(&tokens->diag->buffer, 1) = '\n';
+        *diag_alloc(tokens->diag, 1) = '\n';
     }
 
     if (d->callback) d->callback(d, d->userdata, type);
@@ -324,15 +357,15 @@ void diag_header(TokenStream* tokens, DiagType type, const char* fmt, ...) {
     } else {
         sprintfcb(tokens->diag, "%s%s\x1b[0m: ", report_colors[type], report_names[type]);
     }
-    stbsp_vsprintfcb(sprintf_callback, &tokens->diag->buffer, tmp, fmt, ap);
-    *(char*)tb_arena_unaligned_alloc(&tokens->diag->buffer, 1) = '\n';
+    stbsp_vsprintfcb(sprintf_callback, tokens->diag, tmp, fmt, ap);
+    *diag_alloc(tokens->diag, 1) = '\n';
     va_end(ap);
 }
 
 static void diag_writer_write_upto(DiagWriter* writer, size_t pos) {
     if (writer->cursor < pos) {
         int l = pos - writer->cursor;
-        memset(tb_arena_unaligned_alloc(&writer->tokens->diag->buffer, l), ' ', l);
+        memset(diag_alloc(writer->tokens->diag, l), ' ', l);
 
         //printf("%.*s", (int)(pos - writer->cursor), writer->line_start + writer->cursor);
         writer->cursor = pos;
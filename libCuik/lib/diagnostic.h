@@ -49,6 +49,13 @@ void cuikdg_tally_error(TokenStream* s);
 Cuik_Diagnostics* cuikdg_make(Cuik_DiagCallback callback, void* userdata);
 void cuikdg_free(Cuik_Diagnostics* diag);
 
+// while a redirect is set, the diagnostics written on this thread get appended to
+// *buffer (a DynArray(char), made on demand) instead of the shared output. Returns
+// the old redirect so it can be restored, pass NULL to stop redirecting.
+char** cuikdg_redirect(char** buffer);
+// appends the redirected output to the shared diagnostics
+void cuikdg_flush_redirect(TokenStream* tokens, char* buffer);
+
 ////////////////////////////////
 // Complex diagnostic builder
 ////////////////////////////////
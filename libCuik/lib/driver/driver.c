@@ -57,11 +57,21 @@ struct Cuik_BuildStep {
             TB_Arena arena;
             Cuik_CPP* cpp;
             TranslationUnit* tu;
+
+            // only used if there's no ld step to share one with
+            Cuik_Prefix* prefix;
         } cc;
 
         struct {
             Cuik_DriverArgs* args;
             CompilationUnit* cu;
+
+            // shared by all the cc steps, this way headers are only
+            // loaded and lexed once per build.
+            Cuik_FileCache* fcache;
+
+            // the precompiled header (if there's one)
+            Cuik_Prefix* prefix;
         } ld;
 
         struct {
@@ -70,10 +80,13 @@ struct Cuik_BuildStep {
     };
 };
 
+static Cuik_CPP* preprocess(const char* filepath, Cuik_FileCache* cache, Cuik_Prefix* prefix, const Cuik_DriverArgs* args, bool should_finalize);
+static Cuik_Prefix* get_prefix(const char* header, Cuik_FileCache* cache, const Cuik_DriverArgs* args);
+
 static TB_Arena* get_ir_arena(void) {
     static _Thread_local TB_Arena ir_arena;
     if (tb_arena_is_empty(&ir_arena)) {
-        tb_arena_create(&ir_arena, TB_ARENA_LARGE_CHUNK_SIZE);
+        tb_arena_create(&ir_arena, TB_ARENA_LARGE_CHUNK_SIZE, "ir");
     }
 
     return &ir_arena;
@@ -145,40 +158,82 @@ static void sys_invoke(BuildStepInfo* info) {
 #ifdef CUIK_USE_TB
 static void irgen(Cuik_IThreadpool* restrict thread_pool, Cuik_DriverArgs* restrict args, CompilationUnit* restrict cu, TB_Module* mod);
 
-// ctx is non-NULL when we print asm
+// the function passes are split around the module passes ("-func -mod -func"),
+// see tb/man/PASSES.md
+static void apply_func_early(TB_Module* m, TB_Function* f, void* arg) {
+    CUIK_TIMED_BLOCK("func opt") {
+        TB_Passes* p = tb_pass_enter(f, get_ir_arena());
+
+        // initial run of peepholes
+        tb_pass_peephole(p);
+        // Splitting up aggregates & converting locals into phi nodes
+        tb_pass_sroa(p), tb_pass_mem2reg(p), tb_pass_peephole(p);
+        // Merging the redundant values which are now in SSA
+        tb_pass_gvn(p), tb_pass_peephole(p);
+        // Constant propagation, it'll kill the dead paths before we pick what to inline
+        tb_pass_sccp(p), tb_pass_peephole(p);
+        // Simplify CFG
+        // tb_pass_cfg(p), tb_pass_peephole(p);
+
+        tb_pass_exit(p);
+    }
+}
+
+static void emit_func(TB_Passes* p, Cuik_DriverArgs* args) {
+    // print IR
+    if (args->emit_ir) {
+        // tb_function_print(f, tb_default_print_callback, stdout);
+        tb_pass_print(p);
+    }
+
+    // codegen
+    if (!args->emit_ir) CUIK_TIMED_BLOCK("CodeGen") {
+        TB_FunctionOutput* out = tb_pass_codegen(p, args->assembly);
+        if (args->assembly) {
+            tb_output_print_asm(out, stdout);
+        }
+    }
+}
+
 static void apply_func(TB_Module* m, TB_Function* f, void* arg) {
     Cuik_DriverArgs* args = arg;
-    bool print_asm = args->assembly;
 
-    CUIK_TIMED_BLOCK("func opt") {
+    CUIK_TIMED_BLOCK("func late") {
         TB_Passes* p = tb_pass_enter(f, get_ir_arena());
 
-        if (args->opt_level >= 1) {
-            // initial run of peepholes
+        // the inlined bodies have only been cleaned up in their
+        // own context, let's fold them into ours.
+        if (args->opt_level >= 1 && tb_pass_inline(p)) {
             tb_pass_peephole(p);
-            // Converting locals into phi nodes
-            tb_pass_mem2reg(p), tb_pass_peephole(p);
-            // Simplify CFG
-            // tb_pass_cfg(p), tb_pass_peephole(p);
         }
 
-        // print IR
-        if (args->emit_ir) {
-            // tb_function_print(f, tb_default_print_callback, stdout);
-            tb_pass_print(p);
+        // unrolling, strength reduction & vectorization, it also turns on LICM for the scheduler
+        if (args->opt_level >= 1) {
+            tb_pass_loop(p), tb_pass_peephole(p);
+            tb_pass_vectorize(p), tb_pass_peephole(p);
+            // strength reduction leaves behind twin induction variables
+            tb_pass_gvn(p), tb_pass_peephole(p);
         }
 
-        // codegen
-        if (!args->emit_ir) CUIK_TIMED_BLOCK("CodeGen") {
-            TB_FunctionOutput* out = tb_pass_codegen(p, print_asm);
-            if (print_asm) {
-                tb_output_print_asm(out, stdout);
-            }
+        // this run also leaves the known bits for isel
+        if (args->opt_level >= 1) {
+            tb_pass_sccp(p), tb_pass_peephole(p);
+        }
+
+        // with LTO we wait until tb_module_strip is done before emitting anything
+        if (!args->lto) {
+            emit_func(p, args);
         }
 
         tb_pass_exit(p);
     }
 }
+
+static void apply_func_emit(TB_Module* m, TB_Function* f, void* arg) {
+    TB_Passes* p = tb_pass_enter(f, get_ir_arena());
+    emit_func(p, arg);
+    tb_pass_exit(p);
+}
 #endif
 
 static void cc_invoke(BuildStepInfo* restrict info) {
@@ -192,8 +247,27 @@ static void cc_invoke(BuildStepInfo* restrict info) {
 
     log_debug("BuildStep %p: cc_invoke %s", s, s->cc.source);
 
+    // NOTE(NeGate): can't use a CUIK_TIMED_BLOCK here since we jump to
+    // the exits, it's closed right before step_done.
+    cuikperf_region_start("cc", s->cc.source);
+
+    Cuik_FileCache* fcache = NULL;
+    Cuik_Prefix* prefix = NULL;
+    if (s->anti_dep != NULL && s->anti_dep->tag == BUILD_STEP_LD) {
+        fcache = s->anti_dep->ld.fcache;
+        prefix = s->anti_dep->ld.prefix;
+    }
+
+    if (prefix == NULL && args->prefix_header != NULL) {
+        prefix = s->cc.prefix = get_prefix(args->prefix_header, fcache, args);
+        if (prefix == NULL) {
+            step_error(s);
+            goto done_no_cpp;
+        }
+    }
+
     // dispose the preprocessor crap since we didn't need it
-    Cuik_CPP* cpp = s->cc.cpp = cuik_driver_preprocess(s->cc.source, args, true);
+    Cuik_CPP* cpp = s->cc.cpp = preprocess(s->cc.source, fcache, prefix, args, true);
     if (cpp == NULL) {
         step_error(s);
         goto done_no_cpp;
@@ -209,15 +283,16 @@ static void cc_invoke(BuildStepInfo* restrict info) {
 
     Cuik_ParseResult result;
     CUIK_TIMED_BLOCK_ARGS("parse", s->cc.source) {
-        tb_arena_create(&s->cc.arena, TB_ARENA_LARGE_CHUNK_SIZE);
+        tb_arena_create(&s->cc.arena, TB_ARENA_LARGE_CHUNK_SIZE, "ast");
 
         result = cuikparse_run(args->version, tokens, args->target, &s->cc.arena, false);
         s->cc.tu = result.tu;
+    }
 
-        if (result.error_count > 0) {
-            step_error(s);
-            goto done;
-        }
+    // jumping out of the timed block would leave the region open
+    if (result.error_count > 0) {
+        step_error(s);
+        goto done;
     }
 
     log_debug("BuildStep %p: parsed file", s);
@@ -243,7 +318,7 @@ static void cc_invoke(BuildStepInfo* restrict info) {
         cuik_add_to_compilation_unit(cu, tu);
     }
 
-    if (cuiksema_run(tu, NULL) > 0) {
+    if (cuiksema_run(tu, s->tp) > 0) {
         step_error(s);
         goto done;
     }
@@ -285,11 +360,6 @@ static void cc_invoke(BuildStepInfo* restrict info) {
             cuiklex_free_tokens(tokens);
             cuikpp_free(cpp);
         }
-
-        if (args->opt_level > 0 || args->assembly || args->emit_ir) {
-            // do parallel function passes
-            cuiksched_per_function(s->tp, args->threads, mod, args, apply_func);
-        }
     }
     #endif
 
@@ -307,7 +377,9 @@ static void cc_invoke(BuildStepInfo* restrict info) {
 
     // these are called for early exits
     done: cuikdg_dump_to_file(tokens, stderr);
-    done_no_cpp: step_done(s);
+    done_no_cpp:
+    cuikperf_region_end();
+    step_done(s);
 }
 
 static void ld_invoke(BuildStepInfo* info) {
@@ -316,6 +388,19 @@ static void ld_invoke(BuildStepInfo* info) {
     if (args->verbose) {
         mtx_lock(info->mutex);
         printf("LINK\n");
+        if (s->ld.fcache != NULL) {
+            size_t hits, misses;
+            cuikpp_cache_stats(s->ld.fcache, &hits, &misses);
+            printf("  file cache: %zu hits, %zu misses\n", hits, misses);
+        }
+
+        #ifdef CUIK_USE_TB
+        if (args->codegen_cache != NULL) {
+            size_t hits, misses;
+            tb_module_get_codegen_cache_stats(s->ld.cu->ir_mod, &hits, &misses);
+            printf("  codegen cache: %zu hits, %zu misses\n", hits, misses);
+        }
+        #endif
         mtx_unlock(info->mutex);
     }
 
@@ -330,6 +415,57 @@ static void ld_invoke(BuildStepInfo* info) {
         cuik_destroy_compilation_unit(s->ld.cu);
     }
 
+    // both of these need the IR exactly as irgen left it
+    if (args->profile_generate) CUIK_TIMED_BLOCK("tb_module_profile_instrument") {
+        tb_module_profile_instrument(mod, args->profile_generate, args->run);
+    }
+
+    if (args->profile_use) CUIK_TIMED_BLOCK("tb_module_profile_use") {
+        if (!tb_module_profile_use(mod, args->profile_use)) {
+            fprintf(stderr, "warning: could not read profile '%s'\n", args->profile_use);
+        }
+    }
+
+    // NOTE(NeGate): the function passes wait until every TU is done with irgen, the
+    // module passes need all of them and the TUs share the module anyways.
+    if (args->opt_level > 0 || args->assembly || args->emit_ir || args->lto || args->profile_generate) CUIK_TIMED_BLOCK("Backend") {
+        if (args->opt_level > 0) {
+            cuiksched_per_function(s->tp, args->threads, mod, args, apply_func_early);
+        }
+
+        if (args->lto) CUIK_TIMED_BLOCK("tb_module_lto") {
+            // only a finished program knows who can call in from the outside, objects
+            // and libraries keep their public symbols.
+            static const char* entrypoints[] = {
+                "main", "wmain", "WinMain", "wWinMain", "DllMain",
+                "mainCRTStartup", "WinMainCRTStartup", "_start", NULL
+            };
+
+            size_t root_count = 0;
+            const char* roots[COUNTOF(entrypoints) + 1];
+            if (args->run || args->flavor == TB_FLAVOR_EXECUTABLE) {
+                if (args->entrypoint) roots[root_count++] = args->entrypoint;
+                for (const char** e = entrypoints; *e; e++) roots[root_count++] = *e;
+            }
+
+            tb_module_lto(mod, root_count, root_count ? roots : NULL);
+        }
+
+        if (args->opt_level > 0) CUIK_TIMED_BLOCK("tb_module_inline") {
+            tb_module_inline(mod);
+        }
+
+        cuiksched_per_function(s->tp, args->threads, mod, args, apply_func);
+
+        if (args->lto) {
+            CUIK_TIMED_BLOCK("tb_module_strip") {
+                tb_module_strip(mod);
+            }
+
+            cuiksched_per_function(s->tp, args->threads, mod, args, apply_func_emit);
+        }
+    }
+
     if (!cuik_driver_does_codegen(args)) {
         goto done;
     }
@@ -362,8 +498,13 @@ static void ld_invoke(BuildStepInfo* info) {
         assert(entry != NULL);
 
         // run main()
-        char* argv = (char[]){ "jit" };
-        int code = entry(1, &argv);
+        char* argv[] = { "jit", NULL };
+        int code = entry(1, argv);
+
+        // the counters live in the JIT heap so we grab them before it's gone
+        if (args->profile_generate && !tb_module_profile_write(mod, args->profile_generate)) {
+            fprintf(stderr, "warning: could not write profile '%s'\n", args->profile_generate);
+        }
         tb_jit_end(jit);
 
         fprintf(stderr, "C JIT exit with %d\n", code);
@@ -438,7 +579,11 @@ static void ld_invoke(BuildStepInfo* info) {
             }
         }
 
-        TB_ExportBuffer buffer = tb_linker_export(l);
+        TB_ExportBuffer buffer;
+        CUIK_TIMED_BLOCK("tb_linker_export") {
+            buffer = tb_linker_export(l);
+        }
+
         if (!tb_export_buffer_to_file(buffer, output_path.data)) {
             goto error;
         }
@@ -513,11 +658,26 @@ Cuik_BuildStep* cuik_driver_ld(Cuik_DriverArgs* args, int dep_count, Cuik_BuildS
     s->ld.cu = cuik_create_compilation_unit();
     s->ld.args = args;
 
+    // the file cache is only worth it once there's multiple TUs
+    if (dep_count > 1) {
+        s->ld.fcache = cuikpp_cache_create();
+    }
+
     #ifdef CUIK_USE_TB
-    TB_FeatureSet features = { 0 };
     s->ld.cu->ir_mod = tb_module_create(
-        args->target->arch, (TB_System) cuik_get_target_system(args->target), &features, args->run
+        args->target->arch, (TB_System) cuik_get_target_system(args->target), &args->features, args->run
     );
+
+    if (args->codegen_cache != NULL) {
+        tb_module_set_codegen_cache(s->ld.cu->ir_mod, args->codegen_cache);
+    }
+
+    // debug builds care more about compile times
+    if (args->opt_level == 0) {
+        tb_module_set_isel_mode(s->ld.cu->ir_mod, TB_ISEL_FAST);
+    } else if (args->opt_level >= 2) {
+        tb_module_set_isel_mode(s->ld.cu->ir_mod, TB_ISEL_COLORING);
+    }
     #endif
 
     for (size_t i = 0; i < dep_count; i++) {
@@ -541,6 +701,15 @@ static void step_submit(Cuik_BuildStep* s, Cuik_IThreadpool* tp, mtx_t* mutex, b
     s->visited = true;
     s->tp = tp;
 
+    // the precompiled header needs to be ready before any of the TUs start
+    if (s->tag == BUILD_STEP_LD && s->ld.args->prefix_header != NULL) {
+        s->ld.prefix = get_prefix(s->ld.args->prefix_header, s->ld.fcache, s->ld.args);
+        if (s->ld.prefix == NULL) {
+            step_error(s);
+            return;
+        }
+    }
+
     // submit dependencies
     size_t dep_count = s->dep_count;
     if (dep_count > 0) {
@@ -550,7 +719,11 @@ static void step_submit(Cuik_BuildStep* s, Cuik_IThreadpool* tp, mtx_t* mutex, b
         }
 
         // once dependencies are complete, we can invoke the step
-        futex_wait_eq(&s->remaining, 0);
+        if (tp != NULL) {
+            futex_wait_eq_helping(&s->remaining, 0, tp->work_one_job, tp);
+        } else {
+            futex_wait_eq(&s->remaining, 0);
+        }
 
         // we can't run the step with broken deps, forward the error and early out
         if (s->errors != 0) {
@@ -588,6 +761,11 @@ void cuik_step_free(Cuik_BuildStep* s) {
 
     if (s->tag == BUILD_STEP_SYS) {
         cuik_free(s->sys.data);
+    } else if (s->tag == BUILD_STEP_CC) {
+        if (s->cc.prefix) cuikpp_prefix_free(s->cc.prefix);
+    } else if (s->tag == BUILD_STEP_LD) {
+        if (s->ld.prefix) cuikpp_prefix_free(s->ld.prefix);
+        cuikpp_cache_destroy(s->ld.fcache);
     }
 
     cuik_free(s);
@@ -653,9 +831,12 @@ void cuik_free_driver_args(Cuik_DriverArgs* args) {
     dyn_array_destroy(args->includes);
     dyn_array_destroy(args->libraries);
     dyn_array_destroy(args->defines);
+    cuik_free((void*) args->prefix_header);
+    cuik_free((void*) args->codegen_cache);
+    cuik_free((void*) args->time_report);
 }
 
-static bool run_cpp(Cuik_CPP* cpp, const Cuik_DriverArgs* args, bool should_finalize) {
+static void set_cpp_options(Cuik_CPP* cpp, const Cuik_DriverArgs* args) {
     CUIK_TIMED_BLOCK("set CPP options") {
         cuik_set_standard_defines(cpp, args);
 
@@ -679,10 +860,13 @@ static bool run_cpp(Cuik_CPP* cpp, const Cuik_DriverArgs* args, bool should_fina
             }
         }
     }
+}
 
-    // run the preprocessor
+static bool run_cpp(Cuik_CPP* cpp, bool should_finalize) {
+    // run the preprocessor, if it fails we free it (and its tokens) here
     if (cuikpp_run(cpp) == CUIKPP_ERROR) {
         cuikdg_dump_to_file(cuikpp_get_token_stream(cpp), stderr);
+        cuiklex_free_tokens(cuikpp_get_token_stream(cpp));
         cuikpp_free(cpp);
         return false;
     }
@@ -694,7 +878,7 @@ static bool run_cpp(Cuik_CPP* cpp, const Cuik_DriverArgs* args, bool should_fina
     return true;
 }
 
-CUIK_API Cuik_CPP* cuik_driver_preprocess(const char* filepath, const Cuik_DriverArgs* args, bool should_finalize) {
+static Cuik_CPP* make_cpp(const char* filepath, Cuik_FileCache* cache, const Cuik_DriverArgs* args) {
     Cuik_CPP* cpp = NULL;
     CUIK_TIMED_BLOCK("cuikpp_make") {
         cpp = cuikpp_make(&(Cuik_CPPDesc){
@@ -705,10 +889,66 @@ CUIK_API Cuik_CPP* cuik_driver_preprocess(const char* filepath, const Cuik_Drive
                 .fs            = cuikpp_default_fs,
                 .diag_data     = args->diag_userdata,
                 .diag          = args->diag_callback,
+                .cache         = cache,
             });
     }
 
-    return run_cpp(cpp, args, should_finalize) ? cpp : NULL;
+    set_cpp_options(cpp, args);
+    return cpp;
+}
+
+static Cuik_CPP* preprocess(const char* filepath, Cuik_FileCache* cache, Cuik_Prefix* prefix, const Cuik_DriverArgs* args, bool should_finalize) {
+    Cuik_CPP* cpp = make_cpp(filepath, cache, args);
+    if (prefix != NULL && !cuikpp_prefix_apply(cpp, prefix)) {
+        fprintf(stderr, "\x1b[31merror\x1b[0m: precompiled header doesn't match the options for %s\n", filepath);
+        cuikpp_free(cpp);
+        return NULL;
+    }
+
+    return run_cpp(cpp, should_finalize) ? cpp : NULL;
+}
+
+// the precompiled header is saved next to the header, if it's up to date
+// we just map it otherwise we preprocess the header and save it for next time.
+static Cuik_Prefix* get_prefix(const char* header, Cuik_FileCache* cache, const Cuik_DriverArgs* args) {
+    char path[FILENAME_MAX];
+    snprintf(path, FILENAME_MAX, "%s.cpch", header);
+
+    Cuik_CPP* cpp = make_cpp(header, cache, args);
+    uint64_t key = cuikpp_config_hash(cpp);
+
+    Cuik_Prefix* p;
+    CUIK_TIMED_BLOCK("load prefix") {
+        p = cuikpp_prefix_load(cpp, path);
+    }
+
+    if (p == NULL) {
+        if (args->verbose) {
+            printf("PCH %s\n", header);
+        }
+
+        // run_cpp releases the preprocessor if it fails
+        if (!run_cpp(cpp, false)) {
+            return NULL;
+        }
+
+        TokenStream* tokens = cuikpp_get_token_stream(cpp);
+        p = cuikpp_prefix_make(cpp, key);
+        cuikdg_dump_to_file(tokens, stderr);
+
+        // it's fine if we can't save it, we'll just make it again next time
+        if (!cuikpp_prefix_save(p, path)) {
+            fprintf(stderr, "warning: could not save precompiled header to %s\n", path);
+        }
+    }
+
+    cuiklex_free_tokens(cuikpp_get_token_stream(cpp));
+    cuikpp_free(cpp);
+    return p;
+}
+
+CUIK_API Cuik_CPP* cuik_driver_preprocess(const char* filepath, const Cuik_DriverArgs* args, bool should_finalize) {
+    return preprocess(filepath, NULL, NULL, args, should_finalize);
 }
 
 CUIK_API Cuik_CPP* cuik_driver_preprocess_str(String source, const Cuik_DriverArgs* args, bool should_finalize) {
@@ -725,7 +965,8 @@ CUIK_API Cuik_CPP* cuik_driver_preprocess_str(String source, const Cuik_DriverAr
             });
     }
 
-    return run_cpp(cpp, args, should_finalize) ? cpp : NULL;
+    set_cpp_options(cpp, args);
+    return run_cpp(cpp, should_finalize) ? cpp : NULL;
 }
 
 CUIK_API Cuik_CPP* cuik_driver_preprocess_cstr(const char* source, const Cuik_DriverArgs* args, bool should_finalize) {
@@ -742,7 +983,8 @@ CUIK_API Cuik_CPP* cuik_driver_preprocess_cstr(const char* source, const Cuik_Dr
             });
     }
 
-    return run_cpp(cpp, args, should_finalize) ? cpp : NULL;
+    set_cpp_options(cpp, args);
+    return run_cpp(cpp, should_finalize) ? cpp : NULL;
 }
 
 #ifdef CUIK_USE_TB
@@ -759,13 +1001,47 @@ typedef struct {
     #endif
 } IRGenTask;
 
+// number of statements in the tree, it's a rough estimate for how much irgen work
+// a function is (the expressions are ignored, they scale with the statements anyways)
+static size_t count_stmts(Stmt* restrict s) {
+    if (s == NULL) {
+        return 0;
+    }
+
+    switch (s->op) {
+        case STMT_COMPOUND: {
+            size_t c = 1;
+            for (int i = 0; i < s->compound.kids_count; i++) {
+                c += count_stmts(s->compound.kids[i]);
+            }
+            return c;
+        }
+
+        case STMT_IF:       return 1 + count_stmts(s->if_.body) + count_stmts(s->if_.next);
+        case STMT_FOR:      return 1 + count_stmts(s->for_.first) + count_stmts(s->for_.body);
+        case STMT_WHILE:    return 1 + count_stmts(s->while_.body);
+        case STMT_DO_WHILE: return 1 + count_stmts(s->do_while.body);
+        case STMT_SWITCH:   return 1 + count_stmts(s->switch_.body);
+        default:            return 1;
+    }
+}
+
+static size_t irgen_cost(Stmt* restrict s) {
+    if (s->op == STMT_FUNC_DECL && s->decl.attrs.is_used) {
+        return 1 + count_stmts(s->decl.initial_as_stmt);
+    }
+
+    // globals and typedefs are basically free
+    return 1;
+}
+
 static void irgen_job(void* arg) {
     IRGenTask task = *((IRGenTask*) arg);
     TB_Module* mod = task.mod;
 
     // unoptimized builds can just compile functions without
     // the rest of the functions being ready.
-    bool do_compiles_immediately = task.args->opt_level == 0 && !task.args->emit_ir && !task.args->assembly;
+    bool do_compiles_immediately = task.args->opt_level == 0 && !task.args->emit_ir && !task.args->assembly && !task.args->lto && !task.args->profile_generate;
     TB_Arena* allocator = get_ir_arena();
 
     CUIK_TIMED_BLOCK("taste") for (size_t i = 0; i < task.count; i++) {
@@ -809,36 +1085,50 @@ static void irgen(Cuik_IThreadpool* restrict thread_pool, Cuik_DriverArgs* restr
             stmt_count += cuik_num_of_top_level_stmts(tu);
         }
 
-        size_t batch_size = good_batch_size(args->threads, stmt_count);
-        size_t task_capacity = (stmt_count + batch_size - 1) / batch_size;
+        // estimate the cost of each top level statement and split them up
+        size_t* costs = cuik_malloc(stmt_count * sizeof(size_t));
+        size_t total_cost = 0, base = 0;
+        CUIK_FOR_EACH_TU(tu, cu) {
+            size_t top_level_count = cuik_num_of_top_level_stmts(tu);
+            Stmt** top_level = cuik_get_top_level_stmts(tu);
+            for (size_t i = 0; i < top_level_count; i++) {
+                costs[base + i] = irgen_cost(top_level[i]);
+                total_cost += costs[base + i];
+            }
+            base += top_level_count;
+        }
 
-        IRGenTask* tasks = cuik_malloc(task_capacity * sizeof(IRGenTask));
-        Futex remaining = task_capacity;
+        size_t target = good_batch_cost(total_cost, args->threads, 64);
+        SchedBatch* batches = dyn_array_create(SchedBatch, 64);
 
-        size_t task_count = 0;
+        base = 0;
         CUIK_FOR_EACH_TU(tu, cu) {
             size_t top_level_count = cuik_num_of_top_level_stmts(tu);
+            sched_split(&batches, top_level_count, &costs[base], target, tu);
+            base += top_level_count;
+        }
+        sched_order(batches);
+
+        Futex remaining = dyn_array_length(batches);
+        dyn_array_for(i, batches) {
+            TranslationUnit* tu = batches[i].user_data;
             Stmt** top_level = cuik_get_top_level_stmts(tu);
-            for (size_t i = 0; i < top_level_count; i += batch_size) {
-                size_t end = i + batch_size;
-                if (end >= top_level_count) end = top_level_count;
-
-                assert(task_count < task_capacity);
-                IRGenTask task = {
-                    .mod = mod,
-                    .tu = tu,
-                    .args = args,
-                    .stmts = &top_level[i],
-                    .count = end - i,
-                    .remaining = &remaining
-                };
-
-                CUIK_CALL(thread_pool, submit, irgen_job, sizeof(task), &task);
-            }
+
+            IRGenTask task = {
+                .mod = mod,
+                .tu = tu,
+                .args = args,
+                .stmts = &top_level[batches[i].start],
+                .count = batches[i].count,
+                .remaining = &remaining
+            };
+            CUIK_CALL(thread_pool, submit, irgen_job, sizeof(task), &task);
         }
 
-        // wait for the threads to finish
-        futex_wait_eq(&remaining, 0);
+        // wait for the threads to finish, we'll help out in the meantime
+        futex_wait_eq_helping(&remaining, 0, thread_pool->work_one_job, thread_pool);
+        dyn_array_destroy(batches);
+        cuik_free(costs);
         #else
         fprintf(stderr, "Please compile with -DCUIK_ALLOW_THREADS if you wanna spin up threads");
         abort();
@@ -864,6 +1154,499 @@ static void irgen(Cuik_IThreadpool* restrict thread_pool, Cuik_DriverArgs* restr
 }
 #endif
 
+////////////////////////////////
+// Live compilation
+////////////////////////////////
+#ifdef CUIK_USE_TB
+enum {
+    // old code sticks around (as jumps into the new code) so we wanna be roomy
+    LIVE_JIT_HEAP_SIZE = 64*1024*1024,
+};
+
+typedef struct {
+    uint64_t hash;
+    TB_Symbol* sym;
+    // globals only, the storage can't move once it's placed
+    size_t size;
+    bool exported;
+} LiveSymbol;
+
+typedef struct {
+    const char* source;
+
+    // DynArray(char*) canonical paths of every non-system file the TU read
+    char** deps;
+
+    // hash of the tokens outside of the definitions (types, prototypes, declarations),
+    // if this changes every function in the TU gets recompiled.
+    uint64_t env_hash;
+    bool has_built;
+    // the last rebuild didn't go through (errors), it's still pending
+    bool stale;
+
+    // definitions from the last successful build, the keys are atoms
+    NL_Strmap(LiveSymbol) syms;
+
+    // only alive during an update
+    bool dirty;
+    Cuik_CPP* cpp;
+    TranslationUnit* tu;
+    TB_Arena arena;
+    NL_Strmap(LiveSymbol) new_syms;
+} LiveFile;
+
+typedef struct {
+    LiveFile* file;
+    Stmt* stmt;
+    // previous version (if any), the new one is in stmt->backing
+    TB_Symbol* old;
+    bool compiled;
+} LiveWork;
+
+struct Cuik_Live {
+    Cuik_DriverArgs* args;
+    CompilationUnit* cu;
+    TB_JIT* jit;
+
+    size_t file_count;
+    LiveFile* files;
+
+    // DynArray(const char*)
+    const char** watch;
+};
+
+static uint64_t live_hash_tokens(TokenStream* s, size_t start, size_t end, uint64_t h) {
+    Token* tokens = s->list.tokens;
+    for (size_t i = start; i < end; i++) {
+        uint32_t th = tb__murmur3_32(tokens[i].content.data, tokens[i].content.length);
+        h = (h * 0x100000001B3ull) ^ ((uint64_t) tokens[i].type << 32) ^ th;
+    }
+    return h;
+}
+
+// everything that isn't a function definition or an initializer
+static uint64_t live_env_hash(TranslationUnit* tu, TokenStream* s) {
+    uint64_t h = 0;
+    size_t cursor = 0;
+    dyn_array_for(i, tu->top_level_stmts) {
+        Stmt* stmt = tu->top_level_stmts[i];
+        if (stmt->op != STMT_FUNC_DECL && stmt->op != STMT_GLOBAL_DECL) continue;
+        if (stmt->decl.token_end <= stmt->decl.token_start) continue;
+
+        size_t start = stmt->decl.token_start, end = stmt->decl.token_end;
+        if (start > cursor) h = live_hash_tokens(s, cursor, start, h);
+        if (end > cursor) cursor = end;
+    }
+
+    return live_hash_tokens(s, cursor, dyn_array_length(s->list.tokens), h);
+}
+
+static void live_reset(Cuik_Live* l) {
+    Cuik_DriverArgs* args = l->args;
+    if (l->cu != NULL) {
+        tb_jit_end(l->jit);
+        tb_module_destroy(l->cu->ir_mod);
+        cuik_destroy_compilation_unit(l->cu);
+    }
+
+    l->cu = cuik_create_compilation_unit();
+    l->cu->ir_mod = tb_module_create(
+        args->target->arch, (TB_System) cuik_get_target_system(args->target), &args->features, true
+    );
+    l->jit = tb_jit_begin(l->cu->ir_mod, LIVE_JIT_HEAP_SIZE);
+    if (args->codegen_cache != NULL) {
+        tb_module_set_codegen_cache(l->cu->ir_mod, args->codegen_cache);
+    }
+
+    if (args->opt_level == 0) {
+        tb_module_set_isel_mode(l->cu->ir_mod, TB_ISEL_FAST);
+    } else if (args->opt_level >= 2) {
+        tb_module_set_isel_mode(l->cu->ir_mod, TB_ISEL_COLORING);
+    }
+
+    for (size_t i = 0; i < l->file_count; i++) {
+        nl_map_free(l->files[i].syms);
+        l->files[i].has_built = false;
+    }
+}
+
+Cuik_Live* cuik_live_create(Cuik_DriverArgs* args) {
+    size_t count = dyn_array_length(args->sources);
+
+    Cuik_Live* l = cuik_calloc(1, sizeof(Cuik_Live));
+    l->args = args;
+    l->file_count = count;
+    l->files = cuik_calloc(count, sizeof(LiveFile));
+    for (size_t i = 0; i < count; i++) {
+        l->files[i].source = args->sources[i]->data;
+    }
+
+    live_reset(l);
+    return l;
+}
+
+static void live_free_deps(LiveFile* f) {
+    dyn_array_for(i, f->deps) {
+        cuik_free(f->deps[i]);
+    }
+    dyn_array_destroy(f->deps);
+}
+
+void cuik_live_destroy(Cuik_Live* l) {
+    for (size_t i = 0; i < l->file_count; i++) {
+        live_free_deps(&l->files[i]);
+        nl_map_free(l->files[i].syms);
+    }
+
+    tb_jit_end(l->jit);
+    tb_module_destroy(l->cu->ir_mod);
+    cuik_destroy_compilation_unit(l->cu);
+
+    dyn_array_destroy(l->watch);
+    cuik_free(l->files);
+    cuik_free(l);
+}
+
+const char** cuik_live_files(Cuik_Live* l, size_t* out_count) {
+    if (l->watch == NULL) {
+        l->watch = dyn_array_create(const char*, 64);
+    }
+
+    dyn_array_clear(l->watch);
+    for (size_t i = 0; i < l->file_count; i++) {
+        LiveFile* f = &l->files[i];
+        if (f->deps == NULL) {
+            // never made it past the preprocessor
+            dyn_array_put(l->watch, f->source);
+        }
+
+        dyn_array_for(j, f->deps) {
+            dyn_array_put(l->watch, f->deps[j]);
+        }
+    }
+
+    *out_count = dyn_array_length(l->watch);
+    return l->watch;
+}
+
+static bool live_depends_on(LiveFile* f, size_t changed_count, const char** changed) {
+    for (size_t i = 0; i < changed_count; i++) {
+        if (strcmp(f->source, changed[i]) == 0) {
+            return true;
+        }
+
+        dyn_array_for(j, f->deps) {
+            if (strcmp(f->deps[j], changed[i]) == 0) return true;
+        }
+    }
+
+    return false;
+}
+
+static void live_collect_deps(LiveFile* f, TokenStream* tokens) {
+    live_free_deps(f);
+    f->deps = dyn_array_create(char*, 16);
+
+    dyn_array_for(i, tokens->files) {
+        Cuik_FileEntry* e = &tokens->files[i];
+        // skip the system headers and the fake files (<built-in>, $cuik/...)
+        if (e->is_system || e->filename[0] == '<' || e->filename[0] == '$') continue;
+
+        bool found = false;
+        dyn_array_for(j, f->deps) {
+            if (strcmp(f->deps[j], e->filename) == 0) { found = true; break; }
+        }
+
+        if (!found) {
+            dyn_array_put(f->deps, cuik_strdup(e->filename));
+        }
+    }
+}
+
+static bool live_parse(Cuik_Live* l, LiveFile* f, int ordinal, Cuik_Prefix* prefix, Cuik_IThreadpool* tp) {
+    Cuik_DriverArgs* args = l->args;
+
+    f->cpp = preprocess(f->source, NULL, prefix, args, true);
+    if (f->cpp == NULL) {
+        return false;
+    }
+
+    TokenStream* tokens = cuikpp_get_token_stream(f->cpp);
+    live_collect_deps(f, tokens);
+
+    tb_arena_create(&f->arena, TB_ARENA_LARGE_CHUNK_SIZE, "ast");
+    Cuik_ParseResult result = cuikparse_run(args->version, tokens, args->target, &f->arena, false);
+    f->tu = result.tu;
+
+    bool ok = result.error_count == 0;
+    if (ok) {
+        cuik_set_tu_ordinal(f->tu, ordinal);
+        cuik_add_to_compilation_unit(l->cu, f->tu);
+        ok = cuiksema_run(f->tu, tp) == 0;
+    }
+
+    cuikdg_dump_to_file(tokens, stderr);
+    return ok;
+}
+
+static void live_discard(Cuik_Live* l, LiveFile* f) {
+    if (f->tu != NULL) {
+        if (f->tu->parent != NULL) {
+            cuik_remove_from_compilation_unit(l->cu, f->tu);
+        }
+
+        cuik_destroy_translation_unit(f->tu);
+        f->tu = NULL;
+    }
+
+    if (f->cpp != NULL) {
+        tb_arena_destroy(&f->arena);
+        cuiklex_free_tokens(cuikpp_get_token_stream(f->cpp));
+        cuikpp_free(f->cpp);
+        f->cpp = NULL;
+    }
+
+    nl_map_free(f->new_syms);
+}
+
+// allocates IR for the reparsed TU and points any definition which didn't change
+// back at the symbols from the last build, the rest gets put on the work list.
+// returns false if a global changed size (we need to start over).
+static bool live_remap(Cuik_Live* l, LiveFile* f, Cuik_IThreadpool* tp, LiveWork** work) {
+    TranslationUnit* tu = f->tu;
+    TB_Module* mod = l->cu->ir_mod;
+    TokenStream* tokens = cuikpp_get_token_stream(f->cpp);
+
+    if (tp != NULL) {
+        cuikcg_allocate_ir(tu, tp, mod);
+    } else {
+        cuikcg_allocate_ir2(tu, mod);
+    }
+
+    uint64_t env_hash = live_env_hash(tu, tokens);
+    bool env_changed = !f->has_built || env_hash != f->env_hash;
+    f->env_hash = env_hash;
+
+    bool ok = true;
+    dyn_array_for(i, tu->top_level_stmts) {
+        Stmt* s = tu->top_level_stmts[i];
+        if (s->backing.s == NULL || s->decl.name == NULL) continue;
+
+        const char* name = s->decl.name;
+        ptrdiff_t search = nl_map_get_cstr(f->syms, name);
+        LiveSymbol* old = search >= 0 ? &f->syms[search].v : NULL;
+
+        LiveSymbol sym = {
+            .hash = live_hash_tokens(tokens, s->decl.token_start, s->decl.token_end, 0),
+            .sym = s->backing.s,
+        };
+
+        if (s->op == STMT_FUNC_DECL) {
+            sym.exported = !s->decl.attrs.is_static;
+
+            // NOTE(NeGate): functions which didn't get compiled (unused statics) never
+            // made it into the JIT so they can't be reused.
+            if (!env_changed && old != NULL && old->hash == sym.hash && old->sym->tag == TB_SYMBOL_FUNCTION &&
+                tb_jit_get_code_ptr((TB_Function*) old->sym) != NULL) {
+                s->backing.s = sym.sym = old->sym;
+            } else {
+                LiveWork w = { f, s, old != NULL && old->sym->tag == TB_SYMBOL_FUNCTION ? old->sym : NULL };
+                dyn_array_put(*work, w);
+            }
+        } else {
+            sym.size = cuik_canonical_type(s->decl.type)->size;
+            sym.exported = (s->flags & STMT_FLAGS_IS_EXPORTED) != 0;
+
+            // globals keep their storage (and whatever the program left in there),
+            // changing the initializer rewrites it in place.
+            if (old != NULL && old->sym->tag == TB_SYMBOL_GLOBAL) {
+                if (old->size != sym.size) {
+                    ok = false;
+                }
+
+                s->backing.s = sym.sym = old->sym;
+                if (old->hash != sym.hash) {
+                    LiveWork w = { f, s, old->sym };
+                    dyn_array_put(*work, w);
+                }
+            } else {
+                LiveWork w = { f, s, NULL };
+                dyn_array_put(*work, w);
+            }
+        }
+
+        nl_map_put_cstr(f->new_syms, name, sym);
+        if (sym.exported) {
+            nl_map_put_cstr(l->cu->export_table, name, sym.sym);
+        }
+    }
+
+    return ok;
+}
+
+bool cuik_live_update(Cuik_Live* l, Cuik_IThreadpool* tp, size_t changed_count, const char** changed) {
+    Cuik_DriverArgs* args = l->args;
+
+    size_t dirty_count = 0;
+    for (size_t i = 0; i < l->file_count; i++) {
+        LiveFile* f = &l->files[i];
+        f->dirty = changed_count == 0 || !f->has_built || f->stale || live_depends_on(f, changed_count, changed);
+        dirty_count += f->dirty;
+    }
+
+    if (dirty_count == 0) {
+        return true;
+    }
+
+    Cuik_Prefix* prefix = NULL;
+    if (args->prefix_header != NULL) {
+        prefix = get_prefix(args->prefix_header, NULL, args);
+        if (prefix == NULL) {
+            return false;
+        }
+    }
+
+    // if anything fails to compile we just keep running the old code
+    bool ok = true;
+    CUIK_TIMED_BLOCK("live frontend") {
+        for (size_t i = 0; i < l->file_count; i++) {
+            if (l->files[i].dirty && !live_parse(l, &l->files[i], i, prefix, tp)) {
+                ok = false;
+            }
+        }
+    }
+
+    if (prefix != NULL) {
+        cuikpp_prefix_free(prefix);
+    }
+
+    size_t recompiled = 0;
+    bool reload = false;
+    if (ok) {
+        // the export table is rebuilt from the TUs we didn't touch, the rest
+        // get put in as they allocate their IR.
+        CompilationUnit* cu = l->cu;
+        nl_map_free(cu->export_table);
+        for (size_t i = 0; i < l->file_count; i++) {
+            LiveFile* f = &l->files[i];
+            if (f->dirty) continue;
+
+            nl_map_for_str(j, f->syms) {
+                if (f->syms[j].v.exported) {
+                    NL_Slice k = f->syms[j].k;
+                    nl_map_put(cu->export_table, k, f->syms[j].v.sym);
+                }
+            }
+        }
+
+        DynArray(LiveWork) work = dyn_array_create(LiveWork, 64);
+        CUIK_TIMED_BLOCK("live remap") {
+            for (size_t i = 0; i < l->file_count; i++) {
+                if (l->files[i].dirty && !live_remap(l, &l->files[i], tp, &work)) {
+                    reload = true;
+                }
+            }
+        }
+
+        if (!reload) {
+            TB_Module* mod = cu->ir_mod;
+            TB_Arena* arena = get_ir_arena();
+            CUIK_TIMED_BLOCK("live codegen") {
+                dyn_array_for(i, work) {
+                    TB_Symbol* s = cuikcg_top_level(work[i].file->tu, mod, arena, work[i].stmt);
+                    if (s != NULL && s->tag == TB_SYMBOL_FUNCTION) {
+                        if (args->opt_level > 0) {
+                            apply_func_early(mod, (TB_Function*) s, args);
+                        }
+                        apply_func(mod, (TB_Function*) s, args);
+                        tb_arena_clear(arena);
+
+                        work[i].compiled = true;
+                        recompiled += 1;
+                    }
+                }
+            }
+
+            // the old versions of the functions get turned into jumps to the new ones,
+            // this way nothing which was already in the JIT needs to be touched.
+            CUIK_TIMED_BLOCK("live placement") {
+                dyn_array_for(i, work) {
+                    TB_Symbol* s = work[i].stmt->backing.s;
+                    if (s->tag == TB_SYMBOL_FUNCTION) {
+                        if (!work[i].compiled) continue;
+
+                        if (work[i].old != NULL) {
+                            tb_jit_replace_function(l->jit, (TB_Function*) work[i].old, (TB_Function*) s);
+                        } else {
+                            tb_jit_place_function(l->jit, (TB_Function*) s);
+                        }
+                    }
+                }
+
+                dyn_array_for(i, work) {
+                    TB_Symbol* s = work[i].stmt->backing.s;
+                    if (s->tag == TB_SYMBOL_GLOBAL) {
+                        tb_jit_reinit_global(l->jit, (TB_Global*) s);
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < l->file_count; i++) {
+                LiveFile* f = &l->files[i];
+                if (f->dirty) {
+                    nl_map_free(f->syms);
+                    f->syms = (void*) f->new_syms;
+                    f->new_syms = NULL;
+                    f->has_built = true;
+                }
+            }
+        }
+
+        dyn_array_destroy(work);
+    }
+
+    for (size_t i = 0; i < l->file_count; i++) {
+        if (l->files[i].dirty) {
+            l->files[i].stale = !ok;
+            live_discard(l, &l->files[i]);
+        }
+    }
+
+    if (reload) {
+        // some global changed its layout, anything could be pointing at the old
+        // storage so we just throw everything out.
+        if (args->verbose) printf("LIVE: global changed size, rebuilding everything\n");
+
+        live_reset(l);
+        return cuik_live_update(l, tp, 0, NULL);
+    }
+
+    if (ok && args->verbose) {
+        printf("LIVE: %zu TUs reparsed, %zu functions recompiled\n", dirty_count, recompiled);
+    }
+
+    return ok;
+}
+
+int cuik_live_run(Cuik_Live* l) {
+    int(*entry)(int, char**) = NULL;
+    for (size_t i = 0; i < l->file_count && entry == NULL; i++) {
+        ptrdiff_t search = nl_map_get_cstr(l->files[i].syms, "main");
+        if (search >= 0 && l->files[i].syms[search].v.sym->tag == TB_SYMBOL_FUNCTION) {
+            entry = tb_jit_get_code_ptr((TB_Function*) l->files[i].syms[search].v.sym);
+        }
+    }
+
+    if (entry == NULL) {
+        fprintf(stderr, "error: could not find main()\n");
+        return EXIT_FAILURE;
+    }
+
+    char* argv[] = { "jit", NULL };
+    return entry(1, argv);
+}
+#endif
+
 void cuik_toolchain_free(Cuik_Toolchain* toolchain) {
     cuik_free(toolchain->ctx);
 }
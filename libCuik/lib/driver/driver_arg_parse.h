@@ -41,6 +41,26 @@ static TargetOption target_options[] = {
 };
 enum { TARGET_OPTION_COUNT = sizeof(target_options) / sizeof(target_options[0]) };
 
+#ifdef CUIK_USE_TB
+static const struct {
+    const char* key;
+    TB_FeatureSet_X64 bits;
+} x64_features[] = {
+    { "sse3",   TB_FEATURE_X64_SSE3 },
+    { "sse41",  TB_FEATURE_X64_SSE3 | TB_FEATURE_X64_SSE41 },
+    { "sse42",  TB_FEATURE_X64_SSE3 | TB_FEATURE_X64_SSE41 | TB_FEATURE_X64_SSE42 },
+    { "popcnt", TB_FEATURE_X64_POPCNT },
+    { "lzcnt",  TB_FEATURE_X64_LZCNT },
+    { "clmul",  TB_FEATURE_X64_CLMUL },
+    { "f16c",   TB_FEATURE_X64_F16C },
+    { "bmi1",   TB_FEATURE_X64_BMI1 },
+    { "bmi2",   TB_FEATURE_X64_BMI2 },
+    { "avx",    TB_FEATURE_X64_SSE3 | TB_FEATURE_X64_SSE41 | TB_FEATURE_X64_SSE42 | TB_FEATURE_X64_AVX },
+    { "avx2",   TB_FEATURE_X64_SSE3 | TB_FEATURE_X64_SSE41 | TB_FEATURE_X64_SSE42 | TB_FEATURE_X64_AVX | TB_FEATURE_X64_AVX2 },
+};
+enum { X64_FEATURE_COUNT = sizeof(x64_features) / sizeof(x64_features[0]) };
+#endif
+
 struct Cuik_Arguments {
     TB_Arena arena;
 
@@ -65,8 +85,13 @@ static void print_help(void) {
             len += printf(" <value>");
         }
 
-        size_t round_up = len + (split - (len % split)) % split;
-        for (int j = len; j < round_up; j++) printf(" ");
+        // options too long for the column get their description on the next line
+        if (len >= split) {
+            printf("\n    ");
+            len = 0;
+        }
+
+        for (int j = len; j < split; j++) printf(" ");
         printf("%s\n", arg_descs[i].desc);
     }
     printf("\n");
@@ -150,7 +175,7 @@ CUIK_API void cuik_parse_args(Cuik_Arguments* restrict args, int argc, const cha
 
 CUIK_API bool cuik_parse_driver_args(Cuik_DriverArgs* comp_args, int argc, const char* argv[]) {
     Cuik_Arguments* args = cuik_alloc_args();
-    tb_arena_create(&args->arena, TB_ARENA_SMALL_CHUNK_SIZE);
+    tb_arena_create(&args->arena, TB_ARENA_SMALL_CHUNK_SIZE, "args");
 
     cuik_parse_args(args, argc, argv);
 
@@ -221,6 +246,15 @@ CUIK_API bool cuik_args_to_driver(Cuik_DriverArgs* comp_args, Cuik_Arguments* re
         }
     }
 
+    if (args->_[ARG_PCH]) {
+        Cuik_Path p;
+        if (cuikfs_canonicalize(&p, args->_[ARG_PCH]->value, comp_args->toolchain.case_insensitive)) {
+            comp_args->prefix_header = cuik_strdup(p.data);
+        } else {
+            fprintf(stderr, "error: could not resolve precompiled header: %s\n", args->_[ARG_PCH]->value);
+        }
+    }
+
     FOR_ARGS(a, ARG_LIBDIR) {
         Cuik_Path* p = cuik_malloc(sizeof(Cuik_Path));
         cuik_path_set(p, a->value);
@@ -293,6 +327,38 @@ CUIK_API bool cuik_args_to_driver(Cuik_DriverArgs* comp_args, Cuik_Arguments* re
     #ifdef CUIK_USE_TB
     if (args->_[ARG_OBJECT]) comp_args->flavor = TB_FLAVOR_OBJECT;
     if (args->_[ARG_ASSEMBLY]) comp_args->assembly = true;
+    if (args->_[ARG_CGCACHE]) comp_args->codegen_cache = cuik_strdup(args->_[ARG_CGCACHE]->value);
+
+    // -fprofile-generate=foo.profraw (the = is optional)
+    if (args->_[ARG_PROFGEN]) {
+        const char* v = args->_[ARG_PROFGEN]->value;
+        comp_args->profile_generate = cuik_strdup(v[0] == '=' ? v + 1 : v);
+    }
+
+    if (args->_[ARG_PROFUSE]) {
+        const char* v = args->_[ARG_PROFUSE]->value;
+        comp_args->profile_use = cuik_strdup(v[0] == '=' ? v + 1 : v);
+    }
+
+    // -march=avx2,bmi2 (the = is optional)
+    FOR_ARGS(a, ARG_MARCH) {
+        char* newstr = cuik_strdup(a->value[0] == '=' ? a->value + 1 : a->value);
+
+        char* ctx;
+        char* arg = strtok_r(newstr, ",", &ctx);
+        while (arg != NULL) {
+            size_t i = 0;
+            while (i < X64_FEATURE_COUNT && strcmp(arg, x64_features[i].key) != 0) i++;
+
+            if (i < X64_FEATURE_COUNT) {
+                comp_args->features.x64 |= x64_features[i].bits;
+            } else {
+                fprintf(stderr, "unknown ISA extension: %s\n", arg);
+            }
+            arg = strtok_r(NULL, ",", &ctx);
+        }
+        cuik_free(newstr);
+    }
     #endif
 
     if (args->_[ARG_OPTLVL]) {
@@ -309,8 +375,10 @@ CUIK_API bool cuik_args_to_driver(Cuik_DriverArgs* comp_args, Cuik_Arguments* re
     TOGGLE(ARG_THINK, think);
     TOGGLE(ARG_BASED, based);
     TOGGLE(ARG_TIME, time);
+    if (args->_[ARG_TIMEREPORT]) comp_args->time_report = cuik_strdup(args->_[ARG_TIMEREPORT]->value);
     TOGGLE(ARG_DEBUG, debug_info);
     TOGGLE(ARG_EMITIR, emit_ir);
+    TOGGLE(ARG_LTO, lto);
     TOGGLE(ARG_NOLIBC, nocrt);
 
     if (comp_args->verbose) {
@@ -5,6 +5,7 @@ X(LIVE,        "live",     false, "runs compiler persistently, repeats compile s
 X(DEFINE,      "D",        true,  "defines a macro before compiling")
 X(UNDEF,       "U",        true,  "undefines a macro before compiling")
 X(INCLUDE,     "I",        true,  "add directory to the include searches")
+X(PCH,         "pch",      true,  "precompile a header and place it before every source file")
 X(PPTEST,      "Pp",       false, "test preprocessor")
 X(PP,          "P",        false, "print preprocessor output to stdout")
 // parser
@@ -13,8 +14,13 @@ X(AST,         "ast",      false, "print AST into stdout")
 X(SYNTAX,      "xe",       false, "type check only")
 // optimizer
 X(OPTLVL,      "O",        true,  "no optimizations")
+X(LTO,         "lto",      false, "whole program optimization, the link is treated as the entire program")
+X(PROFGEN,     "fprofile-generate",true, "instrument the program, it writes a profile to this file when it exits")
+X(PROFUSE,     "fprofile-use",true,  "optimize using a profile written by -fprofile-generate")
 // backend
 X(EMITIR,      "emit-ir",  false, "print IR into stdout")
+X(CGCACHE,     "cgcache",  true,  "reuse the machine code for unchanged functions (kept in this directory)")
+X(MARCH,       "march",    true,  "enable ISA extensions, comma separated (sse41, popcnt, avx2...)")
 X(OUTPUT,      "o",        true,  "set the output filepath")
 X(OBJECT,      "c",        false, "output object file")
 X(ASSEMBLY,    "S",        false, "output assembly to stdout")
@@ -29,6 +35,7 @@ X(ENTRY,       "e",        true,  "set entrypoint")
 // misc
 X(TARGET,      "target",   true,  "change the target system and arch")
 X(THREADS,     "j",        true,  "enabled multithreaded compilation")
+X(TIMEREPORT,  "Treport",  true,  "write per-phase, per-TU and per-function compile times to a JSON (or .csv) file")
 X(TIME,        "T",        false, "profile the compile times")
 X(THINK,       "think",    false, "aids in thinking about serious problems")
 // run
@@ -1,10 +1,64 @@
 #ifdef CUIK_USE_TB
+// if set, the batches are submitted from most to least expensive (LPT scheduling) so
+// the big functions don't end up as a long tail at the end of the build.
+#define SCHED_LPT_ORDER 1
+
+typedef struct {
+    size_t start, count;
+    size_t cost;
+
+    // whatever the caller wants to know about the group it came from
+    void* user_data;
+} SchedBatch;
+
+static int sched_batch_cmp(const void* a, const void* b) {
+    const SchedBatch* aa = a;
+    const SchedBatch* bb = b;
+    if (aa->cost != bb->cost) return aa->cost < bb->cost ? 1 : -1;
+    // keep it stable so the order doesn't depend on qsort
+    return aa->start < bb->start ? -1 : aa->start > bb->start;
+}
+
+// we cap the batches at some minimum cost so we don't make them so small that the
+// scheduling overhead eats the gains but when there's less input we might pick
+// something which can get some good division of labor.
+static size_t good_batch_cost(size_t total_cost, size_t threads, size_t min_cost) {
+    // each thread is gonna get ~4 batches so: total_cost / (N * 4)
+    size_t target = total_cost / (threads * 4);
+    return target < min_cost ? min_cost : target;
+}
+
+// splits n items into contiguous batches of roughly equal cost, anything bigger
+// than the target cost ends up as its own batch.
+static void sched_split(SchedBatch** batches, size_t n, const size_t* costs, size_t target, void* user_data) {
+    SchedBatch curr = { .user_data = user_data };
+    for (size_t i = 0; i < n; i++) {
+        if (curr.count > 0 && curr.cost + costs[i] > target) {
+            dyn_array_put(*batches, curr);
+            curr = (SchedBatch){ .start = i, .user_data = user_data };
+        }
+
+        curr.count += 1;
+        curr.cost += costs[i];
+    }
+
+    if (curr.count > 0) {
+        dyn_array_put(*batches, curr);
+    }
+}
+
+static void sched_order(SchedBatch* batches) {
+    #if SCHED_LPT_ORDER
+    qsort(batches, dyn_array_length(batches), sizeof(SchedBatch), sched_batch_cmp);
+    #endif
+}
+
 typedef struct {
     TB_Module* mod;
-    TB_Function* start;
+    TB_Function** funcs;
     Futex* remaining;
 
-    int batch_size;
+    size_t count;
 
     void* ctx;
     CuikSched_PerFunction func;
@@ -12,53 +66,49 @@ typedef struct {
 
 static void per_func_task(void* arg) {
     PerFunction task = *((PerFunction*) arg);
-    TB_Function* f = task.start;
-
-    for (size_t i = 0; i < task.batch_size && f != NULL; i++) {
-        task.func(task.mod, f, task.ctx);
-        f = tb_next_function(f);
+    for (size_t i = 0; i < task.count; i++) {
+        task.func(task.mod, task.funcs[i], task.ctx);
     }
     futex_dec(task.remaining);
 }
 
-static size_t good_batch_size(size_t n, size_t jobs) {
-    // we cap out at 8192 for the batch size but when there's less input
-    // we might pick something which can get some good division of labor.
-    //
-    // each thread is gonna get 4 batches so: job_count / (N * 4)
-    /*size_t batch_size = jobs / (n * 4);
-    if (batch_size < 128) return 100;
-    if (batch_size > 8192) return 8192;
-
-    // next power of two
-    return 1ull << (64ull - __builtin_clzll(batch_size - 1ull));*/
-
-    return 64;
-}
-
 void cuiksched_per_function(Cuik_IThreadpool* restrict thread_pool, int num_threads, TB_Module* mod, void* ctx, CuikSched_PerFunction func) {
     if (thread_pool != NULL) {
         #if CUIK_ALLOW_THREADS
         size_t func_count = tb_module_get_function_count(mod);
+        TB_Function** funcs = cuik_malloc(func_count * sizeof(TB_Function*));
+        size_t* costs = cuik_malloc(func_count * sizeof(size_t));
 
-        size_t batch_size = good_batch_size(num_threads, func_count);
-        size_t capacity = (func_count + batch_size - 1) / batch_size;
-        Futex remaining = capacity;
+        size_t n = 0;
+        TB_FOR_FUNCTIONS(f, mod) {
+            assert(n < func_count);
+            funcs[n] = f;
+            costs[n] = tb_function_get_node_count(f) + 1;
+            n += 1;
+        }
 
-        TB_Function* f = tb_first_function(mod);
-        while (f != NULL) {
-            PerFunction task = { .mod = mod, .start = f, .remaining = &remaining, .batch_size = batch_size, .ctx = ctx, .func = func };
-            CUIK_CALL(thread_pool, submit, per_func_task, sizeof(task), &task);
+        // a batch is at least a few hundred nodes worth of work
+        size_t total_cost = 0;
+        for (size_t i = 0; i < n; i++) total_cost += costs[i];
 
-            // skip to the next batch, this is kinda slow but
-            // a submittion happened already so there's work
-            // being done elsewhere... ideally
-            for (size_t i = 0; f != NULL && i < batch_size; i++) {
-                f = tb_next_function(f);
-            }
+        SchedBatch* batches = dyn_array_create(SchedBatch, 64);
+        sched_split(&batches, n, costs, good_batch_cost(total_cost, num_threads, 256), NULL);
+        sched_order(batches);
+
+        Futex remaining = dyn_array_length(batches);
+
+        dyn_array_for(i, batches) {
+            PerFunction task = {
+                .mod = mod, .funcs = &funcs[batches[i].start], .count = batches[i].count,
+                .remaining = &remaining, .ctx = ctx, .func = func
+            };
+            CUIK_CALL(thread_pool, submit, per_func_task, sizeof(task), &task);
         }
 
-        futex_wait_eq(&remaining, 0);
+        futex_wait_eq_helping(&remaining, 0, thread_pool->work_one_job, thread_pool);
+        dyn_array_destroy(batches);
+        cuik_free(costs);
+        cuik_free(funcs);
         #else
         fprintf(stderr, "Please compile with -DCUIK_ALLOW_THREADS if you wanna spin up threads");
         abort();
@@ -69,4 +119,4 @@ void cuiksched_per_function(Cuik_IThreadpool* restrict thread_pool, int num_thre
         }
     }
 }
-#endif
\ No newline at end of file
+#endif
@@ -1,49 +1,237 @@
 #include "cuik.h"
 #include "atoms.h"
+#include <threads.h>
+#include <stdatomic.h>
 
-enum { INTERNER_EXP = 24 };
+// The interner is shared by every thread in the process so atoms can be compared
+// by pointer across TUs. Lookups and inserts are lock-free, the only lock is for
+// whoever gets to grow the table.
+//
+// Growing works by sealing every empty slot in the old table (so nobody can insert
+// there anymore), copying the entries over and then publishing the new table. If an
+// insert runs into a sealed slot it just waits for the new table to show up.
+enum {
+    INTERNER_INIT_EXP = 16,
+    // each thread bump allocates the strings out of blocks this big
+    ATOM_BLOCK_SIZE   = 256 * 1024,
+};
 
-thread_local static TB_Arena atoms_arena;
-thread_local static Atom* interner;
+// the length and hash live right before the characters so
+// we don't need strlen and rehashing while probing.
+typedef struct {
+    uint32_t hash;
+    uint32_t len;
+    char data[];
+} AtomEntry;
 
-void atoms_free(void) {
-    CUIK_TIMED_BLOCK("free atoms") {
-        tb_arena_destroy(&atoms_arena);
-        cuik__vfree(interner, (1u << INTERNER_EXP) * sizeof(Atom));
-        interner = NULL;
+#define ATOM_SEALED ((AtomEntry*) (uintptr_t) 1)
+
+typedef struct AtomTable AtomTable;
+struct AtomTable {
+    // old tables are kept alive since readers might still be on them
+    AtomTable* prev;
+
+    uint32_t mask;
+    _Atomic uint32_t count;
+    _Atomic(AtomEntry*) slots[];
+};
+
+typedef struct AtomBlock AtomBlock;
+struct AtomBlock {
+    AtomBlock* next;
+    size_t size;
+    char data[];
+};
+
+static _Atomic(AtomTable*) atom_table;
+static mtx_t atom_lock;
+static once_flag atom_init_once = ONCE_FLAG_INIT;
+
+// all string blocks ever made, they're freed in atoms_free. The generation
+// is bumped on every free so threads know to drop their old blocks.
+static _Atomic(AtomBlock*) atom_blocks;
+static _Atomic uint32_t atom_generation;
+static thread_local uint32_t atom_bump_gen;
+static thread_local char* atom_bump;
+static thread_local char* atom_bump_end;
+
+static AtomTable* atom_table_alloc(int exp) {
+    size_t cap = 1u << exp;
+    AtomTable* t = cuik__valloc(sizeof(AtomTable) + cap * sizeof(AtomEntry*));
+    t->prev = NULL;
+    t->mask = cap - 1;
+    atomic_init(&t->count, 0);
+    return t;
+}
+
+static void atoms_init(void) {
+    mtx_init(&atom_lock, mtx_plain);
+}
+
+static AtomTable* atoms_get_table(void) {
+    AtomTable* t = atomic_load_explicit(&atom_table, memory_order_acquire);
+    if (UNLIKELY(t == NULL)) {
+        call_once(&atom_init_once, atoms_init);
+
+        mtx_lock(&atom_lock);
+        t = atomic_load(&atom_table);
+        if (t == NULL) {
+            t = atom_table_alloc(INTERNER_INIT_EXP);
+            atomic_store_explicit(&atom_table, t, memory_order_release);
+        }
+        mtx_unlock(&atom_lock);
     }
+
+    return t;
 }
 
-Atom atoms_put(size_t len, const unsigned char* str) {
-    if (interner == NULL) {
-        CUIK_TIMED_BLOCK("alloc atoms") {
-            interner = cuik__valloc((1u << INTERNER_EXP) * sizeof(Atom));
-            tb_arena_create(&atoms_arena, TB_ARENA_MEDIUM_CHUNK_SIZE);
+static AtomEntry* atom_entry_alloc(size_t len) {
+    size_t size = (sizeof(AtomEntry) + len + 1 + 7) & ~(size_t)7;
+    uint32_t gen = atomic_load_explicit(&atom_generation, memory_order_relaxed);
+    if (atom_bump == NULL || atom_bump_gen != gen || atom_bump + size > atom_bump_end) {
+        size_t block_size = size > ATOM_BLOCK_SIZE ? size : ATOM_BLOCK_SIZE;
+        AtomBlock* b = cuik__valloc(sizeof(AtomBlock) + block_size);
+        b->size = block_size;
+
+        // push onto the global block list
+        b->next = atomic_load_explicit(&atom_blocks, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak(&atom_blocks, &b->next, b)) {}
+
+        atom_bump = b->data;
+        atom_bump_end = b->data + block_size;
+        atom_bump_gen = gen;
+    }
+
+    AtomEntry* e = (AtomEntry*) atom_bump;
+    atom_bump += size;
+    return e;
+}
+
+// if we lost a race with someone inserting the same string, we can give it back
+static void atom_entry_unalloc(AtomEntry* e, size_t len) {
+    size_t size = (sizeof(AtomEntry) + len + 1 + 7) & ~(size_t)7;
+    if ((char*) e + size == atom_bump) {
+        atom_bump = (char*) e;
+    }
+}
+
+static AtomTable* wait_for_new_table(AtomTable* old) {
+    AtomTable* t;
+    while (t = atomic_load_explicit(&atom_table, memory_order_acquire), t == old) {
+        thrd_yield();
+    }
+    return t;
+}
+
+static void atom_table_grow(AtomTable* old) {
+    mtx_lock(&atom_lock);
+    if (atomic_load(&atom_table) != old) {
+        // someone already did it
+        mtx_unlock(&atom_lock);
+        return;
+    }
+
+    int exp = 1;
+    while ((1u << exp) <= old->mask) exp++;
+    AtomTable* t = atom_table_alloc(exp + 1);
+
+    size_t count = 0;
+    for (size_t i = 0; i <= old->mask; i++) {
+        AtomEntry* e = NULL;
+        if (atomic_compare_exchange_strong(&old->slots[i], &e, ATOM_SEALED)) {
+            continue;
         }
+
+        // e is the entry we couldn't replace
+        size_t j = e->hash & t->mask;
+        while (atomic_load_explicit(&t->slots[j], memory_order_relaxed) != NULL) {
+            j = (j + 1) & t->mask;
+        }
+
+        atomic_store_explicit(&t->slots[j], e, memory_order_relaxed);
+        count += 1;
     }
 
-    uint32_t mask = (1 << INTERNER_EXP) - 1;
-    uint32_t hash = tb__murmur3_32(str, len);
-    size_t first = hash & mask, i = first;
-
-    do {
-        // linear probe
-        if (LIKELY(interner[i] == NULL)) {
-            Atom newstr = tb_arena_unaligned_alloc(&atoms_arena, len + 1);
-            memcpy(newstr, str, len);
-            newstr[len] = 0;
-
-            interner[i] = newstr;
-            return newstr;
-        } else if (len == strlen(interner[i]) && memcmp(str, interner[i], len) == 0) {
-            return interner[i];
+    atomic_store_explicit(&t->count, count, memory_order_relaxed);
+    t->prev = old;
+    atomic_store_explicit(&atom_table, t, memory_order_release);
+    mtx_unlock(&atom_lock);
+}
+
+void atoms_free(void) {
+    // NOTE(NeGate): atoms are shared by every thread, this should only be
+    // called once nobody else is gonna touch them (usually at exit).
+    CUIK_TIMED_BLOCK("free atoms") {
+        AtomTable* t = atomic_exchange(&atom_table, NULL);
+        while (t != NULL) {
+            AtomTable* prev = t->prev;
+            cuik__vfree(t, sizeof(AtomTable) + (t->mask + 1ull) * sizeof(AtomEntry*));
+            t = prev;
         }
 
-        i = (i + 1) & mask;
-    } while (i != first);
+        AtomBlock* b = atomic_exchange(&atom_blocks, NULL);
+        while (b != NULL) {
+            AtomBlock* next = b->next;
+            cuik__vfree(b, sizeof(AtomBlock) + b->size);
+            b = next;
+        }
 
-    log_error("atoms arena: out of memory!\n");
-    abort();
+        atom_bump = atom_bump_end = NULL;
+        atom_generation += 1;
+    }
+}
+
+Atom atoms_put(size_t len, const unsigned char* str) {
+    uint32_t hash = tb__murmur3_32(str, len);
+    AtomEntry* new_e = NULL;
+
+    AtomTable* t = atoms_get_table();
+    for (;;) {
+        size_t first = hash & t->mask, i = first;
+        do {
+            // linear probe
+            AtomEntry* e = atomic_load_explicit(&t->slots[i], memory_order_acquire);
+            if (LIKELY(e == NULL)) {
+                if (new_e == NULL) {
+                    new_e = atom_entry_alloc(len);
+                    new_e->hash = hash;
+                    new_e->len = len;
+                    memcpy(new_e->data, str, len);
+                    new_e->data[len] = 0;
+                }
+
+                if (atomic_compare_exchange_strong_explicit(&t->slots[i], &e, new_e, memory_order_acq_rel, memory_order_acquire)) {
+                    // grow at 75% load
+                    uint32_t count = atomic_fetch_add_explicit(&t->count, 1, memory_order_relaxed) + 1;
+                    if (count > (t->mask / 4) * 3) {
+                        atom_table_grow(t);
+                    }
+
+                    return new_e->data;
+                }
+
+                // someone beat us to the slot, e now holds what they put there
+            }
+
+            if (e == ATOM_SEALED) {
+                break;
+            } else if (e->hash == hash && e->len == len && memcmp(str, e->data, len) == 0) {
+                if (new_e != NULL) {
+                    atom_entry_unalloc(new_e, len);
+                }
+                return e->data;
+            }
+
+            i = (i + 1) & t->mask;
+        } while (i != first);
+
+        // we hit a sealed slot (or a full table), the table is growing so
+        // we'll retry on the new one once it's ready.
+        if (i == first) {
+            atom_table_grow(t);
+        }
+        t = wait_for_new_table(t);
+    }
 }
 
 Atom atoms_putc(const char* str) {
@@ -425,6 +425,11 @@ void cuik_destroy_translation_unit(TranslationUnit* restrict tu) {
     if (!tu->is_free) {
         tu->is_free = true;
         dyn_array_destroy(tu->top_level_stmts);
+
+        for (size_t i = 0; i < tu->sema_arena_count; i++) {
+            tb_arena_destroy(&tu->sema_arenas[i]);
+        }
+        cuik_free(tu->sema_arenas);
     }
 
     if (tu->parent == NULL) {
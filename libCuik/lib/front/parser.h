@@ -116,6 +116,12 @@ struct TranslationUnit {
     mtx_t diag_mutex;
     NL_Strmap(Diag_UnresolvedSymbol*) unresolved_symbols;
 
+    // parallel sema gives every task its own arena, they live as long as the TU.
+    // sema_lock guards the few spots where type checking mutates shared types.
+    mtx_t sema_lock;
+    size_t sema_arena_count;
+    TB_Arena* sema_arenas;
+
     Cuik_Type* va_list;
     struct {
         Stmt* va_arg_gp;
@@ -1,10 +1,30 @@
 #include "sema.h"
+#include <futex.h>
 
 #include "../back/ir_gen.h"
 #include "../targets/targets.h"
 
 thread_local Stmt* cuik__sema_function_stmt;
 
+// defined in types.c, it's only set by the parallel sema tasks
+extern thread_local TB_Arena* cuik__sema_arena;
+
+static TB_Arena* sema_arena(TranslationUnit* tu) {
+    return cuik__sema_arena ? cuik__sema_arena : tu->arena;
+}
+
+// most types are laid out by the time we're here but there's stragglers, the types
+// are shared between the sema tasks so this needs to be serialized.
+static void sema_layout(TranslationUnit* tu, Cuik_Type* type) {
+    if (cuik__sema_arena != NULL) {
+        mtx_lock(&tu->sema_lock);
+        type_layout2(NULL, &tu->tokens, type);
+        mtx_unlock(&tu->sema_lock);
+    } else {
+        type_layout2(NULL, &tu->tokens, type);
+    }
+}
+
 void sema_stmt(TranslationUnit* tu, Stmt* restrict s);
 
 static bool is_scalar_type(TranslationUnit* tu, Cuik_Type* type) {
@@ -390,7 +410,7 @@ static int walk_initializer_layer(TranslationUnit* tu, Cuik_Type* parent, int ba
 
     // sometimes this is just not resolved yet?
     if (type->size == 0) {
-        type_layout2(NULL, &tu->tokens, type);
+        sema_layout(tu, type);
     }
 
     uint32_t pos = base_offset + relative_offset;
@@ -538,7 +558,7 @@ static void walk_initializer_for_sema(TranslationUnit* tu, Cuik_Type* type, Init
 
     if (type->array.count == 0) {
         type->array.count = max_cursor;
-        type_layout2(NULL, &tu->tokens, type);
+        sema_layout(tu, type);
     }
 }
 
@@ -1160,12 +1180,17 @@ Cuik_QualType cuik__sema_subexpr(TranslationUnit* tu, Cuik_Expr* restrict _, Sub
 
                 if (type->kind == KIND_ARRAY) {
                     if (type->size == 0 && (sym->op == STMT_GLOBAL_DECL || sym->op == STMT_DECL)) {
+                        // globals are shared between the sema tasks
+                        bool is_shared = cuik__sema_arena != NULL && sym->op == STMT_GLOBAL_DECL;
+                        if (is_shared) mtx_lock(&tu->sema_lock);
+
                         sym->flags |= STMT_FLAGS_IS_RESOLVING;
 
                         // try to resolve the type since it's incomplete
                         sema_stmt(tu, sym);
 
                         sym->flags &= ~STMT_FLAGS_IS_RESOLVING;
+                        if (is_shared) mtx_unlock(&tu->sema_lock);
                         type = cuik_canonical_type(sym->decl.type);
                         assert(type->size != 0 && "Uhh... we fucked up");
                     }
@@ -1190,7 +1215,7 @@ Cuik_QualType cuik__sema_subexpr(TranslationUnit* tu, Cuik_Expr* restrict _, Sub
             size_t len = ((const char*)e->str.end - 1) - in;
 
             // it can't be bigger than the original
-            wchar_t* out = tb_arena_alloc(tu->arena, (len + 1) * 2);
+            wchar_t* out = tb_arena_alloc(sema_arena(tu), (len + 1) * 2);
 
             size_t out_i = 0, in_i = 0;
             while (in_i < len) {
@@ -1217,7 +1242,7 @@ Cuik_QualType cuik__sema_subexpr(TranslationUnit* tu, Cuik_Expr* restrict _, Sub
             size_t len = ((const char*)e->str.end - 1) - in;
 
             // it can't be bigger than the original
-            char* out = tb_arena_alloc(tu->arena, len + 1);
+            char* out = tb_arena_alloc(sema_arena(tu), len + 1);
 
             size_t out_i = 0, in_i = 0;
             while (in_i < len) {
@@ -1245,7 +1270,7 @@ Cuik_QualType cuik__sema_subexpr(TranslationUnit* tu, Cuik_Expr* restrict _, Sub
 
             if (t->kind == KIND_ARRAY) {
                 if (!CUIK_TYPE_IS_COMPLETE(cuik_canonical_type(t->array.of))) {
-                    type_layout2(NULL, &tu->tokens, cuik_canonical_type(t->array.of));
+                    sema_layout(tu, cuik_canonical_type(t->array.of));
                 }
 
                 int old_array_count = t->array.count;
@@ -1446,7 +1471,7 @@ Cuik_QualType cuik__sema_subexpr(TranslationUnit* tu, Cuik_Expr* restrict _, Sub
             }
 
             if (record_type->size == 0) {
-                type_layout2(NULL, &tu->tokens, record_type);
+                sema_layout(tu, record_type);
 
                 if (record_type->size == 0) {
                     diag_err(&tu->tokens, e->loc, "Cannot access members in incomplete type");
@@ -1744,7 +1769,7 @@ Cuik_QualType cuik__sema_expr(TranslationUnit* tu, Cuik_Expr* restrict e) {
     }
 
     // we're gonna need a type and cast_type stream
-    Cuik_QualType* t = TB_ARENA_ARR_ALLOC(tu->arena, 2 * e->count, Cuik_QualType);
+    Cuik_QualType* t = TB_ARENA_ARR_ALLOC(sema_arena(tu), 2 * e->count, Cuik_QualType);
     e->visited    = true;
     e->types      = t;
     e->cast_types = &t[e->count];
@@ -2109,6 +2134,107 @@ static void sema_mark_decl(TranslationUnit* tu, Stmt* restrict s) {
     }
 }
 
+// how many statements worth of function bodies go into a sema task
+#define SEMA_BATCH_COST 2048
+
+typedef struct {
+    TranslationUnit* tu;
+    TB_Arena* arena;
+    Futex* remaining;
+
+    // top level statements [start, end) and their diagnostic buffers
+    size_t start, end;
+    char** diags;
+} SemaTask;
+
+static void sema_task(void* arg) {
+    SemaTask task = *((SemaTask*) arg);
+    TranslationUnit* tu = task.tu;
+
+    // we might be running as a helper on a thread that's waiting in the middle of
+    // something else, restore whatever was there.
+    TB_Arena* old_arena = cuik__sema_arena;
+    cuik__sema_arena = task.arena;
+
+    CUIK_TIMED_BLOCK("sema: task") {
+        for (size_t i = task.start; i < task.end; i++) {
+            Stmt* s = tu->top_level_stmts[i];
+            if (s->op == STMT_FUNC_DECL) {
+                char** old_redirect = cuikdg_redirect(&task.diags[i]);
+                sema_top_level(tu, s);
+                cuikdg_redirect(old_redirect);
+            }
+        }
+    }
+
+    cuik__sema_arena = old_arena;
+    futex_dec(task.remaining);
+}
+
+// globals are checked first since function bodies might depend on them (inferred array
+// sizes), then the function bodies are checked in parallel. Each top level statement
+// gets its own diagnostic buffer and they're stitched back together in order so the
+// output doesn't change with the thread count.
+static void sema_parallel(TranslationUnit* tu, Cuik_IThreadpool* thread_pool, size_t count) {
+    char** diags = cuik_calloc(count, sizeof(char*));
+
+    for (size_t i = 0; i < count; i++) {
+        Stmt* s = tu->top_level_stmts[i];
+        if (s->op != STMT_FUNC_DECL) {
+            char** old_redirect = cuikdg_redirect(&diags[i]);
+            sema_top_level(tu, s);
+            cuikdg_redirect(old_redirect);
+        }
+    }
+
+    // split up the function bodies into batches, the cost is based on the number
+    // of statements at the top of the function body.
+    SemaTask* tasks = dyn_array_create(SemaTask, 64);
+    SemaTask curr = { .tu = tu, .diags = diags };
+    size_t curr_cost = 0;
+    for (size_t i = 0; i < count; i++) {
+        Stmt* s = tu->top_level_stmts[i];
+        if (s->op == STMT_FUNC_DECL && s->decl.initial_as_stmt != NULL) {
+            curr_cost += 1 + s->decl.initial_as_stmt->compound.kids_count;
+        }
+
+        if (curr_cost >= SEMA_BATCH_COST || i + 1 == count) {
+            curr.end = i + 1;
+            dyn_array_put(tasks, curr);
+
+            curr.start = i + 1;
+            curr_cost = 0;
+        }
+    }
+
+    size_t task_count = dyn_array_length(tasks);
+    tu->sema_arena_count = task_count;
+    tu->sema_arenas = cuik_malloc(task_count * sizeof(TB_Arena));
+    mtx_init(&tu->sema_lock, mtx_plain | mtx_recursive);
+
+    Futex remaining = task_count;
+    for (size_t i = 0; i < task_count; i++) {
+        tb_arena_create(&tu->sema_arenas[i], TB_ARENA_MEDIUM_CHUNK_SIZE, "sema");
+        tasks[i].arena = &tu->sema_arenas[i];
+        tasks[i].remaining = &remaining;
+
+        CUIK_CALL(thread_pool, submit, sema_task, sizeof(SemaTask), &tasks[i]);
+    }
+    futex_wait_eq_helping(&remaining, 0, thread_pool->work_one_job, thread_pool);
+    mtx_destroy(&tu->sema_lock);
+
+    // merge diagnostics
+    for (size_t i = 0; i < count; i++) {
+        if (diags[i] != NULL) {
+            cuikdg_flush_redirect(&tu->tokens, diags[i]);
+            dyn_array_destroy(diags[i]);
+        }
+    }
+
+    dyn_array_destroy(tasks);
+    cuik_free(diags);
+}
+
 int cuiksema_run(TranslationUnit* restrict tu, Cuik_IThreadpool* restrict thread_pool) {
     size_t count = dyn_array_length(tu->top_level_stmts);
 
@@ -2137,10 +2263,15 @@ int cuiksema_run(TranslationUnit* restrict tu, Cuik_IThreadpool* restrict thread
     }
 
     // go through all top level statements and type check
-    // NOTE(NeGate): we can multithread this... it's not helpful tho
-    CUIK_TIMED_BLOCK("sema: type check") {
-        for (size_t i = 0; i < count; i++) {
-            sema_top_level(tu, tu->top_level_stmts[i]);
+    if (thread_pool != NULL) {
+        CUIK_TIMED_BLOCK("sema: type check") {
+            sema_parallel(tu, thread_pool, count);
+        }
+    } else {
+        CUIK_TIMED_BLOCK("sema: type check") {
+            for (size_t i = 0; i < count; i++) {
+                sema_top_level(tu, tu->top_level_stmts[i]);
+            }
         }
     }
 
@@ -262,6 +262,10 @@ static ParseResult parse_decl(Cuik_Parser* restrict parser, TokenStream* restric
                 if (expr_start >= 0) {
                     sym->token_start = expr_start;
                     sym->token_end = expr_end;
+
+                    // functions cover the whole definition (prototype included)
+                    n->decl.token_start = n->op == STMT_FUNC_DECL ? starting_point : expr_start;
+                    n->decl.token_end = s->list.current;
                     // SourceRange r = { s->list.tokens[expr_start].location, get_token_range(&s->list.tokens[expr_end]).end };
                     // diag_note(s, r, "Initializer");
                 }
@@ -14,9 +14,13 @@ Cuik_TypeTable init_type_table(Cuik_Target* target) {
     return t;
 }
 
+// if set, new types (and any other sema allocations) go here instead of the
+// TU's arena, this is how parallel sema avoids fighting over the shared arena.
+thread_local TB_Arena* cuik__sema_arena;
+
 // if track is false, it's not type checked later (because it's complete)
 static Cuik_Type* type_alloc(Cuik_TypeTable* types, bool track) {
-    Cuik_Type* t = tb_arena_alloc(types->arena, sizeof(Cuik_Type));
+    Cuik_Type* t = tb_arena_alloc(cuik__sema_arena ? cuik__sema_arena : types->arena, sizeof(Cuik_Type));
     if (track && types->tracked) {
         dyn_array_put(types->tracked, t);
     }
@@ -52,7 +52,9 @@ static TokenList expand_ident(Cuik_CPP* restrict c, TokenArray* in, TokenNode* h
 
 static Cuik_Path* alloc_path(Cuik_CPP* restrict ctx, const char* filepath);
 static Cuik_Path* alloc_directory_path(Cuik_CPP* restrict ctx, const char* filepath);
-static void compute_line_map(TokenStream* s, bool is_system, int depth, SourceLoc include_site, const char* filename, char* data, size_t length);
+static uint32_t* compute_line_map(const char* data, size_t length);
+static void push_file_entries(TokenStream* s, bool is_system, bool is_cached, int depth, SourceLoc include_site, const char* filename, char* data, size_t length, uint32_t* line_map);
+static bool load_file(Cuik_CPP* restrict ctx, const Cuik_Path* restrict path, bool use_cache, bool is_system, int depth, SourceLoc include_site, const char* filename, TokenArray* out_tokens);
 
 enum {
     MAX_CPP_STACK_DEPTH = 1024,
@@ -217,6 +219,8 @@ static const char MAGIC_EMPTY_STRING[] = "";
 
 // Basically a mini-unity build that takes up just the CPP module
 #include "cpp_symtab.h"
+#include "cpp_cache.h"
+#include "cpp_prefix.h"
 #include "cpp_expand.h"
 #include "cpp_fs.h"
 #include "cpp_expr.h"
@@ -249,16 +253,14 @@ Cuik_CPP* cuikpp_make(const Cuik_CPPDesc* desc) {
         .fs        = desc->fs,
         .user_data = desc->fs_data,
         .case_insensitive = desc->case_insensitive,
+        .cache     = desc->cache,
 
         .stack = cuik__valloc(MAX_CPP_STACK_DEPTH * sizeof(CPPStackSlot)),
-        .macros = {
-            .exp = 24,
-            .keys = cuik__valloc((1u << 24) * sizeof(String)),
-            .vals = cuik__valloc((1u << 24) * sizeof(MacroDef)),
-        },
         .the_shtuffs = cuik__valloc(THE_SHTUFFS_SIZE),
     };
 
+    macro_table_alloc(ctx, MACRO_INIT_EXP);
+
     // initialize dynamic arrays
     ctx->system_include_dirs = dyn_array_create(char*, 64);
 
@@ -303,8 +305,9 @@ size_t cuikpp_get_token_count(TokenStream* restrict s) {
 
 void cuiklex_free_tokens(TokenStream* tokens) {
     dyn_array_for(i, tokens->files) {
-        // only free the root line_map, all the others are offsets of this one
-        if (tokens->files[i].file_pos_bias == 0) {
+        // only free the root line_map, all the others are offsets of this one.
+        // cached files are owned by the Cuik_FileCache.
+        if (tokens->files[i].file_pos_bias == 0 && !tokens->files[i].is_cached) {
             dyn_array_destroy(tokens->files[i].line_map);
 
             // TODO(NeGate): we theoretically can allocate file buffers which
@@ -334,12 +337,8 @@ void cuikpp_finalize(Cuik_CPP* ctx) {
     #endif
 
     CUIK_TIMED_BLOCK("cuikpp_finalize") {
-        cuik__vfree(ctx->macros.keys, (1u << ctx->macros.exp) * sizeof(String));
-        cuik__vfree(ctx->macros.vals, (1u << ctx->macros.exp) * sizeof(MacroDef));
+        macro_table_free(ctx);
         cuik__vfree(ctx->stack, MAX_CPP_STACK_DEPTH * sizeof(CPPStackSlot));
-
-        ctx->macros.keys = NULL;
-        ctx->macros.vals = NULL;
         ctx->stack = NULL;
     }
 
@@ -455,7 +454,7 @@ ResolvedSourceLoc cuikpp_find_location(TokenStream* tokens, SourceLoc loc) {
     return find_location(fl.file, fl.pos);
 }
 
-static void compute_line_map(TokenStream* s, bool is_system, int depth, SourceLoc include_site, const char* filename, char* data, size_t length) {
+static uint32_t* compute_line_map(const char* data, size_t length) {
     DynArray(uint32_t) line_map = dyn_array_create(uint32_t, (length / 20) + 32);
 
     #if 1
@@ -488,17 +487,96 @@ static void compute_line_map(TokenStream* s, bool is_system, int depth, SourceLo
     }
     #endif
 
+    return line_map;
+}
+
+static void push_file_entries(TokenStream* s, bool is_system, bool is_cached, int depth, SourceLoc include_site, const char* filename, char* data, size_t length, uint32_t* line_map) {
     // files bigger than the SourceLoc_FilePosBits allows will be fit into multiple sequencial files
     size_t i = 0, single_file_limit = (1u << SourceLoc_FilePosBits);
     do {
         size_t chunk_end = i + single_file_limit;
         if (chunk_end > length) chunk_end = length;
 
-        dyn_array_put(s->files, (Cuik_FileEntry){ filename, is_system, depth, include_site, i, chunk_end - i, &data[i], line_map });
+        dyn_array_put(s->files, (Cuik_FileEntry){ filename, is_system, depth, include_site, i, chunk_end - i, &data[i], line_map, is_cached });
         i += single_file_limit;
     } while (i < length);
 }
 
+// reads, canonicalizes and lexes the file then records it's file entries. if there's
+// a file cache we can skip all of that and just copy the tokens over.
+static bool load_file(Cuik_CPP* restrict ctx, const Cuik_Path* restrict path, bool use_cache, bool is_system, int depth, SourceLoc include_site, const char* filename, TokenArray* out_tokens) {
+    TokenStream* restrict s = &ctx->tokens;
+    uint32_t file_id = dyn_array_length(s->files);
+
+    #if CUIK__CPP_STATS
+    uint64_t start_time = cuik_time_in_nanos();
+    #endif
+
+    Cuik_FileCache* cache = use_cache ? ctx->cache : NULL;
+    CachedFile* cf = NULL;
+    if (cache != NULL) {
+        cf = cache_find_path(cache, path->data);
+    }
+
+    if (cf != NULL) {
+        cache->hits++;
+    } else {
+        Cuik_FileResult file;
+        if (!ctx->fs(ctx->user_data, path, &file, ctx->case_insensitive)) {
+            return false;
+        }
+
+        #if CUIK__CPP_STATS
+        ctx->total_files_read += 1;
+        #endif
+
+        if (cache == NULL) {
+            CUIK_TIMED_BLOCK("convert to tokens") {
+                *out_tokens = convert_to_token_list(ctx, file_id, file.length, file.data);
+            }
+
+            push_file_entries(s, is_system, false, depth, include_site, filename, file.data, file.length, compute_line_map(file.data, file.length));
+            goto done;
+        }
+
+        // lex relative to file ID 0, every user will rebase it
+        cf = cuik_malloc(sizeof(CachedFile));
+        *cf = (CachedFile){
+            .hash     = content_hash(file.length, file.data),
+            .length   = file.length,
+            .data     = file.data,
+            .line_map = compute_line_map(file.data, file.length),
+        };
+
+        CUIK_TIMED_BLOCK("convert to tokens") {
+            cf->tokens = convert_to_token_list(ctx, 0, file.length, file.data).tokens;
+        }
+
+        cf = cache_insert(cache, path->data, cf);
+        cache->misses++;
+    }
+
+    // copy the cached tokens and move them to our file ID
+    size_t count = dyn_array_length(cf->tokens);
+    Token* tokens = dyn_array_create(Token, count);
+    memcpy(tokens, cf->tokens, count * sizeof(Token));
+    dyn_array_set_length(tokens, count);
+
+    uint32_t bias = file_id << SourceLoc_FilePosBits;
+    for (size_t i = 0; i + 1 < count; i++) {
+        tokens[i].location.raw += bias;
+    }
+
+    *out_tokens = (TokenArray){ tokens };
+    push_file_entries(s, is_system, true, depth, include_site, filename, cf->data, cf->length, cf->line_map);
+
+    done:
+    #if CUIK__CPP_STATS
+    ctx->total_io_time += (cuik_time_in_nanos() - start_time);
+    #endif
+    return true;
+}
+
 static Cuik_Path* alloc_path(Cuik_CPP* restrict ctx, const char* filepath) {
     size_t len = strlen(filepath);
 
@@ -524,30 +602,16 @@ Cuikpp_Status cuikpp_run(Cuik_CPP* restrict ctx) {
     ////////////////////////////////
     slot->include_guard = (struct CPPIncludeGuard){ 0 };
 
-    #if CUIK__CPP_STATS
-    uint64_t start_time = cuik_time_in_nanos();
-    #endif
-
-    Cuik_FileResult main_file;
+    // initialize the lexer in the stack slot & record the file entry, the main
+    // file is unique to this TU so there's no point in caching it
+    slot->file_id = dyn_array_length(ctx->tokens.files);
     CUIK_TIMED_BLOCK("load main file") {
-        if (!ctx->fs(ctx->user_data, slot->filepath, &main_file, ctx->case_insensitive)) {
+        if (!load_file(ctx, slot->filepath, false, false, 0, (SourceLoc){ 0 }, slot->filepath->data, &slot->tokens)) {
             fprintf(stderr, "\x1b[31merror\x1b[0m: file \"%s\" doesn't exist.\n", slot->filepath->data);
             return CUIKPP_ERROR;
         }
     }
 
-    #if CUIK__CPP_STATS
-    ctx->total_io_time += (cuik_time_in_nanos() - start_time);
-    ctx->total_files_read += 1;
-    #endif
-
-    // initialize the lexer in the stack slot & record the file entry
-    slot->file_id = dyn_array_length(ctx->tokens.files);
-    CUIK_TIMED_BLOCK("convert to tokens") {
-        slot->tokens = convert_to_token_list(ctx, dyn_array_length(ctx->tokens.files), main_file.length, main_file.data);
-    }
-    compute_line_map(&ctx->tokens, false, 0, (SourceLoc){ 0 }, slot->filepath->data, main_file.data, main_file.length);
-
     // continue along to the actual preprocessing now
     #ifdef CPP_DBG
     cppdbg__break();
@@ -559,10 +623,13 @@ Cuikpp_Status cuikpp_run(Cuik_CPP* restrict ctx) {
 
     TokenStream* restrict s = &ctx->tokens;
 
-    // estimate a good final token count, if we get this right we'll zip past without resizes
-    size_t expected = dyn_array_length(slot->tokens.tokens);
-    if (expected < 4096) expected = 4096;
-    s->list.tokens = dyn_array_create(Token, expected);
+    // estimate a good final token count, if we get this right we'll zip past without resizes.
+    // if there's a prefix the tokens will already be there.
+    if (s->list.tokens == NULL) {
+        size_t expected = dyn_array_length(slot->tokens.tokens);
+        if (expected < 4096) expected = 4096;
+        s->list.tokens = dyn_array_create(Token, expected);
+    }
 
     for (;;) yield: {
         slot = &ctx->stack[ctx->stack_ptr - 1];
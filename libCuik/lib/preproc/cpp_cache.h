@@ -0,0 +1,142 @@
+// This is the shared file cache, it's meant to be owned by the build and
+// handed to every preprocessor that's running in it. Headers get read,
+// canonicalized and lexed once per process and every TU after that just
+// copies the tokens over (rebasing the file IDs in the source locations).
+//
+// The files are content-addressed, two paths with the same contents (symlinks,
+// copied SDK headers) will point to the same CachedFile.
+//
+// NOTE(NeGate): we don't check timestamps, the assumption is that headers
+// don't change underneath us during a build.
+#include <threads.h>
+
+typedef struct CachedFile CachedFile;
+struct CachedFile {
+    // files with the same content hash
+    CachedFile* next;
+
+    uint32_t hash;
+    size_t length;
+    char* data;
+
+    // DynArray(uint32_t), shared by every Cuik_FileEntry that refers to this file
+    uint32_t* line_map;
+
+    // DynArray(Token), lexed with file ID 0 so they need to be rebased before use.
+    // includes the NULL token at the end.
+    Token* tokens;
+};
+
+struct Cuik_FileCache {
+    mtx_t lock;
+
+    // canonical filepath -> file
+    NL_Strmap(CachedFile*) paths;
+    // content hash -> file chain
+    NL_Map(uint32_t, CachedFile*) contents;
+    // every unique file, this is what owns them
+    DynArray(CachedFile*) files;
+
+    // stats
+    _Atomic size_t hits, misses;
+};
+
+Cuik_FileCache* cuikpp_cache_create(void) {
+    Cuik_FileCache* c = cuik_calloc(1, sizeof(Cuik_FileCache));
+    mtx_init(&c->lock, mtx_plain);
+    c->files = dyn_array_create(CachedFile*, 64);
+    return c;
+}
+
+static void cached_file_free(CachedFile* f) {
+    dyn_array_destroy(f->tokens);
+    dyn_array_destroy(f->line_map);
+    cuik__vfree(f->data, f->length + 17);
+    cuik_free(f);
+}
+
+void cuikpp_cache_destroy(Cuik_FileCache* c) {
+    if (c == NULL) {
+        return;
+    }
+
+    // the path map has the keys and the file list has the values
+    nl_map_for_str(i, c->paths) {
+        cuik_free((void*) c->paths[i].k.data);
+    }
+
+    dyn_array_for(i, c->files) {
+        cached_file_free(c->files[i]);
+    }
+
+    dyn_array_destroy(c->files);
+    nl_map_free(c->paths);
+    nl_map_free(c->contents);
+    mtx_destroy(&c->lock);
+    cuik_free(c);
+}
+
+void cuikpp_cache_stats(Cuik_FileCache* c, size_t* out_hits, size_t* out_misses) {
+    *out_hits = c->hits;
+    *out_misses = c->misses;
+}
+
+static uint32_t content_hash(size_t length, const char* data) {
+    uint32_t h = tb__murmur3_32(data, length);
+    // 0 and -1 are reserved by the NL_Map for empty and tombstone keys
+    return h == 0 || h == UINT32_MAX ? 1 : h;
+}
+
+static CachedFile* cache_find_path(Cuik_FileCache* c, const char* path) {
+    CachedFile* f = NULL;
+    mtx_lock(&c->lock);
+    ptrdiff_t search = nl_map_get_cstr(c->paths, path);
+    if (search >= 0) {
+        f = c->paths[search].v;
+    }
+    mtx_unlock(&c->lock);
+    return f;
+}
+
+// inserts the file into the cache, if there's already a file with the same
+// path or the same contents that one is returned and the new one is freed.
+static CachedFile* cache_insert(Cuik_FileCache* c, const char* path, CachedFile* f) {
+    mtx_lock(&c->lock);
+
+    // someone might've beaten us to it
+    ptrdiff_t search = nl_map_get_cstr(c->paths, path);
+    if (search >= 0) {
+        CachedFile* old = c->paths[search].v;
+        mtx_unlock(&c->lock);
+
+        cached_file_free(f);
+        return old;
+    }
+
+    CachedFile* head = NULL;
+    search = nl_map_get(c->contents, f->hash);
+    if (search >= 0) {
+        head = c->contents[search].v;
+    }
+
+    CachedFile* same = head;
+    for (; same != NULL; same = same->next) {
+        if (same->length == f->length && memcmp(same->data, f->data, f->length) == 0) {
+            break;
+        }
+    }
+
+    if (same != NULL) {
+        cached_file_free(f);
+        f = same;
+    } else {
+        f->next = head;
+        nl_map_put(c->contents, f->hash, f);
+        dyn_array_put(c->files, f);
+    }
+
+    char* key = cuik_strdup(path);
+    nl_map_put_cstr(c->paths, key, f);
+    mtx_unlock(&c->lock);
+    return f;
+}
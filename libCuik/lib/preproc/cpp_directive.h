@@ -208,30 +208,13 @@ static DirectiveResult cpp__include(Cuik_CPP* restrict ctx, CPPStackSlot* restri
         .loc = loc.start
     };
 
-    // read new file & lex
-    #if CUIK__CPP_STATS
-    uint64_t start_time = cuik_time_in_nanos();
-    #endif
-
-    Cuik_FileResult next_file;
-    if (!ctx->fs(ctx->user_data, &canonical, &next_file, ctx->case_insensitive)) {
-        fprintf(stderr, "\x1b[31merror\x1b[0m: file doesn't exist.\n");
-        return DIRECTIVE_ERROR;
-    }
-
-    #if CUIK__CPP_STATS
-    ctx->total_io_time += (cuik_time_in_nanos() - start_time);
-    ctx->total_files_read += 1;
-    #endif
-
-    // initialize the file & lexer in the stack new_slot
+    // read new file, lex & record the file entry
     new_slot->include_guard = (struct CPPIncludeGuard){ 0 };
-    // initialize the lexer in the stack slot & record file entry
     new_slot->file_id = dyn_array_length(ctx->tokens.files);
-    CUIK_TIMED_BLOCK("convert to tokens") {
-        new_slot->tokens = convert_to_token_list(ctx, dyn_array_length(ctx->tokens.files), next_file.length, next_file.data);
+    if (!load_file(ctx, &canonical, true, l & LOCATE_SYSTEM, ctx->stack_ptr - 1, new_slot->loc, alloced_filepath->data, &new_slot->tokens)) {
+        fprintf(stderr, "\x1b[31merror\x1b[0m: file doesn't exist.\n");
+        return DIRECTIVE_ERROR;
     }
-    compute_line_map(&ctx->tokens, l & LOCATE_SYSTEM, ctx->stack_ptr - 1, new_slot->loc, alloced_filepath->data, next_file.data, next_file.length);
 
     if (cuikperf_is_active()) {
         cuikperf_region_start("preprocess", filename);
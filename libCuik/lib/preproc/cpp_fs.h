@@ -79,6 +79,7 @@ bool cuikpp_default_fs(void* user_data, const Cuik_Path* restrict input, Cuik_Fi
 
         char* buffer = cuik__valloc(length + 17);
         if (!cuikfs_read(file, buffer, length)) goto err;
+        cuikperf_count("file", path.data, length);
 
         cuiklex_canonicalize(length, buffer);
 
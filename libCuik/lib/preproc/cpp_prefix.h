@@ -0,0 +1,595 @@
+// Precompiled prefixes, this dumps the state of a finished preprocessor (tokens,
+// file entries, macro invocations, defines and include guards) into one blob which
+// can be mapped back in and placed at the start of another TU.
+//
+// All pointers in the blob are stored as offsets from the start of it, we copy the
+// files and the_shtuffs wholesale since that's where almost every string points and
+// a macro's key needs to see the parameter list after it. Every copied string gets
+// 16 bytes of padding so memory_equals16 stays in bounds.
+//
+// NOTE(NeGate): the blob is only meant to be read by the same build of Cuik that
+// wrote it, it's not portable across targets or compiler versions.
+#ifdef _WIN32
+#include <process.h>
+#define prefix_pid() _getpid()
+#else
+#include <unistd.h>
+#define prefix_pid() getpid()
+#endif
+
+enum {
+    PREFIX_MAGIC   = 0x48435043, // CPCH
+    PREFIX_VERSION = 1,
+};
+
+typedef struct {
+    uint32_t magic, version;
+    // if any of these change, the blob is stale
+    uint32_t token_size, file_size, invoke_size;
+    int unique_counter;
+    uint64_t key;
+
+    uint32_t dep_count, file_count, invoke_count, macro_count, once_count, token_count;
+    uint64_t deps, files, invokes, macros, once, tokens;
+} PrefixHeader;
+
+// files which were read by the prefix, used to tell if it's stale
+typedef struct {
+    uint64_t path;
+    uint64_t length;
+    uint32_t hash;
+} PrefixDep;
+
+typedef struct {
+    String key;
+    MacroDef def;
+} PrefixMacro;
+
+struct Cuik_Prefix {
+    // either mapped in from disk or a heap blob we just made
+    bool is_mapped;
+    FileMap map;
+
+    size_t size;
+    const char* data;
+};
+
+typedef struct {
+    const char* start;
+    size_t length;
+
+    // where it was placed in the blob
+    uint64_t offset;
+    // offset to the line map if it's a file (after the DynArrayHeader)
+    uint64_t line_map;
+    const char* filename;
+} PrefixRegion;
+
+typedef struct {
+    DynArray(char) data;
+    // sorted by start
+    DynArray(PrefixRegion) regions;
+} PrefixWriter;
+
+static uint64_t prefix_alloc(PrefixWriter* w, size_t size, size_t align) {
+    size_t len = dyn_array_length(w->data);
+    size_t at = (len + align - 1) & ~(align - 1);
+
+    dyn_array_put_uninit(w->data, (at - len) + size);
+    memset(&w->data[len], 0, (at - len) + size);
+    return at;
+}
+
+static uint64_t prefix_put(PrefixWriter* w, const void* src, size_t size, size_t align, size_t pad) {
+    uint64_t at = prefix_alloc(w, size + pad, align);
+    if (size) {
+        memcpy(&w->data[at], src, size);
+    }
+    return at;
+}
+
+static uint64_t prefix_cstr(PrefixWriter* w, const char* str) {
+    return str ? prefix_put(w, str, strlen(str) + 1, 1, 0) : 0;
+}
+
+static PrefixRegion* prefix_find_region(PrefixWriter* w, const void* ptr) {
+    const char* p = ptr;
+    size_t left = 0, right = dyn_array_length(w->regions);
+    while (left < right) {
+        size_t middle = (left + right) / 2;
+        if (w->regions[middle].start > p) {
+            right = middle;
+        } else {
+            left = middle + 1;
+        }
+    }
+
+    if (right == 0) {
+        return NULL;
+    }
+
+    PrefixRegion* r = &w->regions[right - 1];
+    return p <= r->start + r->length ? r : NULL;
+}
+
+// anything that isn't in a file or the_shtuffs (string literals, #embed data)
+// just gets copied
+static uint64_t prefix_str(PrefixWriter* w, const unsigned char* data, size_t length) {
+    if (data == NULL) {
+        return 0;
+    }
+
+    PrefixRegion* r = prefix_find_region(w, data);
+    if (r != NULL) {
+        return r->offset + ((const char*) data - r->start);
+    }
+
+    return prefix_put(w, data, length, 1, 16);
+}
+
+#define PREFIX_PTR(T, off) ((T) (uintptr_t) (off))
+
+// these change every build so they're not part of the config, the
+// TU's values are placed over the prefix's.
+static const char* prefix_volatile_macros[] = { "__DATE__", "__TIME__" };
+enum { PREFIX_VOLATILE_COUNT = sizeof(prefix_volatile_macros) / sizeof(prefix_volatile_macros[0]) };
+
+static bool prefix_is_volatile(String k) {
+    for (size_t i = 0; i < PREFIX_VOLATILE_COUNT; i++) {
+        if (string_equals_cstr(&k, prefix_volatile_macros[i])) return true;
+    }
+    return false;
+}
+
+static int prefix_region_cmp(const void* a, const void* b) {
+    const PrefixRegion* aa = a;
+    const PrefixRegion* bb = b;
+    return (aa->start > bb->start) - (aa->start < bb->start);
+}
+
+uint64_t cuikpp_config_hash(Cuik_CPP* ctx) {
+    uint64_t h = ((uint64_t) ctx->version << 1) | ctx->case_insensitive;
+    dyn_array_for(i, ctx->system_include_dirs) {
+        Cuik_IncludeDir* dir = &ctx->system_include_dirs[i];
+        h = (h * 0x100000001B3ull) ^ tb__murmur3_32(dir->path->data, dir->path->length) ^ dir->is_system;
+    }
+
+    // the macro table's order depends on what got (un)defined so
+    // we mix the entries in an order independent way.
+    uint64_t m = 0;
+    size_t cap = 1u << ctx->macros.exp;
+    for (size_t i = 0; i < cap; i++) {
+        if (ctx->macros.tags[i] & 0x80) continue;
+
+        String k = ctx->macros.keys[i], v = ctx->macros.vals[i].value;
+        if (prefix_is_volatile(k)) continue;
+
+        uint64_t kh = tb__murmur3_32(k.data, k.length);
+        uint64_t vh = tb__murmur3_32(v.data, v.length);
+        m += ((kh << 32) | vh) * 0x9E3779B97F4A7C15ull;
+    }
+
+    return (h * 0x100000001B3ull) ^ m;
+}
+
+Cuik_Prefix* cuikpp_prefix_make(Cuik_CPP* ctx, uint64_t key) {
+    TokenStream* s = &ctx->tokens;
+    PrefixWriter w = {
+        .data = dyn_array_create(char, 1u << 20),
+        .regions = dyn_array_create(PrefixRegion, 64),
+    };
+
+    // the header goes first so offset 0 is never a real pointer
+    prefix_alloc(&w, sizeof(PrefixHeader), 16);
+
+    CUIK_TIMED_BLOCK("prefix make") {
+        // every file (big files are split into chunks, the first has no bias)
+        size_t file_count = dyn_array_length(s->files);
+        for (size_t i = 1; i < file_count; i++) {
+            Cuik_FileEntry* f = &s->files[i];
+            if (f->file_pos_bias != 0 || f->content == NULL) continue;
+
+            size_t length = f->content_length;
+            for (size_t j = i + 1; j < file_count && s->files[j].file_pos_bias != 0; j++) {
+                length += s->files[j].content_length;
+            }
+
+            PrefixRegion r = { f->content, length, .line_map = (uintptr_t) f->line_map, .filename = f->filename };
+            dyn_array_put(w.regions, r);
+        }
+
+        PrefixRegion shtuffs = { (const char*) ctx->the_shtuffs, ctx->the_shtuffs_size };
+        dyn_array_put(w.regions, shtuffs);
+
+        // the file cache means the same buffer can show up multiple times
+        size_t region_count = dyn_array_length(w.regions);
+        qsort(w.regions, region_count, sizeof(PrefixRegion), prefix_region_cmp);
+
+        size_t j = 0;
+        for (size_t i = 0; i < region_count; i++) {
+            if (j == 0 || w.regions[j - 1].start != w.regions[i].start) {
+                w.regions[j++] = w.regions[i];
+            }
+        }
+        dyn_array_set_length(w.regions, j);
+        region_count = j;
+
+        DynArray(PrefixDep) deps = dyn_array_create(PrefixDep, region_count);
+        for (size_t i = 0; i < region_count; i++) {
+            PrefixRegion* r = &w.regions[i];
+            r->offset = prefix_put(&w, r->start, r->length, 16, 16);
+
+            if (r->filename != NULL) {
+                // line maps are placed as DynArrays so they can be used directly
+                uint32_t* line_map = PREFIX_PTR(uint32_t*, r->line_map);
+                size_t lines = dyn_array_length(line_map);
+                uint64_t header = prefix_alloc(&w, sizeof(DynArrayHeader) + lines*sizeof(uint32_t), 16);
+                *((DynArrayHeader*) &w.data[header]) = (DynArrayHeader){ lines, lines };
+                memcpy(&w.data[header + sizeof(DynArrayHeader)], line_map, lines*sizeof(uint32_t));
+                r->line_map = header + sizeof(DynArrayHeader);
+
+                PrefixDep dep = { prefix_cstr(&w, r->filename), r->length, tb__murmur3_32(r->start, r->length) };
+                dyn_array_put(deps, dep);
+            }
+        }
+
+        // file entries
+        DynArray(Cuik_FileEntry) files = dyn_array_create(Cuik_FileEntry, file_count);
+        for (size_t i = 1; i < file_count; i++) {
+            Cuik_FileEntry f = s->files[i];
+            PrefixRegion* r = f.content ? prefix_find_region(&w, f.content) : NULL;
+
+            f.filename = PREFIX_PTR(const char*, prefix_cstr(&w, f.filename));
+            f.content = r ? PREFIX_PTR(char*, r->offset + (f.content - r->start)) : NULL;
+            f.line_map = r ? PREFIX_PTR(uint32_t*, r->line_map) : NULL;
+            f.is_cached = true;
+            dyn_array_put(files, f);
+        }
+
+        // macro invocations
+        size_t invoke_count = dyn_array_length(s->invokes);
+        DynArray(MacroInvoke) invokes = dyn_array_create(MacroInvoke, invoke_count);
+        for (size_t i = 1; i < invoke_count; i++) {
+            MacroInvoke m = s->invokes[i];
+            m.name.data = PREFIX_PTR(const unsigned char*, prefix_str(&w, m.name.data, m.name.length));
+            dyn_array_put(invokes, m);
+        }
+
+        // defines
+        size_t cap = 1u << ctx->macros.exp;
+        DynArray(PrefixMacro) macros = dyn_array_create(PrefixMacro, ctx->macros.len);
+        for (size_t i = 0; i < cap; i++) {
+            if (ctx->macros.tags[i] & 0x80) continue;
+
+            PrefixMacro m = { ctx->macros.keys[i], ctx->macros.vals[i] };
+            m.key.data = PREFIX_PTR(const unsigned char*, prefix_str(&w, m.key.data, m.key.length));
+            m.def.value.data = PREFIX_PTR(const unsigned char*, prefix_str(&w, m.def.value.data, m.def.value.length));
+            dyn_array_put(macros, m);
+        }
+
+        // #pragma once and include guards
+        DynArray(uint64_t) once = dyn_array_create(uint64_t, 64);
+        nl_map_for_str(i, ctx->include_once) {
+            NL_Slice k = ctx->include_once[i].k;
+            uint64_t str = prefix_alloc(&w, k.length + 1, 1);
+            memcpy(&w.data[str], k.data, k.length);
+            dyn_array_put(once, str);
+        }
+
+        // tokens (without the EOF)
+        size_t token_count = dyn_array_length(s->list.tokens) - 1;
+        uint64_t tokens = prefix_alloc(&w, token_count * sizeof(Token), 16);
+        for (size_t i = 0; i < token_count; i++) {
+            Token t = s->list.tokens[i];
+            t.content.data = PREFIX_PTR(const unsigned char*, prefix_str(&w, t.content.data, t.content.length));
+            memcpy(&w.data[tokens + i*sizeof(Token)], &t, sizeof(Token));
+        }
+
+        PrefixHeader header = {
+            .magic = PREFIX_MAGIC,
+            .version = PREFIX_VERSION,
+            .token_size = sizeof(Token),
+            .file_size = sizeof(Cuik_FileEntry),
+            .invoke_size = sizeof(MacroInvoke),
+            .unique_counter = ctx->unique_counter,
+            .key = key,
+
+            .dep_count    = dyn_array_length(deps),
+            .file_count   = dyn_array_length(files),
+            .invoke_count = dyn_array_length(invokes),
+            .macro_count  = dyn_array_length(macros),
+            .once_count   = dyn_array_length(once),
+            .token_count  = token_count,
+
+            .deps    = prefix_put(&w, deps, dyn_array_length(deps) * sizeof(PrefixDep), 16, 0),
+            .files   = prefix_put(&w, files, dyn_array_length(files) * sizeof(Cuik_FileEntry), 16, 0),
+            .invokes = prefix_put(&w, invokes, dyn_array_length(invokes) * sizeof(MacroInvoke), 16, 0),
+            .macros  = prefix_put(&w, macros, dyn_array_length(macros) * sizeof(PrefixMacro), 16, 0),
+            .once    = prefix_put(&w, once, dyn_array_length(once) * sizeof(uint64_t), 16, 0),
+            .tokens  = tokens,
+        };
+        memcpy(&w.data[0], &header, sizeof(header));
+
+        dyn_array_destroy(deps);
+        dyn_array_destroy(files);
+        dyn_array_destroy(invokes);
+        dyn_array_destroy(macros);
+        dyn_array_destroy(once);
+        dyn_array_destroy(w.regions);
+    }
+
+    Cuik_Prefix* p = cuik_calloc(1, sizeof(Cuik_Prefix));
+    p->size = dyn_array_length(w.data);
+    p->data = w.data;
+    return p;
+}
+
+bool cuikpp_prefix_save(Cuik_Prefix* p, const char* path) {
+    // write it somewhere else first, that way other builds never see half a file.
+    // the pid keeps two builds saving the same prefix off each other's temp file.
+    char tmp[FILENAME_MAX];
+    snprintf(tmp, FILENAME_MAX, "%s.%d.tmp", path, (int) prefix_pid());
+
+    FILE* file = fopen(tmp, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    bool success = fwrite(p->data, 1, p->size, file) == p->size;
+    fclose(file);
+
+    if (success && rename(tmp, path) != 0) {
+        // windows won't rename over an existing file
+        remove(path);
+        success = rename(tmp, path) == 0;
+    }
+
+    if (!success) {
+        remove(tmp);
+    }
+    return success;
+}
+
+void cuikpp_prefix_free(Cuik_Prefix* p) {
+    if (p->is_mapped) {
+        close_file_map(&p->map);
+    } else {
+        char* data = (char*) p->data;
+        dyn_array_destroy(data);
+    }
+    cuik_free(p);
+}
+
+// the offsets come straight from the file so they all get checked against its
+// size, strings also need the 16 bytes of padding after them.
+static bool prefix_range(Cuik_Prefix* p, uint64_t off, uint64_t count, uint64_t elem) {
+    return off <= p->size && count <= (p->size - off) / elem;
+}
+
+static bool prefix_string(Cuik_Prefix* p, const void* ptr, uint64_t length) {
+    uint64_t off = (uintptr_t) ptr;
+    return off == 0 || (off >= sizeof(PrefixHeader) && length <= UINT64_MAX - 16 && prefix_range(p, off, length + 16, 1));
+}
+
+static bool prefix_cstring(Cuik_Prefix* p, uint64_t off) {
+    return off >= sizeof(PrefixHeader) && off < p->size && memchr(&p->data[off], 0, p->size - off) != NULL;
+}
+
+static bool prefix_line_map(Cuik_Prefix* p, const void* ptr) {
+    uint64_t off = (uintptr_t) ptr;
+    if (off == 0) {
+        return true;
+    }
+
+    if (off < sizeof(PrefixHeader) + sizeof(DynArrayHeader) || off > p->size) {
+        return false;
+    }
+
+    DynArrayHeader arr;
+    memcpy(&arr, &p->data[off - sizeof(DynArrayHeader)], sizeof(arr));
+    return arr.size <= arr.capacity && prefix_range(p, off, arr.size, sizeof(uint32_t));
+}
+
+static bool prefix_is_valid(Cuik_Prefix* p) {
+    const PrefixHeader* header = (const PrefixHeader*) p->data;
+    const char* base = p->data;
+
+    if (!prefix_range(p, header->deps,    header->dep_count,    sizeof(PrefixDep))      ||
+        !prefix_range(p, header->files,   header->file_count,   sizeof(Cuik_FileEntry)) ||
+        !prefix_range(p, header->invokes, header->invoke_count, sizeof(MacroInvoke))    ||
+        !prefix_range(p, header->macros,  header->macro_count,  sizeof(PrefixMacro))    ||
+        !prefix_range(p, header->once,    header->once_count,   sizeof(uint64_t))       ||
+        !prefix_range(p, header->tokens,  header->token_count,  sizeof(Token))) {
+        return false;
+    }
+
+    const PrefixDep* deps = (const PrefixDep*) &base[header->deps];
+    for (size_t i = 0; i < header->dep_count; i++) {
+        if (!prefix_cstring(p, deps[i].path)) return false;
+    }
+
+    const Cuik_FileEntry* files = (const Cuik_FileEntry*) &base[header->files];
+    for (size_t i = 0; i < header->file_count; i++) {
+        uint64_t filename = (uintptr_t) files[i].filename;
+        if ((filename != 0 && !prefix_cstring(p, filename)) ||
+            !prefix_string(p, files[i].content, files[i].content_length) ||
+            !prefix_line_map(p, files[i].line_map)) {
+            return false;
+        }
+    }
+
+    const MacroInvoke* invokes = (const MacroInvoke*) &base[header->invokes];
+    for (size_t i = 0; i < header->invoke_count; i++) {
+        if (!prefix_string(p, invokes[i].name.data, invokes[i].name.length)) return false;
+    }
+
+    const PrefixMacro* macros = (const PrefixMacro*) &base[header->macros];
+    for (size_t i = 0; i < header->macro_count; i++) {
+        if ((uintptr_t) macros[i].key.data == 0 ||
+            !prefix_string(p, macros[i].key.data, macros[i].key.length) ||
+            !prefix_string(p, macros[i].def.value.data, macros[i].def.value.length)) {
+            return false;
+        }
+    }
+
+    const uint64_t* once = (const uint64_t*) &base[header->once];
+    for (size_t i = 0; i < header->once_count; i++) {
+        if (!prefix_cstring(p, once[i])) return false;
+    }
+
+    const Token* tokens = (const Token*) &base[header->tokens];
+    for (size_t i = 0; i < header->token_count; i++) {
+        if (!prefix_string(p, tokens[i].content.data, tokens[i].content.length)) return false;
+    }
+
+    return true;
+}
+
+static bool prefix_is_stale(Cuik_CPP* ctx, Cuik_Prefix* p) {
+    const PrefixHeader* header = (const PrefixHeader*) p->data;
+    const PrefixDep* deps = (const PrefixDep*) &p->data[header->deps];
+
+    for (size_t i = 0; i < header->dep_count; i++) {
+        Cuik_Path path;
+        if (!cuik_path_set(&path, &p->data[deps[i].path])) {
+            return true;
+        }
+
+        Cuik_FileResult file;
+        if (!ctx->fs(ctx->user_data, &path, &file, ctx->case_insensitive)) {
+            return true;
+        }
+
+        bool same = file.length == deps[i].length && tb__murmur3_32(file.data, file.length) == deps[i].hash;
+
+        // the builtin headers aren't ours to free
+        if (!cuik_path_is_in(&path, "$cuik")) {
+            cuik__vfree(file.data, file.length + 17);
+        }
+
+        if (!same) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+Cuik_Prefix* cuikpp_prefix_load(Cuik_CPP* ctx, const char* path) {
+    FileMap map = open_file_map(path);
+    if (map.data == NULL) {
+        return NULL;
+    }
+
+    Cuik_Prefix* p = cuik_calloc(1, sizeof(Cuik_Prefix));
+    p->is_mapped = true;
+    p->map = map;
+    p->size = map.size;
+    p->data = map.data;
+
+    const PrefixHeader* header = (const PrefixHeader*) p->data;
+    if (p->size < sizeof(PrefixHeader) ||
+        header->magic != PREFIX_MAGIC ||
+        header->version != PREFIX_VERSION ||
+        header->token_size != sizeof(Token) ||
+        header->file_size != sizeof(Cuik_FileEntry) ||
+        header->invoke_size != sizeof(MacroInvoke) ||
+        header->key != cuikpp_config_hash(ctx) ||
+        !prefix_is_valid(p) ||
+        prefix_is_stale(ctx, p)) {
+        cuikpp_prefix_free(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+bool cuikpp_prefix_apply(Cuik_CPP* ctx, Cuik_Prefix* p) {
+    TokenStream* s = &ctx->tokens;
+    const PrefixHeader* header = (const PrefixHeader*) p->data;
+    const char* base = p->data;
+
+    // it has to go before anything else
+    assert(dyn_array_length(s->files) == 1 && dyn_array_length(s->invokes) == 1);
+    assert(s->list.tokens == NULL);
+
+    if (header->key != cuikpp_config_hash(ctx)) {
+        return false;
+    }
+
+    CUIK_TIMED_BLOCK("prefix apply") {
+        // the files are the same FileIDs as they were in the prefix, they're
+        // marked as cached so nobody tries to free them.
+        const Cuik_FileEntry* files = (const Cuik_FileEntry*) &base[header->files];
+        for (size_t i = 0; i < header->file_count; i++) {
+            Cuik_FileEntry f = files[i];
+            f.filename = base + (uintptr_t) f.filename;
+            f.content = f.content ? (char*) base + (uintptr_t) f.content : NULL;
+            f.line_map = f.line_map ? (uint32_t*) (base + (uintptr_t) f.line_map) : NULL;
+            dyn_array_put(s->files, f);
+        }
+
+        const MacroInvoke* invokes = (const MacroInvoke*) &base[header->invokes];
+        for (size_t i = 0; i < header->invoke_count; i++) {
+            MacroInvoke m = invokes[i];
+            if (m.name.data) m.name.data = (const unsigned char*) base + (uintptr_t) m.name.data;
+            dyn_array_put(s->invokes, m);
+        }
+
+        // NOTE(NeGate): any tokens in the prefix which used these will have the old
+        // values, that's the same deal you get with any precompiled header.
+        MacroDef volatile_defs[PREFIX_VOLATILE_COUNT];
+        bool volatile_found[PREFIX_VOLATILE_COUNT];
+        for (size_t i = 0; i < PREFIX_VOLATILE_COUNT; i++) {
+            size_t j;
+            const char* name = prefix_volatile_macros[i];
+            volatile_found[i] = find_define_unpadded(ctx, &j, (const unsigned char*) name, strlen(name));
+            if (volatile_found[i]) volatile_defs[i] = ctx->macros.vals[j];
+        }
+
+        // the defines from before the prefix are a subset of the ones after it (undefs aside)
+        size_t exp = MACRO_INIT_EXP;
+        while ((1u << exp) - (1u << exp)/8 <= header->macro_count) exp++;
+
+        macro_table_free(ctx);
+        macro_table_alloc(ctx, exp);
+
+        const PrefixMacro* macros = (const PrefixMacro*) &base[header->macros];
+        for (size_t i = 0; i < header->macro_count; i++) {
+            PrefixMacro m = macros[i];
+            m.key.data = (const unsigned char*) base + (uintptr_t) m.key.data;
+            if (m.def.value.data) m.def.value.data = (const unsigned char*) base + (uintptr_t) m.def.value.data;
+
+            size_t j = insert_symtab(ctx, m.key.length, (const char*) m.key.data);
+            ctx->macros.vals[j] = m.def;
+        }
+
+        for (size_t i = 0; i < PREFIX_VOLATILE_COUNT; i++) {
+            size_t j;
+            const char* name = prefix_volatile_macros[i];
+            if (volatile_found[i] && find_define_unpadded(ctx, &j, (const unsigned char*) name, strlen(name))) {
+                ctx->macros.vals[j] = volatile_defs[i];
+            }
+        }
+
+        const uint64_t* once = (const uint64_t*) &base[header->once];
+        for (size_t i = 0; i < header->once_count; i++) {
+            nl_map_put_cstr(ctx->include_once, &base[once[i]], 0);
+        }
+
+        size_t count = header->token_count;
+        s->list.tokens = dyn_array_create(Token, count + 4096);
+        dyn_array_set_length(s->list.tokens, count);
+
+        const Token* tokens = (const Token*) &base[header->tokens];
+        for (size_t i = 0; i < count; i++) {
+            Token t = tokens[i];
+            if (t.content.data) t.content.data = (const unsigned char*) base + (uintptr_t) t.content.data;
+            s->list.tokens[i] = t;
+        }
+
+        ctx->unique_counter = header->unique_counter;
+    }
+
+    return true;
+}
@@ -1,27 +1,235 @@
+// The macro table is a Swiss-table style open addressing map, every slot has a
+// control byte (the tag) which is either empty, deleted or the top 7 bits of the
+// hash. Probing walks groups of 16 tags at a time so we can check a whole group
+// with one compare and only touch the key array when the tag matches.
+//
+// Most identifiers aren't macros so there's a bloom filter in front of it all,
+// a miss there means we don't even touch the tags.
+enum {
+    MACRO_TAG_EMPTY   = 0x80,
+    MACRO_TAG_DELETED = 0xFE,
+
+    MACRO_GROUP_SIZE = 16,
+    MACRO_INIT_EXP   = 12,
+};
 
-static size_t insert_symtab(Cuik_CPP* ctx, size_t len, const char* key) {
-    uint32_t mask = (1u << ctx->macros.exp) - 1;
-    uint32_t hash = tb__murmur3_32((const unsigned char*) key, len);
-    for (size_t i = hash;;) {
-        // hash table lookup
-        uint32_t step = (hash >> (32 - ctx->macros.exp)) | 1;
-        i = (i + step) & mask;
-
-        String* k = &ctx->macros.keys[i];
-        if (k->length == 0 || k->length == MACRO_DEF_TOMBSTONE) {
-            // empty slot
-            if (ctx->macros.len > mask) {
-                printf("Symbol table: out of memory!\n");
-                abort();
+// 16byte based compare
+// it doesn't need to be aligned but the valid range must be (len + 15) & ~15
+static bool memory_equals16(const unsigned char* src1, const unsigned char* src2, size_t length) {
+    #if !USE_INTRIN
+    return memcmp(src1, src2, length) == 0;
+    #else
+    size_t i = 0;
+    size_t chunk_count = length / 16;
+    while (chunk_count--) {
+        __m128i in1 = _mm_loadu_si128((__m128i*)&src1[i]);
+        __m128i in2 = _mm_loadu_si128((__m128i*)&src2[i]);
+
+        int compare = _mm_movemask_epi8(_mm_cmpeq_epi8(in1, in2));
+        if (compare != 0xFFFF) return false;
+
+        i += 16;
+    }
+
+    if (length % 16 == 0) {
+        return true;
+    }
+
+    uint16_t mask = 0xFFFF << (length % 16);
+    __m128i in1 = _mm_loadu_si128((__m128i*)&src1[i]);
+    __m128i in2 = _mm_loadu_si128((__m128i*)&src2[i]);
+
+    uint16_t compare = _mm_movemask_epi8(_mm_cmpeq_epi8(in1, in2));
+    return (compare | mask) == 0xFFFF;
+    #endif
+}
+
+// bit i is set if tags[i] == tag
+static uint32_t macro_group_match(const uint8_t* tags, uint8_t tag) {
+    #if USE_INTRIN
+    __m128i group = _mm_loadu_si128((const __m128i*) tags);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+    #else
+    uint32_t bits = 0;
+    for (int i = 0; i < MACRO_GROUP_SIZE; i++) {
+        bits |= (tags[i] == tag) << i;
+    }
+    return bits;
+    #endif
+}
+
+// bit i is set if tags[i] is empty or deleted
+static uint32_t macro_group_free(const uint8_t* tags) {
+    #if USE_INTRIN
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) tags));
+    #else
+    uint32_t bits = 0;
+    for (int i = 0; i < MACRO_GROUP_SIZE; i++) {
+        bits |= (tags[i] >> 7) << i;
+    }
+    return bits;
+    #endif
+}
+
+static uint8_t macro_tag(uint32_t hash) {
+    return hash >> 25;
+}
+
+// the bloom filter has 8 bits per slot and we set 2 per macro
+static uint64_t macro_bloom_bits(Cuik_CPP* restrict ctx, uint32_t hash) {
+    uint64_t h = hash * 0x9E3779B97F4A7C15ull;
+    size_t bits = ctx->macros.exp + 3;
+    return (h >> (64 - bits)) | (((h >> 7) & ((1ull << bits) - 1)) << 32);
+}
+
+static void macro_bloom_add(Cuik_CPP* restrict ctx, uint32_t hash) {
+    uint64_t b = macro_bloom_bits(ctx, hash);
+    uint32_t b1 = b & 0xFFFFFFFF, b2 = b >> 32;
+    ctx->macros.bloom[b1 / 64] |= 1ull << (b1 % 64);
+    ctx->macros.bloom[b2 / 64] |= 1ull << (b2 % 64);
+}
+
+static bool macro_bloom_test(Cuik_CPP* restrict ctx, uint32_t hash) {
+    uint64_t b = macro_bloom_bits(ctx, hash);
+    uint32_t b1 = b & 0xFFFFFFFF, b2 = b >> 32;
+    return (ctx->macros.bloom[b1 / 64] >> (b1 % 64)) & (ctx->macros.bloom[b2 / 64] >> (b2 % 64)) & 1;
+}
+
+static void macro_table_alloc(Cuik_CPP* restrict ctx, size_t exp) {
+    size_t cap = 1u << exp;
+    ctx->macros.exp = exp;
+    ctx->macros.len = 0;
+    ctx->macros.tombs = 0;
+    ctx->macros.tags = cuik__valloc(cap);
+    ctx->macros.bloom = cuik__valloc(cap);
+    ctx->macros.keys = cuik__valloc(cap * sizeof(String));
+    ctx->macros.vals = cuik__valloc(cap * sizeof(MacroDef));
+    memset(ctx->macros.tags, MACRO_TAG_EMPTY, cap);
+}
+
+static void macro_table_free(Cuik_CPP* restrict ctx) {
+    size_t cap = 1u << ctx->macros.exp;
+    cuik__vfree(ctx->macros.tags, cap);
+    cuik__vfree(ctx->macros.bloom, cap);
+    cuik__vfree(ctx->macros.keys, cap * sizeof(String));
+    cuik__vfree(ctx->macros.vals, cap * sizeof(MacroDef));
+
+    ctx->macros.tags = NULL;
+    ctx->macros.bloom = NULL;
+    ctx->macros.keys = NULL;
+    ctx->macros.vals = NULL;
+}
+
+// padded means both strings can be read up to (len + 15) & ~15, it's true for
+// anything coming out of the lexer but not for the cstr API.
+static ptrdiff_t macro_find(Cuik_CPP* restrict ctx, uint32_t hash, const unsigned char* key, size_t len, bool padded) {
+    if (!macro_bloom_test(ctx, hash)) {
+        return -1;
+    }
+
+    uint8_t tag = macro_tag(hash);
+    size_t gmask = ((1u << ctx->macros.exp) / MACRO_GROUP_SIZE) - 1;
+    size_t g = hash & gmask;
+    for (size_t step = 1;; step++) {
+        const uint8_t* tags = &ctx->macros.tags[g * MACRO_GROUP_SIZE];
+
+        uint32_t bits = macro_group_match(tags, tag);
+        while (bits) {
+            size_t i = g*MACRO_GROUP_SIZE + __builtin_ctz(bits);
+            String* k = &ctx->macros.keys[i];
+            if (k->length == len && (padded ? memory_equals16(key, k->data, len) : memcmp(key, k->data, len) == 0)) {
+                return i;
             }
+            bits &= bits - 1;
+        }
 
-            ctx->macros.len++;
-            ctx->macros.keys[i] = (String){ len, (const unsigned char*) key };
-            return i;
-        } else if (len == k->length && memcmp(key, k->data, len) == 0) {
+        // any empty slot in the group means the key would've been placed here
+        if (macro_group_match(tags, MACRO_TAG_EMPTY)) {
+            return -1;
+        }
+
+        // triangular probing, visits every group since the count is a power of two
+        g = (g + step) & gmask;
+    }
+}
+
+// doesn't check for duplicates
+static size_t macro_insert_slot(Cuik_CPP* restrict ctx, uint32_t hash) {
+    size_t gmask = ((1u << ctx->macros.exp) / MACRO_GROUP_SIZE) - 1;
+    size_t g = hash & gmask;
+    for (size_t step = 1;; step++) {
+        uint32_t bits = macro_group_free(&ctx->macros.tags[g * MACRO_GROUP_SIZE]);
+        if (bits) {
+            size_t i = g*MACRO_GROUP_SIZE + __builtin_ctz(bits);
+            if (ctx->macros.tags[i] == MACRO_TAG_DELETED) {
+                ctx->macros.tombs--;
+            }
+
+            ctx->macros.tags[i] = macro_tag(hash);
+            macro_bloom_add(ctx, hash);
             return i;
         }
+
+        g = (g + step) & gmask;
+    }
+}
+
+static void macro_table_grow(Cuik_CPP* restrict ctx) {
+    size_t old_cap = 1u << ctx->macros.exp;
+    uint8_t* old_tags = ctx->macros.tags;
+    uint64_t* old_bloom = ctx->macros.bloom;
+    String* old_keys = ctx->macros.keys;
+    MacroDef* old_vals = ctx->macros.vals;
+    size_t len = ctx->macros.len;
+
+    // if it's mostly tombstones we just rehash at the same size
+    size_t exp = ctx->macros.exp;
+    if (len >= old_cap / 2) {
+        exp += 1;
+    }
+
+    macro_table_alloc(ctx, exp);
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old_tags[i] & 0x80) {
+            continue;
+        }
+
+        // NOTE(NeGate): hidden macros don't know their length, we shouldn't
+        // be defining anything mid-expansion anyways.
+        String k = old_keys[i];
+        assert(k.length != MACRO_DEF_TOMBSTONE && "can't grow the macro table while expanding");
+
+        size_t j = macro_insert_slot(ctx, tb__murmur3_32(k.data, k.length));
+        ctx->macros.keys[j] = k;
+        ctx->macros.vals[j] = old_vals[i];
+    }
+    ctx->macros.len = len;
+
+    cuik__vfree(old_tags, old_cap);
+    cuik__vfree(old_bloom, old_cap);
+    cuik__vfree(old_keys, old_cap * sizeof(String));
+    cuik__vfree(old_vals, old_cap * sizeof(MacroDef));
+}
+
+static size_t insert_symtab(Cuik_CPP* ctx, size_t len, const char* key) {
+    uint32_t hash = tb__murmur3_32((const unsigned char*) key, len);
+    ptrdiff_t search = macro_find(ctx, hash, (const unsigned char*) key, len, false);
+    if (search >= 0) {
+        // redefinition, the key might have different params
+        ctx->macros.keys[search].data = (const unsigned char*) key;
+        return search;
+    }
+
+    // keep the load under 7/8 (including tombstones)
+    size_t cap = 1u << ctx->macros.exp;
+    if (ctx->macros.len + ctx->macros.tombs + 1 > cap - cap/8) {
+        macro_table_grow(ctx);
     }
+
+    size_t i = macro_insert_slot(ctx, hash);
+    ctx->macros.len++;
+    ctx->macros.keys[i] = (String){ len, (const unsigned char*) key };
+    return i;
 }
 
 void cuikpp_define_empty_cstr(Cuik_CPP* ctx, const char* key) {
@@ -85,53 +293,18 @@ bool cuikpp_undef_cstr(Cuik_CPP* ctx, const char* key) {
 }
 
 bool cuikpp_undef(Cuik_CPP* ctx, size_t keylen, const char* key) {
-    uint32_t mask = (1u << ctx->macros.exp) - 1;
     uint32_t hash = tb__murmur3_32(key, keylen);
-    for (size_t i = hash;;) {
-        // hash table lookup
-        uint32_t step = (hash >> (32 - ctx->macros.exp)) | 1;
-        i = (i + step) & mask;
-
-        String* k = &ctx->macros.keys[i];
-        if (k->length == MACRO_DEF_TOMBSTONE) {
-            continue;
-        } else if (k->length == 0) {
-            break;
-        } else if (keylen == k->length && memcmp(key, k->data, keylen) == 0) {
-            ctx->macros.len--;
-            ctx->macros.keys[i] = (String){ MACRO_DEF_TOMBSTONE, 0 };
-            return true;
-        }
-    }
-
-    return false;
-}
-
-// 16byte based compare
-// it doesn't need to be aligned but the valid range must be (len + 15) & ~15
-static bool memory_equals16(const unsigned char* src1, const unsigned char* src2, size_t length) {
-    #if !USE_INTRIN
-    return memcmp(src1, src2, length) == 0;
-    #else
-    size_t i = 0;
-    size_t chunk_count = length / 16;
-    while (chunk_count--) {
-        __m128i in1 = _mm_loadu_si128((__m128i*)&src1[i]);
-        __m128i in2 = _mm_loadu_si128((__m128i*)&src2[i]);
-
-        int compare = _mm_movemask_epi8(_mm_cmpeq_epi8(in1, in2));
-        if (compare != 0xFFFF) return false;
-
-        i += 16;
+    ptrdiff_t i = macro_find(ctx, hash, (const unsigned char*) key, keylen, false);
+    if (i < 0) {
+        return false;
     }
 
-    uint16_t mask = 0xFFFF << (length % 16);
-    __m128i in1 = _mm_loadu_si128((__m128i*)&src1[i]);
-    __m128i in2 = _mm_loadu_si128((__m128i*)&src2[i]);
-
-    uint16_t compare = _mm_movemask_epi8(_mm_cmpeq_epi8(in1, in2));
-    return (compare | mask) == 0xFFFF;
-    #endif
+    // NOTE(NeGate): the bloom filter can't forget, it'll just be a false positive
+    ctx->macros.len--;
+    ctx->macros.tombs++;
+    ctx->macros.tags[i] = MACRO_TAG_DELETED;
+    ctx->macros.keys[i] = (String){ 0 };
+    return true;
 }
 
 static bool find_define(Cuik_CPP* restrict ctx, size_t* out_index, const unsigned char* start, size_t length) {
@@ -139,22 +312,10 @@ static bool find_define(Cuik_CPP* restrict ctx, size_t* out_index, const unsigne
     uint64_t start_ns = cuik_time_in_nanos();
     #endif
 
-    bool found = false;
-    uint32_t mask = (1u << ctx->macros.exp) - 1;
-    uint32_t hash = tb__murmur3_32(start, length);
-    for (size_t i = hash;;) {
-        // hash table lookup
-        uint32_t step = (hash >> (32 - ctx->macros.exp)) | 1;
-        i = (i + step) & mask;
-
-        String* k = &ctx->macros.keys[i];
-        if (k->length == 0) {
-            break;
-        } else if (length == k->length && memcmp(start, k->data, length) == 0) {
-            *out_index = i;
-            found = true;
-            break;
-        }
+    // everything coming from the lexer is padded
+    ptrdiff_t search = macro_find(ctx, tb__murmur3_32(start, length), start, length, true);
+    if (search >= 0) {
+        *out_index = search;
     }
 
     #if CUIK__CPP_STATS
@@ -162,12 +323,20 @@ static bool find_define(Cuik_CPP* restrict ctx, size_t* out_index, const unsigne
     ctx->total_define_access_time += (end_ns - start_ns);
     ctx->total_define_accesses += 1;
     #endif
-    return found;
+    return search >= 0;
+}
+
+static bool find_define_unpadded(Cuik_CPP* restrict ctx, size_t* out_index, const unsigned char* start, size_t length) {
+    ptrdiff_t search = macro_find(ctx, tb__murmur3_32(start, length), start, length, false);
+    if (search >= 0) {
+        *out_index = search;
+    }
+    return search >= 0;
 }
 
 bool cuikpp_find_define_cstr(Cuik_CPP* restrict ctx, Cuik_DefineIter* out_ref, const char* key) {
     size_t def_i;
-    if (!find_define(ctx, &def_i, (const unsigned char*) key, strlen(key))) {
+    if (!find_define_unpadded(ctx, &def_i, (const unsigned char*) key, strlen(key))) {
         return false;
     }
 
@@ -179,7 +348,7 @@ bool cuikpp_find_define_cstr(Cuik_CPP* restrict ctx, Cuik_DefineIter* out_ref, c
 
 bool cuikpp_find_define(Cuik_CPP* restrict ctx, Cuik_DefineIter* out_ref, size_t keylen, const char key[]) {
     size_t def_i;
-    if (!find_define(ctx, &def_i, (const unsigned char*) key, keylen)) {
+    if (!find_define_unpadded(ctx, &def_i, (const unsigned char*) key, keylen)) {
         return false;
     }
 
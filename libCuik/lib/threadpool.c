@@ -22,10 +22,9 @@ extern void spallperf__start_thread(void);
 extern void spallperf__stop_thread(void);
 #endif
 
-// 1 << QEXP is the size of the queue per pool
+// 1 << QEXP is the starting size of each worker's deque, they grow as needed
 #define QEXP 7
 
-typedef _Atomic uint32_t atomic_uint32_t;
 typedef void work_routine(void*);
 
 typedef struct {
@@ -33,21 +32,66 @@ typedef struct {
     char arg[56];
 } work_t;
 
+// Work-stealing deques, every worker owns one and pushes/pops from the bottom (LIFO)
+// while everyone else steals from the top (FIFO).
+//
 // Inspired by:
-//   https://github.com/skeeto/scratch/blob/master/misc/queue.c
+//   Correct and Efficient Work-Stealing for Weak Memory Models (Lê et al. 2013)
+//   https://fzn.fr/readings/ppopp13.pdf
+typedef struct WorkRing WorkRing;
+struct WorkRing {
+    // rings are never freed while the pool is alive because a thief might
+    // still be reading from an old one, we just chain them up.
+    WorkRing* prev;
+
+    int64_t mask;
+    work_t items[];
+};
+
+typedef struct {
+    _Alignas(64) _Atomic(int64_t) top;
+    _Alignas(64) _Atomic(int64_t) bottom;
+    _Atomic(WorkRing*) ring;
+} WorkDeque;
+
+typedef enum {
+    STEAL_OK, STEAL_EMPTY, STEAL_ABORT
+} StealResult;
+
+// only tracked with -T, each thread writes to its own slot
+typedef struct {
+    _Alignas(64) uint64_t start, end;
+    uint64_t busy;
+    size_t jobs, steals;
+} WorkerStats;
+
 typedef struct {
     Cuik_IThreadpool super;
 
     atomic_bool running;
 
-    // this skeeto guy is kinda sick wit it
-    atomic_uint32_t queue;
-    atomic_uint32_t jobs_done;
+    // number of jobs submitted but not finished
+    _Atomic int64_t jobs_done;
+    // number of workers napping on the semaphore
+    _Atomic int sleeping;
+
+    // thread_count + 1 entries, NULL if we're not profiling
+    WorkerStats* stats;
 
     int thread_count;
-    work_t* work;
     thrd_t* threads;
 
+    // thread_count + 1 deques, the last one belongs to the thread
+    // which made the pool (usually the main thread).
+    WorkDeque* queues;
+
+    // anyone else who isn't part of the pool submits here, it's
+    // rare enough that a lock is fine.
+    mtx_t inject_lock;
+    _Atomic size_t inject_head, inject_tail;
+    size_t inject_cap;
+    work_t* inject;
+
     #ifdef _WIN32
     HANDLE sem;
     #else
@@ -55,38 +99,210 @@ typedef struct {
     #endif
 } threadpool_t;
 
-static work_t* ask_for_work(threadpool_t* threadpool, uint32_t* save) {
-    uint32_t r = *save = threadpool->queue;
-    uint32_t mask = (1u << QEXP) - 1;
-    uint32_t head = r & mask;
-    uint32_t tail = (r >> 16) & mask;
+typedef struct {
+    threadpool_t* tp;
+    int index;
+} WorkerStart;
+
+static thread_local threadpool_t* worker_pool;
+static thread_local int worker_index;
+static thread_local uint32_t worker_rng;
 
-    return head != tail ? &threadpool->work[tail] : NULL;
+static int get_worker_index(threadpool_t* tp) {
+    return worker_pool == tp ? worker_index : -1;
 }
 
-static bool do_work(threadpool_t* threadpool) {
-    uint32_t save;
-    work_t* job = NULL;
-    work_t tmp;
-
-    do {
-        job = ask_for_work(threadpool, &save);
-        if (job == NULL) {
-            // take a nap if we ain't find shit
+static WorkRing* ring_alloc(int64_t cap) {
+    WorkRing* r = cuik_malloc(sizeof(WorkRing) + cap * sizeof(work_t));
+    r->prev = NULL;
+    r->mask = cap - 1;
+    return r;
+}
+
+static void deque_push(WorkDeque* q, const work_t* w) {
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    WorkRing* r = atomic_load_explicit(&q->ring, memory_order_relaxed);
+
+    if (b - t > r->mask) {
+        // it don't fit... double the ring
+        WorkRing* new_r = ring_alloc((r->mask + 1) * 2);
+        for (int64_t i = t; i < b; i++) {
+            new_r->items[i & new_r->mask] = r->items[i & r->mask];
+        }
+
+        new_r->prev = r;
+        atomic_store_explicit(&q->ring, new_r, memory_order_release);
+        r = new_r;
+    }
+
+    r->items[b & r->mask] = *w;
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+}
+
+static bool deque_pop(WorkDeque* q, work_t* out) {
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+    WorkRing* r = atomic_load_explicit(&q->ring, memory_order_relaxed);
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+    if (t > b) {
+        // empty
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return false;
+    }
+
+    *out = r->items[b & r->mask];
+    if (t == b) {
+        // last item, race the thieves for it
+        bool won = atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return won;
+    }
+
+    return true;
+}
+
+static StealResult deque_steal(WorkDeque* q, work_t* out) {
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+    if (t >= b) {
+        return STEAL_EMPTY;
+    }
+
+    // copy out before we commit, if the CAS fails it might've been garbage
+    WorkRing* r = atomic_load_explicit(&q->ring, memory_order_acquire);
+    *out = r->items[t & r->mask];
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return STEAL_ABORT;
+    }
+
+    return STEAL_OK;
+}
+
+static bool deque_is_empty(WorkDeque* q) {
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+    return t >= b;
+}
+
+static void inject_push(threadpool_t* tp, const work_t* w) {
+    mtx_lock(&tp->inject_lock);
+    if (tp->inject_tail - tp->inject_head >= tp->inject_cap) {
+        size_t new_cap = tp->inject_cap * 2;
+        work_t* new_inject = cuik_malloc(new_cap * sizeof(work_t));
+        for (size_t i = tp->inject_head; i < tp->inject_tail; i++) {
+            new_inject[i & (new_cap - 1)] = tp->inject[i & (tp->inject_cap - 1)];
+        }
+
+        cuik_free(tp->inject);
+        tp->inject = new_inject;
+        tp->inject_cap = new_cap;
+    }
+
+    tp->inject[tp->inject_tail++ & (tp->inject_cap - 1)] = *w;
+    mtx_unlock(&tp->inject_lock);
+}
+
+static bool inject_pop(threadpool_t* tp, work_t* out) {
+    // peek before locking, this is usually empty
+    if (tp->inject_head == tp->inject_tail) {
+        return false;
+    }
+
+    bool found = false;
+    mtx_lock(&tp->inject_lock);
+    if (tp->inject_head != tp->inject_tail) {
+        *out = tp->inject[tp->inject_head++ & (tp->inject_cap - 1)];
+        found = true;
+    }
+    mtx_unlock(&tp->inject_lock);
+    return found;
+}
+
+static bool has_work(threadpool_t* tp) {
+    for (int i = 0; i <= tp->thread_count; i++) {
+        if (!deque_is_empty(&tp->queues[i])) return true;
+    }
+
+    mtx_lock(&tp->inject_lock);
+    bool result = tp->inject_head != tp->inject_tail;
+    mtx_unlock(&tp->inject_lock);
+    return result;
+}
+
+static bool find_work(threadpool_t* tp, int self, work_t* out) {
+    // our own work is the hottest in cache
+    if (self >= 0 && deque_pop(&tp->queues[self], out)) {
+        return true;
+    }
+
+    if (inject_pop(tp, out)) {
+        return true;
+    }
+
+    // go steal from a random victim, the xorshift state is per thread so
+    // we don't all end up picking on the same poor guy.
+    uint32_t x = worker_rng ? worker_rng : (uint32_t) (uintptr_t) &x | 1;
+    x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+    worker_rng = x;
+
+    int n = tp->thread_count + 1;
+    int start = x % n;
+    for (int i = 0; i < n; i++) {
+        int victim = (start + i) % n;
+        if (victim == self) continue;
+
+        StealResult r;
+        while ((r = deque_steal(&tp->queues[victim], out)) == STEAL_ABORT) {
+            // contention, just try again
+        }
+
+        if (r == STEAL_OK) {
+            if (self >= 0 && tp->stats) tp->stats[self].steals += 1;
             return true;
         }
+    }
+
+    return false;
+}
 
-        // copy out before we commit
-        tmp = *job;
-    } while (!atomic_compare_exchange_strong(&threadpool->queue, &save, save + 0x10000));
+// returns true if it didn't find any work
+static bool do_work(threadpool_t* threadpool) {
+    work_t job;
+    int self = get_worker_index(threadpool);
+    if (!find_work(threadpool, self, &job)) {
+        // take a nap if we ain't find shit
+        return true;
+    }
 
-    tmp.fn(tmp.arg);
+    if (self >= 0 && threadpool->stats) {
+        uint64_t t = cuik_time_in_nanos();
+        job.fn(job.arg);
+
+        WorkerStats* stats = &threadpool->stats[self];
+        stats->busy += cuik_time_in_nanos() - t;
+        stats->jobs += 1;
+    } else {
+        job.fn(job.arg);
+    }
     threadpool->jobs_done -= 1;
     return false;
 }
 
 static int thread_func(void* arg) {
-    threadpool_t* threadpool = arg;
+    WorkerStart start = *(WorkerStart*) arg;
+    cuik_free(arg);
+
+    threadpool_t* threadpool = start.tp;
+    worker_pool = threadpool;
+    worker_index = start.index;
+    if (threadpool->stats) {
+        threadpool->stats[start.index].start = cuik_time_in_nanos();
+    }
 
     #ifdef CUIK_USE_CUIK
     spallperf__start_thread();
@@ -94,14 +310,27 @@ static int thread_func(void* arg) {
 
     while (threadpool->running) {
         if (do_work(threadpool)) {
-            #ifdef _WIN32
-            WaitForSingleObjectEx(threadpool->sem, -1, false); // wait for jobs
-            #else
-            sem_wait(&threadpool->sem);
-            #endif
+            // announce we're sleeping and then check one last time, submitters
+            // only wake us if they see us sleeping so this order matters.
+            threadpool->sleeping += 1;
+            atomic_thread_fence(memory_order_seq_cst);
+
+            if (threadpool->running && !has_work(threadpool)) {
+                #ifdef _WIN32
+                WaitForSingleObjectEx(threadpool->sem, -1, false); // wait for jobs
+                #else
+                sem_wait(&threadpool->sem);
+                #endif
+            }
+
+            threadpool->sleeping -= 1;
         }
     }
 
+    if (threadpool->stats) {
+        threadpool->stats[start.index].end = cuik_time_in_nanos();
+    }
+
     #ifdef CUIK_USE_CUIK
     spallperf__stop_thread();
     // tb_free_thread_resources();
@@ -112,42 +341,33 @@ static int thread_func(void* arg) {
 }
 
 void threadpool_submit(threadpool_t* threadpool, work_routine fn, size_t arg_size, void* arg) {
-    ptrdiff_t i = 0;
-    for (;;) {
-        // might wanna change the memory order on this atomic op
-        uint32_t r = threadpool->queue;
-
-        uint32_t mask = (1u << QEXP) - 1;
-        uint32_t head = r & mask;
-        uint32_t tail = (r >> 16) & mask;
-        uint32_t next = (head + 1u) & mask;
-        if (r & 0x8000) { // avoid overflow on commit
-            threadpool->queue &= ~0x8000;
-        }
-
-        // it don't fit...
-        if (next != tail) {
-            i = head;
-            break;
-        }
-    }
-
-    assert(arg_size <= sizeof(threadpool->work[i].arg));
-    threadpool->work[i].fn = fn;
-    memcpy(threadpool->work[i].arg, arg, arg_size);
+    work_t w;
+    assert(arg_size <= sizeof(w.arg));
+    w.fn = fn;
+    memcpy(w.arg, arg, arg_size);
 
     threadpool->jobs_done += 1;
-    threadpool->queue += 1;
 
-    #ifdef _WIN32
-    ReleaseSemaphore(threadpool->sem, 1, 0);
-    #else
-    sem_post(&threadpool->sem);
-    #endif
+    int self = get_worker_index(threadpool);
+    if (self >= 0) {
+        deque_push(&threadpool->queues[self], &w);
+    } else {
+        inject_push(threadpool, &w);
+    }
+
+    // only bother with the syscall if someone's actually asleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (threadpool->sleeping > 0) {
+        #ifdef _WIN32
+        ReleaseSemaphore(threadpool->sem, 1, 0);
+        #else
+        sem_post(&threadpool->sem);
+        #endif
+    }
 }
 
-void threadpool_work_one_job(threadpool_t* threadpool) {
-    do_work(threadpool);
+bool threadpool_work_one_job(threadpool_t* threadpool) {
+    return !do_work(threadpool);
 }
 
 void threadpool_work_while_wait(threadpool_t* threadpool) {
@@ -175,8 +395,36 @@ static void threadpool__submit(void* user_data, Cuik_TaskFn fn, size_t arg_size,
     threadpool_submit(user_data, fn, arg_size, arg);
 }
 
-static void threadpool__work_one_job(void* user_data) {
-    threadpool_work_one_job(user_data);
+static bool threadpool__work_one_job(void* user_data) {
+    return threadpool_work_one_job(user_data);
+}
+
+static void print_worker_stats(threadpool_t* tp) {
+    printf("\nthreadpool: %d workers\n", tp->thread_count);
+    printf("  thread    busy (ms)   idle (ms)   busy%%   jobs   steals\n");
+
+    uint64_t total_busy = 0, total_time = 0;
+    for (int i = 0; i <= tp->thread_count; i++) {
+        WorkerStats* stats = &tp->stats[i];
+        uint64_t lifetime = stats->end - stats->start;
+        uint64_t idle = lifetime > stats->busy ? lifetime - stats->busy : 0;
+
+        // the creator only works while it's helping out, the rest is
+        // just it doing its own thing so "idle" is a bit of a misnomer
+        if (i == tp->thread_count) {
+            printf("  main  ");
+        } else {
+            printf("  %-6d", i);
+            total_busy += stats->busy, total_time += lifetime;
+        }
+
+        printf("  %10.3f  %10.3f  %5.1f%%  %5zu  %7zu\n",
+            stats->busy / 1000000.0, idle / 1000000.0,
+            lifetime ? (stats->busy * 100.0) / lifetime : 0.0,
+            stats->jobs, stats->steals);
+    }
+
+    printf("  workers were busy %.1f%% of the time\n", total_time ? (total_busy * 100.0) / total_time : 0.0);
 }
 
 Cuik_IThreadpool* cuik_threadpool_create(int worker_count) {
@@ -188,22 +436,45 @@ Cuik_IThreadpool* cuik_threadpool_create(int worker_count) {
     threadpool_t* tp = cuik_calloc(1, sizeof(threadpool_t));
     tp->super.submit = threadpool__submit;
     tp->super.work_one_job = threadpool__work_one_job;
-    tp->work = cuik_malloc(workqueue_size * sizeof(work_t));
     tp->threads = cuik_malloc(worker_count * sizeof(thrd_t));
     tp->thread_count = worker_count;
     tp->running = true;
 
+    tp->queues = cuik__valloc((worker_count + 1) * sizeof(WorkDeque));
+    for (int i = 0; i <= worker_count; i++) {
+        atomic_init(&tp->queues[i].top, 0);
+        atomic_init(&tp->queues[i].bottom, 0);
+        atomic_init(&tp->queues[i].ring, ring_alloc(workqueue_size));
+    }
+
+    mtx_init(&tp->inject_lock, mtx_plain);
+    tp->inject_cap = workqueue_size;
+    tp->inject = cuik_malloc(workqueue_size * sizeof(work_t));
+
+    // the creator gets the spare deque
+    worker_pool = tp;
+    worker_index = worker_count;
+
+    if (cuikperf_is_active()) {
+        tp->stats = cuik__valloc((worker_count + 1) * sizeof(WorkerStats));
+        memset(tp->stats, 0, (worker_count + 1) * sizeof(WorkerStats));
+        tp->stats[worker_count].start = cuik_time_in_nanos();
+    }
+
     #if _WIN32
-    tp->sem = CreateSemaphoreExA(0, worker_count, worker_count, 0, 0, SEMAPHORE_ALL_ACCESS);
+    tp->sem = CreateSemaphoreExA(0, 0, worker_count, 0, 0, SEMAPHORE_ALL_ACCESS);
     #else
-    if (sem_init(&tp->sem, 0 /* shared between threads */, worker_count) != 0) {
+    if (sem_init(&tp->sem, 0 /* shared between threads */, 0) != 0) {
         fprintf(stderr, "error: could not create semaphore!\n");
         return NULL;
     }
     #endif
 
     for (int i = 0; i < worker_count; i++) {
-        if (thrd_create(&tp->threads[i], thread_func, tp) != thrd_success) {
+        WorkerStart* start = cuik_malloc(sizeof(WorkerStart));
+        *start = (WorkerStart){ tp, i };
+
+        if (thrd_create(&tp->threads[i], thread_func, start) != thrd_success) {
             fprintf(stderr, "error: could not create worker threads!\n");
             return NULL;
         }
@@ -241,7 +512,28 @@ void cuik_threadpool_destroy(Cuik_IThreadpool* thread_pool) {
     sem_destroy(&tp->sem);
     #endif
 
+    if (tp->stats) {
+        tp->stats[tp->thread_count].end = cuik_time_in_nanos();
+        print_worker_stats(tp);
+        cuik__vfree(tp->stats, (tp->thread_count + 1) * sizeof(WorkerStats));
+    }
+
+    for (int i = 0; i <= tp->thread_count; i++) {
+        WorkRing* r = tp->queues[i].ring;
+        while (r != NULL) {
+            WorkRing* prev = r->prev;
+            cuik_free(r);
+            r = prev;
+        }
+    }
+
+    if (worker_pool == tp) {
+        worker_pool = NULL;
+    }
+
+    mtx_destroy(&tp->inject_lock);
+    cuik__vfree(tp->queues, (tp->thread_count + 1) * sizeof(WorkDeque));
+    cuik_free(tp->inject);
     cuik_free(tp->threads);
-    cuik_free(tp->work);
     cuik_free(tp);
 }
@@ -1,7 +1,43 @@
+// Watches files for the live compiler, the changed list hands back the same
+// strings which were passed to live_compile_add.
 typedef struct {
-    uint64_t og_last_write;
+    // DynArray(char*) everything we're watching
+    char** files;
+    // DynArray(const char*) the files which changed in the last live_compile_wait,
+    // they point into files.
+    const char** changed;
+
+    #if _WIN32
+    // DynArray(uint64_t) parallel to files
+    uint64_t* last_write;
+    #else
+    // DynArray(char*) parallel to files, the events come back as real paths
+    // so that's what we compare against.
+    char** real_paths;
+
+    // inotify watches directories, this maps the watch descriptors back
+    // to the directory names.
+    int fd;
+    struct LiveDir { int wd; char* path; }* dirs;
+    #endif
 } LiveCompiler;
 
+static ptrdiff_t live_find_file(LiveCompiler* l, const char* path) {
+    dyn_array_for(i, l->files) {
+        if (strcmp(l->files[i], path) == 0) return i;
+    }
+
+    return -1;
+}
+
+static void live_mark_changed(LiveCompiler* l, ptrdiff_t i) {
+    dyn_array_for(j, l->changed) {
+        if (l->changed[j] == l->files[i]) return;
+    }
+
+    dyn_array_put(l->changed, l->files[i]);
+}
+
 #if _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -9,6 +45,9 @@ typedef struct {
 static uint64_t get_last_write_time(const char* filepath) {
     WIN32_FIND_DATA data;
     HANDLE handle = FindFirstFile(filepath, &data);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
 
     ULARGE_INTEGER i;
     i.LowPart = data.ftLastWriteTime.dwLowDateTime;
@@ -18,36 +57,179 @@ static uint64_t get_last_write_time(const char* filepath) {
     return i.QuadPart;
 }
 
-// returns false if no changes are made, true if the file is ready to be reloaded
-static bool live_compile_watch(LiveCompiler* l, const char* source_file) {
+static void live_compile_init(LiveCompiler* l) {
+    l->files = dyn_array_create(char*, 16);
+    l->changed = dyn_array_create(const char*, 16);
+    l->last_write = dyn_array_create(uint64_t, 16);
+}
+
+static void live_compile_add(LiveCompiler* l, const char* path) {
+    if (live_find_file(l, path) >= 0) return;
+
+    dyn_array_put(l->files, cuik_strdup(path));
+    dyn_array_put(l->last_write, get_last_write_time(path));
+}
+
+// blocks until some of the files are saved, returns how many changed (0 on failure)
+static size_t live_compile_wait(LiveCompiler* l) {
+    dyn_array_clear(l->changed);
+
     // Wait for the user to save again
-    uint64_t current_last_write;
-    if (current_last_write = get_last_write_time(source_file), l->og_last_write == current_last_write) {
-        return false;
-    }
+    while (dyn_array_length(l->changed) == 0) {
+        SleepEx(50, FALSE);
 
-    l->og_last_write = current_last_write;
+        dyn_array_for(i, l->files) {
+            uint64_t current_last_write = get_last_write_time(l->files[i]);
+            if (current_last_write != l->last_write[i]) {
+                l->last_write[i] = current_last_write;
+                live_mark_changed(l, i);
+            }
+        }
+    }
 
     // wait for it to finish writing before trying to compile
-    int ticks = 0;
-    while (GetFileAttributesA(source_file) == INVALID_FILE_ATTRIBUTES) {
-        SleepEx(1, FALSE);
+    dyn_array_for(i, l->changed) {
+        int ticks = 0;
+        while (GetFileAttributesA(l->changed[i]) == INVALID_FILE_ATTRIBUTES) {
+            SleepEx(1, FALSE);
 
-        if (ticks++ > 100) {
-            printf("live-compiler error: file locked (tried multiple times)\n");
-            return false;
+            if (ticks++ > 100) {
+                printf("live-compiler error: file locked (tried multiple times)\n");
+                return 0;
+            }
         }
     }
 
-    return true;
+    return dyn_array_length(l->changed);
+}
+
+static void live_compile_free(LiveCompiler* l) {
+    dyn_array_for(i, l->files) cuik_free(l->files[i]);
+    dyn_array_destroy(l->files);
+    dyn_array_destroy(l->changed);
+    dyn_array_destroy(l->last_write);
 }
 #else
-static uint64_t get_last_write_time(const char* filepath) {
-    return 0;
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+
+enum {
+    // once something changes we wait for things to be quiet for this
+    // long (in ms), editors love to save in multiple steps.
+    LIVE_SETTLE_TIME = 50,
+};
+
+static void live_compile_init(LiveCompiler* l) {
+    l->files = dyn_array_create(char*, 16);
+    l->changed = dyn_array_create(const char*, 16);
+    l->dirs = dyn_array_create(struct LiveDir, 16);
+    l->real_paths = dyn_array_create(char*, 16);
+
+    l->fd = inotify_init1(IN_CLOEXEC);
+    if (l->fd < 0) {
+        fprintf(stderr, "live-compiler error: inotify_init1 failed (%s)\n", strerror(errno));
+    }
 }
 
-static bool live_compile_watch(LiveCompiler* l, const char* source_file) {
-    l->og_last_write = get_last_write_time(source_file);
-    return false;
+static void live_compile_add(LiveCompiler* l, const char* path) {
+    if (l->fd < 0 || live_find_file(l, path) >= 0) return;
+
+    char real[PATH_MAX];
+    if (realpath(path, real) == NULL) {
+        fprintf(stderr, "live-compiler error: can't find %s (%s)\n", path, strerror(errno));
+        return;
+    }
+
+    const char* slash = strrchr(real, '/');
+    char dir[PATH_MAX];
+    size_t dir_len = slash == real ? 1 : slash - real;
+    memcpy(dir, real, dir_len);
+    dir[dir_len] = 0;
+
+    // editors tend to write a new file and rename it over the old one so
+    // we watch the directory instead of the file itself.
+    int wd = inotify_add_watch(l->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) {
+        fprintf(stderr, "live-compiler error: can't watch %s (%s)\n", dir, strerror(errno));
+        return;
+    }
+
+    dyn_array_put(l->files, cuik_strdup(path));
+    dyn_array_put(l->real_paths, cuik_strdup(real));
+
+    // the same directory gives back the same watch descriptor
+    dyn_array_for(i, l->dirs) {
+        if (l->dirs[i].wd == wd) return;
+    }
+
+    struct LiveDir d = { wd, cuik_strdup(dir) };
+    dyn_array_put(l->dirs, d);
+}
+
+// blocks until some of the files are saved, returns how many changed (0 on failure)
+static size_t live_compile_wait(LiveCompiler* l) {
+    dyn_array_clear(l->changed);
+    if (l->fd < 0) {
+        return 0;
+    }
+
+    _Alignas(struct inotify_event) char buffer[4096];
+    for (;;) {
+        // block until the first change, after that we only wait for things to settle
+        struct pollfd p = { .fd = l->fd, .events = POLLIN };
+        int r = poll(&p, 1, dyn_array_length(l->changed) ? LIVE_SETTLE_TIME : -1);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+
+            fprintf(stderr, "live-compiler error: poll failed (%s)\n", strerror(errno));
+            return 0;
+        } else if (r == 0) {
+            break;
+        }
+
+        ssize_t len = read(l->fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) continue;
+
+            fprintf(stderr, "live-compiler error: couldn't read events\n");
+            return 0;
+        }
+
+        for (char* ptr = buffer; ptr < buffer + len;) {
+            const struct inotify_event* e = (const struct inotify_event*) ptr;
+            ptr += sizeof(struct inotify_event) + e->len;
+            if (e->len == 0) continue;
+
+            dyn_array_for(i, l->dirs) {
+                if (l->dirs[i].wd != e->wd) continue;
+
+                char path[PATH_MAX];
+                const char* sep = strcmp(l->dirs[i].path, "/") == 0 ? "" : "/";
+                snprintf(path, sizeof(path), "%s%s%s", l->dirs[i].path, sep, e->name);
+
+                dyn_array_for(j, l->real_paths) {
+                    if (strcmp(l->real_paths[j], path) == 0) live_mark_changed(l, j);
+                }
+                break;
+            }
+        }
+    }
+
+    return dyn_array_length(l->changed);
+}
+
+static void live_compile_free(LiveCompiler* l) {
+    if (l->fd >= 0) close(l->fd);
+
+    dyn_array_for(i, l->files) cuik_free(l->files[i]);
+    dyn_array_for(i, l->real_paths) cuik_free(l->real_paths[i]);
+    dyn_array_for(i, l->dirs) cuik_free(l->dirs[i].path);
+    dyn_array_destroy(l->files);
+    dyn_array_destroy(l->real_paths);
+    dyn_array_destroy(l->changed);
+    dyn_array_destroy(l->dirs);
 }
 #endif
@@ -3,6 +3,7 @@
 #include <dyn_array.h>
 
 #include "spall_perf.h"
+#include "report_perf.h"
 #include "live.h"
 
 // hacky but i dont care
@@ -95,6 +96,71 @@ static void test_diag(void) {
 }
 #endif
 
+static bool compile(Cuik_DriverArgs* args, Cuik_IThreadpool* tp) {
+    // compile source files
+    size_t obj_count = dyn_array_length(args->sources);
+    Cuik_BuildStep** objs = cuik_malloc(obj_count * sizeof(Cuik_BuildStep*));
+    dyn_array_for(i, args->sources) {
+        objs[i] = cuik_driver_cc(args, args->sources[i]->data);
+    }
+
+    // link (if no codegen is performed this doesn't *really* do much)
+    Cuik_BuildStep* linked = cuik_driver_ld(args, obj_count, objs);
+    bool success = cuik_step_run(linked, tp);
+
+    cuik_step_free(linked);
+    cuik_free(objs);
+    return success;
+}
+
+// rebuilds whenever the inputs change, this only ends when the process gets killed.
+static void run_live(Cuik_DriverArgs* args, Cuik_IThreadpool* tp) {
+    LiveCompiler lc = { 0 };
+    live_compile_init(&lc);
+
+    #ifdef CUIK_USE_TB
+    if (args->run) {
+        // JIT builds are incremental, we only recompile what changed
+        Cuik_Live* l = cuik_live_create(args);
+
+        size_t changed_count = 0;
+        for (;;) {
+            if (cuik_live_update(l, tp, changed_count, lc.changed)) {
+                int code = cuik_live_run(l);
+                fprintf(stderr, "C JIT exit with %d\n", code);
+            }
+
+            // the includes might've changed so we check every time
+            size_t file_count;
+            const char** files = cuik_live_files(l, &file_count);
+            for (size_t i = 0; i < file_count; i++) {
+                live_compile_add(&lc, files[i]);
+            }
+
+            printf("\nWaiting for changes...\n");
+            if (changed_count = live_compile_wait(&lc), changed_count == 0) {
+                break;
+            }
+        }
+
+        cuik_live_destroy(l);
+        live_compile_free(&lc);
+        return;
+    }
+    #endif
+
+    dyn_array_for(i, args->sources) {
+        live_compile_add(&lc, args->sources[i]->data);
+    }
+
+    do {
+        compile(args, tp);
+        printf("\nWaiting for changes...\n");
+    } while (live_compile_wait(&lc) > 0);
+
+    live_compile_free(&lc);
+}
+
 int main(int argc, const char** argv) {
     #ifdef CUIK_USE_SPALL_AUTO
     spall_auto_init("perf.spall");
@@ -178,12 +244,22 @@ int main(int argc, const char** argv) {
         printf("\n");
     }
 
+    char perf_output_path[FILENAME_MAX];
+    ReportProfiler report = { .path = args.time_report };
     if (args.time) {
-        char* perf_output_path = cuik_malloc(FILENAME_MAX);
         snprintf(perf_output_path, FILENAME_MAX, "%s.spall", args.output_name ? args.output_name : args.sources[0]->data);
+    }
+
+    if (args.time_report) {
+        // the report can pass everything along to spall
+        if (args.time) {
+            report.next = &spall_profiler;
+            report.next_ud = perf_output_path;
+        }
 
+        cuikperf_start(&report, &report_profiler, false);
+    } else if (args.time) {
         cuikperf_start(perf_output_path, &spall_profiler, false);
-        cuik_free(perf_output_path);
     }
 
     // spin up worker threads
@@ -196,28 +272,19 @@ int main(int argc, const char** argv) {
     }
     #endif
 
-    // compile source files
-    size_t obj_count = dyn_array_length(args.sources);
-    Cuik_BuildStep** objs = cuik_malloc(obj_count * sizeof(Cuik_BuildStep*));
-    dyn_array_for(i, args.sources) {
-        objs[i] = cuik_driver_cc(&args, args.sources[i]->data);
-    }
-
-    // link (if no codegen is performed this doesn't *really* do much)
-    Cuik_BuildStep* linked = cuik_driver_ld(&args, obj_count, objs);
-    if (!cuik_step_run(linked, tp)) {
+    if (args.live) {
+        run_live(&args, tp);
+    } else if (!compile(&args, tp)) {
         status = 1;
     }
 
-    cuik_step_free(linked);
-    cuik_free(objs);
-
     #if CUIK_ALLOW_THREADS
     cuik_threadpool_destroy(tp);
     #endif
 
-    if (args.time) cuikperf_stop();
+    if (args.time || args.time_report) cuikperf_stop();
     cuik_free_thread_resources();
+    cuik_free_process_resources();
 
     done:
     // Free arguments
@@ -0,0 +1,593 @@
+// Aggregating profiler for -Treport, instead of keeping every event like the
+// spall profiler it tallies them up per phase, TU, function, arena and file and
+// writes a JSON (or CSV) summary at exit. It can forward everything to another
+// profiler so -T and -Treport work together.
+//
+// Each thread keeps its own stack of open regions, when one closes its self time
+// (total minus the time spent in nested regions) goes to the innermost phase and
+// TU on that stack so the phase totals add up to the measured thread time without
+// double counting.
+//
+// NOTE(NeGate): the TU breakdown only knows about work on the thread which ran
+// the cc step, with -j the tasks it farms out (sema, function passes) land in the
+// phase totals but not under the TU.
+#include <dyn_array.h>
+#include <hash_map.h>
+#include <inttypes.h>
+#include <threads.h>
+#include <stdatomic.h>
+
+enum {
+    REPORT_TOP_FUNCTIONS = 32,
+};
+
+typedef enum {
+    REPORT_OTHER,
+    REPORT_PREPROCESS,
+    REPORT_PARSE,
+    REPORT_SEMA,
+    REPORT_IRGEN,
+    REPORT_OPT,
+    REPORT_OPT_PEEPHOLE,
+    REPORT_OPT_MEM2REG,
+    REPORT_OPT_INLINE,
+    REPORT_OPT_SCCP,
+    REPORT_OPT_LOOP,
+    REPORT_OPT_VECTORIZE,
+    REPORT_OPT_MEM,
+    REPORT_OPT_SROA,
+    REPORT_OPT_GVN,
+    REPORT_LTO,
+    REPORT_PROFILE,
+    REPORT_CODEGEN,
+    REPORT_SCHEDULE,
+    REPORT_ISEL,
+    REPORT_REGALLOC,
+    REPORT_EMIT,
+    REPORT_EXPORT,
+    REPORT_LINK,
+
+    REPORT_PHASE_COUNT,
+    // not a phase, the region doesn't change which phase we're in
+    REPORT_INHERIT = REPORT_PHASE_COUNT,
+} ReportPhase;
+
+static const char* report_phase_names[REPORT_PHASE_COUNT] = {
+    [REPORT_OTHER]        = "other",
+    [REPORT_PREPROCESS]   = "preprocess",
+    [REPORT_PARSE]        = "parse",
+    [REPORT_SEMA]         = "sema",
+    [REPORT_IRGEN]        = "irgen",
+    [REPORT_OPT]          = "opt",
+    [REPORT_OPT_PEEPHOLE] = "opt: peephole",
+    [REPORT_OPT_MEM2REG]  = "opt: mem2reg",
+    [REPORT_OPT_INLINE]   = "opt: inline",
+    [REPORT_OPT_SCCP]     = "opt: sccp",
+    [REPORT_OPT_LOOP]     = "opt: loop",
+    [REPORT_OPT_VECTORIZE] = "opt: vectorize",
+    [REPORT_OPT_MEM]      = "opt: mem",
+    [REPORT_OPT_SROA]     = "opt: sroa",
+    [REPORT_OPT_GVN]      = "opt: gvn",
+    [REPORT_LTO]          = "lto",
+    [REPORT_PROFILE]      = "profile",
+    [REPORT_CODEGEN]      = "codegen",
+    [REPORT_SCHEDULE]     = "schedule",
+    [REPORT_ISEL]         = "isel",
+    [REPORT_REGALLOC]     = "regalloc",
+    [REPORT_EMIT]         = "emit",
+    [REPORT_EXPORT]       = "export",
+    [REPORT_LINK]         = "link",
+};
+
+// the regions which start a phase, everything nested inside them counts towards
+// that phase until another one of these shows up.
+static const struct {
+    const char* label;
+    ReportPhase phase;
+} report_phase_labels[] = {
+    { "cuikpp_make",             REPORT_PREPROCESS   },
+    { "preprocess",              REPORT_PREPROCESS   },
+    { "load prefix",             REPORT_PREPROCESS   },
+    { "prefix make",             REPORT_PREPROCESS   },
+    { "parse",                   REPORT_PARSE        },
+    { "sema: collection",        REPORT_SEMA         },
+    { "sema: type check",        REPORT_SEMA         },
+    { "sema: task",              REPORT_SEMA         },
+    { "Allocate IR",             REPORT_IRGEN        },
+    { "ir_alloc_task",           REPORT_IRGEN        },
+    { "IRGen",                   REPORT_IRGEN        },
+    { "func opt",                REPORT_OPT          },
+    { "func late",               REPORT_OPT          },
+    { "peephole",                REPORT_OPT_PEEPHOLE },
+    { "mem2reg",                 REPORT_OPT_MEM2REG  },
+    { "inline",                  REPORT_OPT_INLINE   },
+    { "tb_module_inline",        REPORT_OPT_INLINE   },
+    { "sccp",                    REPORT_OPT_SCCP     },
+    { "loop",                    REPORT_OPT_LOOP     },
+    { "vectorize",               REPORT_OPT_VECTORIZE },
+    { "mem opt",                 REPORT_OPT_MEM      },
+    { "sroa",                    REPORT_OPT_SROA     },
+    { "gvn",                     REPORT_OPT_GVN      },
+    { "tb_module_lto",           REPORT_LTO          },
+    { "tb_module_strip",         REPORT_LTO          },
+    { "tb_module_profile_instrument", REPORT_PROFILE },
+    { "tb_module_profile_use",   REPORT_PROFILE      },
+    { "profile instrument",      REPORT_PROFILE      },
+    { "profile use",             REPORT_PROFILE      },
+    { "codegen",                 REPORT_CODEGEN      },
+    { "CodeGen",                 REPORT_CODEGEN      },
+    { "compile",                 REPORT_CODEGEN      },
+    { "schedule",                REPORT_SCHEDULE     },
+    { "isel",                    REPORT_ISEL         },
+    { "data flow",               REPORT_REGALLOC     },
+    { "build intervals",         REPORT_REGALLOC     },
+    { "reg alloc",               REPORT_REGALLOC     },
+    { "fast regalloc",           REPORT_REGALLOC     },
+    { "graph regalloc",          REPORT_REGALLOC     },
+    { "move resolver",           REPORT_REGALLOC     },
+    { "split resolver",          REPORT_REGALLOC     },
+    { "emit code",               REPORT_EMIT         },
+    { "export",                  REPORT_EXPORT       },
+    { "linker",                  REPORT_LINK         },
+    { "tb_linker_append_module", REPORT_LINK         },
+    { "tb_linker_export",        REPORT_LINK         },
+};
+
+typedef struct {
+    // first copy of the label we saw, the pointer we're keyed on might
+    // be freed by the time we write the report.
+    char* name;
+    ReportPhase phase;
+
+    uint64_t count;
+    uint64_t self_ns, total_ns;
+} ReportRegion;
+
+typedef struct {
+    char* name;
+    uint64_t total_ns;
+    uint64_t phases[REPORT_PHASE_COUNT];
+} ReportTU;
+
+typedef struct {
+    char* name;
+    uint64_t ns;
+} ReportFunc;
+
+typedef struct {
+    char* name;
+    uint64_t count, amount;
+} ReportCount;
+
+typedef struct {
+    const char* label;
+    const char* extra;
+    uint64_t start, child_ns;
+
+    ReportPhase phase;
+    // index into the thread's tus (-1 if we're not in one)
+    ptrdiff_t tu;
+} ReportFrame;
+
+typedef struct ReportThread ReportThread;
+struct ReportThread {
+    ReportThread* next;
+
+    DynArray(ReportFrame) stack;
+    uint64_t phases[REPORT_PHASE_COUNT];
+
+    // keyed by label pointer, same string literal means same pointer (mostly)
+    NL_Map(const char*, ReportRegion) regions;
+    NL_Map(const char*, ReportCount) arenas;
+
+    DynArray(ReportTU) tus;
+    DynArray(ReportFunc) funcs;
+    DynArray(ReportCount) files;
+};
+
+typedef struct {
+    const char* path;
+    uint64_t start_ns, end_ns;
+
+    // another profiler we forward to (optional)
+    const Cuik_IProfiler* next;
+    void* next_ud;
+
+    _Atomic(ReportThread*) threads;
+} ReportProfiler;
+
+static _Thread_local ReportThread* report_thread;
+
+static char* report_strdup(const char* str) {
+    size_t len = strlen(str);
+    char* dst = cuik_malloc(len + 1);
+    memcpy(dst, str, len + 1);
+    return dst;
+}
+
+static ReportThread* report_get_thread(ReportProfiler* r) {
+    if (report_thread == NULL) {
+        ReportThread* t = cuik_calloc(1, sizeof(ReportThread));
+        t->stack = dyn_array_create(ReportFrame, 64);
+        t->tus = dyn_array_create(ReportTU, 16);
+        t->funcs = dyn_array_create(ReportFunc, 256);
+        t->files = dyn_array_create(ReportCount, 64);
+
+        // the report is written once all threads are dead so we
+        // keep everything on a global list
+        t->next = atomic_load_explicit(&r->threads, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak(&r->threads, &t->next, t)) {}
+
+        report_thread = t;
+    }
+
+    return report_thread;
+}
+
+static ReportRegion* report_get_region(ReportThread* t, const char* label) {
+    ptrdiff_t i;
+    nl_map_puti(t->regions, label, i);
+
+    ReportRegion* r = &t->regions[i].v;
+    if (r->name == NULL) {
+        r->name = report_strdup(label);
+        r->phase = REPORT_INHERIT;
+        for (size_t j = 0; j < sizeof(report_phase_labels) / sizeof(report_phase_labels[0]); j++) {
+            if (strcmp(report_phase_labels[j].label, label) == 0) {
+                r->phase = report_phase_labels[j].phase;
+                break;
+            }
+        }
+    }
+    return r;
+}
+
+static void reportperf__start(void* user_data) {
+    ReportProfiler* r = user_data;
+    r->start_ns = cuik_time_in_nanos();
+    if (r->next) r->next->start(r->next_ud);
+}
+
+static void reportperf__begin_plot(void* user_data, uint64_t nanos, const char* label, const char* extra) {
+    ReportProfiler* r = user_data;
+    if (r->next) r->next->begin_plot(r->next_ud, nanos, label, extra);
+
+    ReportThread* t = report_get_thread(r);
+    ReportFrame* parent = dyn_array_length(t->stack) ? &t->stack[dyn_array_length(t->stack) - 1] : NULL;
+
+    ReportFrame f = { label, extra, nanos, 0, REPORT_OTHER, -1 };
+    if (parent) {
+        f.phase = parent->phase;
+        f.tu = parent->tu;
+    }
+
+    ReportPhase phase = report_get_region(t, label)->phase;
+    if (phase != REPORT_INHERIT) {
+        f.phase = phase;
+    }
+
+    // cc regions are a whole TU
+    if (strcmp(label, "cc") == 0 && extra[0]) {
+        f.tu = dyn_array_length(t->tus);
+        dyn_array_put(t->tus, (ReportTU){ report_strdup(extra) });
+    }
+
+    dyn_array_put(t->stack, f);
+}
+
+static void reportperf__end_plot(void* user_data, uint64_t nanos) {
+    ReportProfiler* r = user_data;
+    if (r->next) r->next->end_plot(r->next_ud, nanos);
+
+    ReportThread* t = report_get_thread(r);
+    if (dyn_array_length(t->stack) == 0) {
+        return;
+    }
+
+    ReportFrame f = dyn_array_pop(t->stack);
+    uint64_t total = nanos - f.start;
+    uint64_t self  = total > f.child_ns ? total - f.child_ns : 0;
+    if (dyn_array_length(t->stack)) {
+        t->stack[dyn_array_length(t->stack) - 1].child_ns += total;
+    }
+
+    ReportRegion* region = report_get_region(t, f.label);
+    region->count += 1;
+    region->self_ns += self;
+    region->total_ns += total;
+
+    t->phases[f.phase] += self;
+    if (f.tu >= 0) {
+        t->tus[f.tu].phases[f.phase] += self;
+        if (strcmp(f.label, "cc") == 0) {
+            t->tus[f.tu].total_ns = total;
+        }
+    }
+
+    // the per function part of codegen
+    if (strcmp(f.label, "compile") == 0 && f.extra[0]) {
+        dyn_array_put(t->funcs, (ReportFunc){ report_strdup(f.extra), total });
+    }
+}
+
+static void reportperf__count(void* user_data, const char* category, const char* name, uint64_t amount) {
+    ReportProfiler* r = user_data;
+    if (r->next && r->next->count) r->next->count(r->next_ud, category, name, amount);
+
+    ReportThread* t = report_get_thread(r);
+    if (name == NULL) name = "unnamed";
+
+    if (strcmp(category, "arena") == 0) {
+        ptrdiff_t i;
+        nl_map_puti(t->arenas, name, i);
+
+        ReportCount* c = &t->arenas[i].v;
+        if (c->name == NULL) c->name = report_strdup(name);
+        c->count += 1;
+        c->amount += amount;
+    } else if (strcmp(category, "file") == 0) {
+        dyn_array_put(t->files, (ReportCount){ report_strdup(name), 1, amount });
+    }
+}
+
+////////////////////////////////
+// Writing the report
+////////////////////////////////
+// merges the per-thread stuff by name
+static ReportRegion* report_merge_region(ReportRegion* arr, const ReportRegion* r) {
+    dyn_array_for(i, arr) {
+        if (strcmp(arr[i].name, r->name) == 0) {
+            arr[i].count += r->count;
+            arr[i].self_ns += r->self_ns;
+            arr[i].total_ns += r->total_ns;
+            return arr;
+        }
+    }
+
+    dyn_array_put(arr, *r);
+    return arr;
+}
+
+static ReportCount* report_merge(ReportCount* arr, const char* name, uint64_t count, uint64_t amount) {
+    dyn_array_for(i, arr) {
+        if (strcmp(arr[i].name, name) == 0) {
+            arr[i].count += count;
+            arr[i].amount += amount;
+            return arr;
+        }
+    }
+
+    dyn_array_put(arr, (ReportCount){ (char*) name, count, amount });
+    return arr;
+}
+
+static int report_cmp_func(const void* a, const void* b) {
+    const ReportFunc* aa = a;
+    const ReportFunc* bb = b;
+    return aa->ns < bb->ns ? 1 : aa->ns > bb->ns ? -1 : 0;
+}
+
+static int report_cmp_region(const void* a, const void* b) {
+    const ReportRegion* aa = a;
+    const ReportRegion* bb = b;
+    return aa->self_ns < bb->self_ns ? 1 : aa->self_ns > bb->self_ns ? -1 : 0;
+}
+
+static int report_cmp_count(const void* a, const void* b) {
+    const ReportCount* aa = a;
+    const ReportCount* bb = b;
+    return aa->amount < bb->amount ? 1 : aa->amount > bb->amount ? -1 : 0;
+}
+
+static void report_json_str(FILE* out, const char* str) {
+    fputc('"', out);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fprintf(out, "\\%c", *str);
+        } else if ((unsigned char) *str < 0x20) {
+            fprintf(out, "\\u%04x", (unsigned char) *str);
+        } else {
+            fputc(*str, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void report_csv_str(FILE* out, const char* str) {
+    if (strpbrk(str, ",\"\n") == NULL) {
+        fputs(str, out);
+        return;
+    }
+
+    fputc('"', out);
+    for (; *str; str++) {
+        if (*str == '"') fputc('"', out);
+        fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+static void report_write(ReportProfiler* r, FILE* out, bool csv) {
+    uint64_t phases[REPORT_PHASE_COUNT] = { 0 };
+    DynArray(ReportRegion) regions = dyn_array_create(ReportRegion, 64);
+    DynArray(ReportCount) arenas = dyn_array_create(ReportCount, 16);
+    DynArray(ReportCount) files = dyn_array_create(ReportCount, 64);
+    DynArray(ReportTU) tus = dyn_array_create(ReportTU, 16);
+    DynArray(ReportFunc) funcs = dyn_array_create(ReportFunc, 256);
+
+    size_t thread_count = 0;
+    for (ReportThread* t = atomic_load(&r->threads); t; t = t->next, thread_count++) {
+        for (size_t i = 0; i < REPORT_PHASE_COUNT; i++) phases[i] += t->phases[i];
+
+        nl_map_for(i, t->regions) {
+            regions = report_merge_region(regions, &t->regions[i].v);
+        }
+
+        nl_map_for(i, t->arenas) {
+            arenas = report_merge(arenas, t->arenas[i].v.name, t->arenas[i].v.count, t->arenas[i].v.amount);
+        }
+
+        dyn_array_for(i, t->files) {
+            files = report_merge(files, t->files[i].name, t->files[i].count, t->files[i].amount);
+        }
+
+        dyn_array_for(i, t->tus) dyn_array_put(tus, t->tus[i]);
+        dyn_array_for(i, t->funcs) dyn_array_put(funcs, t->funcs[i]);
+    }
+
+    qsort(regions, dyn_array_length(regions), sizeof(ReportRegion), report_cmp_region);
+    qsort(funcs, dyn_array_length(funcs), sizeof(ReportFunc), report_cmp_func);
+    qsort(arenas, dyn_array_length(arenas), sizeof(ReportCount), report_cmp_count);
+
+    size_t func_count = dyn_array_length(funcs);
+    if (func_count > REPORT_TOP_FUNCTIONS) func_count = REPORT_TOP_FUNCTIONS;
+
+    uint64_t bytes_read = 0;
+    dyn_array_for(i, files) bytes_read += files[i].amount;
+
+    uint64_t wall_ns = r->end_ns - r->start_ns;
+    if (csv) {
+        fprintf(out, "section,name,phase,ns,count,bytes\n");
+        fprintf(out, "total,wall,,%"PRIu64",%zu,\n", wall_ns, thread_count);
+        for (size_t i = 0; i < REPORT_PHASE_COUNT; i++) {
+            fprintf(out, "phase,%s,,%"PRIu64",,\n", report_phase_names[i], phases[i]);
+        }
+
+        dyn_array_for(i, regions) {
+            fprintf(out, "region,"), report_csv_str(out, regions[i].name);
+            fprintf(out, ",,%"PRIu64",%"PRIu64",\n", regions[i].self_ns, regions[i].count);
+        }
+
+        dyn_array_for(i, tus) {
+            fprintf(out, "tu,"), report_csv_str(out, tus[i].name);
+            fprintf(out, ",total,%"PRIu64",,\n", tus[i].total_ns);
+
+            for (size_t j = 0; j < REPORT_PHASE_COUNT; j++) if (tus[i].phases[j]) {
+                fprintf(out, "tu,"), report_csv_str(out, tus[i].name);
+                fprintf(out, ",%s,%"PRIu64",,\n", report_phase_names[j], tus[i].phases[j]);
+            }
+        }
+
+        for (size_t i = 0; i < func_count; i++) {
+            fprintf(out, "function,"), report_csv_str(out, funcs[i].name);
+            fprintf(out, ",codegen,%"PRIu64",,\n", funcs[i].ns);
+        }
+
+        dyn_array_for(i, arenas) {
+            fprintf(out, "arena,"), report_csv_str(out, arenas[i].name);
+            fprintf(out, ",,,%"PRIu64",%"PRIu64"\n", arenas[i].count, arenas[i].amount);
+        }
+
+        dyn_array_for(i, files) {
+            fprintf(out, "file,"), report_csv_str(out, files[i].name);
+            fprintf(out, ",,,%"PRIu64",%"PRIu64"\n", files[i].count, files[i].amount);
+        }
+    } else {
+        fprintf(out, "{\n");
+        fprintf(out, "  \"wall_ns\": %"PRIu64",\n", wall_ns);
+        fprintf(out, "  \"threads\": %zu,\n", thread_count);
+
+        fprintf(out, "  \"phases\": {");
+        for (size_t i = 0; i < REPORT_PHASE_COUNT; i++) {
+            fprintf(out, "%s\n    \"%s\": %"PRIu64, i ? "," : "", report_phase_names[i], phases[i]);
+        }
+        fprintf(out, "\n  },\n");
+
+        fprintf(out, "  \"regions\": [");
+        dyn_array_for(i, regions) {
+            fprintf(out, "%s\n    { \"name\": ", i ? "," : ""), report_json_str(out, regions[i].name);
+            fprintf(out, ", \"count\": %"PRIu64", \"self_ns\": %"PRIu64", \"total_ns\": %"PRIu64" }", regions[i].count, regions[i].self_ns, regions[i].total_ns);
+        }
+        fprintf(out, "\n  ],\n");
+
+        fprintf(out, "  \"tus\": [");
+        dyn_array_for(i, tus) {
+            fprintf(out, "%s\n    { \"name\": ", i ? "," : ""), report_json_str(out, tus[i].name);
+            fprintf(out, ", \"total_ns\": %"PRIu64", \"phases\": {", tus[i].total_ns);
+
+            bool first = true;
+            for (size_t j = 0; j < REPORT_PHASE_COUNT; j++) if (tus[i].phases[j]) {
+                fprintf(out, "%s \"%s\": %"PRIu64, first ? "" : ",", report_phase_names[j], tus[i].phases[j]);
+                first = false;
+            }
+            fprintf(out, " } }");
+        }
+        fprintf(out, "\n  ],\n");
+
+        fprintf(out, "  \"functions\": [");
+        for (size_t i = 0; i < func_count; i++) {
+            fprintf(out, "%s\n    { \"name\": ", i ? "," : ""), report_json_str(out, funcs[i].name);
+            fprintf(out, ", \"ns\": %"PRIu64" }", funcs[i].ns);
+        }
+        fprintf(out, "\n  ],\n");
+
+        fprintf(out, "  \"arenas\": [");
+        dyn_array_for(i, arenas) {
+            fprintf(out, "%s\n    { \"name\": ", i ? "," : ""), report_json_str(out, arenas[i].name);
+            fprintf(out, ", \"chunks\": %"PRIu64", \"bytes\": %"PRIu64" }", arenas[i].count, arenas[i].amount);
+        }
+        fprintf(out, "\n  ],\n");
+
+        fprintf(out, "  \"files_read\": %zu,\n", (size_t) dyn_array_length(files));
+        fprintf(out, "  \"bytes_read\": %"PRIu64",\n", bytes_read);
+        fprintf(out, "  \"files\": [");
+        dyn_array_for(i, files) {
+            fprintf(out, "%s\n    { \"path\": ", i ? "," : ""), report_json_str(out, files[i].name);
+            fprintf(out, ", \"reads\": %"PRIu64", \"bytes\": %"PRIu64" }", files[i].count, files[i].amount);
+        }
+        fprintf(out, "\n  ]\n");
+        fprintf(out, "}\n");
+    }
+
+    dyn_array_destroy(regions);
+    dyn_array_destroy(arenas);
+    dyn_array_destroy(files);
+    dyn_array_destroy(tus);
+    dyn_array_destroy(funcs);
+}
+
+static void reportperf__stop(void* user_data) {
+    ReportProfiler* r = user_data;
+    r->end_ns = cuik_time_in_nanos();
+    if (r->next) r->next->stop(r->next_ud);
+
+    size_t len = strlen(r->path);
+    bool csv = len >= 4 && strcmp(r->path + len - 4, ".csv") == 0;
+
+    FILE* out = fopen(r->path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "error: could not open %s for the time report\n", r->path);
+    } else {
+        report_write(r, out, csv);
+        fclose(out);
+    }
+
+    // everything in the threads is owned by the report
+    ReportThread* t = atomic_exchange(&r->threads, NULL);
+    while (t != NULL) {
+        ReportThread* next = t->next;
+        nl_map_for(i, t->regions) cuik_free(t->regions[i].v.name);
+        nl_map_for(i, t->arenas) cuik_free(t->arenas[i].v.name);
+        dyn_array_for(i, t->tus) cuik_free(t->tus[i].name);
+        dyn_array_for(i, t->funcs) cuik_free(t->funcs[i].name);
+        dyn_array_for(i, t->files) cuik_free(t->files[i].name);
+
+        nl_map_free(t->regions);
+        nl_map_free(t->arenas);
+        dyn_array_destroy(t->stack);
+        dyn_array_destroy(t->tus);
+        dyn_array_destroy(t->funcs);
+        dyn_array_destroy(t->files);
+        cuik_free(t);
+        t = next;
+    }
+    report_thread = NULL;
+}
+
+static Cuik_IProfiler report_profiler = {
+    .start      = reportperf__start,
+    .stop       = reportperf__stop,
+    .begin_plot = reportperf__begin_plot,
+    .end_plot   = reportperf__end_plot,
+    .count      = reportperf__count,
+};
@@ -23,11 +23,14 @@ __declspec(dllimport) unsigned long GetCurrentThreadId(void);
 static SpallProfile ctx;
 static _Thread_local SpallBuffer muh_buffer;
 
+// the active profiler might not be us (-Treport without -T)
+static bool spall_active;
+
 void spallperf__start_thread(void) {
     #ifdef CUIK_USE_SPALL_AUTO
     spall_auto_thread_init(1, 1ull<<28ull);
     #else
-    if (cuikperf_is_active()) {
+    if (spall_active) {
         size_t size = 4 * 1024 * 1024;
         muh_buffer = (SpallBuffer){ cuik_malloc(size), size };
         spall_buffer_init(&ctx, &muh_buffer);
@@ -39,7 +42,7 @@ void spallperf__stop_thread(void) {
     #ifdef CUIK_USE_SPALL_AUTO
     spall_auto_thread_quit();
     #else
-    if (cuikperf_is_active()) {
+    if (spall_active) {
         spall_buffer_quit(&ctx, &muh_buffer);
     }
     #endif
@@ -48,6 +51,7 @@ void spallperf__stop_thread(void) {
 static void spallperf__start(void* user_data) {
     #ifndef CUIK_USE_SPALL_AUTO
     ctx = spall_init_file((char*) user_data, 1.0 / 1000.0);
+    spall_active = true;
     spallperf__start_thread();
     #endif
 }
@@ -56,6 +60,7 @@ static void spallperf__stop(void* user_data) {
     #ifndef CUIK_USE_SPALL_AUTO
     spallperf__stop_thread();
     spall_quit(&ctx);
+    spall_active = false;
     #endif
 }
 
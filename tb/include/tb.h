@@ -130,6 +130,13 @@ typedef enum TB_BranchHint {
     TB_BRANCH_HINT_UNLIKELY
 } TB_BranchHint;
 
+// how often something ran according to the profile (see tb_module_profile_use)
+typedef enum TB_Heat {
+    TB_HEAT_UNKNOWN,
+    TB_HEAT_HOT,
+    TB_HEAT_COLD,
+} TB_Heat;
+
 typedef enum TB_Linkage {
     TB_LINKAGE_PUBLIC,
     TB_LINKAGE_PRIVATE
@@ -151,9 +158,14 @@ typedef enum TB_MemoryOrder {
 } TB_MemoryOrder;
 
 typedef enum TB_ISelMode {
-    // FastISel
+    // FastISel, registers are allocated one block at a time and anything
+    // which crosses blocks goes through the stack (meant for -O0).
     TB_ISEL_FAST,
-    TB_ISEL_COMPLEX
+    // full liveness & linear scan, the default
+    TB_ISEL_COMPLEX,
+    // graph coloring with move coalescing, slower to compile than linear scan
+    // but tighter code in the hot loops (meant for -O2).
+    TB_ISEL_COLORING,
 } TB_ISelMode;
 
 typedef enum TB_DataTypeEnum {
@@ -182,7 +194,8 @@ typedef enum TB_FloatFormat {
 typedef union TB_DataType {
     struct {
         uint8_t type;
-        // Only integers and floats can be wide.
+        // Only integers and floats can be wide, it's log2 of the
+        // lane count (so a vector of 4 floats is a width of 2).
         uint8_t width;
         // for integers it's the bitwidth
         uint16_t data;
@@ -394,6 +407,11 @@ typedef enum TB_NodeTypeEnum {
     // variadic
     TB_VA_START,
 
+    // Vector ops
+    //   the usual arithmatic works on vector types lane by lane, these
+    //   are for moving between the scalar and vector world.
+    TB_VBROADCAST, // Data -> Vector
+
     // x86 intrinsics
     TB_X86INTRIN_RDTSC,
     TB_X86INTRIN_LDMXCSR,
@@ -488,8 +506,9 @@ struct TB_Node {
     uint16_t input_count; // number of node inputs
     uint16_t extra_count; // number of bytes for extra operand data
 
-    // local to the TB_Passes
-    uint32_t lattice_id;
+    // dense id within the function, the optimizer's side tables
+    // (use-lists, worklist, lattice) are indexed by it.
+    uint32_t gvn;
 
     TB_Attrib* attribs;
     TB_Node** inputs;
@@ -507,6 +526,10 @@ typedef struct { // TB_BRANCH
     size_t succ_count;
     TB_Node** succ;
 
+    // chance of taking each successor, NULL if nobody told us (codegen
+    // will guess based on the shape of the CFG).
+    float* probs;
+
     int64_t keys[];
 } TB_NodeBranch;
 
@@ -576,6 +599,7 @@ typedef struct {
 
 typedef struct {
     TB_FunctionPrototype* proto;
+    TB_Heat heat; // filled in by tb_module_profile_use
     TB_Node* projs[];
 } TB_NodeCall;
 
@@ -642,6 +666,7 @@ typedef struct {
 
 #define TB_TYPE_INTN(N) TB_DataType{ { TB_INT,   0, (N) } }
 #define TB_TYPE_PTRN(N) TB_DataType{ { TB_PTR,   0, (N) } }
+#define TB_TYPE_VEC(dt, log2_lanes) TB_DataType{ { (dt).type, (uint8_t) (log2_lanes), (dt).data } }
 
 #else
 
@@ -658,6 +683,7 @@ typedef struct {
 #define TB_TYPE_PTR     (TB_DataType){ { TB_PTR,   0, 0 } }
 #define TB_TYPE_INTN(N) (TB_DataType){ { TB_INT,  0, (N) } }
 #define TB_TYPE_PTRN(N) (TB_DataType){ { TB_PTR,  0, (N) } }
+#define TB_TYPE_VEC(dt, log2_lanes) (TB_DataType){ { (dt).type, (log2_lanes), (dt).data } }
 
 #endif
 
@@ -666,8 +692,8 @@ typedef void (*TB_PrintCallback)(void* user_data, const char* fmt, ...);
 // defined in common/arena.h
 typedef struct TB_Arena TB_Arena;
 
-// 0 for default
-TB_API void tb_arena_create(TB_Arena* restrict arena, size_t chunk_size);
+// 0 for default, the name is only used by the profiler
+TB_API void tb_arena_create(TB_Arena* restrict arena, size_t chunk_size, const char* name);
 TB_API void tb_arena_destroy(TB_Arena* restrict arena);
 TB_API bool tb_arena_is_empty(TB_Arena* arena);
 
@@ -695,6 +721,15 @@ TB_API void tb_module_set_tls_index(TB_Module* m, ptrdiff_t len, const char* nam
 // exporting.
 TB_API void tb_module_layout_sections(TB_Module* m);
 
+// Functions whose final IR matches something compiled before (same target too) will
+// load the machine code from this directory instead of running codegen. NULL disables it,
+// the directory is made if it doesn't exist.
+TB_API void tb_module_set_codegen_cache(TB_Module* m, const char* dir);
+TB_API void tb_module_get_codegen_cache_stats(TB_Module* m, size_t* out_hits, size_t* out_misses);
+
+// picks the codegen strategy for every function compiled after this, see TB_ISelMode
+TB_API void tb_module_set_isel_mode(TB_Module* m, TB_ISelMode mode);
+
 ////////////////////////////////
 // Compiled code introspection
 ////////////////////////////////
@@ -731,6 +766,13 @@ typedef struct TB_JIT TB_JIT;
 TB_API TB_JIT* tb_jit_begin(TB_Module* m, size_t jit_heap_capacity);
 TB_API void* tb_jit_place_function(TB_JIT* jit, TB_Function* f);
 TB_API void* tb_jit_place_global(TB_JIT* jit, TB_Global* g);
+
+// for live reloading: places new_f and makes the old code jump into it so
+// anything still calling old_f ends up in the new version.
+TB_API void* tb_jit_replace_function(TB_JIT* jit, TB_Function* old_f, TB_Function* new_f);
+// rewrites the contents of a global (placing it if it's not there yet), the
+// address doesn't change.
+TB_API void tb_jit_reinit_global(TB_JIT* jit, TB_Global* g);
 TB_API void tb_jit_end(TB_JIT* jit);
 
 TB_API void* tb_jit_get_code_ptr(TB_Function* f);
@@ -975,6 +1017,10 @@ TB_API TB_Function* tb_function_create(TB_Module* m, ptrdiff_t len, const char*
 
 TB_API TB_Arena* tb_function_get_arena(TB_Function* f);
 
+// number of nodes allocated in the function so far, it's a decent estimate of
+// how much work it'll take to optimize & compile.
+TB_API size_t tb_function_get_node_count(TB_Function* f);
+
 // if len is -1, it's null terminated
 TB_API void tb_symbol_set_name(TB_Symbol* s, ptrdiff_t len, const char* name);
 
@@ -1104,6 +1150,10 @@ TB_API TB_Node* tb_inst_fsub(TB_Function* f, TB_Node* a, TB_Node* b);
 TB_API TB_Node* tb_inst_fmul(TB_Function* f, TB_Node* a, TB_Node* b);
 TB_API TB_Node* tb_inst_fdiv(TB_Function* f, TB_Node* a, TB_Node* b);
 
+// Vector ops
+//   copies a scalar into every lane, the result is TB_TYPE_VEC(src->dt, log2_lanes).
+TB_API TB_Node* tb_inst_vbroadcast(TB_Function* f, TB_Node* src, int log2_lanes);
+
 // Comparisons
 TB_API TB_Node* tb_inst_cmp_eq(TB_Function* f, TB_Node* a, TB_Node* b);
 TB_API TB_Node* tb_inst_cmp_ne(TB_Function* f, TB_Node* a, TB_Node* b);
@@ -1141,6 +1191,7 @@ TB_API bool tb_inst_add_phi_operand(TB_Function* f, TB_Node* phi, TB_Node* regio
 TB_API TB_Node* tb_inst_phi2(TB_Function* f, TB_Node* region, TB_Node* a, TB_Node* b);
 TB_API void tb_inst_goto(TB_Function* f, TB_Node* target);
 TB_API void tb_inst_if(TB_Function* f, TB_Node* cond, TB_Node* true_case, TB_Node* false_case);
+TB_API void tb_inst_if_hint(TB_Function* f, TB_Node* cond, TB_Node* true_case, TB_Node* false_case, TB_BranchHint hint);
 TB_API void tb_inst_branch(TB_Function* f, TB_DataType dt, TB_Node* key, TB_Node* default_case, size_t entry_count, const TB_SwitchEntry* keys);
 
 TB_API void tb_inst_ret(TB_Function* f, size_t count, TB_Node** values);
@@ -1160,6 +1211,9 @@ TB_API void tb_pass_exit(TB_Passes* opt);
 //     should be run after any bigger passes (it's incremental
 //     so it's not that bad)
 //
+//   sroa: splits up the TB_LOCALs which are only accessed at known offsets into
+//     one local per field, run it right before mem2reg so those can be promoted.
+//
 //   mem2reg: lowers TB_LOCALs into SSA values, this makes more
 //     data flow analysis possible on the code and allows to codegen
 //     to place variables into registers.
@@ -1167,12 +1221,36 @@ TB_API void tb_pass_exit(TB_Passes* opt);
 //   cfg: performs simplifications on the CFG like `a && b => select(a, b, 0)`
 //     or removing redundant branches.
 //
-//   loop: NOT READY
+//   loop: canonicalizes loops (one preheader, one latch), strength reduces the
+//     array accesses on induction variables and fully unrolls the small ones with
+//     known trip counts. It also lets the scheduler hoist loop invariant code, run
+//     a peephole afterwards.
+//
+//   vectorize: turns simple counted loops over arrays into packed SIMD loops
+//     (the scalar loop stays around for the leftovers), run it after loop.
+//
+//   inline: pastes in the calls to functions picked by tb_module_inline, the
+//     callers should be peepholed afterwards.
+//
+//   sccp: optimistic constant propagation across the whole function, removes
+//     unreachable code and folds constants through phis, it also keeps the known
+//     bits around for codegen (until the next sccp run). Should be followed
+//     by a peephole.
+//
+//   gvn: optimistic global value numbering, merges the congruent values the
+//     peepholes can't see (commuted operands, identical loop phis, loads of the
+//     same address from the same memory state). Run it after mem2reg and follow
+//     it with a peephole.
 //
 TB_API bool tb_pass_peephole(TB_Passes* opt);
+TB_API bool tb_pass_sroa(TB_Passes* opt);
 TB_API bool tb_pass_mem2reg(TB_Passes* opt);
 TB_API bool tb_pass_loop(TB_Passes* opt);
+TB_API bool tb_pass_vectorize(TB_Passes* opt);
 TB_API bool tb_pass_cfg(TB_Passes* opt);
+TB_API bool tb_pass_inline(TB_Passes* opt);
+TB_API bool tb_pass_sccp(TB_Passes* opt);
+TB_API bool tb_pass_gvn(TB_Passes* opt);
 
 // analysis
 //   print: prints IR in a flattened text form.
@@ -1183,6 +1261,36 @@ TB_API void tb_pass_schedule(TB_Passes* opt);
 // codegen
 TB_API TB_FunctionOutput* tb_pass_codegen(TB_Passes* opt, bool emit_asm);
 
+// module passes: these can't run while any function in the module is in
+// between tb_pass_enter and tb_pass_exit (see man/PASSES.md).
+//   inline: builds the call graph and picks which functions are cheap enough
+//     to inline, the actual inlining is done by tb_pass_inline.
+//
+//   lto: treats the module as the whole program, externals get resolved against
+//     the definitions of the same name and anything public which isn't named in
+//     roots becomes private (roots = NULL keeps the linkage as is). Unreachable
+//     symbols are dropped and constant arguments are pushed into the private
+//     callees, run it before tb_module_inline.
+//
+//   strip: drops the private symbols nothing refers to anymore.
+//
+//   profile_instrument: adds counters to every branch successor, call site and
+//     function entry. The program writes them to path when main returns (or exits)
+//     unless is_jit is set, then it's on you to call tb_module_profile_write once
+//     the JIT'd code is done. Run it on the fresh IR, before any other passes.
+//
+//   profile_use: reads back a profile and annotates the branches (probabilities),
+//     calls and functions (TB_Heat), this needs to see the same IR the instrumented
+//     build did so it also runs before any other passes. Functions which changed
+//     since the profile was made are left alone, returns false if the file couldn't
+//     be read.
+TB_API void tb_module_inline(TB_Module* m);
+TB_API void tb_module_lto(TB_Module* m, size_t root_count, const char** roots);
+TB_API void tb_module_strip(TB_Module* m);
+TB_API void tb_module_profile_instrument(TB_Module* m, const char* path, bool is_jit);
+TB_API bool tb_module_profile_use(TB_Module* m, const char* path);
+TB_API bool tb_module_profile_write(TB_Module* m, const char* path);
+
 TB_API void tb_pass_kill_node(TB_Passes* opt, TB_Node* n);
 TB_API bool tb_pass_mark(TB_Passes* opt, TB_Node* n);
 TB_API void tb_pass_mark_users(TB_Passes* opt, TB_Node* n);
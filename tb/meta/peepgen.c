@@ -0,0 +1,569 @@
+// Compiles the peephole rules (tb/src/opt/peeps.txt) into C matchers (peeps.h)
+//
+//   rule  := pat '=>' rhs ['if' C-expression until the end of the line]
+//   pat   := [name ':'] ( '(' op ['@' pat] pat* ')' | name | '_' | integer | '#' name )
+//   rhs   := name | '{' C-expression '}' | build
+//   build := '(' op arg* ')'
+//   arg   := name | '#{' C-expression '}' | '{' C-expression '}' | build
+//
+// ops are the TB_NodeTypeEnum names in lowercase without the TB_ prefix. Inside a node
+// pattern the '@' operand is inputs[0] (control/memory) and the rest are inputs[1...].
+// Names are bound the first time they appear and every other use is an equality check,
+// integers match single word TB_INTEGER_CONSTs (and splats of them) while '#x' binds
+// the constant to a uint64_t. The matched node is always 'n'.
+//
+// a rule which produces one of its bound nodes (or a C expression) is an identity, one
+// which builds nodes (typed like 'n') is an idealization.
+//
+// Rules with the same root op are merged into a decision tree, siblings only merge when
+// they're adjacent so the rules are still tried in the order they're written.
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <assert.h>
+
+#define MAX_STEPS 64
+#define MAX_RULES 512
+#define MAX_NAMES 32
+
+typedef struct {
+    char* text;
+    // opens a scope
+    char* decl;
+} Step;
+
+typedef struct {
+    int line;
+    bool is_ideal;
+    char* op;
+    char* result;
+
+    int step_count;
+    Step steps[MAX_STEPS];
+} Rule;
+
+typedef struct Tree Tree;
+struct Tree {
+    Step step;
+    // only on the leaves
+    Rule* rule;
+
+    int kid_count, kid_cap;
+    Tree** kids;
+};
+
+static const char* path;
+static char* src;
+static int line = 1;
+
+static int rule_count;
+static Rule rules[MAX_RULES];
+
+// bound names for the rule being parsed
+static int name_count;
+static char* names[MAX_NAMES];
+
+static _Noreturn void error(const char* msg, const char* extra) {
+    fprintf(stderr, "%s:%d: error: %s%s\n", path, line, msg, extra ? extra : "");
+    exit(1);
+}
+
+static char* format(const char* fmt, ...) {
+    va_list ap, ap2;
+    va_start(ap, fmt);
+    va_copy(ap2, ap);
+    int len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    char* s = malloc(len + 1);
+    vsnprintf(s, len + 1, fmt, ap2);
+    va_end(ap2);
+    return s;
+}
+
+////////////////////////////////
+// Lexing
+////////////////////////////////
+static void skip_space(bool newlines) {
+    for (;;) {
+        if (*src == '#' && (src[1] == ' ' || src[1] == '#' || src[1] == '\n')) {
+            // comments only appear at the start of a line so '#x' is fine
+            while (*src && *src != '\n') src++;
+        } else if (*src == '\n' && newlines) {
+            line++, src++;
+        } else if (*src == ' ' || *src == '\t' || *src == '\r') {
+            src++;
+        } else {
+            return;
+        }
+    }
+}
+
+static bool is_ident_char(char ch) {
+    return isalnum((unsigned char) ch) || ch == '_';
+}
+
+static char* lex_ident(void) {
+    skip_space(true);
+    if (!isalpha((unsigned char) *src) && *src != '_') {
+        error("expected name", NULL);
+    }
+
+    const char* start = src;
+    while (is_ident_char(*src)) src++;
+    return format("%.*s", (int) (src - start), start);
+}
+
+static bool accept(const char* str) {
+    skip_space(true);
+    size_t len = strlen(str);
+    if (strncmp(src, str, len) == 0) {
+        src += len;
+        return true;
+    }
+    return false;
+}
+
+static void expect(const char* str) {
+    if (!accept(str)) error("expected ", str);
+}
+
+// grabs everything up to the matching '}'
+static char* lex_braces(void) {
+    const char* start = src;
+    int depth = 1;
+    for (; *src; src++) {
+        if (*src == '\n') error("unterminated {", NULL);
+        if (*src == '{') depth++;
+        if (*src == '}' && --depth == 0) break;
+    }
+
+    char* s = format("%.*s", (int) (src - start), start);
+    src++;
+    return s;
+}
+
+static char* node_type(const char* op) {
+    char* s = format("TB_%s", op);
+    for (char* p = s; *p; p++) *p = toupper((unsigned char) *p);
+    return s;
+}
+
+////////////////////////////////
+// Patterns
+////////////////////////////////
+static bool is_bound(const char* name) {
+    for (int i = 0; i < name_count; i++) {
+        if (strcmp(names[i], name) == 0) return true;
+    }
+    return false;
+}
+
+static void bind(const char* name) {
+    if (name_count == MAX_NAMES) error("too many names", NULL);
+    names[name_count++] = (char*) name;
+}
+
+static void push_step(Rule* r, char* text, char* decl) {
+    if (r->step_count == MAX_STEPS) error("rule is too big", NULL);
+    r->steps[r->step_count++] = (Step){ text, decl };
+}
+
+static void parse_pattern(Rule* r, const char* at, bool is_root);
+
+// name ':' binds whatever is at 'at' and then matches the rest against it
+static void parse_binding(Rule* r, const char* at, bool is_root) {
+    skip_space(true);
+    if (!isalpha((unsigned char) *src) && *src != '_') {
+        parse_pattern(r, at, is_root);
+        return;
+    }
+
+    const char* save = src;
+    int save_line = line;
+
+    char* name = lex_ident();
+    if (accept(":")) {
+        if (is_root) error("can't rename the root, it's always 'n'", NULL);
+        if (is_bound(name)) error("name bound twice: ", name);
+
+        push_step(r, NULL, format("TB_Node* %s = %s;", name, at));
+        bind(name);
+        parse_pattern(r, name, false);
+        return;
+    }
+
+    src = (char*) save, line = save_line;
+    parse_pattern(r, at, is_root);
+}
+
+static void parse_pattern(Rule* r, const char* at, bool is_root) {
+    skip_space(true);
+
+    if (accept("(")) {
+        char* op = lex_ident();
+        char* type = node_type(op);
+
+        // the root's type is the switch case
+        if (is_root) {
+            r->op = type;
+        } else {
+            push_step(r, format("%s->type == %s", at, type), NULL);
+        }
+
+        // control edge
+        int step_at = r->step_count;
+        push_step(r, NULL, NULL);
+        if (accept("@")) {
+            char* in = format("%s->inputs[0]", at);
+            push_step(r, format("%s != NULL", in), NULL);
+            parse_binding(r, in, false);
+        }
+
+        int count = 1;
+        while (!accept(")")) {
+            if (*src == 0) error("unterminated pattern", NULL);
+
+            parse_binding(r, format("%s->inputs[%d]", at, count), false);
+            count++;
+        }
+
+        // we can't know the input count until we've parsed the operands
+        r->steps[step_at].text = format("%s->input_count >= %d", at, count);
+    } else if (accept("#")) {
+        char* name = lex_ident();
+        if (is_bound(name)) error("name bound twice: ", name);
+
+        push_step(r, format("get_int_const(%s, &%s)", at, name), format("uint64_t %s;", name));
+        bind(name);
+    } else if (isdigit((unsigned char) *src)) {
+        char* end;
+        unsigned long long x = strtoull(src, &end, 0);
+        src = end;
+
+        push_step(r, format("peep_is_int(%s, %lluull)", at, x), NULL);
+    } else if (is_root) {
+        error("root has to be a node pattern", NULL);
+    } else {
+        char* name = lex_ident();
+        if (strcmp(name, "_") == 0) {
+            // anything goes
+        } else if (is_bound(name)) {
+            push_step(r, format("%s == %s", at, name), NULL);
+        } else {
+            push_step(r, NULL, format("TB_Node* %s = %s;", name, at));
+            bind(name);
+        }
+    }
+}
+
+////////////////////////////////
+// Rewrites
+////////////////////////////////
+// extra data for the nodes we can build
+static const char* node_extra(const char* type, const char* first_arg) {
+    static const char* binops[] = {
+        "TB_AND", "TB_OR", "TB_XOR", "TB_ADD", "TB_SUB", "TB_MUL",
+        "TB_SHL", "TB_SHR", "TB_SAR", "TB_ROL", "TB_ROR",
+        "TB_UDIV", "TB_SDIV", "TB_UMOD", "TB_SMOD",
+    };
+
+    static const char* unary[] = {
+        "TB_NOT", "TB_NEG", "TB_ZERO_EXT", "TB_SIGN_EXT", "TB_TRUNCATE",
+        "TB_INT2PTR", "TB_PTR2INT", "TB_BITCAST",
+    };
+
+    for (size_t i = 0; i < sizeof(binops) / sizeof(*binops); i++) {
+        if (strcmp(type, binops[i]) == 0) return "sizeof(TB_NodeBinopInt)";
+    }
+
+    for (size_t i = 0; i < sizeof(unary) / sizeof(*unary); i++) {
+        if (strcmp(type, unary[i]) == 0) return "0";
+    }
+
+    if (strncmp(type, "TB_CMP_", 7) == 0) {
+        if (first_arg == NULL) error("comparisons need operands", NULL);
+        return "sizeof(TB_NodeCompare)";
+    }
+
+    error("can't build node: ", type);
+}
+
+typedef struct {
+    char buf[4096];
+    size_t len;
+    int tmp;
+} Builder;
+
+static void emit(Builder* b, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    b->len += vsnprintf(&b->buf[b->len], sizeof(b->buf) - b->len, fmt, ap);
+    va_end(ap);
+
+    if (b->len >= sizeof(b->buf)) error("rewrite is too big", NULL);
+}
+
+// returns the name of the node holding the result
+static char* parse_build(Builder* b, bool is_root) {
+    skip_space(true);
+    if (accept("(")) {
+        char* type = node_type(lex_ident());
+
+        int count = 0;
+        char* args[16];
+        while (!accept(")")) {
+            if (*src == 0) error("unterminated rewrite", NULL);
+            if (count == 16) error("too many operands", NULL);
+
+            args[count++] = parse_build(b, false);
+        }
+
+        const char* extra = node_extra(type, count ? args[0] : NULL);
+        char* k = format("k%d", b->tmp++);
+        emit(b, "TB_Node* %s = tb_alloc_node(f, %s, n->dt, %d, %s);\n", k, type, count + 1, extra);
+        for (int i = 0; i < count; i++) {
+            emit(b, "set_input(p, %s, %s, %d);\n", k, args[i], i + 1);
+        }
+
+        if (strncmp(type, "TB_CMP_", 7) == 0) {
+            emit(b, "TB_NODE_SET_EXTRA(%s, TB_NodeCompare, .cmp_dt = %s->dt);\n", k, args[0]);
+        }
+
+        // the root gets marked by the peephole loop
+        if (!is_root) {
+            emit(b, "tb_pass_mark(p, %s);\n", k);
+        }
+        return k;
+    } else if (accept("#{")) {
+        char* k = format("k%d", b->tmp++);
+        emit(b, "TB_Node* %s = make_int_node(f, p, n->dt, %s);\n", k, lex_braces());
+        emit(b, "tb_pass_mark(p, %s);\n", k);
+        return k;
+    } else if (accept("{")) {
+        return format("(%s)", lex_braces());
+    } else {
+        char* name = lex_ident();
+        if (!is_bound(name)) error("unbound name: ", name);
+        return name;
+    }
+}
+
+static void parse_rule(void) {
+    if (rule_count == MAX_RULES) error("too many rules", NULL);
+
+    Rule* r = &rules[rule_count++];
+    r->line = line;
+    name_count = 0;
+
+    bind("n");
+    parse_pattern(r, "n", true);
+    expect("=>");
+
+    // we parse the guard before building anything, it'll go first
+    skip_space(false);
+    char* rhs = src;
+    int depth = 0;
+    while (*src && *src != '\n') {
+        if (*src == '(' || *src == '{') depth++;
+        if (*src == ')' || *src == '}') depth--;
+        if (depth == 0 && strncmp(src, " if ", 4) == 0) break;
+        src++;
+    }
+    char* rhs_end = src;
+
+    if (strncmp(src, " if ", 4) == 0) {
+        src += 4;
+
+        const char* start = src;
+        while (*src && *src != '\n') src++;
+
+        // trim
+        const char* end = src;
+        while (end > start && isspace((unsigned char) end[-1])) end--;
+        while (start < end && isspace((unsigned char) *start)) start++;
+        push_step(r, format("%.*s", (int) (end - start), start), NULL);
+    }
+    char* after = src;
+
+    // now build the rewrite
+    char saved = *rhs_end;
+    *rhs_end = 0;
+    src = rhs;
+    skip_space(false);
+
+    Builder b = { 0 };
+    if (*src == '(') {
+        r->is_ideal = true;
+
+        char* k = parse_build(&b, true);
+        emit(&b, "return %s;\n", k);
+    } else {
+        emit(&b, "return %s;\n", parse_build(&b, false));
+    }
+
+    skip_space(false);
+    if (*src != 0) error("junk after rewrite: ", src);
+
+    *rhs_end = saved;
+    src = after;
+    r->result = format("%s", b.buf);
+}
+
+////////////////////////////////
+// Decision trees
+////////////////////////////////
+static Tree* new_tree(Step step) {
+    Tree* t = calloc(1, sizeof(Tree));
+    t->step = step;
+    return t;
+}
+
+static bool same_step(Step* a, Step* b) {
+    #define SAME_STR(x, y) ((x) == NULL ? (y) == NULL : (y) != NULL && strcmp(x, y) == 0)
+    return SAME_STR(a->text, b->text) && SAME_STR(a->decl, b->decl);
+    #undef SAME_STR
+}
+
+static void tree_insert(Tree* t, Rule* r) {
+    for (int i = 0; i < r->step_count; i++) {
+        // only the last kid is a candidate, merging with an earlier one would move
+        // this rule ahead of the ones in between.
+        Tree* last = t->kid_count ? t->kids[t->kid_count - 1] : NULL;
+        if (last != NULL && last->rule == NULL && same_step(&last->step, &r->steps[i])) {
+            t = last;
+            continue;
+        }
+
+        Tree* kid = new_tree(r->steps[i]);
+        if (t->kid_count == t->kid_cap) {
+            t->kid_cap = t->kid_cap ? t->kid_cap * 2 : 4;
+            t->kids = realloc(t->kids, t->kid_cap * sizeof(Tree*));
+        }
+        t->kids[t->kid_count++] = kid;
+        t = kid;
+    }
+
+    // leaf
+    Tree* leaf = new_tree((Step){ 0 });
+    leaf->rule = r;
+    if (t->kid_count == t->kid_cap) {
+        t->kid_cap = t->kid_cap ? t->kid_cap * 2 : 4;
+        t->kids = realloc(t->kids, t->kid_cap * sizeof(Tree*));
+    }
+    t->kids[t->kid_count++] = leaf;
+}
+
+static void indent(FILE* out, int depth) {
+    fprintf(out, "%*s", 8 + depth*4, "");
+}
+
+static void tree_emit(FILE* out, Tree* t, int depth) {
+    for (int i = 0; i < t->kid_count; i++) {
+        Tree* kid = t->kids[i];
+        if (kid->rule) {
+            indent(out, depth), fprintf(out, "// %s:%d\n", path, kid->rule->line);
+
+            for (const char* s = kid->rule->result; *s;) {
+                const char* end = strchr(s, '\n');
+                indent(out, depth), fprintf(out, "%.*s\n", (int) (end - s), s);
+                s = end + 1;
+            }
+            continue;
+        }
+
+        int opened = 0;
+        if (kid->step.decl) {
+            indent(out, depth), fprintf(out, "{\n");
+            indent(out, depth + 1), fprintf(out, "%s\n", kid->step.decl);
+            depth++, opened++;
+        }
+
+        if (kid->step.text) {
+            indent(out, depth), fprintf(out, "if (%s) {\n", kid->step.text);
+            depth++, opened++;
+        }
+
+        tree_emit(out, kid, depth);
+
+        while (opened--) {
+            depth--;
+            indent(out, depth), fprintf(out, "}\n");
+        }
+    }
+}
+
+static void emit_matcher(FILE* out, const char* name, bool is_ideal, const char* fail) {
+    fprintf(out, "static TB_Node* %s(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {\n", name);
+    fprintf(out, "    switch (n->type) {\n");
+
+    bool* done = calloc(rule_count, sizeof(bool));
+    for (int i = 0; i < rule_count; i++) {
+        if (done[i] || rules[i].is_ideal != is_ideal) continue;
+
+        // every rule with the same root goes into one tree, their relative
+        // order doesn't change.
+        Tree* root = new_tree((Step){ 0 });
+        for (int j = i; j < rule_count; j++) {
+            if (!done[j] && rules[j].is_ideal == is_ideal && strcmp(rules[j].op, rules[i].op) == 0) {
+                tree_insert(root, &rules[j]);
+                done[j] = true;
+            }
+        }
+
+        fprintf(out, "        case %s: {\n", rules[i].op);
+        tree_emit(out, root, 1);
+        fprintf(out, "            break;\n");
+        fprintf(out, "        }\n\n");
+    }
+    free(done);
+
+    fprintf(out, "        default: break;\n");
+    fprintf(out, "    }\n\n");
+    fprintf(out, "    return %s;\n", fail);
+    fprintf(out, "}\n\n");
+}
+
+int main(int argc, char** argv) {
+    path = argc > 1 ? argv[1] : "tb/src/opt/peeps.txt";
+    const char* out_path = argc > 2 ? argv[2] : "tb/src/opt/peeps.h";
+
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "error: could not open %s\n", path);
+        return 1;
+    }
+
+    fseek(in, 0, SEEK_END);
+    size_t len = ftell(in);
+    rewind(in);
+
+    src = malloc(len + 1);
+    src[fread(src, 1, len, in)] = 0;
+    fclose(in);
+
+    for (;;) {
+        skip_space(true);
+        if (*src == 0) break;
+
+        parse_rule();
+    }
+
+    FILE* out = fopen(out_path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "error: could not open %s\n", out_path);
+        return 1;
+    }
+
+    fprintf(out, "// Auto-generated with peepgen.c from %s, don't edit!\n\n", path);
+    emit_matcher(out, "peep_identity", false, "n");
+    emit_matcher(out, "peep_ideal", true, "NULL");
+    fclose(out);
+    return 0;
+}
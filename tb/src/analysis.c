@@ -114,12 +114,23 @@ TB_API void tb_free_dominance_frontiers(TB_Function* f, TB_DominanceFrontiers fr
 
 // https://www.cs.rice.edu/~keith/EMBED/dom.pdf
 void tb_compute_dominators(TB_Function* f, TB_PostorderWalk order) {
-    // entrypoint dominates itself
     DomContext ctx = { .f = f, .order = order };
 
     // identify post order traversal order
     int entry_dom = ctx.order.count - 1;
 
+    // start from a clean slate, stale doms would look like processed nodes
+    FOREACH_N(i, 0, ctx.order.count) {
+        TB_NodeRegion* r = TB_NODE_GET_EXTRA(ctx.order.traversal[i]);
+        r->dom_depth = -1; // unresolved
+        r->dom = NULL;
+    }
+
+    // entry dominates itself
+    TB_NodeRegion* entry = TB_NODE_GET_EXTRA(f->start_node);
+    entry->dom_depth = 0;
+    entry->dom = f->start_node;
+
     bool changed = true;
     while (changed) {
         changed = false;
@@ -127,37 +138,41 @@ void tb_compute_dominators(TB_Function* f, TB_PostorderWalk order) {
         // for all nodes, b, in reverse postorder (except start node)
         FOREACH_REVERSE_N(i, 0, ctx.order.count - 1) {
             TB_Node* b = ctx.order.traversal[i];
-            TB_Node* new_idom = find_region(b->inputs[0]);
+            TB_Node* new_idom = NULL;
 
-            // for all other predecessors, p, of b
-            FOREACH_N(j, 1, b->input_count) {
+            // for all predecessors, p, of b
+            FOREACH_N(j, 0, b->input_count) {
                 TB_Node* p = find_region(b->inputs[j]);
 
-                // if doms[p] already calculated
-                TB_Node* idom_p = TB_NODE_GET_EXTRA_T(p, TB_NodeRegion)->dom;
-                if (idom_p == NULL && p->input_count > 0) {
-                    int a = try_find_traversal_index(&ctx, p);
-                    if (a >= 0) {
-                        int b = find_traversal_index(&ctx, new_idom);
-                        while (a != b) {
-                            // while (finger1 < finger2)
-                            //   finger1 = doms[finger1]
-                            while (a < b) {
-                                TB_Node* d = idom(ctx.order.traversal[a]);
-                                a = d ? find_traversal_index(&ctx, d) : entry_dom;
-                            }
-
-                            // while (finger2 < finger1)
-                            //   finger2 = doms[finger2]
-                            while (b < a) {
-                                TB_Node* d = idom(ctx.order.traversal[b]);
-                                b = d ? find_traversal_index(&ctx, d) : entry_dom;
-                            }
-                        }
-
-                        new_idom = ctx.order.traversal[a];
+                // if doms[p] already calculated (unreachable preds never are)
+                int a = try_find_traversal_index(&ctx, p);
+                if (a < 0 || TB_NODE_GET_EXTRA_T(p, TB_NodeRegion)->dom == NULL) {
+                    continue;
+                }
+
+                if (new_idom == NULL) {
+                    new_idom = p;
+                    continue;
+                }
+
+                int b = find_traversal_index(&ctx, new_idom);
+                while (a != b) {
+                    // while (finger1 < finger2)
+                    //   finger1 = doms[finger1]
+                    while (a < b) {
+                        TB_Node* d = idom(ctx.order.traversal[a]);
+                        a = d ? find_traversal_index(&ctx, d) : entry_dom;
+                    }
+
+                    // while (finger2 < finger1)
+                    //   finger2 = doms[finger2]
+                    while (b < a) {
+                        TB_Node* d = idom(ctx.order.traversal[b]);
+                        b = d ? find_traversal_index(&ctx, d) : entry_dom;
                     }
                 }
+
+                new_idom = ctx.order.traversal[a];
             }
 
             assert(new_idom != NULL);
@@ -0,0 +1,371 @@
+// Block layout
+//
+// branch probabilities come from the TB_BRANCH if someone gave us any (builtin
+// expect, profiles), otherwise we guess from the CFG: paths which die in an
+// unreachable or trap are cold and staying inside a loop is likely. Those give
+// us rough block frequencies and from there we build fallthrough chains bottom
+// up (Pettis & Hansen), hottest edges first. The chains get placed entry first
+// and the cold ones go at the end of the function.
+//
+// isel is lazy about values and GCM will schedule the operands of a phi in the
+// join, so a block must always be placed after its forward predecessors (any
+// topological order like RPO works). We only append a block to a chain which
+// already holds all of those, which means no loop rotation but also that placing
+// chain heads in topological order can't get stuck.
+#define LAYOUT_PROB_COLD   0.05f   // edges this unlikely are kept out of line
+#define LAYOUT_PROB_NEVER  0.001f  // paths into unreachable & traps
+#define LAYOUT_PROB_LOOP   0.9f    // staying in the loop
+#define LAYOUT_LOOP_SCALE  8.0f    // trip count guess for the frequencies
+
+typedef struct {
+    int src, dst;
+    float w;
+} LayoutEdge;
+
+typedef struct {
+    size_t count;
+    TB_Node** blocks; // postorder
+
+    int* id;          // TB_Node.gvn -> postorder index (-1 if it's not a reachable block)
+    int* loop;        // innermost loop header, -1 if not in a loop
+    int* loop_parent; // enclosing loop of a header
+} Layout;
+
+static int layout_id(Layout* l, TB_Node* bb) {
+    return l->id[bb->gvn];
+}
+
+static TB_NodeBranch* layout_branch(TB_Node* bb) {
+    TB_Node* end = TB_NODE_GET_EXTRA_T(bb, TB_NodeRegion)->end;
+    return end->type == TB_BRANCH ? TB_NODE_GET_EXTRA(end) : NULL;
+}
+
+// walks through a few gotos to see if we're about to crash anyways
+static bool layout_dead_end(TB_Node* bb) {
+    FOREACH_N(i, 0, 4) {
+        TB_Node* end = TB_NODE_GET_EXTRA_T(bb, TB_NodeRegion)->end;
+        if (end->type == TB_UNREACHABLE || end->type == TB_TRAP) {
+            return true;
+        }
+
+        TB_NodeBranch* br = layout_branch(bb);
+        if (br == NULL || br->succ_count != 1) break;
+        bb = br->succ[0];
+    }
+
+    return false;
+}
+
+static bool layout_in_loop(Layout* l, int bb, int header) {
+    for (int x = l->loop[bb]; x >= 0; x = l->loop_parent[x]) {
+        if (x == header) return true;
+    }
+    return false;
+}
+
+static bool layout_is_backedge(Layout* l, int bb, int pred) {
+    return tb_is_dominated_by(l->blocks[bb], l->blocks[pred]);
+}
+
+// outermost loop we've found so far which holds bb
+static int layout_loop_top(Layout* l, int bb) {
+    int x = l->loop[bb];
+    if (x < 0) return bb;
+
+    while (l->loop_parent[x] >= 0) x = l->loop_parent[x];
+    return x;
+}
+
+static void layout_push_preds(Layout* l, DynArray(int)* stack, int bb) {
+    TB_Node* n = l->blocks[bb];
+    if (n->type != TB_REGION) return;
+
+    FOREACH_N(i, 0, n->input_count) {
+        int pred = layout_id(l, tb_get_parent_region(n->inputs[i]));
+        if (pred >= 0) dyn_array_put(*stack, pred);
+    }
+}
+
+// natural loops, inner headers come first in postorder so they claim blocks first
+static void layout_find_loops(Layout* l) {
+    DynArray(int) stack = dyn_array_create(int, 16);
+    FOREACH_N(h, 0, l->count) {
+        TB_Node* header = l->blocks[h];
+        if (header->type != TB_REGION) continue;
+
+        FOREACH_N(i, 0, header->input_count) {
+            int pred = layout_id(l, tb_get_parent_region(header->inputs[i]));
+            if (pred >= 0 && layout_is_backedge(l, h, pred)) {
+                dyn_array_put(stack, pred);
+            }
+        }
+
+        if (dyn_array_length(stack) == 0) continue;
+        l->loop[h] = h;
+
+        while (dyn_array_length(stack) > 0) {
+            int x = stack[dyn_array_length(stack) - 1];
+            dyn_array_pop(stack);
+            if (x == h) continue;
+
+            if (l->loop[x] < 0) {
+                l->loop[x] = h;
+                layout_push_preds(l, &stack, x);
+            } else {
+                // part of an inner loop, that whole loop is nested in us
+                int top = layout_loop_top(l, x);
+                if (top != h) {
+                    l->loop_parent[top] = h;
+                    layout_push_preds(l, &stack, top);
+                }
+            }
+        }
+    }
+    dyn_array_destroy(stack);
+}
+
+static int layout_find(int* chain, int x) {
+    while (chain[x] != x) {
+        chain[x] = chain[chain[x]];
+        x = chain[x];
+    }
+    return x;
+}
+
+// every forward edge into bb comes from chain c
+static bool layout_preds_in_chain(Layout* l, int* chain, int bb, int c) {
+    TB_Node* n = l->blocks[bb];
+    if (n->type != TB_REGION) return true;
+
+    FOREACH_N(i, 0, n->input_count) {
+        int pred = layout_id(l, tb_get_parent_region(n->inputs[i]));
+        if (pred >= 0 && !layout_is_backedge(l, bb, pred) && layout_find(chain, pred) != c) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// every forward edge into bb comes from a placed block, before limit
+static bool layout_preds_placed(Layout* l, int* pos, int bb, int limit) {
+    TB_Node* n = l->blocks[bb];
+    if (n->type != TB_REGION) return true;
+
+    FOREACH_N(i, 0, n->input_count) {
+        int pred = layout_id(l, tb_get_parent_region(n->inputs[i]));
+        if (pred >= 0 && !layout_is_backedge(l, bb, pred) && (pos[pred] < 0 || pos[pred] >= limit)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static float layout_prob(Layout* l, int bb, TB_NodeBranch* br, int j) {
+    if (br->probs) {
+        return br->probs[j];
+    }
+
+    if (br->succ_count != 2) {
+        return 1.0f / br->succ_count;
+    }
+
+    // guess the odds of the true case
+    float p = 0.5f;
+    bool cold0 = layout_dead_end(br->succ[0]);
+    bool cold1 = layout_dead_end(br->succ[1]);
+    if (cold0 != cold1) {
+        p = cold0 ? LAYOUT_PROB_NEVER : 1.0f - LAYOUT_PROB_NEVER;
+    } else if (l->loop[bb] >= 0) {
+        int s0 = layout_id(l, br->succ[0]), s1 = layout_id(l, br->succ[1]);
+        bool in0 = s0 >= 0 && layout_in_loop(l, s0, l->loop[bb]);
+        bool in1 = s1 >= 0 && layout_in_loop(l, s1, l->loop[bb]);
+        if (in0 != in1) {
+            p = in0 ? LAYOUT_PROB_LOOP : 1.0f - LAYOUT_PROB_LOOP;
+        }
+    }
+
+    return j == 0 ? p : 1.0f - p;
+}
+
+static int layout_edge_cmp(const void* a, const void* b) {
+    const LayoutEdge* x = a;
+    const LayoutEdge* y = b;
+    if (x->w != y->w) return x->w > y->w ? -1 : 1;
+
+    // ties go in reverse postorder so the result doesn't depend on qsort
+    if (x->src != y->src) return y->src - x->src;
+    return y->dst - x->dst;
+}
+
+static Layout layout_create(TB_Function* f, TB_PostorderWalk* order) {
+    size_t count = order->count;
+    Layout l = {
+        .count = count,
+        .blocks = order->traversal,
+        .id = tb_arena_alloc(tmp_arena, f->node_count * sizeof(int)),
+        .loop = tb_arena_alloc(tmp_arena, count * sizeof(int)),
+        .loop_parent = tb_arena_alloc(tmp_arena, count * sizeof(int)),
+    };
+    memset(l.id, 0xFF, f->node_count * sizeof(int));
+    memset(l.loop, 0xFF, count * sizeof(int));
+    memset(l.loop_parent, 0xFF, count * sizeof(int));
+    FOREACH_N(i, 0, count) {
+        l.id[order->traversal[i]->gvn] = i;
+    }
+
+    layout_find_loops(&l);
+    return l;
+}
+
+// how many loops each block is nested in (indexed by TB_Node.gvn), it has to be a
+// fresh postorder since block_layout has already reordered the codegen one.
+static int* block_loop_depths(TB_Function* f) {
+    int* depths = tb_arena_alloc(tmp_arena, f->node_count * sizeof(int));
+    memset(depths, 0, f->node_count * sizeof(int));
+
+    TB_PostorderWalk order = tb_function_get_postorder(f);
+    Layout l = layout_create(f, &order);
+    FOREACH_N(i, 0, l.count) {
+        int d = 0;
+        for (int x = l.loop[i]; x >= 0; x = l.loop_parent[x]) d++;
+        depths[l.blocks[i]->gvn] = d;
+    }
+
+    tb_function_free_postorder(&order);
+    return depths;
+}
+
+static void block_layout(TB_Function* f, TB_PostorderWalk* order) {
+    size_t count = order->count;
+    if (count <= 2) return;
+
+    TB_Node* stop_bb = tb_get_parent_region(f->stop_node);
+    Layout l = layout_create(f, order);
+
+    int entry = count - 1;
+    int stop = layout_id(&l, stop_bb);
+
+    // estimate frequencies in reverse postorder, backedges are accounted
+    // for by scaling the loop headers.
+    float* freq = tb_arena_alloc(tmp_arena, count * sizeof(float));
+    bool* cold = tb_arena_alloc(tmp_arena, count * sizeof(bool));
+    FOREACH_REVERSE_N(i, 0, count) {
+        TB_Node* bb = l.blocks[i];
+        if (i == entry) {
+            freq[i] = 1.0f;
+            cold[i] = false;
+            continue;
+        }
+
+        float sum = 0.0f;
+        bool all_cold = true;
+        FOREACH_N(k, 0, bb->input_count) {
+            int pred = layout_id(&l, tb_get_parent_region(bb->inputs[k]));
+            if (pred < 0 || layout_is_backedge(&l, i, pred)) continue;
+
+            // irreducible bits might not have been visited yet, they stay hot
+            float p = 0.0f;
+            TB_NodeBranch* br = layout_branch(l.blocks[pred]);
+            if (br != NULL && pred > i) {
+                FOREACH_N(j, 0, br->succ_count) {
+                    if (br->succ[j] == bb) p += layout_prob(&l, pred, br, j);
+                }
+
+                sum += freq[pred] * p;
+                if (!cold[pred] && p > LAYOUT_PROB_COLD) all_cold = false;
+            } else {
+                all_cold = false;
+            }
+        }
+
+        freq[i] = l.loop[i] == i ? sum * LAYOUT_LOOP_SCALE : sum;
+        cold[i] = all_cold;
+    }
+
+    // chains start out as single blocks
+    int* chain = tb_arena_alloc(tmp_arena, count * sizeof(int));
+    int* head = tb_arena_alloc(tmp_arena, count * sizeof(int));
+    int* tail = tb_arena_alloc(tmp_arena, count * sizeof(int));
+    int* next = tb_arena_alloc(tmp_arena, count * sizeof(int));
+    FOREACH_N(i, 0, count) {
+        chain[i] = head[i] = tail[i] = i;
+        next[i] = -1;
+    }
+
+    DynArray(LayoutEdge) edges = dyn_array_create(LayoutEdge, count * 2);
+    FOREACH_N(i, 0, count) {
+        TB_NodeBranch* br = layout_branch(l.blocks[i]);
+        if (br == NULL) continue;
+
+        FOREACH_N(j, 0, br->succ_count) {
+            int dst = layout_id(&l, br->succ[j]);
+            // the stop block always goes last and nothing falls into the entry
+            if (dst < 0 || dst == entry || dst == stop || dst == i) continue;
+            // hot and cold code never share a chain
+            if (cold[i] != cold[dst]) continue;
+
+            LayoutEdge e = { i, dst, freq[i] * layout_prob(&l, i, br, j) };
+            dyn_array_put(edges, e);
+        }
+    }
+    qsort(edges, dyn_array_length(edges), sizeof(LayoutEdge), layout_edge_cmp);
+
+    dyn_array_for(i, edges) {
+        int a = layout_find(chain, edges[i].src);
+        int b = layout_find(chain, edges[i].dst);
+        if (a != b && tail[a] == edges[i].src && head[b] == edges[i].dst &&
+            layout_preds_in_chain(&l, chain, edges[i].dst, a)) {
+            next[edges[i].src] = edges[i].dst;
+            chain[b] = a;
+            tail[a] = tail[b];
+        }
+    }
+    dyn_array_destroy(edges);
+
+    // place chains in reverse postorder, hot ones first. a chain can only
+    // go down once the predecessors of its head have.
+    int* pos = tb_arena_alloc(tmp_arena, count * sizeof(int));
+    TB_Node** layout = tb_arena_alloc(tmp_arena, count * sizeof(TB_Node*));
+    memset(pos, 0xFF, count * sizeof(int));
+
+    size_t placed = 0;
+    FOREACH_N(pass, 0, 2) {
+        bool progress = true;
+        while (progress) {
+            progress = false;
+            FOREACH_REVERSE_N(i, 0, count) {
+                if (pos[i] >= 0 || i == stop || head[layout_find(chain, i)] != i) continue;
+                if (pass == 0 && cold[i]) continue;
+                if (i != entry && !layout_preds_placed(&l, pos, i, INT_MAX)) continue;
+
+                for (int x = i; x >= 0; x = next[x]) {
+                    pos[x] = placed;
+                    layout[placed++] = l.blocks[x];
+                }
+                progress = true;
+            }
+        }
+    }
+
+    if (stop >= 0) {
+        pos[stop] = placed;
+        layout[placed++] = stop_bb;
+    }
+
+    if (placed != count) {
+        DO_IF(TB_OPTDEBUG_LAYOUT)(log_debug("%s: couldn't place every chain, keeping RPO", f->super.name));
+        return;
+    }
+
+    FOREACH_N(i, 0, count) {
+        if (i != entry && !layout_preds_placed(&l, pos, i, pos[i])) {
+            DO_IF(TB_OPTDEBUG_LAYOUT)(log_debug("%s: layout isn't topological, keeping RPO", f->super.name));
+            return;
+        }
+    }
+
+    // codegen walks the postorder backwards
+    FOREACH_N(i, 0, count) {
+        order->traversal[count - 1 - i] = layout[i];
+    }
+}
@@ -0,0 +1,621 @@
+// Function-level codegen cache, the key is a canonical serialization of the final
+// IR graph (nodes are numbered in DFS order so addresses don't matter) along with
+// the target and the function prototype. Each entry stores the key itself so a
+// hash collision can't hand back the wrong code.
+//
+// Symbols in the IR are referred to by their first use in the walk, on a hit
+// the patches get mapped back onto whatever symbols the current IR points at.
+#include "tb_internal.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#define tb__mkdir(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define tb__mkdir(path) mkdir(path, 0755)
+#endif
+
+enum {
+    CG_CACHE_MAGIC   = 0x47434254, // "TBCG"
+    // bump whenever the codegen or the entry layout changes
+    CG_CACHE_VERSION = 5,
+};
+
+// how the patches refer to their targets
+enum {
+    CG_PATCH_IR_SYMBOL, // index into TB_CacheKey.syms
+    CG_PATCH_CHKSTK,
+    CG_PATCH_SMALL_CONST,
+};
+
+struct TB_CacheKey {
+    DynArray(uint8_t) bytes;
+    uint64_t hash;
+
+    // nodes in the order they got numbered
+    DynArray(TB_Node*) nodes;
+    NL_Map(TB_Node*, uint32_t) ids;
+
+    // every symbol the IR refers to, in order of first use
+    DynArray(const TB_Symbol*) syms;
+    // every variable attribute in order of appearance
+    DynArray(TB_Attrib*) vars;
+};
+
+static uint64_t cg_cache_fnv1a(const void* data, size_t len) {
+    const uint8_t* p = data;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void key_put(DynArray(uint8_t)* buf, const void* data, size_t len) {
+    size_t old = dyn_array_length(*buf);
+    dyn_array_put_uninit(*buf, len);
+    memcpy(&(*buf)[old], data, len);
+}
+
+#define KEY_PUT(buf, T, ...) key_put(buf, &(T){ __VA_ARGS__ }, sizeof(T))
+
+static void key_put_str(DynArray(uint8_t)* buf, const char* str) {
+    uint32_t len = str ? strlen(str) : 0;
+    KEY_PUT(buf, uint32_t, len);
+    key_put(buf, str, len);
+}
+
+// the paths aren't NULL terminated
+static void key_put_file(DynArray(uint8_t)* buf, TB_SourceFile* file) {
+    uint32_t len = file ? file->len : 0;
+    KEY_PUT(buf, uint32_t, len);
+    if (file) key_put(buf, file->path, len);
+}
+
+static void key_discover(TB_CacheKey* k, DynArray(TB_Node*)* stack, TB_Node* n) {
+    if (n != NULL && nl_map_get(k->ids, n) < 0) {
+        nl_map_put(k->ids, n, dyn_array_length(k->nodes));
+        dyn_array_put(k->nodes, n);
+        dyn_array_put(*stack, n);
+    }
+}
+
+static uint32_t key_node_id(TB_CacheKey* k, TB_Node* n) {
+    ptrdiff_t search = n ? nl_map_get(k->ids, n) : -1;
+    return search >= 0 ? k->ids[search].v : UINT32_MAX;
+}
+
+static uint32_t key_sym_id(TB_CacheKey* k, const TB_Symbol* s) {
+    dyn_array_for(i, k->syms) {
+        if (k->syms[i] == s) return i;
+    }
+
+    dyn_array_put(k->syms, s);
+    return dyn_array_length(k->syms) - 1;
+}
+
+static void key_put_proto(DynArray(uint8_t)* buf, const TB_FunctionPrototype* proto) {
+    if (proto == NULL) {
+        KEY_PUT(buf, uint32_t, UINT32_MAX);
+        return;
+    }
+
+    KEY_PUT(buf, uint32_t, proto->call_conv);
+    KEY_PUT(buf, uint32_t, proto->param_count | (proto->return_count << 16));
+    KEY_PUT(buf, uint8_t, proto->has_varargs);
+    FOREACH_N(i, 0, proto->param_count + proto->return_count) {
+        KEY_PUT(buf, uint32_t, proto->params[i].dt.raw);
+    }
+}
+
+TB_CacheKey* tb__cg_cache_key(TB_Function* f) {
+    TB_Module* m = f->super.module;
+
+    // the safepoint tables aren't in the entries
+    if (f->safepoint_count > 0) {
+        return NULL;
+    }
+
+    TB_CacheKey* k = tb_platform_heap_alloc(sizeof(TB_CacheKey));
+    *k = (TB_CacheKey){ 0 };
+    k->bytes = dyn_array_create(uint8_t, 4096);
+    k->nodes = dyn_array_create(TB_Node*, f->node_count);
+    k->syms = dyn_array_create(const TB_Symbol*, 16);
+    k->vars = dyn_array_create(TB_Attrib*, 16);
+    nl_map_create(k->ids, f->node_count);
+
+    DynArray(uint8_t)* buf = &k->bytes;
+    KEY_PUT(buf, uint32_t, CG_CACHE_VERSION);
+    KEY_PUT(buf, uint32_t, m->target_arch);
+    KEY_PUT(buf, uint32_t, m->target_system);
+    KEY_PUT(buf, uint32_t, m->target_abi);
+    KEY_PUT(buf, uint8_t, m->is_jit);
+    KEY_PUT(buf, uint8_t, m->isel_mode);
+    key_put(buf, &m->features, sizeof(m->features));
+    key_put_proto(buf, f->prototype);
+
+    // number the nodes, anything codegen could reach is a root
+    DynArray(TB_Node*) stack = dyn_array_create(TB_Node*, 64);
+    key_discover(k, &stack, f->start_node);
+    key_discover(k, &stack, f->stop_node);
+    while (dyn_array_length(stack)) {
+        TB_Node* n = dyn_array_pop(stack);
+        FOREACH_N(i, 0, n->input_count) {
+            key_discover(k, &stack, n->inputs[i]);
+        }
+
+        switch (n->type) {
+            case TB_START: case TB_REGION:
+            key_discover(k, &stack, TB_NODE_GET_EXTRA_T(n, TB_NodeRegion)->end);
+            break;
+
+            case TB_BRANCH: {
+                TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
+                FOREACH_N(i, 0, br->succ_count) key_discover(k, &stack, br->succ[i]);
+                break;
+            }
+
+            case TB_MULPAIR: {
+                TB_NodeMulPair* mp = TB_NODE_GET_EXTRA(n);
+                key_discover(k, &stack, mp->lo);
+                key_discover(k, &stack, mp->hi);
+                break;
+            }
+
+            case TB_CALL: case TB_SYSCALL: {
+                size_t proj_count = (n->extra_count - sizeof(TB_NodeCall)) / sizeof(TB_Node*);
+                TB_NodeCall* c = TB_NODE_GET_EXTRA(n);
+                FOREACH_N(i, 0, proj_count) key_discover(k, &stack, c->projs[i]);
+                break;
+            }
+
+            default: break;
+        }
+    }
+    dyn_array_destroy(stack);
+
+    // write out the nodes now that every ID is known
+    dyn_array_for(i, k->nodes) {
+        TB_Node* n = k->nodes[i];
+        KEY_PUT(buf, uint16_t, n->type);
+        KEY_PUT(buf, uint32_t, n->dt.raw);
+        KEY_PUT(buf, uint16_t, n->input_count);
+        FOREACH_N(j, 0, n->input_count) {
+            KEY_PUT(buf, uint32_t, key_node_id(k, n->inputs[j]));
+        }
+
+        switch (n->type) {
+            // the tag is just a name and the dominators are recomputed
+            case TB_START: case TB_REGION:
+            KEY_PUT(buf, uint32_t, key_node_id(k, TB_NODE_GET_EXTRA_T(n, TB_NodeRegion)->end));
+            break;
+
+            case TB_BRANCH: {
+                TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
+                KEY_PUT(buf, uint32_t, br->succ_count);
+                FOREACH_N(j, 0, br->succ_count) {
+                    KEY_PUT(buf, uint32_t, key_node_id(k, br->succ[j]));
+                }
+                if (br->succ_count > 1) {
+                    key_put(buf, br->keys, (br->succ_count - 1) * sizeof(int64_t));
+                }
+                // the block layout depends on these
+                KEY_PUT(buf, uint8_t, br->probs != NULL);
+                if (br->probs) {
+                    key_put(buf, br->probs, br->succ_count * sizeof(float));
+                }
+                break;
+            }
+
+            case TB_MULPAIR: {
+                TB_NodeMulPair* mp = TB_NODE_GET_EXTRA(n);
+                KEY_PUT(buf, uint32_t, key_node_id(k, mp->lo));
+                KEY_PUT(buf, uint32_t, key_node_id(k, mp->hi));
+                break;
+            }
+
+            case TB_CALL: case TB_SYSCALL: {
+                size_t proj_count = (n->extra_count - sizeof(TB_NodeCall)) / sizeof(TB_Node*);
+                TB_NodeCall* c = TB_NODE_GET_EXTRA(n);
+                key_put_proto(buf, c->proto);
+                KEY_PUT(buf, uint32_t, proj_count);
+                FOREACH_N(j, 0, proj_count) {
+                    KEY_PUT(buf, uint32_t, key_node_id(k, c->projs[j]));
+                }
+                break;
+            }
+
+            case TB_SYMBOL: {
+                const TB_Symbol* s = TB_NODE_GET_EXTRA_T(n, TB_NodeSymbol)->sym;
+                KEY_PUT(buf, uint32_t, key_sym_id(k, s));
+                KEY_PUT(buf, uint32_t, s->tag);
+                if (s->tag == TB_SYMBOL_GLOBAL) {
+                    // TLS globals are accessed differently
+                    KEY_PUT(buf, uint8_t, ((TB_Global*) s)->parent == &m->tls);
+                }
+                break;
+            }
+
+            case TB_MACHINE_OP: {
+                TB_NodeMachineOp* mach = TB_NODE_GET_EXTRA(n);
+                KEY_PUT(buf, uint64_t, mach->length);
+                key_put(buf, mach->data, mach->length);
+                KEY_PUT(buf, uint64_t, mach->outs);
+                KEY_PUT(buf, uint64_t, mach->ins);
+                KEY_PUT(buf, uint64_t, mach->tmps);
+                key_put(buf, mach->regs, (mach->outs + mach->ins + mach->tmps) * sizeof(TB_PhysicalReg));
+                break;
+            }
+
+            // no pointers in the rest
+            default:
+            KEY_PUT(buf, uint16_t, n->extra_count);
+            key_put(buf, n->extra, n->extra_count);
+            break;
+        }
+
+        // debug info changes the output too
+        KEY_PUT(buf, uint32_t, dyn_array_length(n->attribs));
+        dyn_array_for(j, n->attribs) {
+            TB_Attrib* a = &n->attribs[j];
+            KEY_PUT(buf, uint8_t, a->tag);
+            if (a->tag == TB_ATTRIB_LOCATION) {
+                key_put_file(buf, a->loc.file);
+                KEY_PUT(buf, int32_t, a->loc.line);
+                KEY_PUT(buf, int32_t, a->loc.column);
+            } else if (a->tag == TB_ATTRIB_VARIABLE) {
+                // the stack slots point at the variables, on a hit they're
+                // mapped back by index
+                dyn_array_put(k->vars, a);
+                key_put_str(buf, a->var.name);
+                KEY_PUT(buf, uint32_t, key_node_id(k, a->var.parent));
+            } else {
+                KEY_PUT(buf, uint32_t, key_node_id(k, a->scope.parent));
+            }
+        }
+    }
+
+    k->hash = cg_cache_fnv1a(k->bytes, dyn_array_length(k->bytes));
+    return k;
+}
+
+void tb__cg_cache_free(TB_CacheKey* k) {
+    dyn_array_destroy(k->bytes);
+    dyn_array_destroy(k->nodes);
+    dyn_array_destroy(k->syms);
+    dyn_array_destroy(k->vars);
+    nl_map_free(k->ids);
+    tb_platform_heap_free(k);
+}
+
+static void cg_cache_path(TB_Module* m, char* out, size_t cap, uint64_t hash) {
+    snprintf(out, cap, "%s/%016llx.tbc", m->codegen_cache, (unsigned long long) hash);
+}
+
+////////////////////////////////
+// Entry layout:
+//   magic, key_len, key bytes
+//   code_size, prologue, epilogue, stack_usage
+//   patches   (newest first, same as the list)
+//   locations (file path, line, col, pos)
+//   stack slots (position, variable index)
+//   code bytes
+//   fnv1a of everything before it
+////////////////////////////////
+typedef struct {
+    const uint8_t* data;
+    size_t pos, len;
+    bool failed;
+} CacheReader;
+
+static const void* cache_read(CacheReader* r, size_t len) {
+    if (r->failed || len > r->len - r->pos) {
+        r->failed = true;
+        return NULL;
+    }
+
+    const void* p = &r->data[r->pos];
+    r->pos += len;
+    return p;
+}
+
+#define X(T, name) \
+static T name(CacheReader* r) { \
+    T x = 0; \
+    const void* p = cache_read(r, sizeof(T)); \
+    if (p) memcpy(&x, p, sizeof(T)); \
+    return x; \
+}
+X(uint8_t,  cache_read_u8)
+X(uint32_t, cache_read_u32)
+X(int32_t,  cache_read_i32)
+X(uint64_t, cache_read_u64)
+#undef X
+
+bool tb__cg_cache_store(TB_Module* m, TB_CacheKey* k, TB_FunctionOutput* out) {
+    DynArray(uint8_t) buf = dyn_array_create(uint8_t, 256 + dyn_array_length(k->bytes) + out->code_size);
+    KEY_PUT(&buf, uint32_t, CG_CACHE_MAGIC);
+    KEY_PUT(&buf, uint32_t, dyn_array_length(k->bytes));
+    key_put(&buf, k->bytes, dyn_array_length(k->bytes));
+
+    KEY_PUT(&buf, uint32_t, out->code_size);
+    KEY_PUT(&buf, uint8_t, out->prologue_length);
+    KEY_PUT(&buf, uint8_t, out->epilogue_length);
+    KEY_PUT(&buf, uint64_t, out->stack_usage);
+
+    bool ok = true;
+    KEY_PUT(&buf, uint32_t, out->patch_count);
+    for (TB_SymbolPatch* p = out->last_patch; p && ok; p = p->prev) {
+        KEY_PUT(&buf, uint32_t, p->pos);
+
+        ptrdiff_t sym_id = -1;
+        dyn_array_for(i, k->syms) {
+            if (k->syms[i] == p->target) { sym_id = i; break; }
+        }
+
+        if (sym_id >= 0) {
+            KEY_PUT(&buf, uint8_t, CG_PATCH_IR_SYMBOL);
+            KEY_PUT(&buf, uint32_t, sym_id);
+        } else if (p->target == m->chkstk_extern) {
+            KEY_PUT(&buf, uint8_t, CG_PATCH_CHKSTK);
+        } else if (p->target->tag == TB_SYMBOL_GLOBAL) {
+            // codegen interns float constants into rdata
+            TB_Global* g = (TB_Global*) p->target;
+            if (g->parent != &m->rdata || g->size > 16 || g->obj_count != 1 || g->objects[0].type != TB_INIT_OBJ_REGION) {
+                ok = false;
+                break;
+            }
+
+            SmallConst c = { .len = g->size };
+            memcpy(c.data, g->objects[0].region.ptr, g->size);
+
+            mtx_lock(&m->lock);
+            ptrdiff_t search = nl_map_get(m->global_interns, c);
+            ok = search >= 0 && m->global_interns[search].v == g;
+            mtx_unlock(&m->lock);
+
+            KEY_PUT(&buf, uint8_t, CG_PATCH_SMALL_CONST);
+            KEY_PUT(&buf, uint8_t, c.len);
+            key_put(&buf, c.data, c.len);
+        } else {
+            ok = false;
+        }
+    }
+
+    KEY_PUT(&buf, uint32_t, dyn_array_length(out->locations));
+    dyn_array_for(i, out->locations) {
+        TB_Location* l = &out->locations[i];
+        key_put_file(&buf, l->file);
+        KEY_PUT(&buf, int32_t, l->line);
+        KEY_PUT(&buf, int32_t, l->column);
+        KEY_PUT(&buf, uint32_t, l->pos);
+    }
+
+    KEY_PUT(&buf, uint32_t, dyn_array_length(out->stack_slots));
+    dyn_array_for(i, out->stack_slots) {
+        TB_StackSlot* s = &out->stack_slots[i];
+
+        ptrdiff_t var_id = -1;
+        dyn_array_for(j, k->vars) {
+            if (k->vars[j]->var.name == s->name && k->vars[j]->var.storage == s->storage_type) { var_id = j; break; }
+        }
+
+        if (var_id < 0) {
+            ok = false;
+            break;
+        }
+
+        KEY_PUT(&buf, int32_t, s->position);
+        KEY_PUT(&buf, uint32_t, var_id);
+    }
+
+    key_put(&buf, out->code, out->code_size);
+    KEY_PUT(&buf, uint64_t, cg_cache_fnv1a(buf, dyn_array_length(buf)));
+
+    if (ok) {
+        // write it somewhere else first so nobody reads half an entry
+        char path[FILENAME_MAX], tmp_path[FILENAME_MAX];
+        cg_cache_path(m, path, sizeof(path), k->hash);
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%p.tmp", path, (void*) &buf);
+
+        FILE* file = fopen(tmp_path, "wb");
+        if (file != NULL) {
+            ok = fwrite(buf, dyn_array_length(buf), 1, file) == 1;
+            fclose(file);
+
+            if (!ok || rename(tmp_path, path) != 0) {
+                remove(tmp_path);
+                ok = false;
+            }
+        } else {
+            ok = false;
+        }
+    }
+
+    dyn_array_destroy(buf);
+    return ok;
+}
+
+static uint8_t* cg_cache_read_file(const char* path, size_t* out_len) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = len > 0 ? tb_platform_heap_alloc(len) : NULL;
+    if (data != NULL && fread(data, len, 1, file) != 1) {
+        tb_platform_heap_free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    *out_len = len;
+    return data;
+}
+
+bool tb__cg_cache_load(TB_Module* m, TB_CacheKey* k, TB_FunctionOutput* out, TB_CodeRegion* region) {
+    char path[FILENAME_MAX];
+    cg_cache_path(m, path, sizeof(path), k->hash);
+
+    size_t len;
+    uint8_t* data = cg_cache_read_file(path, &len);
+    if (data == NULL) {
+        return false;
+    }
+
+    CacheReader r = { data, 0, len };
+    size_t key_len = dyn_array_length(k->bytes);
+    if (len < sizeof(uint64_t) || cg_cache_fnv1a(data, len - sizeof(uint64_t)) != *(uint64_t*) &data[len - sizeof(uint64_t)] ||
+        cache_read_u32(&r) != CG_CACHE_MAGIC || cache_read_u32(&r) != key_len) {
+        goto fail;
+    }
+
+    const void* key = cache_read(&r, key_len);
+    if (key == NULL || memcmp(key, k->bytes, key_len) != 0) {
+        goto fail;
+    }
+
+    uint32_t code_size = cache_read_u32(&r);
+    uint8_t prologue = cache_read_u8(&r);
+    uint8_t epilogue = cache_read_u8(&r);
+    uint64_t stack_usage = cache_read_u64(&r);
+
+    // resolve the patches before touching the output, the list is newest first
+    uint32_t patch_count = cache_read_u32(&r);
+    if (patch_count > len) goto fail;
+
+    uint32_t* patch_pos = tb_platform_heap_alloc((patch_count + 1) * sizeof(uint32_t));
+    const TB_Symbol** patch_target = tb_platform_heap_alloc((patch_count + 1) * sizeof(TB_Symbol*));
+    FOREACH_N(i, 0, patch_count) {
+        patch_pos[i] = cache_read_u32(&r);
+
+        const TB_Symbol* target = NULL;
+        switch (cache_read_u8(&r)) {
+            case CG_PATCH_IR_SYMBOL: {
+                uint32_t id = cache_read_u32(&r);
+                target = id < dyn_array_length(k->syms) ? k->syms[id] : NULL;
+                break;
+            }
+
+            case CG_PATCH_CHKSTK:
+            target = m->chkstk_extern;
+            break;
+
+            case CG_PATCH_SMALL_CONST: {
+                uint8_t c_len = cache_read_u8(&r);
+                const void* c_data = c_len <= 16 ? cache_read(&r, c_len) : NULL;
+                if (c_data != NULL) {
+                    target = &tb__small_data_intern(m, c_len, c_data)->super;
+                }
+                break;
+            }
+        }
+
+        if (target == NULL || r.failed) {
+            tb_platform_heap_free(patch_pos);
+            tb_platform_heap_free(patch_target);
+            goto fail;
+        }
+        patch_target[i] = target;
+    }
+
+    uint32_t loc_count = cache_read_u32(&r);
+    DynArray(TB_Location) locations = dyn_array_create(TB_Location, loc_count < len ? loc_count : 0);
+    FOREACH_N(i, 0, loc_count) {
+        uint32_t path_len = cache_read_u32(&r);
+        const char* path_data = cache_read(&r, path_len);
+        if (r.failed) break;
+
+        TB_SourceFile* file = NULL;
+        if (path_len > 0) {
+            char file_path[FILENAME_MAX];
+            if (path_len >= FILENAME_MAX) { r.failed = true; break; }
+
+            memcpy(file_path, path_data, path_len);
+            file_path[path_len] = 0;
+            file = tb_get_source_file(m, file_path);
+        }
+
+        TB_Location l = { .file = file };
+        l.line = cache_read_i32(&r);
+        l.column = cache_read_i32(&r);
+        l.pos = cache_read_u32(&r);
+        dyn_array_put(locations, l);
+    }
+
+    uint32_t slot_count = cache_read_u32(&r);
+    DynArray(TB_StackSlot) stack_slots = dyn_array_create(TB_StackSlot, slot_count < len ? slot_count : 0);
+    FOREACH_N(i, 0, slot_count) {
+        int32_t position = cache_read_i32(&r);
+        uint32_t var_id = cache_read_u32(&r);
+        if (r.failed || var_id >= dyn_array_length(k->vars)) {
+            r.failed = true;
+            break;
+        }
+
+        TB_Attrib* a = k->vars[var_id];
+        TB_StackSlot s = { .position = position, .name = a->var.name, .storage_type = a->var.storage };
+        dyn_array_put(stack_slots, s);
+    }
+
+    const uint8_t* code = cache_read(&r, code_size);
+    if (r.failed) {
+        dyn_array_destroy(locations);
+        dyn_array_destroy(stack_slots);
+        tb_platform_heap_free(patch_pos);
+        tb_platform_heap_free(patch_target);
+        goto fail;
+    }
+
+    // same deal as the emitter, if it doesn't fit we get a fresh region
+    if (region->size + code_size >= region->capacity) {
+        TB_CodeRegion* new_region = tb_platform_valloc(CODE_REGION_BUFFER_SIZE);
+        if (new_region == NULL) tb_panic("could not allocate code region!");
+
+        new_region->capacity = CODE_REGION_BUFFER_SIZE - sizeof(TB_CodeRegion);
+        out->code_region = region = new_region;
+    }
+
+    out->code = &region->data[region->size];
+    out->code_size = code_size;
+    memcpy(out->code, code, code_size);
+
+    out->prologue_length = prologue;
+    out->epilogue_length = epilogue;
+    out->stack_usage = stack_usage;
+    out->locations = locations;
+    out->stack_slots = stack_slots;
+
+    FOREACH_REVERSE_N(i, 0, patch_count) {
+        tb_emit_symbol_patch(out, patch_target[i], patch_pos[i]);
+    }
+
+    tb_platform_heap_free(patch_pos);
+    tb_platform_heap_free(patch_target);
+    tb_platform_heap_free(data);
+    return true;
+
+    fail:
+    tb_platform_heap_free(data);
+    return false;
+}
+
+void tb_module_set_codegen_cache(TB_Module* m, const char* dir) {
+    if (dir == NULL) {
+        m->codegen_cache = NULL;
+        return;
+    }
+
+    // it's fine if it's already there
+    tb__mkdir(dir);
+    m->codegen_cache = tb__tb_arena_strdup(m, -1, dir);
+}
+
+void tb_module_get_codegen_cache_stats(TB_Module* m, size_t* out_hits, size_t* out_misses) {
+    *out_hits = m->codegen_cache_hits;
+    *out_misses = m->codegen_cache_misses;
+}
@@ -71,6 +71,11 @@ static int compare_symbols(const void* a, const void* b) {
     return (sym_a->ordinal > sym_b->ordinal) - (sym_a->ordinal < sym_b->ordinal);
 }
 
+// hot code first, cold code last and everything we've got no profile for in between
+static int heat_rank(TB_Heat heat) {
+    return heat == TB_HEAT_HOT ? 0 : heat == TB_HEAT_COLD ? 2 : 1;
+}
+
 static int compare_functions(const void* a, const void* b) {
     const TB_Function* sym_a = *(const TB_Function**) a;
     const TB_Function* sym_b = *(const TB_Function**) b;
@@ -79,6 +84,9 @@ static int compare_functions(const void* a, const void* b) {
     int diff = sym_a->comdat.type - sym_b->comdat.type;
     if (diff) return diff;
 
+    diff = heat_rank(sym_a->heat) - heat_rank(sym_b->heat);
+    if (diff) return diff;
+
     return (sym_a->super.ordinal > sym_b->super.ordinal) - (sym_a->super.ordinal < sym_b->super.ordinal);
 }
 
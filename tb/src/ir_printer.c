@@ -20,6 +20,7 @@ TB_API const char* tb_node_get_name(TB_Node* n) {
         case TB_LOCAL: return "local";
 
         case TB_VA_START: return "vastart";
+        case TB_VBROADCAST: return "vbroadcast";
         case TB_DEBUGBREAK: return "dbgbrk";
 
         case TB_POISON: return "poison";
@@ -97,6 +98,7 @@ TB_API const char* tb_node_get_name(TB_Node* n) {
 #define P(...) callback(user_data, __VA_ARGS__)
 static void tb_print_type(TB_DataType dt, TB_PrintCallback callback, void* user_data) {
     assert(dt.width < 8 && "Vector width too big!");
+    if (dt.width) P("v%d", 1 << dt.width);
 
     switch (dt.type) {
         case TB_INT: {
@@ -1,6 +1,10 @@
 #include "../tb_internal.h"
 #include "../host.h"
 
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
 size_t tb_helper_write_text_section(size_t write_pos, TB_Module* m, uint8_t* output, uint32_t pos);
 size_t tb_helper_write_data_section(size_t write_pos, TB_Module* m, uint8_t* output, uint32_t pos);
 size_t tb_helper_write_rodata_section(size_t write_pos, TB_Module* m, uint8_t* output, uint32_t pos);
@@ -162,7 +166,8 @@ static void* get_proc(TB_JIT* jit, const char* name) {
     nl_map_put_cstr(jit->loaded_funcs, name, addr);
     return addr;
     #else
-    return NULL;
+    // anything the compiler process itself has loaded (libc mostly)
+    return dlsym(RTLD_DEFAULT, name);
     #endif
 }
 
@@ -248,15 +253,7 @@ void* tb_jit_place_function(TB_JIT* jit, TB_Function* f) {
     return dst;
 }
 
-void* tb_jit_place_global(TB_JIT* jit, TB_Global* g) {
-    if (g->address != NULL) {
-        return g->address;
-    }
-
-    log_debug("jit: apply global %s", g->super.name ? g->super.name : "<unnamed>");
-    char* data = tb_jitheap_alloc_region(&jit->rw_heap, g->size);
-    g->address = data;
-
+static void jit_init_global(TB_JIT* jit, TB_Global* g, char* data) {
     memset(data, 0, g->size);
     FOREACH_N(k, 0, g->obj_count) {
         if (g->objects[k].type == TB_INIT_OBJ_REGION) {
@@ -266,16 +263,59 @@ void* tb_jit_place_global(TB_JIT* jit, TB_Global* g) {
 
     FOREACH_N(k, 0, g->obj_count) {
         if (g->objects[k].type == TB_INIT_OBJ_RELOC) {
-            uintptr_t addr = (uintptr_t) get_symbol_address(g->objects[k].reloc);
+            // the target might not have been placed yet
+            const TB_Symbol* target = g->objects[k].reloc;
+            if (target->tag == TB_SYMBOL_FUNCTION) {
+                tb_jit_place_function(jit, (TB_Function*) target);
+            } else if (target->tag == TB_SYMBOL_GLOBAL) {
+                tb_jit_place_global(jit, (TB_Global*) target);
+            }
 
+            uintptr_t addr = (uintptr_t) get_symbol_address(target);
             uintptr_t* dst = (uintptr_t*) &data[g->objects[k].offset];
             *dst += addr;
         }
     }
+}
+
+void* tb_jit_place_global(TB_JIT* jit, TB_Global* g) {
+    if (g->address != NULL) {
+        return g->address;
+    }
+
+    log_debug("jit: apply global %s", g->super.name ? g->super.name : "<unnamed>");
+    char* data = tb_jitheap_alloc_region(&jit->rw_heap, g->size);
+    g->address = data;
 
+    jit_init_global(jit, g, data);
     return data;
 }
 
+void* tb_jit_replace_function(TB_JIT* jit, TB_Function* old_f, TB_Function* new_f) {
+    char* dst = tb_jit_place_function(jit, new_f);
+    char* src = old_f->compiled_pos;
+    if (src != NULL && src != dst) {
+        log_debug("jit: replace function %s (%p -> %p)", new_f->super.name, src, dst);
+
+        // NOTE(NeGate): x64 only, regions are at least ALLOC_GRANULARITY
+        // bytes so there's always room for the jmp rel32.
+        int32_t rel32 = (intptr_t)dst - ((intptr_t)src + 5);
+        src[0] = 0xE9;
+        memcpy(&src[1], &rel32, sizeof(int32_t));
+    }
+
+    return dst;
+}
+
+void tb_jit_reinit_global(TB_JIT* jit, TB_Global* g) {
+    if (g->address == NULL) {
+        tb_jit_place_global(jit, g);
+    } else {
+        log_debug("jit: reinit global %s", g->super.name ? g->super.name : "<unnamed>");
+        jit_init_global(jit, g, g->address);
+    }
+}
+
 TB_JIT* tb_jit_begin(TB_Module* m, size_t jit_heap_capacity) {
     if (jit_heap_capacity == 0) {
         jit_heap_capacity = 2*1024*1024;
@@ -8,6 +8,7 @@
 #include "ir_printer.c"
 #include "exporter.c"
 #include "symbols.c"
+#include "codegen_cache.c"
 
 #include "bigint/BigInt.c"
 
@@ -33,10 +33,8 @@ static void transmute_goto(TB_Passes* restrict opt, TB_Function* f, TB_Node* br,
     tb_pass_mark(opt, dst);
     tb_pass_mark_users(opt, bb);
 
-    CUIK_TIMED_BLOCK("recompute order") {
-        tb_function_free_postorder(&opt->order);
-        opt->order = tb_function_get_postorder(f);
-    }
+    // the edges changed so the dominators did too
+    recompute_cfg(f, opt);
 }
 
 static TB_Node* ideal_phi(TB_Passes* restrict opt, TB_Function* f, TB_Node* n) {
@@ -47,7 +45,7 @@ static TB_Node* ideal_phi(TB_Passes* restrict opt, TB_Function* f, TB_Node* n) {
         // for now we'll leave multi-phi scenarios alone, we need
         // to come up with a cost-model around this stuff.
         int phi_count = 0;
-        for (User* use = find_users(opt, region); use; use = use->next) {
+        FOR_USERS(use, opt, region) {
             if (use->n->type == TB_PHI) phi_count++;
             if (phi_count > 1) return NULL;
         }
@@ -95,6 +93,24 @@ static TB_Node* ideal_phi(TB_Passes* restrict opt, TB_Function* f, TB_Node* n) {
     return NULL;
 }
 
+// do the edges from a and b into region carry the same PHI values
+static bool same_phi_edges(TB_Passes* restrict opt, TB_Node* region, TB_Node* a, TB_Node* b) {
+    int ai = -1, bi = -1;
+    FOREACH_N(i, 0, region->input_count) {
+        TB_Node* pred = tb_get_parent_region(region->inputs[i]);
+        if (pred == a) ai = i;
+        if (pred == b) bi = i;
+    }
+
+    if (ai < 0 || bi < 0) return false;
+    FOR_USERS(use, opt, region) {
+        if (use->n->type == TB_PHI && use->slot == 0 && use->n->inputs[1 + ai] != use->n->inputs[1 + bi]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static TB_Node* ideal_branch(TB_Passes* restrict opt, TB_Function* f, TB_Node* n) {
     TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
 
@@ -110,22 +126,22 @@ static TB_Node* ideal_branch(TB_Passes* restrict opt, TB_Function* f, TB_Node* n
                 assert(bb->type == TB_REGION || bb->type == TB_START);
 
                 uint64_t falsey = br->keys[0];
-                TB_Node* pred_branch = bb->inputs[0]->inputs[0];
+                TB_Node* pred_branch = bb->type == TB_REGION && bb->input_count == 1 ? bb->inputs[0]->inputs[0] : NULL;
 
-                // needs one pred
+                // needs one pred (the start node doesn't have any)
                 uint64_t pred_falsey;
-                if (bb->input_count == 1 && is_if_branch(pred_branch, &pred_falsey)) {
+                if (pred_branch != NULL && is_if_branch(pred_branch, &pred_falsey)) {
                     TB_NodeBranch* pred_br_info = TB_NODE_GET_EXTRA(pred_branch);
 
                     bool bb_on_false = pred_br_info->succ[0] != bb;
                     TB_Node* shared_edge = pred_br_info->succ[!bb_on_false];
 
-                    int shared_i = -1;
-                    if (shared_edge == pred_br_info->succ[0]) shared_i = 0;
-                    if (shared_edge == pred_br_info->succ[1]) shared_i = 1;
+                    // the pred's other edge has to be our false edge and both
+                    // of them need to agree on the PHIs in there
+                    bool shared = shared_edge == br->succ[1] && same_phi_edges(opt, shared_edge, unsafe_get_region(pred_branch), bb);
 
                     // TODO(NeGate): implement form which works on an arbitrary falsey
-                    if (falsey == 0 && shared_i >= 0) {
+                    if (falsey == 0 && shared) {
                         TB_Node* pred_cmp = pred_branch->inputs[1];
 
                         // convert first branch into an unconditional into bb
@@ -170,6 +186,7 @@ static TB_Node* ideal_branch(TB_Passes* restrict opt, TB_Function* f, TB_Node* n
                 TB_NODE_SET_EXTRA(new_cmp, TB_NodeCompare, .cmp_dt = TB_NODE_GET_EXTRA_T(cmp_node, TB_NodeCompare)->cmp_dt);
 
                 SWAP(TB_Node*, br->succ[0], br->succ[1]);
+                if (br->probs) SWAP(float, br->probs[0], br->probs[1]);
                 set_input(opt, n, new_cmp, 1);
                 tb_pass_mark(opt, new_cmp);
                 return n;
@@ -185,6 +202,7 @@ static TB_Node* ideal_branch(TB_Passes* restrict opt, TB_Function* f, TB_Node* n
                     // flip successors
                     if (cmp_type == TB_CMP_EQ) {
                         SWAP(TB_Node*, br->succ[0], br->succ[1]);
+                        if (br->probs) SWAP(float, br->probs[0], br->probs[1]);
                     }
                     return n;
                 }
@@ -11,8 +11,9 @@ uint32_t cse_hash(void* a) {
     // fib hashing amirite
     h = ((uint64_t) h * 11400714819323198485llu) >> 32llu;
 
-    FOREACH_N(i, 0, n->input_count) {
-        h ^= ((uintptr_t) n->inputs[i] * 11400714819323198485llu) >> 32llu;
+    // inputs hash by id, it doesn't depend on where the allocator put things
+    FOREACH_N(i, 0, n->input_count) if (n->inputs[i]) {
+        h ^= ((uint64_t) (n->inputs[i]->gvn + 1) * 11400714819323198485llu) >> 32llu;
     }
 
     // fnv1a the extra space
@@ -23,24 +24,22 @@ uint32_t cse_hash(void* a) {
     return h;
 }
 
-bool cse_compare(void* a, void* b) {
-    TB_Node *x = a, *y = b;
-
-    // early outs
-    if (x->type != y->type ||
-        x->input_count != y->input_count ||
-        x->extra_count != y->extra_count ||
-        x->dt.raw != y->dt.raw) {
-        return false;
-    }
+// (a op b) == (b op a), the hash already doesn't care about input order
+static bool cse_commutes(TB_Node* n) {
+    switch (n->type) {
+        case TB_AND: case TB_OR: case TB_XOR:
+        case TB_ADD: case TB_MUL:
+        case TB_FADD: case TB_FMUL:
+        case TB_CMP_EQ: case TB_CMP_NE:
+        return n->input_count == 3;
 
-    // match up inputs
-    FOREACH_N(i, 0, x->input_count) {
-        if (x->inputs[i] != y->inputs[i]) {
-            return false;
-        }
+        default: return false;
     }
+}
 
+// compares the extra data of two nodes with the same type, the types which aren't
+// listed here are never considered equivalent (stores, locals, regions, projs...)
+static bool cse_extra_equal(TB_Node* x, TB_Node* y) {
     // If there's no extra data, we good
     if (x->extra_count == 0) return true;
 
@@ -109,6 +108,47 @@ bool cse_compare(void* a, void* b) {
             return aa->cmp_dt.raw == bb->cmp_dt.raw;
         }
 
+        case TB_FLOAT32_CONST: {
+            TB_NodeFloat32* aa = TB_NODE_GET_EXTRA(x);
+            TB_NodeFloat32* bb = TB_NODE_GET_EXTRA(y);
+            return memcmp(&aa->value, &bb->value, sizeof(float)) == 0;
+        }
+
+        case TB_FLOAT64_CONST: {
+            TB_NodeFloat64* aa = TB_NODE_GET_EXTRA(x);
+            TB_NodeFloat64* bb = TB_NODE_GET_EXTRA(y);
+            return memcmp(&aa->value, &bb->value, sizeof(double)) == 0;
+        }
+
         default: return false;
     }
 }
+
+bool cse_compare(void* a, void* b) {
+    TB_Node *x = a, *y = b;
+
+    // early outs
+    if (x->type != y->type ||
+        x->input_count != y->input_count ||
+        x->extra_count != y->extra_count ||
+        x->dt.raw != y->dt.raw) {
+        return false;
+    }
+
+    // match up inputs
+    if (cse_commutes(x)) {
+        if (x->inputs[0] != y->inputs[0]) return false;
+        if (!(x->inputs[1] == y->inputs[1] && x->inputs[2] == y->inputs[2]) &&
+            !(x->inputs[1] == y->inputs[2] && x->inputs[2] == y->inputs[1])) {
+            return false;
+        }
+    } else {
+        FOREACH_N(i, 0, x->input_count) {
+            if (x->inputs[i] != y->inputs[i]) {
+                return false;
+            }
+        }
+    }
+
+    return cse_extra_equal(x, y);
+}
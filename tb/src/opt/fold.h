@@ -60,8 +60,10 @@ static TB_Node* ideal_truncate(TB_Passes* restrict opt, TB_Function* f, TB_Node*
     BigInt_copy(src_i->num_words, words, src_i->words);
 
     // mask bits on the top word
-    uint64_t top_mask = (1ull << (src->dt.data & 63)) - 1;
-    words[src_i->num_words - 1] &= ~top_mask;
+    if (n->dt.data % 64) {
+        uint64_t top_mask = (1ull << (n->dt.data & 63)) - 1;
+        words[src_i->num_words - 1] &= top_mask;
+    }
 
     return new_n;
 }
@@ -92,28 +94,15 @@ static bool is_non_zero(TB_Node* n) {
     return n->type == TB_INTEGER_CONST && i->num_words == 1 && i->words[0] != 0;
 }
 
-static bool is_zero(TB_Node* n) {
-    TB_NodeInt* i = TB_NODE_GET_EXTRA(n);
-    return n->type == TB_INTEGER_CONST && i->num_words == 1 && i->words[0] == 0;
-}
-
-static TB_Node* ideal_select(TB_Passes* restrict opt, TB_Function* f, TB_Node* n) {
-    TB_Node* src = n->inputs[1];
-
-    // T(some_bool ? 1 : 0) => movzx(T, some_bool)
-    if (src->dt.type == TB_INT && src->dt.data == 1) {
-        uint64_t on_true, on_false;
-        if (get_int_const(n->inputs[2], &on_true) && get_int_const(n->inputs[3], &on_false)) {
-            if (on_true == 1 && on_false == 0) {
-                TB_Node* ext_node = tb_alloc_node(f, TB_ZERO_EXT, n->dt, 2, 0);
-                set_input(opt, ext_node, src, 1);
-                tb_pass_mark(opt, ext_node);
-                return ext_node;
-            }
-        }
+// integer constant (or a splat of one, it's the same in every lane) with the value x,
+// the generated peepholes use it for their literals.
+static bool peep_is_int(TB_Node* n, uint64_t x) {
+    if (n->type == TB_VBROADCAST) {
+        n = n->inputs[1];
     }
 
-    return NULL;
+    uint64_t y;
+    return get_int_const(n, &y) && y == x;
 }
 
 static TB_Node* ideal_extension(TB_Passes* restrict opt, TB_Function* f, TB_Node* n) {
@@ -166,11 +155,17 @@ static TB_Node* identity_extension(TB_Passes* restrict opt, TB_Function* f, TB_N
         }
 
         // fixup the bits here
-        uint64_t shift = (64 - (src->dt.data % 64));
-        uint64_t mask = (~UINT64_C(0) >> shift) << shift;
+        if (src->dt.data % 64) {
+            uint64_t mask = ~UINT64_C(0) << (src->dt.data % 64);
+
+            if (is_signed) words[src_num_words - 1] |= mask;
+            else words[src_num_words - 1] &= ~mask;
+        }
 
-        if (is_signed) words[src_num_words - 1] |= mask;
-        else words[src_num_words - 1] &= ~mask;
+        // nothing past the destination width
+        if (n->dt.data % 64) {
+            words[dst_num_words - 1] &= ~(~UINT64_C(0) << (n->dt.data % 64));
+        }
 
         return new_n;
     } else {
@@ -216,80 +211,13 @@ static TB_Node* ideal_int_binop(TB_Passes* restrict opt, TB_Function* f, TB_Node
         }
     }
 
-    TB_Node* a = n->inputs[1];
-    TB_Node* b = n->inputs[2];
-    if (type == TB_OR) {
-        assert(n->dt.type == TB_INT);
-        int bits = n->dt.data;
-
-        // (or (shr a 40) (shl a 24)) => (rol a 24)
-        if (a->type == TB_SHR && b->type == TB_SHL) {
-            uint64_t shl_amt, shr_amt;
-            if (a->inputs[1] == b->inputs[1] &&
-                get_int_const(a->inputs[2], &shr_amt) &&
-                get_int_const(b->inputs[2], &shl_amt) &&
-                shl_amt == bits - shr_amt) {
-                // convert to rotate left
-                n->type = TB_ROL;
-                set_input(opt, n, b->inputs[1], 1);
-                set_input(opt, n, b->inputs[2], 2);
-                return n;
-            }
-        }
-    } else if (type == TB_MUL) {
-        uint64_t rhs;
-        if (get_int_const(b, &rhs)) {
-            uint64_t log2 = tb_ffs(rhs) - 1;
-            if (rhs == (UINT64_C(1) << log2)) {
-                TB_Node* shl_node = tb_alloc_node(f, TB_SHL, n->dt, 3, sizeof(TB_NodeBinopInt));
-                set_input(opt, shl_node, a, 1);
-                set_input(opt, shl_node, make_int_node(f, opt, n->dt, log2), 2);
-
-                tb_pass_mark(opt, shl_node->inputs[1]);
-                tb_pass_mark(opt, shl_node->inputs[2]);
-                return shl_node;
-            }
-        }
-    } else if (type == TB_CMP_EQ) {
-        // (a == 0) is !a
-        TB_Node* cmp = n->inputs[1];
-
-        uint64_t rhs;
-        if (get_int_const(n->inputs[2], &rhs) && rhs == 0) {
-            // !(a <  b) is (b <= a)
-            switch (cmp->type) {
-                case TB_CMP_SLT: n->type = TB_CMP_SLE; break;
-                case TB_CMP_SLE: n->type = TB_CMP_SLT; break;
-                case TB_CMP_ULT: n->type = TB_CMP_ULE; break;
-                case TB_CMP_ULE: n->type = TB_CMP_ULT; break;
-                default: return NULL;
-            }
-
-            TB_DataType cmp_dt = TB_NODE_GET_EXTRA_T(cmp, TB_NodeCompare)->cmp_dt;
-            TB_NODE_SET_EXTRA(n, TB_NodeCompare, .cmp_dt = cmp_dt);
-
-            set_input(opt, n, cmp->inputs[2], 1);
-            set_input(opt, n, cmp->inputs[1], 2);
-            return n;
-        }
-    } else if (type == TB_SHL || type == TB_SHR) {
-        // (a << b) >> c = a << (b - c)
-        // (a >> b) << c = a >> (b - c)
-        TB_NodeTypeEnum flipped = type == TB_SHL ? TB_SHR : TB_SHL;
-
-        uint64_t a, b;
-        if (n->inputs[1]->type == flipped &&
-            get_int_const(n->inputs[1]->inputs[2], &a) &&
-            get_int_const(n->inputs[2], &b)) {
-            TB_Node* imm = make_int_node(f, opt, n->dt, a - b);
-            tb_pass_mark(opt, imm);
-
-            set_input(opt, n, n->inputs[1]->inputs[1], 1);
-            set_input(opt, n, imm, 2);
-            return n;
-        }
+    // the pattern rewrites are in peeps.txt, folding is scalar only
+    if (n->dt.width) {
+        return NULL;
     }
 
+    TB_Node* a = n->inputs[1];
+    TB_Node* b = n->inputs[2];
     if (a->type != TB_INTEGER_CONST || b->type != TB_INTEGER_CONST) {
         return NULL;
     }
@@ -330,9 +258,10 @@ static TB_Node* ideal_int_binop(TB_Passes* restrict opt, TB_Function* f, TB_Node
             default: tb_unreachable();
         }
 
-        // fixup the bits here
-        uint64_t shift = (64 - (n->dt.data % 64)), mask = (~UINT64_C(0) >> shift) << shift;
-        words[num_words-1] &= ~mask;
+        // fixup the bits here, a full 64bit word has nothing above it to clear
+        if (n->dt.data % 64) {
+            words[num_words-1] &= ~(~UINT64_C(0) << (n->dt.data % 64));
+        }
         return new_n;
     } else {
         return NULL;
@@ -428,47 +357,6 @@ static TB_Node* ideal_int_div(TB_Passes* restrict opt, TB_Function* f, TB_Node*
     }
 }
 
-////////////////////////////////
-// Integer identities
-////////////////////////////////
-// a + 0 => a
-// a - 0 => a
-// a * 0 => 0
-// a / 0 => poison
-static TB_Node* identity_int_binop(TB_Passes* restrict opt, TB_Function* f, TB_Node* n) {
-    if (!is_zero(n->inputs[2])) return n;
-
-    switch (n->type) {
-        default: return n;
-
-        case TB_SHL:
-        case TB_SHR:
-        case TB_ADD:
-        case TB_SUB:
-        case TB_MUL:
-        return n->inputs[1];
-
-        case TB_UDIV:
-        case TB_SDIV:
-        return tb_inst_poison(f);
-
-        // (cmp.ne a 0) => a
-        case TB_CMP_NE: {
-            // walk up extension
-            TB_Node* src = n->inputs[1];
-            if (src->type == TB_ZERO_EXT) {
-                src = src->inputs[1];
-            }
-
-            if (src->dt.type == TB_INT && src->dt.data == 1) {
-                return src;
-            }
-
-            return n;
-        }
-    }
-}
-
 ////////////////////////////////
 // Pointer idealizations
 ////////////////////////////////
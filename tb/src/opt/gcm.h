@@ -7,24 +7,24 @@ static bool is_pinned(TB_Node* n) {
     return (n->type >= TB_START && n->type <= TB_SAFEPOINT_POLL) || n->type == TB_PROJ;
 }
 
-static void schedule_early(TB_Passes* passes, NL_HashSet* visited, TB_Node* n) {
-    if (!nl_hashset_put(visited, n)) {
+static void schedule_early(TB_Passes* passes, Set* visited, TB_Node* n) {
+    if (!set_first_time(visited, n->gvn)) {
         // already visited
         return;
     }
 
     if (is_pinned(n)) {
-        // pinned nodes will schedule their inputs but they themselves can't move
+        // pinned nodes will schedule their inputs but they themselves can't move,
+        // the inputs are deferred since walking into a phi from its users would go
+        // around the loop and back into the nodes we're still placing.
         tb_assert(n->inputs[0], "needs a control node already");
-        FOREACH_N(i, 1, n->input_count) {
-            schedule_early(passes, visited, n->inputs[i]);
-        }
+        dyn_array_put(passes->worklist, n);
     } else {
         if (n->inputs[0] == NULL) {
             // add_user without remove because we know there's nothing there
             TB_Node* root = passes->f->start_node;
             n->inputs[0] = root;
-            add_user(passes, n, root, 0, NULL);
+            add_user(passes, n, root, 0);
         }
 
         TB_Node* best = tb_get_parent_region(n->inputs[0]);
@@ -52,7 +52,7 @@ static void schedule_early(TB_Passes* passes, NL_HashSet* visited, TB_Node* n) {
     }
 }
 
-static void schedule_region(TB_Passes* passes, NL_HashSet* visited, TB_Node* n) {
+static void schedule_region(TB_Passes* passes, Set* visited, TB_Node* n) {
     TB_Node* parent = n->inputs[0];
     if (parent->type != TB_START && parent->type != TB_REGION) {
         schedule_region(passes, visited, parent);
@@ -61,6 +61,14 @@ static void schedule_region(TB_Passes* passes, NL_HashSet* visited, TB_Node* n)
     FOREACH_N(i, 1, n->input_count) {
         schedule_early(passes, visited, n->inputs[i]);
     }
+
+    // the pinned nodes we ran into
+    while (dyn_array_length(passes->worklist)) {
+        TB_Node* pinned = dyn_array_pop(passes->worklist);
+        FOREACH_N(i, 1, pinned->input_count) {
+            schedule_early(passes, visited, pinned->inputs[i]);
+        }
+    }
 }
 
 ////////////////////////////////
@@ -73,7 +81,7 @@ static TB_Node* walk_up(TB_Node* a, TB_Node* b) {
     int bdom = dom_depth(b);
     while (a->input_count > 0) {
         TB_Node* aa = tb_get_parent_region(a);
-        if (dom_depth(aa) >= bdom) {
+        if (dom_depth(aa) <= bdom) {
             break;
         }
 
@@ -101,16 +109,46 @@ static TB_Node* find_lca(TB_Node* a, TB_Node* b) {
     return a;
 }
 
-static void schedule_late(TB_Passes* passes, NL_HashSet* visited, TB_Node* n) {
+// Click's trick for LICM: anywhere between the early and late placement is legal
+// so we walk up the dominators and pick the shallowest loop nest.
+static TB_Node* schedule_hoist(LoopMap depths, TB_Node* early, TB_Node* lca) {
+    TB_Node* best = lca;
+    int best_depth = loop_depth(depths, lca);
+
+    int early_depth = dom_depth(early);
+    for (TB_Node* bb = lca; bb != early && best_depth > 0;) {
+        TB_Node* up = idom(bb);
+        if (up == bb || dom_depth(up) < early_depth) {
+            // early doesn't dominate us? leave it be
+            return lca;
+        }
+
+        bb = up;
+        int d = loop_depth(depths, bb);
+        if (best_depth > d) {
+            best = bb;
+            best_depth = d;
+        }
+    }
+
+    return best;
+}
+
+static bool schedule_can_hoist(TB_Node* n) {
+    // constants are cheaper to rematerialize and division can trap
+    return n->input_count > 1 && !(n->type >= TB_UDIV && n->type <= TB_SMOD);
+}
+
+static void schedule_late(TB_Passes* passes, Set* visited, LoopMap depths, TB_Node* n) {
     // uses doubles as the visited map for this function
-    if (!nl_hashset_put(visited, n) || is_pinned(n)) {
+    if (!set_first_time(visited, n->gvn) || is_pinned(n)) {
         // already visited
         return;
     }
 
     // we're gonna find the least common ancestor
     TB_Node* lca = NULL;
-    for (User* use = find_users(passes, n); use; use = use->next) {
+    FOR_USERS(use, passes, n) {
         // only care about control nodes
         if (use->slot == 0) continue;
 
@@ -118,7 +156,7 @@ static void schedule_late(TB_Passes* passes, NL_HashSet* visited, TB_Node* n) {
         // dead node
         if (y->inputs[0] == NULL) continue;
 
-        schedule_late(passes, visited, y);
+        schedule_late(passes, visited, depths, y);
 
         TB_Node* use_block = tb_get_parent_region(y->inputs[0]);
         if (y->type == TB_PHI) {
@@ -126,27 +164,23 @@ static void schedule_late(TB_Passes* passes, NL_HashSet* visited, TB_Node* n) {
                 tb_panic("phi has parent with mismatched predecessors");
             }
 
-            ptrdiff_t j = -1;
-            for (; j < y->input_count; j++) {
-                if (y->inputs[j] == n) {
-                    break;
-                }
-            }
-            assert(j >= 0);
-
-            use_block = tb_get_parent_region(use_block->inputs[j - 1]);
+            // the value is used at the end of the matching predecessor
+            use_block = tb_get_parent_region(use_block->inputs[use->slot - 1]);
         }
 
         lca = find_lca(lca, use_block);
     }
 
     // tb_assert(lca, "missing least common ancestor");
+    if (depths != NULL && lca != NULL && schedule_can_hoist(n)) {
+        lca = schedule_hoist(depths, tb_get_parent_region(n->inputs[0]), lca);
+    }
     set_input(passes, n, lca, 0);
 }
 
 // We'll be using this for late schedling
-static void postorder_all_nodes(NL_HashSet* visited, DynArray(TB_Node*)* worklist, TB_Node* n) {
-    if (!nl_hashset_put(visited, n)) {
+static void postorder_all_nodes(Set* visited, DynArray(TB_Node*)* worklist, TB_Node* n) {
+    if (!set_first_time(visited, n->gvn)) {
         return;
     }
 
@@ -158,15 +192,87 @@ static void postorder_all_nodes(NL_HashSet* visited, DynArray(TB_Node*)* worklis
     dyn_array_put(*worklist, n);
 }
 
+static bool has_phis(TB_Passes* passes, TB_Node* bb) {
+    FOR_USERS(use, passes, bb) {
+        if (use->n->type == TB_PHI && use->slot == 0) return true;
+    }
+    return false;
+}
+
+// codegen only places the phi moves for a branch's last successor (it does
+// them before the branch), any other edge into a block with phis gets its own
+// block to put them in.
+static void split_phi_edges(TB_Passes* passes, TB_Function* f) {
+    bool changed = false;
+    FOREACH_N(i, 0, passes->order.count) {
+        TB_Node* end = TB_NODE_GET_EXTRA_T(passes->order.traversal[i], TB_NodeRegion)->end;
+        if (end->type != TB_BRANCH) continue;
+
+        TB_NodeBranch* br = TB_NODE_GET_EXTRA(end);
+        if (br->succ_count <= 1) continue;
+
+        // the edges are found from the successor's side, the branch peepholes swap
+        // succ[] without renumbering the projections so their index can't be used.
+        TB_Node* last = br->succ[br->succ_count - 1];
+        FOREACH_N(index, 0, br->succ_count - 1) {
+            TB_Node* dst = br->succ[index];
+            if (dst == last || !has_phis(passes, dst)) continue;
+
+            ptrdiff_t slot = -1;
+            FOREACH_N(j, 0, dst->input_count) {
+                TB_Node* in = dst->inputs[j];
+                if (in->type == TB_PROJ && in->inputs[0] == end) {
+                    slot = j;
+                    break;
+                }
+            }
+            tb_assert(slot >= 0, "successor isn't reached by its branch edge");
+            TB_Node* proj = dst->inputs[slot];
+
+            TB_Node* region = tb_alloc_node(f, TB_REGION, TB_TYPE_CONTROL, 1, sizeof(TB_NodeRegion));
+            TB_NodeRegion* r = TB_NODE_GET_EXTRA(region);
+            r->dom_depth = -1; // unresolved
+
+            // goto dst
+            TB_Node* go = tb_alloc_node(f, TB_BRANCH, TB_TYPE_TUPLE, 1, sizeof(TB_NodeBranch));
+            TB_NodeBranch* go_info = TB_NODE_GET_EXTRA(go);
+            go_info->succ_count = 1;
+            go_info->succ = alloc_from_node_arena(f, sizeof(TB_Node*));
+            go_info->succ[0] = dst;
+            set_input(passes, go, region, 0);
+            r->end = go;
+
+            TB_Node* go_proj = make_proj_node(f, passes, TB_TYPE_CONTROL, go, 0);
+            set_input(passes, dst, go_proj, slot);
+
+            // the phis don't change, they're still indexed by the same edge
+            set_input(passes, region, proj, 0);
+            br->succ[index] = region;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        recompute_cfg(f, passes);
+    }
+}
+
 void tb_pass_schedule(TB_Passes* passes) {
     // Scheduling: "Global Code Motion Global Value Numbering", Cliff Click 1995
     //   https://courses.cs.washington.edu/courses/cse501/06wi/reading/click-pldi95.pdf
     CUIK_TIMED_BLOCK("schedule") {
+        split_phi_edges(passes, passes->f);
         tb_pass_ensure_empty(passes);
 
-        NL_HashSet* restrict visited = &passes->visited;
+        Set* restrict visited = &passes->visited;
         DynArray(TB_Node*)* restrict worklist = &passes->worklist;
 
+        // tb_pass_loop turns on LICM
+        LoopMap depths = NULL;
+        if (passes->licm) CUIK_TIMED_BLOCK("loop depths") {
+            depths = loop_compute_depths(passes);
+        }
+
         CUIK_TIMED_BLOCK("early schedule") {
             FOREACH_REVERSE_N(i, 0, passes->order.count) {
                 TB_Node* bb = passes->order.traversal[i];
@@ -178,7 +284,7 @@ void tb_pass_schedule(TB_Passes* passes) {
 
         // generate instruction list we can walk
         CUIK_TIMED_BLOCK("gen worklist") {
-            nl_hashset_clear(visited);
+            set_clear(visited);
             FOREACH_N(i, 0, passes->order.count) {
                 TB_Node* bb = passes->order.traversal[i];
                 postorder_all_nodes(visited, worklist, TB_NODE_GET_EXTRA_T(bb, TB_NodeRegion)->end);
@@ -187,26 +293,33 @@ void tb_pass_schedule(TB_Passes* passes) {
 
         // move nodes closer to their usage site
         CUIK_TIMED_BLOCK("late schedule") {
-            nl_hashset_clear(visited);
+            set_clear(visited);
             FOREACH_REVERSE_N(i, 0, dyn_array_length(*worklist)) {
                 TB_Node* n = (*worklist)[i];
 
                 if (is_pinned(n)) {
-                    nl_hashset_put(visited, n);
+                    set_put(visited, n->gvn);
+
+                    // the users move between blocks as they're scheduled which can
+                    // edit this list (n might be their block), so we walk a copy.
+                    size_t count = user_count(passes, n);
+                    User* users = tb_arena_alloc(tmp_arena, count * sizeof(User));
+                    FOREACH_N(j, 0, count) {
+                        users[j] = find_users(passes, n)[j];
+                    }
 
-                    for (User* use = find_users(passes, n); use; use = use->next) {
-                        if (use->n->inputs[0] != NULL) {
-                            schedule_late(passes, visited, use->n);
+                    FOREACH_N(j, 0, count) {
+                        if (users[j].n->inputs[0] != NULL) {
+                            schedule_late(passes, visited, depths, users[j].n);
                         }
                     }
                 } else if (n->input_count == 1) {
                     // this is gonna usually be the constants
-                    schedule_late(passes, visited, (*worklist)[i]);
+                    schedule_late(passes, visited, depths, (*worklist)[i]);
                 }
             }
         }
 
-        // reset node count
-        passes->f->node_count = visited->count;
+        nl_map_free(depths);
     }
 }
@@ -0,0 +1,239 @@
+// Global value numbering (Simpson's optimistic RPO algorithm)
+//
+// the peephole CSE only merges nodes which point at the exact same inputs, which
+// means it can't see through cycles: two induction variables which step the same
+// way are both phis of themselves and neither one is ever "identical" first. Here
+// every value starts as TOP (NULL, no number yet), phis ignore the TOP operands
+// and we keep renumbering the whole function until nothing changes. Only then do
+// the congruent nodes get folded into their leader.
+//
+// loads participate keyed by their memory input, so two loads only meet when they
+// see the same memory state. Everything else with side effects (stores, calls,
+// projections...) just numbers to itself.
+#define GVN_MAX_ITERS 32
+
+static thread_local TB_Node** gvn_table; // indexed by TB_Node.gvn, NULL is TOP
+
+static bool gvn_participates(TB_Node* n) {
+    switch (n->type) {
+        case TB_INTEGER_CONST:
+        case TB_FLOAT32_CONST:
+        case TB_FLOAT64_CONST:
+        case TB_SYMBOL:
+        case TB_MEMBER_ACCESS:
+        case TB_ARRAY_ACCESS:
+        case TB_LOAD:
+        case TB_VBROADCAST:
+        return true;
+
+        // control & memory phis are part of the CFG and memory chains, let them be
+        case TB_PHI:
+        return n->dt.type != TB_CONTROL && n->dt.type != TB_MEMORY && n->dt.type != TB_TUPLE;
+
+        // casts, selects, unary, binary ops and comparisons are all pure
+        default:
+        return n->type >= TB_INT2PTR && n->type <= TB_CMP_FLE;
+    }
+}
+
+static TB_Node* gvn_get(TB_Node* n) {
+    if (n == NULL || !gvn_participates(n)) return n;
+    return gvn_table[n->gvn];
+}
+
+static uint32_t gvn_hash(void* a) {
+    TB_Node* n = a;
+
+    uint32_t h = n->type + n->dt.raw + n->input_count + n->extra_count;
+    h = ((uint64_t) h * 11400714819323198485llu) >> 32llu;
+
+    // XOR so commutative ops hash the same both ways around
+    FOREACH_N(i, 0, n->input_count) {
+        TB_Node* in = gvn_get(n->inputs[i]);
+        if (in) h ^= ((uint64_t) (in->gvn + 1) * 11400714819323198485llu) >> 32llu;
+    }
+
+    FOREACH_N(i, 0, n->extra_count) {
+        h = (n->extra[i] ^ h) * 0x01000193;
+    }
+
+    return h;
+}
+
+static bool gvn_compare(void* a, void* b) {
+    TB_Node *x = a, *y = b;
+    if (x->type != y->type ||
+        x->input_count != y->input_count ||
+        x->extra_count != y->extra_count ||
+        x->dt.raw != y->dt.raw) {
+        return false;
+    }
+
+    if (cse_commutes(x)) {
+        TB_Node *x1 = gvn_get(x->inputs[1]), *x2 = gvn_get(x->inputs[2]);
+        TB_Node *y1 = gvn_get(y->inputs[1]), *y2 = gvn_get(y->inputs[2]);
+        if (gvn_get(x->inputs[0]) != gvn_get(y->inputs[0])) return false;
+        if (!(x1 == y1 && x2 == y2) && !(x1 == y2 && x2 == y1)) return false;
+    } else {
+        FOREACH_N(i, 0, x->input_count) {
+            if (gvn_get(x->inputs[i]) != gvn_get(y->inputs[i])) {
+                return false;
+            }
+        }
+    }
+
+    return cse_extra_equal(x, y);
+}
+
+// postorder over the inputs (defs before uses), the optimism depends on phis being
+// numbered before the values coming around their backedges so we don't walk those.
+static DynArray(TB_Node*) gvn_order(size_t count, TB_Node** nodes, size_t node_count, int* block_po) {
+    typedef struct { TB_Node* n; int i; } Frame;
+
+    Set visited = set_create(node_count);
+    DynArray(Frame) stack = dyn_array_create(Frame, 64);
+    DynArray(TB_Node*) order = dyn_array_create(TB_Node*, count);
+
+    FOREACH_N(i, 0, count) {
+        TB_Node* root = nodes[i];
+        if (!gvn_participates(root) || !set_first_time(&visited, root->gvn)) {
+            continue;
+        }
+
+        dyn_array_put(stack, (Frame){ root });
+        while (dyn_array_length(stack) > 0) {
+            Frame* top = &stack[dyn_array_length(stack) - 1];
+            if (top->i < top->n->input_count) {
+                int i = top->i++;
+                TB_Node* in = top->n->inputs[i];
+
+                // in postorder a backedge comes from a block numbered at or before the header
+                if (top->n->type == TB_PHI && i > 0) {
+                    TB_Node* pred = tb_get_parent_region(top->n->inputs[0]->inputs[i - 1]);
+                    if (block_po[pred->gvn] <= block_po[top->n->inputs[0]->gvn]) continue;
+                }
+
+                if (in && gvn_participates(in) && set_first_time(&visited, in->gvn)) {
+                    dyn_array_put(stack, (Frame){ in });
+                }
+            } else {
+                dyn_array_put(order, top->n);
+                dyn_array_pop(stack);
+            }
+        }
+    }
+
+    dyn_array_destroy(stack);
+    set_free(&visited);
+    return order;
+}
+
+static TB_Node* gvn_value(NL_HashSet* table, TB_Node* n) {
+    if (n->type == TB_PHI) {
+        // all the operands we know of agree? then we're just that
+        TB_Node* same = NULL;
+        FOREACH_N(i, 1, n->input_count) {
+            TB_Node* v = gvn_get(n->inputs[i]);
+            if (v == NULL) continue;
+
+            if (same == NULL) {
+                same = v;
+            } else if (same != v) {
+                same = NULL;
+                goto hash;
+            }
+        }
+
+        // all TOP means we stay TOP
+        return same;
+    }
+
+    hash:;
+    TB_Node* k = nl_hashset_put2(table, n, gvn_hash, gvn_compare);
+    return k ? k : n;
+}
+
+bool tb_pass_gvn(TB_Passes* p) {
+    verify_tmp_arena(p);
+
+    TB_Function* f = p->f;
+    bool changes = false;
+    CUIK_TIMED_BLOCK("gvn") {
+        DynArray(TB_Node*) nodes = walk_all_nodes(f->start_node, f->node_count);
+
+        // postorder numbers for the blocks, -1 for everything else
+        TB_PostorderWalk walk = tb_function_get_postorder(f);
+        int* block_po = tb_arena_alloc(tmp_arena, f->node_count * sizeof(int));
+        memset(block_po, 0xFF, f->node_count * sizeof(int));
+        FOREACH_N(i, 0, walk.count) {
+            block_po[walk.traversal[i]->gvn] = i;
+        }
+
+        DynArray(TB_Node*) order = gvn_order(dyn_array_length(nodes), nodes, f->node_count, block_po);
+        tb_function_free_postorder(&walk);
+        size_t count = dyn_array_length(order);
+
+        gvn_table = tb_arena_alloc(tmp_arena, f->node_count * sizeof(TB_Node*));
+        memset(gvn_table, 0, f->node_count * sizeof(TB_Node*));
+
+        // the table only holds the leaders for the current round, each
+        // round starts it over since the numbers it was keyed on moved.
+        NL_HashSet table = nl_hashset_alloc(count);
+        bool converged = false;
+        FOREACH_N(iter, 0, GVN_MAX_ITERS) {
+            bool progress = false;
+            nl_hashset_clear(&table);
+
+            FOREACH_N(i, 0, count) {
+                TB_Node* n = order[i];
+                TB_Node* v = gvn_value(&table, n);
+                if (gvn_table[n->gvn] != v) {
+                    gvn_table[n->gvn] = v;
+                    progress = true;
+                }
+            }
+
+            if (!progress) {
+                converged = true;
+                break;
+            }
+        }
+
+        // the optimistic guesses are only safe to act on at the fixpoint
+        if (converged) {
+            FOREACH_N(i, 0, count) {
+                TB_Node* n = order[i];
+                TB_Node* v = gvn_table[n->gvn];
+                if (v != NULL && v != n) {
+                    DO_IF(TB_OPTDEBUG_GVN)(printf("gvn: %p (%s) => %p (%s)\n", n, tb_node_get_name(n), v, tb_node_get_name(v)));
+                    subsume_node(p, f, n, v);
+                    changes = true;
+                }
+            }
+
+            // canonical operand order for the survivors, constants go on the right
+            FOREACH_N(i, 0, count) {
+                TB_Node* n = order[i];
+                if (n->type != TB_NULL && cse_commutes(n) &&
+                    n->inputs[1]->type == TB_INTEGER_CONST &&
+                    n->inputs[2]->type != TB_INTEGER_CONST) {
+                    TB_Node* a = n->inputs[1];
+                    TB_Node* b = n->inputs[2];
+                    set_input(p, n, b, 1);
+                    set_input(p, n, a, 2);
+                    tb_pass_mark(p, n);
+                    changes = true;
+                }
+            }
+        } else {
+            DO_IF(TB_OPTDEBUG_GVN)(log_debug("%s: gvn didn't converge", f->super.name));
+        }
+
+        nl_hashset_free(table);
+        dyn_array_destroy(order);
+        dyn_array_destroy(nodes);
+        gvn_table = NULL;
+    }
+
+    return changes;
+}
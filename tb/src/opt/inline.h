@@ -0,0 +1,385 @@
+// Inlining is split across the "-func -mod -func" scheme (see man/PASSES.md):
+//
+//   tb_module_inline: runs at the sync point, it picks which functions are small
+//     enough to inline and takes a snapshot of their graphs (TB_InlineBody).
+//
+//   tb_pass_inline: runs per function afterwards, it clones the snapshots into the
+//     call sites. Since it only reads the snapshots it's fine for the callee to be
+//     running its own passes on another thread.
+//
+// the costs are roughly "how many instructions will this turn into". With a
+// profile the calls it says are hot can take bigger bodies and the cold ones
+// are left alone.
+#define TB_INLINE_MAX_COST    24
+#define TB_INLINE_HOT_COST    96
+#define TB_INLINE_MAX_GROWTH  256
+
+typedef NL_Map(TB_Node*, TB_Node*) InlineMap;
+
+static size_t inline_node_cost(TB_Node* n) {
+    switch (n->type) {
+        // these either don't generate code or get folded into their users
+        case TB_NULL: case TB_START: case TB_STOP: case TB_REGION: case TB_PROJ:
+        case TB_LOCAL: case TB_SYMBOL: case TB_POISON:
+        case TB_INTEGER_CONST: case TB_FLOAT32_CONST: case TB_FLOAT64_CONST:
+        return 0;
+
+        // argument shuffling and clobbers aren't free
+        case TB_CALL: case TB_SYSCALL:
+        return 4;
+
+        default:
+        return 1;
+    }
+}
+
+static TB_Function* inline_call_target(TB_Node* n) {
+    if (n->type != TB_CALL || n->inputs[1]->type != TB_SYMBOL) {
+        return NULL;
+    }
+
+    TB_Symbol* sym = TB_NODE_GET_EXTRA_T(n->inputs[1], TB_NodeSymbol)->sym;
+    return sym->tag == TB_SYMBOL_FUNCTION ? (TB_Function*) sym : NULL;
+}
+
+static TB_Node* inline_lookup(InlineMap map, TB_Node* n) {
+    if (n == NULL) return NULL;
+
+    ptrdiff_t search = nl_map_get(map, n);
+    tb_assert(search >= 0, "inline: node %p (%s) escaped the walk", n, tb_node_get_name(n));
+    return map[search].v;
+}
+
+// copies every node which isn't already in the map, whatever is in the map is treated
+// as living outside of the clone (the call's arguments, the entry control, the exit).
+// out[i] is the copy of nodes[i] or NULL if it was mapped ahead of time. Copies which
+// go into a live function get fresh ids from *next_gvn (NULL keeps the old ones).
+static void inline_clone(TB_Arena* arena, size_t count, TB_Node** nodes, InlineMap* map, TB_Node** out, size_t* next_gvn) {
+    FOREACH_N(i, 0, count) {
+        TB_Node* n = nodes[i];
+        if (nl_map_get(*map, n) >= 0) {
+            out[i] = NULL;
+            continue;
+        }
+
+        TB_Node* k = tb_arena_alloc(arena, tb_node_size(n));
+        *k = *n;
+        memcpy(k->extra, n->extra, n->extra_count);
+        k->inputs = n->input_count ? (TB_Node**) &k->extra[tb_node_inputs_offset(n->extra_count)] : NULL;
+        if (next_gvn) {
+            k->gvn = (*next_gvn)++;
+        }
+
+        nl_map_put(*map, n, k);
+        out[i] = k;
+    }
+
+    FOREACH_N(i, 0, count) if (out[i]) {
+        TB_Node* n = nodes[i];
+        TB_Node* k = out[i];
+
+        FOREACH_N(j, 0, n->input_count) {
+            k->inputs[j] = inline_lookup(*map, n->inputs[j]);
+        }
+
+        switch (n->type) {
+            case TB_START: case TB_REGION: {
+                TB_NodeRegion* r = TB_NODE_GET_EXTRA(k);
+                r->end = inline_lookup(*map, r->end);
+                r->dom_depth = -1;
+                r->dom = NULL;
+                break;
+            }
+
+            case TB_BRANCH: {
+                TB_NodeBranch* br = TB_NODE_GET_EXTRA(k);
+                TB_Node** succ = tb_arena_alloc(arena, br->succ_count * sizeof(TB_Node*));
+                FOREACH_N(j, 0, br->succ_count) {
+                    succ[j] = inline_lookup(*map, br->succ[j]);
+                }
+                br->succ = succ;
+
+                if (br->probs) {
+                    float* probs = tb_arena_alloc(arena, br->succ_count * sizeof(float));
+                    memcpy(probs, br->probs, br->succ_count * sizeof(float));
+                    br->probs = probs;
+                }
+                break;
+            }
+
+            case TB_CALL: case TB_SYSCALL: {
+                size_t proj_count = (n->extra_count - sizeof(TB_NodeCall)) / sizeof(TB_Node*);
+                TB_NodeCall* c = TB_NODE_GET_EXTRA(k);
+                FOREACH_N(j, 0, proj_count) {
+                    c->projs[j] = inline_lookup(*map, c->projs[j]);
+                }
+                break;
+            }
+
+            case TB_MULPAIR: {
+                TB_NodeMulPair* mp = TB_NODE_GET_EXTRA(k);
+                mp->lo = inline_lookup(*map, mp->lo);
+                mp->hi = inline_lookup(*map, mp->hi);
+                break;
+            }
+
+            default: break;
+        }
+    }
+}
+
+// only the line info is meaningful outside of the callee, variables and scopes
+// would point at the callee's debug info.
+static TB_Attrib* inline_location_attribs(TB_Attrib* attribs) {
+    TB_Attrib* out = NULL;
+    dyn_array_for(i, attribs) {
+        if (attribs[i].tag == TB_ATTRIB_LOCATION) {
+            if (out == NULL) {
+                out = dyn_array_create(TB_Attrib, 2);
+            }
+            dyn_array_put(out, attribs[i]);
+        }
+    }
+    return out;
+}
+
+static TB_InlineBody* inline_make_body(TB_Arena* arena, TB_Function* f, DynArray(TB_Node*) nodes, size_t cost) {
+    size_t count = dyn_array_length(nodes);
+
+    TB_InlineBody* body = tb_arena_alloc(arena, sizeof(TB_InlineBody));
+    body->cost = cost;
+    body->node_count = count;
+    body->nodes = tb_arena_alloc(arena, count * sizeof(TB_Node*));
+
+    InlineMap map = NULL;
+    nl_map_create(map, count);
+    inline_clone(arena, count, nodes, &map, body->nodes, NULL);
+
+    body->start = inline_lookup(map, f->start_node);
+    body->stop = inline_lookup(map, f->stop_node);
+    nl_map_free(map);
+
+    FOREACH_N(i, 0, count) {
+        body->nodes[i]->attribs = inline_location_attribs(body->nodes[i]->attribs);
+    }
+
+    return body;
+}
+
+typedef NL_Map(TB_Function*, int) InlineColors;
+
+// any cycle between the inlineable functions would just keep expanding until the
+// growth budget runs out so we break them on the back edges.
+static void inline_break_cycles(InlineColors* colors, TB_Function* f, DynArray(TB_Function*)* drop) {
+    nl_map_put(*colors, f, 1);
+
+    TB_InlineBody* body = f->inline_body;
+    FOREACH_N(i, 0, body->node_count) {
+        TB_Function* target = inline_call_target(body->nodes[i]);
+        if (target == NULL || target->inline_body == NULL) {
+            continue;
+        }
+
+        ptrdiff_t search = nl_map_get(*colors, target);
+        if (search < 0) {
+            inline_break_cycles(colors, target, drop);
+        } else if ((*colors)[search].v == 1) {
+            dyn_array_put(*drop, target);
+        }
+    }
+
+    nl_map_put(*colors, f, 2);
+}
+
+void tb_module_inline(TB_Module* m) {
+    TB_Arena* arena = get_permanent_arena(m);
+
+    size_t max_cost = m->has_profile ? TB_INLINE_HOT_COST : TB_INLINE_MAX_COST;
+    size_t candidates = 0;
+    CUIK_TIMED_BLOCK("inline bodies") {
+        TB_FOR_FUNCTIONS(f, m) {
+            f->inline_body = NULL;
+            if (f->stop_node == NULL || f->prototype == NULL || f->prototype->has_varargs) {
+                continue;
+            }
+
+            DynArray(TB_Node*) nodes = walk_all_nodes(f->start_node, f->node_count);
+
+            size_t cost = 0;
+            bool has_stop = false;
+            dyn_array_for(i, nodes) {
+                TB_Node* n = nodes[i];
+                cost += inline_node_cost(n);
+
+                if (n == f->stop_node) {
+                    has_stop = true;
+                } else if (n->type == TB_SAFEPOINT || n->type == TB_SAFEPOINT_POLL || n->type == TB_VA_START) {
+                    // safepoints are keyed to the function they were made in and
+                    // va_start needs the callee's frame.
+                    cost = SIZE_MAX;
+                    break;
+                }
+            }
+
+            if (has_stop && cost <= max_cost) {
+                f->inline_body = inline_make_body(arena, f, nodes, cost);
+                candidates += 1;
+            }
+            dyn_array_destroy(nodes);
+        }
+    }
+
+    if (candidates > 0) CUIK_TIMED_BLOCK("inline cycles") {
+        InlineColors colors = NULL;
+        nl_map_create(colors, candidates);
+
+        DynArray(TB_Function*) drop = NULL;
+        TB_FOR_FUNCTIONS(f, m) {
+            if (f->inline_body != NULL && nl_map_get(colors, f) < 0) {
+                inline_break_cycles(&colors, f, &drop);
+            }
+        }
+
+        dyn_array_for(i, drop) {
+            drop[i]->inline_body = NULL;
+        }
+
+        dyn_array_destroy(drop);
+        nl_map_free(colors);
+    }
+}
+
+// replaces the call with a copy of the callee's body, the block the call was in gets
+// split: the top half flows into the callee's entry and the callee's exit takes over
+// the block's old terminator.
+static bool inline_call(TB_Passes* restrict p, TB_Function* f, TB_Node* call, TB_Function* callee, DynArray(TB_Node*)* calls) {
+    TB_InlineBody* body = callee->inline_body;
+    TB_FunctionPrototype* proto = callee->prototype;
+    TB_NodeCall* c = TB_NODE_GET_EXTRA(call);
+
+    // the call has to agree with the callee's signature, K&R calls and casted function
+    // pointers can disagree.
+    if (call->input_count - 2 != proto->param_count) {
+        return false;
+    }
+
+    FOREACH_N(i, 0, proto->param_count) {
+        if (call->inputs[2 + i]->dt.raw != proto->params[i].dt.raw) return false;
+    }
+
+    size_t proj_count = (call->extra_count - sizeof(TB_NodeCall)) / sizeof(TB_Node*);
+    FOREACH_N(i, 1, proj_count) {
+        TB_Node* proj = c->projs[i];
+        if (proj == NULL || proj->type != TB_PROJ) continue;
+
+        if (i >= body->stop->input_count || body->stop->inputs[i]->dt.raw != proj->dt.raw) {
+            return false;
+        }
+    }
+
+    TB_Node* bb = tb_get_parent_region(call);
+    TB_NodeRegion* r = TB_NODE_GET_EXTRA(bb);
+    TB_Node* old_end = r->end;
+
+    // entry control, params and the exit live outside of the clone
+    InlineMap map = NULL;
+    nl_map_create(map, body->node_count);
+    nl_map_put(map, body->start, call->inputs[0]);
+    nl_map_put(map, body->stop, old_end);
+    FOREACH_N(i, 0, body->node_count) {
+        TB_Node* n = body->nodes[i];
+        if (n->type == TB_PROJ && n->inputs[0] == body->start) {
+            int index = TB_NODE_GET_EXTRA_T(n, TB_NodeProj)->index;
+            nl_map_put(map, n, call->inputs[2 + index]);
+        }
+    }
+
+    TB_Node** clones = tb_arena_alloc(tmp_arena, body->node_count * sizeof(TB_Node*));
+    inline_clone(f->arena, body->node_count, body->nodes, &map, clones, &f->node_count);
+
+    FOREACH_N(i, 0, body->node_count) {
+        TB_Node* k = clones[i];
+        if (k == NULL) continue;
+
+        FOREACH_N(j, 0, k->input_count) if (k->inputs[j]) {
+            add_user(p, k, k->inputs[j], j);
+        }
+
+        if (k->type == TB_REGION) {
+            f->control_node_count += 1;
+        } else if (k->type == TB_LOCAL) {
+            dyn_array_put(p->locals, k);
+        } else if (k->type == TB_CALL) {
+            dyn_array_put(*calls, k);
+        }
+
+        tb_pass_mark(p, k);
+    }
+
+    // the entry block's terminator becomes ours, if the callee was a single block
+    // that's just the old terminator again.
+    TB_NodeRegion* entry = TB_NODE_GET_EXTRA(body->start);
+    r->end = inline_lookup(map, entry->end);
+
+    // the exit control & return values replace the call's projections
+    subsume_node(p, f, c->projs[0], inline_lookup(map, body->stop->inputs[0]));
+    FOREACH_N(i, 1, proj_count) {
+        TB_Node* proj = c->projs[i];
+        if (proj == NULL || proj->type != TB_PROJ) continue;
+
+        subsume_node(p, f, proj, inline_lookup(map, body->stop->inputs[i]));
+    }
+
+    tb_pass_kill_node(p, call);
+    nl_map_free(map);
+    return true;
+}
+
+bool tb_pass_inline(TB_Passes* p) {
+    verify_tmp_arena(p);
+
+    TB_Function* f = p->f;
+    bool changes = false;
+    CUIK_TIMED_BLOCK("inline") {
+        // walking the graph (instead of the user map) keeps the order, and thus
+        // which calls fit in the budget, deterministic.
+        DynArray(TB_Node*) calls = NULL;
+        DynArray(TB_Node*) nodes = walk_all_nodes(f->start_node, f->node_count);
+        dyn_array_for(i, nodes) {
+            TB_Function* target = inline_call_target(nodes[i]);
+            if (target != NULL && target->inline_body != NULL) {
+                dyn_array_put(calls, nodes[i]);
+            }
+        }
+        dyn_array_destroy(nodes);
+
+        // the calls in the bodies we paste in get appended so we expand breadth first
+        size_t budget = TB_INLINE_MAX_GROWTH;
+        for (size_t i = 0; i < dyn_array_length(calls); i++) {
+            TB_Node* n = calls[i];
+            TB_Function* target = inline_call_target(n);
+            if (target == NULL || target == f || target->inline_body == NULL || target->inline_body->cost > budget) {
+                continue;
+            }
+
+            TB_Heat heat = TB_NODE_GET_EXTRA_T(n, TB_NodeCall)->heat;
+            if (heat == TB_HEAT_COLD || (heat != TB_HEAT_HOT && target->inline_body->cost > TB_INLINE_MAX_COST)) {
+                continue;
+            }
+
+            if (inline_call(p, f, n, target, &calls)) {
+                DO_IF(TB_OPTDEBUG_INLINE)(log_debug("%s: inlined %s", f->super.name, target->super.name));
+
+                budget -= target->inline_body->cost;
+                changes = true;
+            }
+        }
+        dyn_array_destroy(calls);
+
+        if (changes) {
+            recompute_cfg(f, p);
+        }
+    }
+
+    return changes;
+}
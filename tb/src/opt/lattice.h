@@ -2,8 +2,11 @@
 // TODO(NeGate): implement dual? from there i can do join with
 //
 // dual(dual(x) ^ dual(y)) = join(x, y)
+//
+// integers are tracked as a signed range (of the sign extended value) along with
+// the known bits, only the bits within the data type are meaningful.
 typedef struct {
-    uint64_t bot, top;
+    int64_t min, max;
 
     // for known bit analysis
     uint64_t known_zeros;
@@ -32,8 +35,17 @@ typedef struct {
 
 // Represents the fancier type system within the optimizer, it's
 // all backed by my shitty understanding of lattice theory
-typedef struct {
+//
+//             ANY             (anything goes)
+//              |
+//   CTRL, INT, FLOAT, PTR      (some facts are known, see lattice_top for the widest of each)
+//              |
+//             NONE            (the empty set, nothing has reached it yet: for control it's unreachable)
+typedef struct Lattice {
     enum {
+        LATTICE_NONE,
+        LATTICE_ANY,
+        LATTICE_CTRL,
         LATTICE_INT,
         LATTICE_FLOAT32,
         LATTICE_FLOAT64,
@@ -46,15 +58,40 @@ typedef struct {
     };
 } Lattice;
 
+static uint64_t lattice_int_mask(TB_DataType dt) {
+    return dt.data >= 64 ? UINT64_MAX : (UINT64_C(1) << dt.data) - 1;
+}
+
+static int64_t lattice_sxt(TB_DataType dt, uint64_t x) {
+    int shift = 64 - dt.data;
+    return dt.data >= 64 ? (int64_t) x : ((int64_t) (x << shift)) >> shift;
+}
+
+static Lattice lattice_int_const(TB_DataType dt, uint64_t x) {
+    uint64_t mask = lattice_int_mask(dt);
+    int64_t v = lattice_sxt(dt, x & mask);
+    return (Lattice){ LATTICE_INT, ._int = { v, v, ~x & mask, x & mask } };
+}
+
+static bool lattice_is_const(const Lattice* l) {
+    return l->tag == LATTICE_INT && l->_int.min == l->_int.max;
+}
+
 // maximal subset
 static Lattice lattice_top(TB_DataType dt) {
+    // we don't track the lanes separately
+    if (dt.width) {
+        return (Lattice){ LATTICE_ANY };
+    }
+
     switch (dt.type) {
         case TB_INT: {
-            assert(dt.data <= 64);
-            uint64_t max_bits = UINT64_MAX >> dt.data;
-            tb_todo();
+            if (dt.data == 0 || dt.data > 64) {
+                return (Lattice){ LATTICE_ANY };
+            }
 
-            return (Lattice){ LATTICE_INT, ._int = { 0, max_bits } };
+            int64_t max = dt.data >= 64 ? INT64_MAX : (INT64_C(1) << (dt.data - 1)) - 1;
+            return (Lattice){ LATTICE_INT, ._int = { -max - 1, max } };
         }
 
         case TB_FLOAT: {
@@ -66,8 +103,60 @@ static Lattice lattice_top(TB_DataType dt) {
             return (Lattice){ LATTICE_POINTER, ._ptr = { LATTICE_UNKNOWN } };
         }
 
+        case TB_CONTROL:
+        case TB_TUPLE:
+        return (Lattice){ LATTICE_CTRL };
+
         default:
-        tb_todo();
+        return (Lattice){ LATTICE_ANY };
+    }
+}
+
+// the range and the known bits can tell us different things, we let them
+// tighten each other so that a constant looks the same no matter where it came from.
+static Lattice lattice_int_normalize(TB_DataType dt, LatticeInt i) {
+    uint64_t mask = lattice_int_mask(dt);
+    i.known_zeros &= mask, i.known_ones &= mask;
+
+    // all bits are known
+    if ((i.known_zeros | i.known_ones) == mask) {
+        return lattice_int_const(dt, i.known_ones);
+    }
+
+    // a non-negative range has the same high bits as the max
+    if (i.min >= 0) {
+        int hi = i.max ? 64 - tb_clz64(i.max) : 0;
+        if (hi < dt.data) {
+            i.known_zeros |= mask & ~((UINT64_C(1) << hi) - 1);
+        }
+    }
+
+    // known sign bit clamps the range
+    uint64_t sign = UINT64_C(1) << (dt.data - 1);
+    if ((i.known_zeros & sign) && i.min < 0) i.min = 0;
+    if ((i.known_ones & sign) && i.max >= 0) i.max = -1;
+
+    if (i.min == i.max) {
+        return lattice_int_const(dt, i.min);
+    }
+
+    return (Lattice){ LATTICE_INT, ._int = i };
+}
+
+static bool lattice_equal(const Lattice* a, const Lattice* b) {
+    if (a->tag != b->tag) return false;
+    switch (a->tag) {
+        case LATTICE_INT:
+        return memcmp(&a->_int, &b->_int, sizeof(LatticeInt)) == 0;
+
+        case LATTICE_FLOAT32: case LATTICE_FLOAT64:
+        return a->_float.trifecta == b->_float.trifecta;
+
+        case LATTICE_POINTER:
+        return a->_ptr.trifecta == b->_ptr.trifecta;
+
+        default:
+        return true;
     }
 }
 
@@ -77,16 +166,19 @@ static Lattice lattice_top(TB_DataType dt) {
 
 // generates the greatest lower bound between a and b
 static Lattice lattice_meet(const Lattice* a, const Lattice* b) {
-    assert(a->tag == b->tag);
+    if (a->tag == LATTICE_NONE) return *b;
+    if (b->tag == LATTICE_NONE) return *a;
+    if (a->tag != b->tag) return (Lattice){ LATTICE_ANY };
+
     switch (a->tag) {
         case LATTICE_INT: {
             // [amin, amax] ^ [bmin, bmax] => [min(amin, bmin), max(amax, bmax)]
             LatticeInt aa = a->_int;
             LatticeInt bb = b->_int;
 
-            LatticeInt i = { aa.bot, aa.top };
-            if (i.bot > bb.bot) i.bot = bb.bot;
-            if (i.top < bb.top) i.top = bb.top;
+            LatticeInt i = { aa.min, aa.max };
+            if (i.min > bb.min) i.min = bb.min;
+            if (i.max < bb.max) i.max = bb.max;
 
             i.known_zeros = aa.known_zeros & bb.known_zeros;
             i.known_ones = aa.known_ones & bb.known_ones;
@@ -104,6 +196,7 @@ static Lattice lattice_meet(const Lattice* a, const Lattice* b) {
             return (Lattice){ LATTICE_POINTER, ._ptr = p };
         }
 
-        default: tb_todo();
+        default:
+        return *a;
     }
 }
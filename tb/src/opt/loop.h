@@ -1,156 +1,708 @@
+// Loop optimizations, everything here works off the natural loops we find using
+// the dominator tree so the CFG info should be up to date (recompute_cfg).
+//
+//   canonicalization: loop headers end up with exactly two predecessors, the
+//     entry (a new preheader if there were several) and the latch (a new block
+//     which all the backedges go through).
+//
+//   induction variables: i = phi(init, i + c) is recognized and the array accesses
+//     indexed by it get strength reduced into a pointer which gets bumped every
+//     iteration, we only bother with the strides x64 can't fold into an address.
+//
+//   unrolling: small loops (a header and one body block) with a known trip
+//     count get fully unrolled.
+//
+//   LICM: is done by the scheduler since it's the one placing the floating nodes
+//     anyways (see gcm.h), this pass just turns it on.
+#define TB_LOOP_UNROLL_MAX_TRIPS 8
+#define TB_LOOP_UNROLL_MAX_NODES 64
 
-TB_Attrib* get_debug_var(TB_Node* n) {
-    dyn_array_for(i, n->attribs) {
-        if (n->attribs[i].tag == TB_ATTRIB_VARIABLE) return &n->attribs[i];
-    }
+typedef NL_Map(TB_Node*, int) LoopMap;
 
-    return NULL;
+// dominators are garbage for anything we can't reach
+static NL_HashSet loop_reachable_blocks(TB_Passes* p) {
+    NL_HashSet blocks = nl_hashset_alloc(p->order.count);
+    FOREACH_N(i, 0, p->order.count) {
+        nl_hashset_put(&blocks, p->order.traversal[i]);
+    }
+    return blocks;
 }
 
-static void add_region_pred_tracked(TB_Passes* opt, TB_Function* f, TB_Node* n, TB_Node* pred) {
-    // detach old predecessor list, make bigger one
-    assert(n->type == TB_REGION);
-
-    size_t old_count = n->input_count;
-    TB_Node** new_inputs = alloc_from_node_arena(f, (old_count + 1) * sizeof(TB_Node*));
-    memcpy(new_inputs, n->inputs, old_count * sizeof(TB_Node*));
-    new_inputs[old_count] = pred;
+static bool loop_has_block(NL_HashSet* blocks, TB_Node* bb) {
+    return nl_hashset_lookup(blocks, bb) & NL_HASHSET_HIGH_BIT;
+}
 
-    n->inputs = new_inputs;
-    n->input_count = old_count + 1;
+// an edge is a backedge if the header dominates where it came from
+static bool loop_is_backedge(NL_HashSet* blocks, TB_Node* header, TB_Node* pred) {
+    TB_Node* bb = tb_get_parent_region(pred);
+    return loop_has_block(blocks, bb) && tb_is_dominated_by(header, bb);
+}
 
-    add_user(opt, n, pred, old_count, NULL);
+static bool loop_is_header(NL_HashSet* blocks, TB_Node* bb) {
+    FOREACH_N(i, 0, bb->input_count) {
+        if (loop_is_backedge(blocks, bb, bb->inputs[i])) return true;
+    }
+    return false;
 }
 
-bool tb_passes_loop(TB_Passes* p) {
-    verify_tmp_arena(p);
+// the header and every block which reaches one of its backedges without going through it
+static void loop_find_body(NL_HashSet* blocks, TB_Node* header, NL_HashSet* body) {
+    DynArray(TB_Node*) stack = NULL;
 
-    TB_Function* f = p->f;
-    TB_PostorderWalk order = p->order;
+    nl_hashset_put(body, header);
+    FOREACH_N(i, 0, header->input_count) {
+        TB_Node* pred = header->inputs[i];
+        if (loop_is_backedge(blocks, header, pred)) {
+            dyn_array_put(stack, tb_get_parent_region(pred));
+        }
+    }
 
-    // canonicalize loops
-    DynArray(ptrdiff_t) backedges = NULL;
-    FOREACH_N(i, 0, order.count) {
-        TB_Node* header = order.traversal[i];
-        if (header->input_count != 2) {
+    while (dyn_array_length(stack) > 0) {
+        TB_Node* bb = dyn_array_pop(stack);
+        if (!loop_has_block(blocks, bb) || !nl_hashset_put(body, bb)) {
             continue;
         }
 
-        // find backedges, we'll be unifying them soon
-        dyn_array_clear(backedges);
-        FOREACH_N(j, 0, header->input_count) {
-            if (tb_is_dominated_by(header, tb_get_parent_region(header->inputs[j]))) {
-                dyn_array_put(backedges, j);
+        FOREACH_N(i, 0, bb->input_count) {
+            dyn_array_put(stack, tb_get_parent_region(bb->inputs[i]));
+        }
+    }
+
+    dyn_array_destroy(stack);
+}
+
+// how many loops each block is nested in, blocks outside of loops aren't in the map.
+static LoopMap loop_compute_depths(TB_Passes* p) {
+    LoopMap depths = NULL;
+    nl_map_create(depths, p->order.count);
+
+    NL_HashSet blocks = loop_reachable_blocks(p);
+    FOREACH_N(i, 0, p->order.count) {
+        TB_Node* header = p->order.traversal[i];
+        if (!loop_is_header(&blocks, header)) continue;
+
+        NL_HashSet body = nl_hashset_alloc(16);
+        loop_find_body(&blocks, header, &body);
+        nl_hashset_for(it, &body) {
+            TB_Node* bb = *it;
+
+            ptrdiff_t search = nl_map_get(depths, bb);
+            if (search >= 0) {
+                depths[search].v += 1;
+            } else {
+                nl_map_put(depths, bb, 1);
             }
         }
+        nl_hashset_free(body);
+    }
 
-        size_t backedge_count = dyn_array_length(backedges);
-        if (backedge_count == 0) {
-            continue;
+    nl_hashset_free(blocks);
+    return depths;
+}
+
+static int loop_depth(LoopMap depths, TB_Node* bb) {
+    ptrdiff_t search = nl_map_get(depths, bb);
+    return search >= 0 ? depths[search].v : 0;
+}
+
+////////////////////////////////
+// Canonicalization
+////////////////////////////////
+// swaps out all of n's inputs, keeps the users in sync
+static void loop_replace_inputs(TB_Passes* p, TB_Function* f, TB_Node* n, size_t count, TB_Node** ins) {
+    FOREACH_N(i, 0, n->input_count) {
+        set_input(p, n, NULL, i);
+    }
+
+    if (count > n->input_count) {
+        n->inputs = alloc_from_node_arena(f, count * sizeof(TB_Node*));
+        memset(n->inputs, 0, count * sizeof(TB_Node*));
+    }
+
+    n->input_count = count;
+    FOREACH_N(i, 0, count) {
+        set_input(p, n, ins[i], i);
+    }
+}
+
+// routes every predecessor of the header which is (or isn't) a backedge through
+// one new block, the phis get split along with it. returns true if it changed.
+static bool loop_merge_preds(TB_Passes* p, TB_Function* f, NL_HashSet* blocks, TB_Node* header, bool backedges) {
+    size_t pred_count = header->input_count;
+    bool* moved = tb_arena_alloc(tmp_arena, pred_count * sizeof(bool));
+
+    size_t count = 0;
+    FOREACH_N(i, 0, pred_count) {
+        TB_Node* pred = header->inputs[i];
+        moved[i] = loop_is_backedge(blocks, header, pred) == backedges;
+        if (!moved[i]) continue;
+
+        // we need the branch to retarget it
+        if (pred->type != TB_PROJ || pred->inputs[0]->type != TB_BRANCH) {
+            return false;
         }
+        count++;
+    }
 
-        DO_IF(TB_OPTDEBUG_LOOP)(printf("Loop %p:\n", header));
-        tb_assert(backedge_count == 1, "TODO: we only support one backedge rn");
+    if (count < 2) {
+        return false;
+    }
 
-        // the header in uncanonical form has a branch at the top to exit,
-        // also this branch should be a trivial IF not anything wacky like
-        // a switch... tf?
-        TB_Node* br = TB_NODE_GET_EXTRA_T(header, TB_NodeRegion)->end;
-        TB_NodeBranch* br_info = TB_NODE_GET_EXTRA(br);
-        if (br->type != TB_BRANCH || br->input_count != 2 || br_info->succ_count != 2) {
-            continue;
+    TB_Node* region = tb_alloc_node(f, TB_REGION, TB_TYPE_CONTROL, count, sizeof(TB_NodeRegion));
+    TB_NodeRegion* r = TB_NODE_GET_EXTRA(region);
+    r->dom_depth = -1; // unresolved
+    DO_IF(TB_OPTDEBUG_LOOP)(r->tag = lil_name(f, backedges ? "loop.latch" : "loop.preheader"));
+
+    // goto header
+    TB_Node* br = tb_alloc_node(f, TB_BRANCH, TB_TYPE_TUPLE, 1, sizeof(TB_NodeBranch));
+    TB_NodeBranch* br_info = TB_NODE_GET_EXTRA(br);
+    br_info->succ_count = 1;
+    br_info->succ = alloc_from_node_arena(f, sizeof(TB_Node*));
+    br_info->succ[0] = header;
+    set_input(p, br, region, 0);
+    r->end = br;
+
+    TB_Node* proj = make_proj_node(f, p, TB_TYPE_CONTROL, br, 0);
+
+    size_t k = 0;
+    FOREACH_N(i, 0, pred_count) if (moved[i]) {
+        TB_Node* pred = header->inputs[i];
+        set_input(p, region, pred, k++);
+
+        TB_NodeBranch* pred_br = TB_NODE_GET_EXTRA(pred->inputs[0]);
+        FOREACH_N(j, 0, pred_br->succ_count) {
+            if (pred_br->succ[j] == header) pred_br->succ[j] = region;
         }
+    }
 
-        // find the loop exit path
-        ptrdiff_t exit_i = -1;
-        TB_Node* backedge_proj = header->inputs[backedges[0]];
-        TB_Node* backedge_bb = tb_get_parent_region(backedge_proj);
-        FOREACH_N(j, 0, br_info->succ_count) {
-            if (!tb_is_dominated_by(br_info->succ[j], backedge_bb)) {
-                DO_IF(TB_OPTDEBUG_LOOP)(printf("  exit %p\n", br_info->succ[j]));
-                exit_i = j;
-                break;
+    // the phis get split the same way, the moved values go into a phi on the new block
+    DynArray(TB_Node*) phis = NULL;
+    FOR_USERS(use, p, header) {
+        if (use->n->type == TB_PHI && use->slot == 0) dyn_array_put(phis, use->n);
+    }
+
+    size_t new_count = pred_count - count + 1;
+    TB_Node** ins = tb_arena_alloc(tmp_arena, (new_count + 1) * sizeof(TB_Node*));
+    dyn_array_for(i, phis) {
+        TB_Node* phi = phis[i];
+        TB_Node* split = tb_alloc_node(f, TB_PHI, phi->dt, 1 + count, 0);
+        set_input(p, split, region, 0);
+
+        size_t a = 1, b = 1;
+        ins[0] = header;
+        FOREACH_N(j, 0, pred_count) {
+            if (moved[j]) {
+                set_input(p, split, phi->inputs[1 + j], a++);
+            } else {
+                ins[b++] = phi->inputs[1 + j];
             }
         }
+        ins[b++] = split;
+
+        loop_replace_inputs(p, f, phi, b, ins);
+        tb_pass_mark(p, split);
+        tb_pass_mark(p, phi);
+    }
+    dyn_array_destroy(phis);
 
-        // we didn't find the loop exit here... it's not a valid candidate
-        // for loop rotation
-        if (i < 0) {
+    size_t b = 0;
+    FOREACH_N(j, 0, pred_count) if (!moved[j]) {
+        ins[b++] = header->inputs[j];
+    }
+    ins[b++] = proj;
+    loop_replace_inputs(p, f, header, b, ins);
+
+    tb_pass_mark(p, region);
+    tb_pass_mark(p, header);
+    return true;
+}
+
+static bool loop_canonicalize(TB_Passes* p, TB_Function* f, NL_HashSet* blocks) {
+    bool changes = false;
+    FOREACH_N(i, 0, p->order.count) {
+        TB_Node* header = p->order.traversal[i];
+        if (header->type != TB_REGION || !loop_is_header(blocks, header)) {
             continue;
         }
 
-        // Loop rotation is not fun:
-        //
-        //       header         header:                    header:
-        //         |              ...                        ...
-        //         v              if (A) body else exit      if (A) body else exit
-        //     +->body->exit    body:                      body:
-        //     |   |              ...                        ...
-        //     |   v              jmp body                   if (A) body else exit
-        //     +-latch          exit:                      exit:
-        //
-        TB_Node* cond = br->inputs[1];
-        TB_Node* exit = br_info->succ[exit_i];
-        TB_Node* body = br_info->succ[1 - exit_i];
-
-        // move phi nodes from the header to the body
-        User* use = find_users(p, header);
-        while (use != NULL) {
-            User* next = use->next;
-            if (use->n->type == TB_PHI) {
-                set_input(p, use->n, body, 0);
+        // entries first so the header ends up as (entry, latch)
+        changes |= loop_merge_preds(p, f, blocks, header, false);
+        changes |= loop_merge_preds(p, f, blocks, header, true);
+    }
+
+    return changes;
+}
+
+////////////////////////////////
+// Induction variables
+////////////////////////////////
+// i = phi(init, i + step)
+static bool loop_iv_step(TB_Node* header, TB_Node* phi, size_t latch, int64_t* step) {
+    if (phi->type != TB_PHI || phi->inputs[0] != header || phi->input_count != 3 || phi->dt.type != TB_INT || phi->dt.data > 64) {
+        return false;
+    }
+
+    TB_Node* next = phi->inputs[1 + latch];
+    if (next->type != TB_ADD || next->inputs[1] != phi || next->inputs[2]->type != TB_INTEGER_CONST) {
+        return false;
+    }
+
+    TB_NodeInt* i = TB_NODE_GET_EXTRA(next->inputs[2]);
+    if (i->num_words != 1) {
+        return false;
+    }
+
+    *step = lattice_sxt(phi->dt, i->words[0] & lattice_int_mask(phi->dt));
+    return true;
+}
+
+// nothing inside of the loop feeds into n
+static bool loop_is_invariant(NL_HashSet* body, TB_Node* n, int depth) {
+    if (is_pinned(n)) {
+        return !loop_has_block(body, tb_get_parent_region(n));
+    }
+
+    if (depth > 16 || (n->inputs[0] && loop_has_block(body, tb_get_parent_region(n->inputs[0])))) {
+        return false;
+    }
+
+    FOREACH_N(i, 1, n->input_count) {
+        if (n->inputs[i] && !loop_is_invariant(body, n->inputs[i], depth + 1)) return false;
+    }
+    return true;
+}
+
+// array(base, i) for an invariant base and a non-scaling stride becomes a pointer
+// which starts at array(base, init) and gets bumped by step*stride each iteration.
+static bool loop_reduce_array(TB_Passes* p, TB_Function* f, NL_HashSet* body, TB_Node* header, size_t entry, size_t latch, TB_Node* iv, int64_t step, TB_Node* arr) {
+    int64_t stride = TB_NODE_GET_EXTRA_T(arr, TB_NodeArray)->stride;
+    if (stride == 1 || stride == 2 || stride == 4 || stride == 8) {
+        return false;
+    }
+
+    int64_t bump;
+    if (__builtin_mul_overflow(step, stride, &bump) || !loop_is_invariant(body, arr->inputs[1], 0)) {
+        return false;
+    }
+
+    TB_Node* idx = arr->inputs[2];
+    TB_Node* init = iv->inputs[1 + entry];
+    if (idx != iv) {
+        TB_Node* ext = tb_alloc_node(f, idx->type, idx->dt, 2, 0);
+        set_input(p, ext, init, 1);
+        tb_pass_mark(p, ext);
+        init = ext;
+    }
+
+    TB_Node* first = tb_alloc_node(f, TB_ARRAY_ACCESS, arr->dt, 3, sizeof(TB_NodeArray));
+    set_input(p, first, arr->inputs[1], 1);
+    set_input(p, first, init, 2);
+    TB_NODE_SET_EXTRA(first, TB_NodeArray, .stride = stride);
+
+    TB_Node* phi = tb_alloc_node(f, TB_PHI, arr->dt, 3, 0);
+    TB_Node* next = tb_alloc_node(f, TB_MEMBER_ACCESS, arr->dt, 2, sizeof(TB_NodeMember));
+    set_input(p, next, phi, 1);
+    TB_NODE_SET_EXTRA(next, TB_NodeMember, .offset = bump);
+
+    set_input(p, phi, header, 0);
+    set_input(p, phi, first, 1 + entry);
+    set_input(p, phi, next, 1 + latch);
+
+    DO_IF(TB_OPTDEBUG_LOOP)(printf("loop %p: strength reduced %p (stride %"PRId64")\n", header, arr, stride));
+    subsume_node(p, f, arr, phi);
+
+    tb_pass_mark(p, first);
+    tb_pass_mark(p, next);
+    tb_pass_mark(p, phi);
+    return true;
+}
+
+static bool loop_strength_reduce(TB_Passes* p, TB_Function* f, NL_HashSet* blocks, TB_Node* header) {
+    size_t latch = loop_is_backedge(blocks, header, header->inputs[1]) ? 1 : 0;
+    size_t entry = 1 - latch;
+    if (header->input_count != 2 || loop_is_backedge(blocks, header, header->inputs[entry])) {
+        return false;
+    }
+
+    NL_HashSet body = nl_hashset_alloc(16);
+    loop_find_body(blocks, header, &body);
+
+    DynArray(TB_Node*) ivs = NULL;
+    FOR_USERS(use, p, header) {
+        if (use->n->type == TB_PHI && use->slot == 0) dyn_array_put(ivs, use->n);
+    }
+
+    bool changes = false;
+    DynArray(TB_Node*) arrs = NULL;
+    dyn_array_for(i, ivs) {
+        TB_Node* iv = ivs[i];
+
+        int64_t step;
+        if (!loop_iv_step(header, iv, latch, &step)) continue;
+
+        // the extensions are only fine if i + step doesn't wrap in the narrow type
+        TB_ArithmeticBehavior ab = TB_NODE_GET_EXTRA_T(iv->inputs[1 + latch], TB_NodeBinopInt)->ab;
+
+        dyn_array_clear(arrs);
+        FOR_USERS(use, p, iv) {
+            TB_Node* u = use->n;
+            if (u->type == TB_ARRAY_ACCESS && use->slot == 2) {
+                dyn_array_put(arrs, u);
+            } else if ((u->type == TB_SIGN_EXT && (ab & TB_ARITHMATIC_NSW)) || (u->type == TB_ZERO_EXT && (ab & TB_ARITHMATIC_NUW))) {
+                FOR_USERS(use2, p, u) {
+                    if (use2->n->type == TB_ARRAY_ACCESS && use2->slot == 2) dyn_array_put(arrs, use2->n);
+                }
+            }
+        }
+
+        dyn_array_for(j, arrs) {
+            changes |= loop_reduce_array(p, f, &body, header, entry, latch, iv, step, arrs[j]);
+        }
+    }
+
+    dyn_array_destroy(arrs);
+    dyn_array_destroy(ivs);
+    nl_hashset_free(body);
+    return changes;
+}
+
+////////////////////////////////
+// Unrolling
+////////////////////////////////
+typedef struct {
+    TB_Node* header;
+    TB_Node* body;
+    TB_Node* body_proj;
+
+    // see loop_classify
+    LoopMap class;
+    DynArray(TB_Node*) nodes;
+} LoopUnroll;
+
+static bool loop_eval_cmp(TB_NodeTypeEnum type, TB_DataType dt, uint64_t a, uint64_t b) {
+    uint64_t mask = lattice_int_mask(dt);
+    a &= mask, b &= mask;
+
+    switch (type) {
+        case TB_CMP_EQ:  return a == b;
+        case TB_CMP_NE:  return a != b;
+        case TB_CMP_ULT: return a < b;
+        case TB_CMP_ULE: return a <= b;
+        case TB_CMP_SLT: return lattice_sxt(dt, a) < lattice_sxt(dt, b);
+        case TB_CMP_SLE: return lattice_sxt(dt, a) <= lattice_sxt(dt, b);
+        default: tb_unreachable(); return false;
+    }
+}
+
+// 0 if n is the same across iterations, 1 if it only depends on the header's phis
+// and 2 if it depends on the body block. Every 1 or 2 (besides the phis and the
+// entry into the body) gets cloned per iteration, -1 means we can't unroll.
+static int loop_classify(LoopUnroll* u, TB_Node* n, int depth) {
+    ptrdiff_t search = nl_map_get(u->class, n);
+    if (search >= 0) {
+        return u->class[search].v;
+    }
+
+    if (n->type == TB_PHI && n->inputs[0] == u->header) return 1;
+    if (n == u->body_proj) return 2;
+    if (n == u->header || depth > 256) return -1;
+
+    int c = 0;
+    if (is_pinned(n)) {
+        if (tb_get_parent_region(n) != u->body) {
+            nl_map_put(u->class, n, 0);
+            return 0;
+        }
+
+        // we only bother with simple bodies
+        if (n->type != TB_REGION && n->type != TB_LOAD && n->type != TB_STORE && n->type != TB_BRANCH && n->type != TB_PROJ) {
+            return -1;
+        }
+        c = 2;
+    }
+
+    FOREACH_N(i, 0, n->input_count) if (n->inputs[i]) {
+        int k = loop_classify(u, n->inputs[i], depth + 1);
+        if (k < 0) return -1;
+        if (c < k) c = k;
+    }
+
+    nl_map_put(u->class, n, c);
+    if (c > 0) {
+        dyn_array_put(u->nodes, n);
+    }
+    return c;
+}
+
+// counts how many times we go into the body, -1 if it's not known (or too many)
+static ptrdiff_t loop_trip_count(TB_Node* header, TB_Node* br, size_t entry, size_t latch, size_t body_i) {
+    TB_Node* cmp = br->inputs[1];
+    if (cmp->type < TB_CMP_EQ || cmp->type > TB_CMP_SLE) {
+        return -1;
+    }
+
+    // cmp(i, bound) or cmp(bound, i)
+    bool iv_left = cmp->inputs[1]->type == TB_PHI;
+    TB_Node* iv = cmp->inputs[iv_left ? 1 : 2];
+    TB_Node* bound = cmp->inputs[iv_left ? 2 : 1];
+
+    int64_t step;
+    TB_DataType dt = TB_NODE_GET_EXTRA_T(cmp, TB_NodeCompare)->cmp_dt;
+    if (!loop_iv_step(header, iv, latch, &step) || dt.raw != iv->dt.raw) {
+        return -1;
+    }
+
+    TB_Node* init = iv->inputs[1 + entry];
+    if (bound->type != TB_INTEGER_CONST || TB_NODE_GET_EXTRA_T(bound, TB_NodeInt)->num_words != 1 ||
+        init->type != TB_INTEGER_CONST || TB_NODE_GET_EXTRA_T(init, TB_NodeInt)->num_words != 1) {
+        return -1;
+    }
+
+    uint64_t b = TB_NODE_GET_EXTRA_T(bound, TB_NodeInt)->words[0];
+    uint64_t x = TB_NODE_GET_EXTRA_T(init, TB_NodeInt)->words[0];
+    uint64_t falsey = TB_NODE_GET_EXTRA_T(br, TB_NodeBranch)->keys[0];
+
+    ptrdiff_t trips = 0;
+    for (;;) {
+        bool c = iv_left ? loop_eval_cmp(cmp->type, dt, x, b) : loop_eval_cmp(cmp->type, dt, b, x);
+
+        // succ[1] is taken when the key matches
+        if ((c == falsey) != (body_i == 1)) break;
+        if (++trips > TB_LOOP_UNROLL_MAX_TRIPS) return -1;
+
+        x = (x + step) & lattice_int_mask(dt);
+    }
+
+    return trips;
+}
+
+// only handles loops of the form:
+//
+//   header:                        body:
+//     i = phi(init, i + step)        ...
+//     if (cmp(i, bound)) body        goto header
+//     else exit
+static bool loop_unroll(TB_Passes* p, TB_Function* f, NL_HashSet* blocks, TB_Node* header) {
+    if (header->input_count != 2) {
+        return false;
+    }
+
+    size_t latch = loop_is_backedge(blocks, header, header->inputs[1]) ? 1 : 0;
+    size_t entry = 1 - latch;
+    TB_Node* entry_proj = header->inputs[entry];
+    TB_Node* latch_proj = header->inputs[latch];
+    if (loop_is_backedge(blocks, header, entry_proj) ||
+        entry_proj->type != TB_PROJ || entry_proj->inputs[0]->type != TB_BRANCH ||
+        latch_proj->type != TB_PROJ) {
+        return false;
+    }
+
+    // the header is just the phis and the exit test
+    uint64_t falsey;
+    TB_Node* br = TB_NODE_GET_EXTRA_T(header, TB_NodeRegion)->end;
+    if (!is_if_branch(br, &falsey) || br->inputs[0] != header) {
+        return false;
+    }
+
+    size_t phi_count = 0;
+    FOR_USERS(use, p, header) {
+        if (use->n == br) continue;
+        if (use->n->type != TB_PHI || use->slot != 0 || use->n->input_count != 3) return false;
+        phi_count++;
+    }
+
+    // the body ends in a goto back to the header
+    TB_Node* latch_br = latch_proj->inputs[0];
+    TB_Node* body = tb_get_parent_region(latch_br);
+    if (body == header || body->input_count != 1 || latch_br->type != TB_BRANCH || latch_br->input_count != 1) {
+        return false;
+    }
+
+    TB_Node* projs[2];
+    if (!sccp_match_projs(p, br, projs)) {
+        return false;
+    }
+
+    size_t body_i = body->inputs[0] == projs[0] ? 0 : 1;
+    TB_Node* exit = TB_NODE_GET_EXTRA_T(br, TB_NodeBranch)->succ[1 - body_i];
+    if (body->inputs[0] != projs[body_i] || exit == header || exit == body) {
+        return false;
+    }
+
+    ptrdiff_t trips = loop_trip_count(header, br, entry, latch, body_i);
+    if (trips <= 0) {
+        return false;
+    }
+
+    TB_Node** phis = tb_arena_alloc(tmp_arena, phi_count * sizeof(TB_Node*));
+    TB_Node** vals = tb_arena_alloc(tmp_arena, phi_count * sizeof(TB_Node*));
+
+    size_t k = 0;
+    FOR_USERS(use, p, header) {
+        if (use->n != br) phis[k++] = use->n;
+    }
+
+    // find everything which has to get copied
+    LoopUnroll u = { header, body, projs[body_i] };
+    nl_map_create(u.class, 32);
+
+    bool ok = loop_classify(&u, latch_proj, 0) >= 0;
+    FOREACH_N(i, 0, phi_count) {
+        ok = ok && loop_classify(&u, phis[i]->inputs[1 + latch], 0) >= 0;
+        vals[i] = phis[i]->inputs[1 + entry];
+    }
+
+    size_t count = dyn_array_length(u.nodes);
+    if (!ok || count * trips > TB_LOOP_UNROLL_MAX_NODES) {
+        dyn_array_destroy(u.nodes);
+        nl_map_free(u.class);
+        return false;
+    }
+
+    DO_IF(TB_OPTDEBUG_LOOP)(printf("loop %p: unrolled %td times (%zu nodes)\n", header, trips, count));
+
+    TB_Node** clones = tb_arena_alloc(tmp_arena, count * sizeof(TB_Node*));
+    TB_Node* ctrl = entry_proj;
+    TB_Node* prev_goto = NULL;
+    FOREACH_N(t, 0, trips) {
+        InlineMap map = NULL;
+        nl_map_create(map, count + phi_count + 2);
+
+        // the previous iteration's values go in, the goto at the end leads
+        // out to the exit until we know who's next.
+        FOREACH_N(i, 0, phi_count) {
+            nl_map_put(map, phis[i], vals[i]);
+        }
+        nl_map_put(map, u.body_proj, ctrl);
+        nl_map_put(map, header, exit);
+
+        // whatever doesn't change across iterations maps to itself
+        FOREACH_N(i, 0, count) {
+            TB_Node* n = u.nodes[i];
+            FOREACH_N(j, 0, n->input_count) {
+                TB_Node* in = n->inputs[j];
+                if (in == NULL || nl_map_get(map, in) >= 0) continue;
+
+                ptrdiff_t search = nl_map_get(u.class, in);
+                if (search >= 0 && u.class[search].v == 0) {
+                    nl_map_put(map, in, in);
+                }
+            }
+        }
+
+        inline_clone(f->arena, count, u.nodes, &map, clones, &f->node_count);
+        FOREACH_N(i, 0, count) {
+            TB_Node* k = clones[i];
+            FOREACH_N(j, 0, k->input_count) if (k->inputs[j]) {
+                add_user(p, k, k->inputs[j], j);
             }
-            use = next;
+
+            if (k->type == TB_REGION) {
+                f->control_node_count += 1;
+            }
+
+            tb_pass_mark(p, k);
         }
 
-        DO_IF(TB_OPTDEBUG_LOOP)(r->tag = lil_name(f, "loop.header.%d", i));
-        br_info->succ_count = 1;
-        br_info->succ[0] = body;
+        // hook it up to the previous iteration (or the loop entry)
+        TB_Node* bb = inline_lookup(map, body);
+        TB_Node* prev = prev_goto ? prev_goto : entry_proj->inputs[0];
+        TB_NodeBranch* prev_br = TB_NODE_GET_EXTRA(prev);
+        FOREACH_N(j, 0, prev_br->succ_count) {
+            if (prev_br->succ[j] == header) prev_br->succ[j] = bb;
+        }
+
+        FOREACH_N(i, 0, phi_count) {
+            TB_Node* v = phis[i]->inputs[1 + latch];
+            ptrdiff_t search = nl_map_get(map, v);
+            vals[i] = search >= 0 ? map[search].v : v;
+        }
 
-        // duplicate condition for backedge
-        bool n;
-        TB_Node* dupped_cond = clone_node(p, f, header, cond, &n);
-        set_input(p, br, dupped_cond, 0);
+        ctrl = inline_lookup(map, latch_proj);
+        prev_goto = inline_lookup(map, latch_br);
+        TB_NODE_GET_EXTRA_T(prev_goto, TB_NodeBranch)->succ[0] = header;
+        nl_map_free(map);
+    }
 
-        // backedge needs to refer to the body not the header
-        TB_Node* backedge_br = backedge_proj->inputs[0];
-        TB_NodeBranch* backedge_br_info = TB_NODE_GET_EXTRA(backedge_br);
-        DO_IF(TB_OPTDEBUG_LOOP)(backedge->tag = lil_name(f, "loop.back.%d", i));
+    // the last iteration leaves through the old exit edge
+    TB_NODE_GET_EXTRA_T(prev_goto, TB_NodeBranch)->succ[0] = exit;
+    FOREACH_N(i, 0, exit->input_count) if (exit->inputs[i] == projs[1 - body_i]) {
+        set_input(p, exit, ctrl, i);
+        break;
+    }
+    tb_pass_mark(p, exit);
 
-        backedge_br_info->succ_count = 2;
-        backedge_br_info->succ = alloc_from_node_arena(f, 2 * sizeof(TB_Node*));
-        backedge_br_info->succ[0] = body;
-        backedge_br_info->succ[1] = exit;
+    FOREACH_N(i, 0, phi_count) {
+        subsume_node(p, f, phis[i], vals[i]);
+    }
 
-        // backedge should now point into the body
-        add_region_pred_tracked(p, f, body, backedge_proj);
-        add_region_pred_tracked(p, f, exit, backedge_proj);
+    // anything which only used the phis might still be used after the loop, the body is dead tho
+    DynArray(TB_Node*) dead = NULL;
+    FOREACH_N(i, 0, count) {
+        TB_Node* n = u.nodes[i];
+        if (u.class[nl_map_get(u.class, n)].v != 2) continue;
 
-        {
-            TB_Node* old = backedge_br->inputs[0];
+        dyn_array_put(dead, n);
+        FOR_USERS(use, p, n) {
+            if (nl_map_get(u.class, use->n) < 0) dyn_array_put(dead, use->n);
+        }
+    }
 
-            backedge_br->input_count = 2;
-            backedge_br->inputs = alloc_from_node_arena(f, 2 * sizeof(TB_Node*));
-            backedge_br->inputs[0] = old;
+    dyn_array_for(i, dead) {
+        if (dead[i]->type != TB_NULL) tb_pass_kill_node(p, dead[i]);
+    }
+    tb_pass_kill_node(p, projs[0]);
+    tb_pass_kill_node(p, projs[1]);
+    tb_pass_kill_node(p, br);
+    tb_pass_kill_node(p, header);
 
-            add_user(p, backedge_br, cond, 1, NULL);
-            backedge_br->inputs[1] = cond;
+    dyn_array_destroy(dead);
+    dyn_array_destroy(u.nodes);
+    nl_map_free(u.class);
+    return true;
+}
+
+bool tb_pass_loop(TB_Passes* p) {
+    verify_tmp_arena(p);
+
+    TB_Function* f = p->f;
+    bool changes = false;
+    CUIK_TIMED_BLOCK("loop") {
+        NL_HashSet blocks = loop_reachable_blocks(p);
+        if (loop_canonicalize(p, f, &blocks)) {
+            recompute_cfg(f, p);
+            nl_hashset_free(blocks);
+            blocks = loop_reachable_blocks(p);
+            changes = true;
         }
 
-        // the other path leaves the loop
-        {
-            TB_Node* proj = tb_alloc_node(f, TB_PROJ, TB_TYPE_CONTROL, 1, sizeof(TB_NodeProj));
-            set_input(p, proj, backedge_proj->inputs[0], 0);
-            TB_NODE_SET_EXTRA(proj, TB_NodeProj, .index = 1);
-            add_region_pred_tracked(p, f, exit, proj);
+        // unrolling moves blocks around so we refresh the CFG after each one
+        DynArray(TB_Node*) headers = NULL;
+        FOREACH_N(i, 0, p->order.count) {
+            if (loop_is_header(&blocks, p->order.traversal[i])) dyn_array_put(headers, p->order.traversal[i]);
         }
 
-        if (backedges[0] == 1) {
-            set_input(p, header, header->inputs[1 - backedges[0]], 0);
+        dyn_array_for(i, headers) {
+            if (headers[i]->type == TB_REGION && loop_unroll(p, f, &blocks, headers[i])) {
+                recompute_cfg(f, p);
+                nl_hashset_free(blocks);
+                blocks = loop_reachable_blocks(p);
+                changes = true;
+            }
         }
-        header->input_count = 1;
+        dyn_array_destroy(headers);
+
+        FOREACH_N(i, 0, p->order.count) {
+            TB_Node* header = p->order.traversal[i];
+            if (header->type == TB_REGION && loop_is_header(&blocks, header)) {
+                changes |= loop_strength_reduce(p, f, &blocks, header);
+            }
+        }
+        nl_hashset_free(blocks);
+
+        // invariant code gets hoisted when we schedule
+        p->licm = true;
     }
 
-    tb_function_print(f, tb_default_print_callback, stdout);
-    return false;
+    return changes;
 }
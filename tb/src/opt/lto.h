@@ -0,0 +1,313 @@
+// Whole module optimizations, these treat the module as the entire program (or at
+// least everything which gets linked together):
+//
+//   tb_module_lto: every TU shares the module but they don't share symbols, a call
+//     into another TU is just an external with the right name. We resolve those
+//     against the definitions, drop duplicate COMDATs and internalize everything
+//     which isn't a root. Once that's done we know every call site of the private
+//     functions so we can propagate constant arguments.
+//
+//   tb_module_strip: drops whatever isn't reachable from the public symbols, the
+//     inliner tends to leave a bunch of those.
+//
+// both run at the sync point like tb_module_inline.
+typedef struct {
+    // a reference which isn't the target of a direct call means we can't
+    // know all the callers.
+    bool escapes;
+    DynArray(TB_Node*) calls;
+} LTO_FuncInfo;
+
+typedef NL_Map(TB_Function*, LTO_FuncInfo) LTO_FuncMap;
+
+// name -> definition
+typedef NL_Strmap(TB_Symbol*) LTO_Defs;
+
+static bool lto_has_name(TB_Symbol* s) {
+    return s->name != NULL && s->name[0] != 0;
+}
+
+// unlinks every symbol which got turned into a tombstone
+static void lto_compact(TB_Module* m, enum TB_SymbolTag tag) {
+    TB_Symbol** prev = (TB_Symbol**) &m->first_symbol_of_tag[tag];
+    for (TB_Symbol* s = *prev; s != NULL; s = s->next) {
+        if (s->tag == tag) {
+            *prev = s;
+            prev = &s->next;
+        } else {
+            m->symbol_count[tag] -= 1;
+        }
+    }
+    *prev = NULL;
+}
+
+static void lto_kill(TB_Symbol* s) {
+    DO_IF(TB_OPTDEBUG_LTO)(log_debug("lto: dropped %s", s->name ? s->name : "<unnamed>"));
+    s->tag = TB_SYMBOL_TOMBSTONE;
+}
+
+static TB_Symbol* lto_resolve(LTO_Defs defs, const TB_Symbol* s) {
+    ptrdiff_t search = nl_map_get_cstr(defs, s->name);
+    assert(search >= 0 && "we only kill the symbols with definitions");
+    return defs[search].v;
+}
+
+static bool lto_visited(NL_HashSet* visited, void* s) {
+    return nl_hashset_lookup(visited, s) & NL_HASHSET_HIGH_BIT;
+}
+
+static void lto_reach(NL_HashSet* visited, DynArray(TB_Symbol*)* ws, const TB_Symbol* s) {
+    if (nl_hashset_put(visited, (void*) s)) {
+        dyn_array_put(*ws, (TB_Symbol*) s);
+    }
+}
+
+static LTO_FuncInfo* lto_func_info(LTO_FuncMap* map, TB_Function* f) {
+    ptrdiff_t search = nl_map_get(*map, f);
+    if (search < 0) {
+        nl_map_puti(*map, f, search);
+        (*map)[search].v = (LTO_FuncInfo){ 0 };
+    }
+    return &(*map)[search].v;
+}
+
+// marks everything reachable from the public symbols (and the ones the backend
+// needs on its own), if info is non-NULL we also note down every call site.
+static NL_HashSet lto_mark(TB_Module* m, LTO_FuncMap* info) {
+    NL_HashSet visited = nl_hashset_alloc(m->symbol_count[TB_SYMBOL_FUNCTION] + m->symbol_count[TB_SYMBOL_GLOBAL]);
+    DynArray(TB_Symbol*) ws = dyn_array_create(TB_Symbol*, 64);
+
+    TB_FOR_FUNCTIONS(f, m) if (f->linkage == TB_LINKAGE_PUBLIC) lto_reach(&visited, &ws, &f->super);
+    TB_FOR_GLOBALS(g, m) if (g->linkage == TB_LINKAGE_PUBLIC) lto_reach(&visited, &ws, &g->super);
+    if (m->chkstk_extern)    lto_reach(&visited, &ws, m->chkstk_extern);
+    if (m->tls_index_extern) lto_reach(&visited, &ws, m->tls_index_extern);
+
+    while (dyn_array_length(ws) > 0) {
+        TB_Symbol* s = dyn_array_pop(ws);
+        if (s->tag == TB_SYMBOL_GLOBAL) {
+            TB_Global* g = (TB_Global*) s;
+            FOREACH_N(i, 0, g->obj_count) if (g->objects[i].type == TB_INIT_OBJ_RELOC) {
+                const TB_Symbol* target = g->objects[i].reloc;
+                if (info && target->tag == TB_SYMBOL_FUNCTION) {
+                    lto_func_info(info, (TB_Function*) target)->escapes = true;
+                }
+                lto_reach(&visited, &ws, target);
+            }
+        } else if (s->tag == TB_SYMBOL_FUNCTION) {
+            TB_Function* f = (TB_Function*) s;
+            if (f->start_node == NULL) continue;
+
+            DynArray(TB_Node*) nodes = walk_all_nodes(f->start_node, f->node_count);
+            dyn_array_for(i, nodes) {
+                TB_Node* n = nodes[i];
+                FOREACH_N(j, 0, n->input_count) {
+                    TB_Node* in = n->inputs[j];
+                    if (in == NULL || in->type != TB_SYMBOL) continue;
+
+                    TB_Symbol* target = TB_NODE_GET_EXTRA_T(in, TB_NodeSymbol)->sym;
+                    if (info && target->tag == TB_SYMBOL_FUNCTION) {
+                        LTO_FuncInfo* fi = lto_func_info(info, (TB_Function*) target);
+                        if (n->type == TB_CALL && j == 1) {
+                            dyn_array_put(fi->calls, n);
+                        } else {
+                            fi->escapes = true;
+                        }
+                    }
+                    lto_reach(&visited, &ws, target);
+                }
+            }
+            dyn_array_destroy(nodes);
+        }
+    }
+
+    dyn_array_destroy(ws);
+    return visited;
+}
+
+static void lto_sweep(TB_Module* m, NL_HashSet* visited) {
+    TB_FOR_FUNCTIONS(f, m) if (!lto_visited(visited, f)) lto_kill(&f->super);
+    TB_FOR_GLOBALS(g, m) if (!lto_visited(visited, g)) lto_kill(&g->super);
+    TB_FOR_EXTERNALS(e, m) if (!lto_visited(visited, e)) lto_kill(&e->super);
+
+    lto_compact(m, TB_SYMBOL_FUNCTION);
+    lto_compact(m, TB_SYMBOL_GLOBAL);
+    lto_compact(m, TB_SYMBOL_EXTERNAL);
+}
+
+// if every caller passes the same integer constant for a parameter, the parameter
+// is that constant. We don't change the signature, the callers still pass it.
+static size_t lto_const_args(TB_Function* f, LTO_FuncInfo* fi) {
+    TB_FunctionPrototype* proto = f->prototype;
+    if (proto == NULL || proto->has_varargs || f->param_count != proto->param_count || dyn_array_length(fi->calls) == 0) {
+        return 0;
+    }
+
+    dyn_array_for(i, fi->calls) {
+        if (fi->calls[i]->input_count - 2 != f->param_count) return 0;
+    }
+
+    size_t count = 0;
+    NL_Map(TB_Node*, TB_Node*) subs = NULL;
+    FOREACH_N(i, 0, f->param_count) {
+        TB_Node* param = f->params[i];
+        if (param == NULL || !(TB_IS_INTEGER_TYPE(param->dt) || TB_IS_POINTER_TYPE(param->dt))) {
+            continue;
+        }
+
+        uint64_t imm = 0;
+        bool same = true;
+        dyn_array_for(j, fi->calls) {
+            TB_Node* arg = fi->calls[j]->inputs[2 + i];
+            if (arg->type != TB_INTEGER_CONST || arg->dt.raw != param->dt.raw) {
+                same = false;
+                break;
+            }
+
+            TB_NodeInt* num = TB_NODE_GET_EXTRA(arg);
+            if (num->num_words != 1 || (j > 0 && num->words[0] != imm)) {
+                same = false;
+                break;
+            }
+            imm = num->words[0];
+        }
+
+        if (same) {
+            DO_IF(TB_OPTDEBUG_LTO)(log_debug("lto: %s's param %zu is always %"PRIu64, f->super.name, i, imm));
+
+            TB_Node* k = tb_alloc_node(f, TB_INTEGER_CONST, param->dt, 1, sizeof(TB_NodeInt) + sizeof(uint64_t));
+            k->inputs[0] = f->start_node;
+            TB_NodeInt* num = TB_NODE_GET_EXTRA(k);
+            num->num_words = 1;
+            num->words[0] = imm;
+
+            nl_map_put(subs, param, k);
+            count += 1;
+        }
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    DynArray(TB_Node*) nodes = walk_all_nodes(f->start_node, f->node_count);
+    dyn_array_for(i, nodes) {
+        TB_Node* n = nodes[i];
+        FOREACH_N(j, 0, n->input_count) {
+            ptrdiff_t search = n->inputs[j] ? nl_map_get(subs, n->inputs[j]) : -1;
+            if (search >= 0) {
+                n->inputs[j] = subs[search].v;
+            }
+        }
+    }
+    dyn_array_destroy(nodes);
+    nl_map_free(subs);
+    return count;
+}
+
+void tb_module_lto(TB_Module* m, size_t root_count, const char** roots) {
+    LTO_Defs defs = NULL;
+    bool changes = false;
+
+    CUIK_TIMED_BLOCK("lto resolve") {
+        TB_FOR_FUNCTIONS(f, m) if (f->linkage == TB_LINKAGE_PUBLIC && lto_has_name(&f->super)) {
+            ptrdiff_t search = nl_map_get_cstr(defs, f->super.name);
+            if (search < 0) {
+                nl_map_put_cstr(defs, f->super.name, &f->super);
+            } else if (f->comdat.type != TB_COMDAT_NONE) {
+                // every copy of a COMDAT is the same, the first one wins
+                lto_kill(&f->super);
+                changes = true;
+            }
+        }
+
+        TB_FOR_GLOBALS(g, m) if (g->linkage == TB_LINKAGE_PUBLIC && lto_has_name(&g->super)) {
+            if (nl_map_get_cstr(defs, g->super.name) < 0) {
+                nl_map_put_cstr(defs, g->super.name, &g->super);
+            }
+        }
+
+        TB_FOR_EXTERNALS(e, m) if (lto_has_name(&e->super) && nl_map_get_cstr(defs, e->super.name) >= 0) {
+            lto_kill(&e->super);
+            changes = true;
+        }
+    }
+
+    // point every reference to a dead symbol at the definition of the same name
+    if (changes) CUIK_TIMED_BLOCK("lto redirect") {
+        TB_FOR_FUNCTIONS(f, m) if (f->super.tag == TB_SYMBOL_FUNCTION && f->start_node != NULL) {
+            DynArray(TB_Node*) nodes = walk_all_nodes(f->start_node, f->node_count);
+            dyn_array_for(i, nodes) if (nodes[i]->type == TB_SYMBOL) {
+                TB_NodeSymbol* sym = TB_NODE_GET_EXTRA(nodes[i]);
+                if (sym->sym->tag == TB_SYMBOL_TOMBSTONE) {
+                    sym->sym = lto_resolve(defs, sym->sym);
+                }
+            }
+            dyn_array_destroy(nodes);
+        }
+
+        TB_FOR_GLOBALS(g, m) {
+            FOREACH_N(i, 0, g->obj_count) {
+                TB_InitObj* obj = &g->objects[i];
+                if (obj->type == TB_INIT_OBJ_RELOC && obj->reloc->tag == TB_SYMBOL_TOMBSTONE) {
+                    obj->reloc = lto_resolve(defs, obj->reloc);
+                }
+            }
+        }
+
+        lto_compact(m, TB_SYMBOL_FUNCTION);
+        lto_compact(m, TB_SYMBOL_EXTERNAL);
+    }
+    nl_map_free(defs);
+
+    // everything that isn't a root can't be seen from the outside anymore
+    if (roots != NULL) CUIK_TIMED_BLOCK("lto internalize") {
+        NL_Strmap(bool) root_set = NULL;
+        FOREACH_N(i, 0, root_count) {
+            nl_map_put_cstr(root_set, roots[i], true);
+        }
+
+        TB_FOR_FUNCTIONS(f, m) if (f->linkage == TB_LINKAGE_PUBLIC) {
+            if (!lto_has_name(&f->super) || nl_map_get_cstr(root_set, f->super.name) < 0) {
+                f->linkage = TB_LINKAGE_PRIVATE;
+                f->comdat.type = TB_COMDAT_NONE;
+            }
+        }
+
+        TB_FOR_GLOBALS(g, m) if (g->linkage == TB_LINKAGE_PUBLIC) {
+            if (!lto_has_name(&g->super) || nl_map_get_cstr(root_set, g->super.name) < 0) {
+                g->linkage = TB_LINKAGE_PRIVATE;
+            }
+        }
+        nl_map_free(root_set);
+    }
+
+    LTO_FuncMap info = NULL;
+    CUIK_TIMED_BLOCK("lto strip") {
+        NL_HashSet visited = lto_mark(m, &info);
+        lto_sweep(m, &visited);
+        nl_hashset_free(visited);
+    }
+
+    CUIK_TIMED_BLOCK("lto const args") {
+        TB_FOR_FUNCTIONS(f, m) if (f->linkage == TB_LINKAGE_PRIVATE) {
+            ptrdiff_t search = nl_map_get(info, f);
+            if (search >= 0 && !info[search].v.escapes) {
+                TB_Arena* old_arena = f->arena;
+                f->arena = get_permanent_arena(m);
+                lto_const_args(f, &info[search].v);
+                f->arena = old_arena;
+            }
+        }
+    }
+
+    nl_map_for(i, info) {
+        dyn_array_destroy(info[i].v.calls);
+    }
+    nl_map_free(info);
+}
+
+void tb_module_strip(TB_Module* m) {
+    NL_HashSet visited = lto_mark(m, NULL);
+    lto_sweep(m, &visited);
+    nl_hashset_free(visited);
+}
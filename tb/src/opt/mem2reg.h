@@ -77,14 +77,15 @@ static TB_Node* new_phi(Mem2Reg_Ctx* restrict c, TB_Function* f, int var, TB_Nod
 }
 
 static void add_phi_operand(Mem2Reg_Ctx* restrict c, TB_Function* f, TB_Node* phi_node, TB_Node* bb, TB_Node* node) {
-    // we're using NULL nodes as the baseline PHI0
-    if (phi_node == node) {
+    if (phi_node->type == TB_POISON) {
+        phi_node->dt = node->dt;
         return;
     }
 
-    phi_node->dt = node->dt;
-    if (phi_node->type == TB_POISON) {
-        return;
+    // the PHI flowing into itself (a loop which doesn't touch the variable)
+    // still needs the edge filled, it's not allowed to be NULL.
+    if (phi_node != node) {
+        phi_node->dt = node->dt;
     }
 
     assert(phi_node->type == TB_PHI);
@@ -163,36 +164,37 @@ static void ssa_rename_node(Mem2Reg_Ctx* c, TB_Node* n, DynArray(TB_Node*)* stac
         }
     }
 
-    // check for any loads and replace them
-    for (User* u = find_users(c->p, n); u; u = u->next) {
-        TB_Node* use = u->n;
-
-        if (use->type == TB_LOAD) {
-            int var = get_variable_id(c, use->inputs[1]);
-            if (var >= 0) {
-                TB_Node* val;
-                if (dyn_array_length(stack[var]) == 0) {
-                    // this is UB since it implies we've read before initializing the
-                    // stack slot.
-                    val = c->poison;
-                    log_warn("%p: found load-before-init in mem2reg, this is UB", use);
-                } else {
-                    val = stack[var][dyn_array_length(stack[var]) - 1];
-                }
+    // check for any loads and replace them, replacing one takes it out of n's
+    // users (the last one moves into its place) so we don't step forward then.
+    for (size_t i = 0; i < user_count(c->p, n);) {
+        TB_Node* use = find_users(c->p, n)[i].n;
+        int var = use->type == TB_LOAD ? get_variable_id(c, use->inputs[1]) : -1;
+        if (var < 0) {
+            i++;
+            continue;
+        }
 
-                // make sure it's the right type
-                if (use->dt.raw != val->dt.raw) {
-                    TB_Node* cast = tb_alloc_node(c->f, TB_BITCAST, use->dt, 2, 0);
-                    tb_pass_mark(c->p, cast);
-                    set_input(c->p, cast, val, 1);
+        TB_Node* val;
+        if (dyn_array_length(stack[var]) == 0) {
+            // this is UB since it implies we've read before initializing the
+            // stack slot.
+            val = c->poison;
+            log_warn("%p: found load-before-init in mem2reg, this is UB", use);
+        } else {
+            val = stack[var][dyn_array_length(stack[var]) - 1];
+        }
 
-                    val = cast;
-                }
+        // make sure it's the right type
+        if (use->dt.raw != val->dt.raw) {
+            TB_Node* cast = tb_alloc_node(c->f, TB_BITCAST, use->dt, 2, 0);
+            tb_pass_mark(c->p, cast);
+            set_input(c->p, cast, val, 1);
 
-                set_input(c->p, use, NULL, 1); // unlink first
-                subsume_node(c->p, c->f, use, val);
-            }
+            val = cast;
         }
+
+        set_input(c->p, use, NULL, 1); // unlink first
+        subsume_node(c->p, c->f, use, val);
     }
 
     if (kill) {
@@ -209,12 +211,13 @@ static void ssa_rename(Mem2Reg_Ctx* c, TB_Function* f, TB_Node* bb, DynArray(TB_
     // push phi nodes
     size_t* old_len = tb_tls_push(c->tls, sizeof(size_t) * c->to_promote_count);
     FOREACH_N(var, 0, c->to_promote_count) {
+        // the phi is one of our defs so it gets popped with the rest of them
+        old_len[var] = dyn_array_length(stack[var]);
+
         ptrdiff_t search = nl_map_get(c->defs[var], bb);
         if (search >= 0 && c->defs[var][search].v->type == TB_PHI) {
             dyn_array_put(stack[var], c->defs[var][search].v);
         }
-
-        old_len[var] = dyn_array_length(stack[var]);
     }
 
     // rewrite operations
@@ -258,44 +261,6 @@ static void ssa_rename(Mem2Reg_Ctx* c, TB_Function* f, TB_Node* bb, DynArray(TB_
     tb_tls_restore(c->tls, old_len);
 }
 
-typedef struct {
-    TB_Node* old_n;
-
-    int64_t offset;
-    TB_CharUnits size;
-    TB_DataType dt;
-} AggregateConfig;
-
-static ptrdiff_t find_config(size_t config_count, AggregateConfig* configs, int64_t offset) {
-    FOREACH_N(i, 0, config_count) {
-        if (configs[i].offset == offset) return i;
-    }
-
-    tb_unreachable();
-    return -1;
-}
-
-// -1 is a bad match
-// -2 is no match, so we can add a new config
-static ptrdiff_t compatible_with_configs(size_t config_count, AggregateConfig* configs, int64_t offset, TB_CharUnits size, TB_DataType dt) {
-    int64_t max = offset + size;
-
-    FOREACH_N(i, 0, config_count) {
-        int64_t max2 = configs[i].offset + configs[i].size;
-
-        if (offset >= configs[i].offset && max <= max2) {
-            // they overlap... but is it a clean overlap?
-            if (offset == configs[i].offset && max == max2 && TB_DATA_TYPE_EQUALS(dt, configs[i].dt)) {
-                return i;
-            }
-
-            return -1;
-        }
-    }
-
-    return -2;
-}
-
 static void insert_phis(Mem2Reg_Ctx* restrict ctx, TB_Node* parent, TB_Node* n) {
     if (n->type != TB_REGION && n->type != TB_START && n->type != TB_PHI) {
         insert_phis(ctx, parent, n->inputs[0]);
@@ -334,75 +299,6 @@ static void insert_phis(Mem2Reg_Ctx* restrict ctx, TB_Node* parent, TB_Node* n)
     }
 }
 
-// false means failure to SROA
-static bool add_configs(TB_Passes* p, TB_TemporaryStorage* tls, User* use, TB_Node* base_address, size_t base_offset, size_t* config_count, AggregateConfig* configs, int pointer_size) {
-    for (; use; use = use->next) {
-        TB_Node* n = use->n;
-
-        // we can only SROA if we know we're not using the
-        // address for anything but direct memory ops or TB_MEMBERs.
-        if (use->slot != 1) {
-            return false;
-        }
-
-        if (n->type == TB_MEMBER_ACCESS) {
-            // same rules, different offset
-            int64_t offset = TB_NODE_GET_EXTRA_T(n, TB_NodeMember)->offset;
-            if (!add_configs(p, tls, find_users(p, n), base_address, base_offset + offset, config_count, configs, pointer_size)) {
-                return false;
-            }
-            continue;
-        }
-
-        // find direct memory op
-        if (n->type != TB_LOAD && n->type != TB_STORE) {
-            return false;
-        }
-
-        TB_DataType dt = n->type == TB_LOAD ? n->dt : n->inputs[2]->dt;
-        TB_Node* address = n->inputs[1];
-        int size = (bits_in_data_type(pointer_size, dt) + 7) / 8;
-
-        // see if it's a compatible configuration
-        int match = compatible_with_configs(*config_count, configs, base_offset, size, dt);
-        if (match == -1) {
-            return false;
-        } else if (match == -2) {
-            // add new config
-            tb_tls_push(tls, sizeof(AggregateConfig));
-            configs[(*config_count)++] = (AggregateConfig){ address, base_offset, size, dt };
-        } else if (configs[match].old_n != address) {
-            log_warn("%s: %p SROA config matches but reaches so via a different node, please idealize nodes before mem2reg", p->f->super.name, address);
-            return false;
-        }
-    }
-
-    return true;
-}
-
-static bool attempt_sroa(TB_Passes* p, TB_Function* f, TB_TemporaryStorage* tls, TB_Node* address) {
-    int pointer_size = tb__find_code_generator(f->super.module)->pointer_size;
-
-    size_t config_count = 0;
-    AggregateConfig* configs = tb_tls_push(tls, 0);
-    if (!add_configs(p, tls, find_users(p, address), address, 0, &config_count, configs, pointer_size)) {
-        return false;
-    }
-
-    uint32_t alignment = TB_NODE_GET_EXTRA_T(address, TB_NodeLocal)->align;
-    FOREACH_N(i, 0, config_count) {
-        TB_Node* new_n = tb_alloc_node(f, TB_LOCAL, TB_TYPE_PTR, 1, sizeof(TB_NodeLocal));
-        TB_NODE_SET_EXTRA(new_n, TB_NodeLocal, .size = configs[i].size, .align = alignment);
-
-        // replace old pointer with new fancy
-        subsume_node(p, f, configs[i].old_n, new_n);
-        dyn_array_put(p->locals, new_n);
-    }
-
-    tb_pass_kill_node(p, address);
-    return true;
-}
-
 bool tb_pass_mem2reg(TB_Passes* p) {
     cuikperf_region_start("mem2reg", NULL);
     verify_tmp_arena(p);
@@ -410,26 +306,6 @@ bool tb_pass_mem2reg(TB_Passes* p) {
     TB_Function* f = p->f;
     TB_TemporaryStorage* tls = tb_tls_steal();
 
-    ////////////////////////////////
-    // Try SROA first
-    ////////////////////////////////
-    for (size_t i = dyn_array_length(p->locals); i--;) retry: {
-        TB_Node* address = p->locals[i];
-
-        TB_DataType dt;
-        Coherency coherence = tb_get_stack_slot_coherency(p, f, address, &dt);
-        if (coherence == COHERENCY_USES_ADDRESS) {
-            void* mark = tb_tls_push(tls, 0);
-            if (attempt_sroa(p, f, tls, address)) {
-                DO_IF(TB_OPTDEBUG_MEM2REG)(log_debug("%s: %p was able to SROA", f->super.name, address));
-                tb_tls_restore(tls, mark);
-                goto retry; // but don't go the next int
-            } else {
-                tb_tls_restore(tls, mark);
-            }
-        }
-    }
-
     ////////////////////////////////
     // Decide which stack slots to promote
     ////////////////////////////////
@@ -608,7 +484,7 @@ static Coherency tb_get_stack_slot_coherency(TB_Passes* p, TB_Function* f, TB_No
     bool initialized = false;
     int dt_bits = 0;
 
-    for (User* use = find_users(p, address); use; use = use->next) {
+    FOR_USERS(use, p, address) {
         TB_Node* n = use->n;
         if (n->type == TB_MEMSET && n->inputs[1] == address && tb_node_is_constant_zero(n->inputs[2])) {
             TB_NodeInt* size = TB_NODE_GET_EXTRA(n->inputs[2]);
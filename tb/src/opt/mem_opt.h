@@ -1,70 +1,413 @@
 // Certain aliasing optimizations technically count as peepholes lmao, these can get fancy
 // so the sliding window notion starts to break down but there's no global analysis and
 // i can make them incremental technically so we'll go wit it.
+//
+// The memory effects are already threaded as a chain through the control edges (stores,
+// calls, memsets... each take the previous one as input 0, regions merge them), so it's
+// basically memory SSA with one big memory variable. The alias queries below let us walk
+// up that chain past anything that can't touch the address we care about:
+//
+//   * two distinct objects (locals or symbols) never alias
+//   * a local which doesn't escape can't alias any pointer not derived from it, calls
+//     can't touch it either
+//   * same base, known offsets: it's just a range check
+//
+// Loads walk up until they find a matching store (forward the value), an older load of
+// the same address (reuse it) or a clobber, at merge points we try each predecessor and
+// put a phi on the results. Stores walk up to find older stores they completely cover.
+#define MEM_WALK_BUDGET 32
+#define MEM_WALK_DEPTH  4
+#define MEM_MAX_PREDS   8
+#define MEM_DOM_STEPS   64
+
+typedef enum {
+    ALIAS_NO, ALIAS_MAY, ALIAS_MUST
+} AliasResult;
+
 typedef struct {
     TB_Node* base;
     int64_t offset;
 } KnownPointer;
 
 static KnownPointer known_pointer(TB_Node* n) {
-    if (n->type == TB_MEMBER_ACCESS) {
-        return (KnownPointer){ n->inputs[1], TB_NODE_GET_EXTRA_T(n, TB_NodeMember)->offset };
-    } else {
-        return (KnownPointer){ n, 0 };
+    int64_t offset = 0;
+    for (;;) {
+        uint64_t idx;
+        if (n->type == TB_MEMBER_ACCESS) {
+            offset += TB_NODE_GET_EXTRA_T(n, TB_NodeMember)->offset;
+        } else if (n->type == TB_ARRAY_ACCESS && get_int_const(n->inputs[2], &idx)) {
+            offset += (int64_t) idx * TB_NODE_GET_EXTRA_T(n, TB_NodeArray)->stride;
+        } else {
+            return (KnownPointer){ n, offset };
+        }
+
+        n = n->inputs[1];
     }
 }
 
-static TB_Node* ideal_load(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
-    // if a load is control dependent on a store and it doesn't alias we can move the
-    // dependency up a bit.
-    if (n->inputs[0]->type != TB_STORE) return NULL;
+// the object a pointer was derived from, offsets don't matter here
+static TB_Node* mem_root(TB_Node* n) {
+    while (n->type == TB_MEMBER_ACCESS || n->type == TB_ARRAY_ACCESS) {
+        n = n->inputs[1];
+    }
+    return n;
+}
+
+static bool mem_is_object(TB_Node* n) {
+    return n->type == TB_LOCAL || n->type == TB_SYMBOL;
+}
 
-    KnownPointer ld_ptr = known_pointer(n->inputs[1]);
-    KnownPointer st_ptr = known_pointer(n->inputs[0]->inputs[1]);
-    if (ld_ptr.base != st_ptr.base) return NULL;
+// a local escapes once its address is used as anything other than an address: stored
+// somewhere, passed to a call, merged in a phi... if it never does, nothing but direct
+// accesses can touch it. 'read' is set if anything loads from it.
+static bool mem_escapes(TB_Passes* restrict p, TB_Node* n, bool* read, int depth) {
+    if (depth > 8) return true;
+
+    FOR_USERS(use, p, n) {
+        TB_Node* u = use->n;
+        switch (u->type) {
+            case TB_LOAD:
+            *read = true;
+            break;
+
+            case TB_STORE:
+            case TB_MEMSET:
+            if (use->slot != 1) return true;
+            break;
+
+            case TB_MEMCPY:
+            if (use->slot == 2) *read = true;
+            else if (use->slot != 1) return true;
+            break;
+
+            case TB_MEMBER_ACCESS:
+            case TB_ARRAY_ACCESS:
+            if (use->slot != 1 || mem_escapes(p, u, read, depth + 1)) return true;
+            break;
+
+            default:
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool mem_is_private(TB_Passes* restrict p, TB_Node* root) {
+    bool read = false;
+    return root->type == TB_LOCAL && !mem_escapes(p, root, &read, 0);
+}
+
+// writes into locals nobody reads from are dead
+static bool mem_is_write_only(TB_Passes* restrict p, TB_Node* addr) {
+    TB_Node* root = mem_root(known_pointer(addr).base);
+    bool read = false;
+    return root->type == TB_LOCAL && !mem_escapes(p, root, &read, 0) && !read;
+}
 
-    // it's probably not the fastest way to grab this value ngl...
+// size in bits, 0 if we don't know
+static int mem_size(TB_Function* f, TB_DataType dt) {
     ICodeGen* cg = tb__find_code_generator(f->super.module);
-    ld_ptr.offset *= cg->minimum_addressable_size;
-    st_ptr.offset *= cg->minimum_addressable_size;
+    return dt.width ? 0 : bits_in_data_type(cg->pointer_size, dt);
+}
 
-    size_t loaded_end = ld_ptr.offset + bits_in_data_type(cg->pointer_size, n->dt);
-    size_t stored_end = st_ptr.offset + bits_in_data_type(cg->pointer_size, n->inputs[0]->inputs[2]->dt);
+static AliasResult mem_alias(TB_Passes* restrict p, TB_Function* f, TB_Node* a, int a_size, TB_Node* b, int b_size) {
+    if (a == b) {
+        return a_size && a_size == b_size ? ALIAS_MUST : ALIAS_MAY;
+    }
 
-    // both bases match so if the effective ranges don't intersect, they don't alias.
-    if (ld_ptr.offset <= stored_end && st_ptr.offset <= loaded_end) return NULL;
+    KnownPointer a_ptr = known_pointer(a);
+    KnownPointer b_ptr = known_pointer(b);
+    if (a_ptr.base == b_ptr.base) {
+        if (a_size == 0 || b_size == 0) return ALIAS_MAY;
 
-    set_input(p, n, n->inputs[0]->inputs[0], 0);
-    return n;
+        // it's probably not the fastest way to grab this value ngl...
+        ICodeGen* cg = tb__find_code_generator(f->super.module);
+        int64_t a_start = a_ptr.offset * cg->minimum_addressable_size;
+        int64_t b_start = b_ptr.offset * cg->minimum_addressable_size;
+
+        // both bases match so if the effective ranges don't intersect, they don't alias.
+        if (a_start + a_size <= b_start || b_start + b_size <= a_start) return ALIAS_NO;
+        return a_start == b_start && a_size == b_size ? ALIAS_MUST : ALIAS_MAY;
+    }
+
+    TB_Node* a_root = mem_root(a_ptr.base);
+    TB_Node* b_root = mem_root(b_ptr.base);
+    if (a_root == b_root) {
+        // same object, unknown indices
+        return ALIAS_MAY;
+    }
+
+    if (mem_is_object(a_root) && mem_is_object(b_root)) {
+        if (a_root->type == TB_SYMBOL && b_root->type == TB_SYMBOL &&
+            TB_NODE_GET_EXTRA_T(a_root, TB_NodeSymbol)->sym == TB_NODE_GET_EXTRA_T(b_root, TB_NodeSymbol)->sym) {
+            return ALIAS_MAY;
+        }
+
+        return ALIAS_NO;
+    }
+
+    // arbitrary pointers can't reach locals which never had their address leak
+    if (mem_is_private(p, a_root) || mem_is_private(p, b_root)) {
+        return ALIAS_NO;
+    }
+
+    return ALIAS_MAY;
 }
 
-static TB_Node* identity_load(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
-    // god i need a pattern matcher
-    //   (load (store X A Y) A) => Y
-    if (n->inputs[0]->type == TB_STORE &&
-        n->inputs[0]->inputs[1] == n->inputs[1] &&
-        n->dt.raw == n->inputs[0]->inputs[2]->dt.raw &&
-        is_same_align(n, n->inputs[0])) {
-        return n->inputs[0]->inputs[2];
+static bool mem_is_zero_fill(TB_Node* n, int64_t* size) {
+    uint64_t val, len;
+    if (!get_int_const(n->inputs[2], &val) || !get_int_const(n->inputs[3], &len) || val != 0) {
+        return false;
+    }
+
+    *size = len;
+    return true;
+}
+
+// any pred which the region dominates is a backedge. the dominators were built at the
+// start of the pass so blocks they can't place (or that are too deep) count as one too.
+static bool mem_is_loop_header(TB_Node* region) {
+    FOREACH_N(i, 0, region->input_count) {
+        TB_Node* bb = tb_get_parent_region(region->inputs[i]);
+        for (int steps = 0;; steps++) {
+            if (bb == region) return true;
+
+            TB_Node* up = idom(bb);
+            if (up == NULL || steps >= MEM_DOM_STEPS) return true;
+            if (up == bb) break;
+            bb = up;
+        }
+    }
+
+    return false;
+}
+
+typedef struct {
+    TB_Node* ld;
+    TB_Node* addr;
+    int size;
+    bool private;
+
+    int budget;
+    int depth;
+    TB_Node* stack[MEM_WALK_DEPTH];
+} MemWalk;
+
+// what does the load see after 'mem', NULL if we don't know
+static TB_Node* mem_walk(TB_Passes* restrict p, TB_Function* f, MemWalk* w, TB_Node* mem) {
+    TB_Node* ld = w->ld;
+    for (;;) {
+        if (--w->budget < 0) return NULL;
+
+        // redundant loads, if someone already read it from this memory state just reuse it
+        FOR_USERS(use, p, mem) {
+            TB_Node* u = use->n;
+            if (u != ld && u->type == TB_LOAD && use->slot == 0 && u->inputs[1] == w->addr && u->dt.raw == ld->dt.raw) {
+                return u;
+            }
+        }
+
+        switch (mem->type) {
+            case TB_STORE: {
+                TB_Node* val = mem->inputs[2];
+                AliasResult a = mem_alias(p, f, w->addr, w->size, mem->inputs[1], mem_size(f, val->dt));
+                if (a == ALIAS_MUST && val->dt.raw == ld->dt.raw) {
+                    return val;
+                } else if (a != ALIAS_NO) {
+                    return NULL;
+                }
+
+                mem = mem->inputs[0];
+                break;
+            }
+
+            case TB_MEMSET: {
+                int64_t len;
+                bool zeroes = mem_is_zero_fill(mem, &len);
+                ICodeGen* cg = tb__find_code_generator(f->super.module);
+                int bits = zeroes ? len * cg->minimum_addressable_size : 0;
+
+                AliasResult a = mem_alias(p, f, w->addr, w->size, mem->inputs[1], bits);
+                if (a == ALIAS_NO) {
+                    mem = mem->inputs[0];
+                    break;
+                }
+
+                // zeroed memory, we don't care about the exact overlap as long as we're
+                // covered by it.
+                KnownPointer ld_ptr = known_pointer(w->addr);
+                KnownPointer st_ptr = known_pointer(mem->inputs[1]);
+                if (zeroes && w->size && ld_ptr.base == st_ptr.base && ld->dt.type == TB_INT &&
+                    ld_ptr.offset >= st_ptr.offset && (ld_ptr.offset - st_ptr.offset) * cg->minimum_addressable_size + w->size <= bits) {
+                    TB_Node* zero = make_int_node(f, p, ld->dt, 0);
+                    tb_pass_mark(p, zero);
+                    return zero;
+                }
+                return NULL;
+            }
+
+            case TB_MEMCPY: {
+                uint64_t len;
+                ICodeGen* cg = tb__find_code_generator(f->super.module);
+                int bits = get_int_const(mem->inputs[3], &len) ? len * cg->minimum_addressable_size : 0;
+                if (mem_alias(p, f, w->addr, w->size, mem->inputs[1], bits) != ALIAS_NO) {
+                    return NULL;
+                }
+
+                mem = mem->inputs[0];
+                break;
+            }
+
+            case TB_PROJ: {
+                TB_Node* tup = mem->inputs[0];
+                if (tup->type == TB_BRANCH) {
+                    mem = tup->inputs[0];
+                } else if ((tup->type == TB_CALL || tup->type == TB_SYSCALL) && w->private) {
+                    // calls can't see locals which didn't escape
+                    mem = tup->inputs[0];
+                } else {
+                    return NULL;
+                }
+                break;
+            }
+
+            case TB_REGION: {
+                if (mem->input_count == 1) {
+                    mem = mem->inputs[0];
+                    break;
+                }
+
+                // only acyclic merges get a phi, going around a loop we'd be looking at
+                // the last iteration. dead regions (nothing flows in) don't tell us anything either.
+                if (mem->input_count == 0 || mem->input_count > MEM_MAX_PREDS || w->depth >= MEM_WALK_DEPTH) return NULL;
+                if (mem_is_loop_header(mem)) return NULL;
+                FOREACH_N(i, 0, w->depth) {
+                    if (w->stack[i] == mem) return NULL;
+                }
+
+                TB_Node* vals[MEM_MAX_PREDS];
+                w->stack[w->depth++] = mem;
+                FOREACH_N(i, 0, mem->input_count) {
+                    vals[i] = mem_walk(p, f, w, mem->inputs[i]);
+                    if (vals[i] == NULL) {
+                        w->depth--;
+                        return NULL;
+                    }
+                }
+                w->depth--;
+
+                // everyone agrees, no phi needed
+                bool same = true;
+                FOREACH_N(i, 1, mem->input_count) {
+                    if (vals[i] != vals[0]) { same = false; break; }
+                }
+
+                if (same) return vals[0];
+
+                TB_Node* phi = tb_alloc_node(f, TB_PHI, ld->dt, 1 + mem->input_count, 0);
+                set_input(p, phi, mem, 0);
+                FOREACH_N(i, 0, mem->input_count) {
+                    set_input(p, phi, vals[i], 1 + i);
+                }
+                tb_pass_mark(p, phi);
+                return phi;
+            }
+
+            default:
+            return NULL;
+        }
+    }
+}
+
+static TB_Node* ideal_load(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
+    MemWalk w = {
+        .ld = n, .addr = n->inputs[1], .size = mem_size(f, n->dt),
+        .budget = MEM_WALK_BUDGET,
+    };
+    w.private = mem_is_private(p, mem_root(known_pointer(w.addr).base));
+
+    TB_Node* k = mem_walk(p, f, &w, n->inputs[0]);
+    if (k != NULL) {
+        return k;
     }
 
+    // if a load is control dependent on a store and it doesn't alias we can move the
+    // dependency up a bit.
+    if (n->inputs[0]->type != TB_STORE) return NULL;
+
+    TB_Node* st = n->inputs[0];
+    if (mem_alias(p, f, w.addr, w.size, st->inputs[1], mem_size(f, st->inputs[2]->dt)) != ALIAS_NO) {
+        return NULL;
+    }
+
+    set_input(p, n, st->inputs[0], 0);
     return n;
 }
 
+// can anything hanging off the memory state 'mem' (other than the next effect in the
+// chain) observe the address
+static bool mem_is_observed(TB_Passes* restrict p, TB_Function* f, TB_Node* mem, TB_Node* next, TB_Node* addr, int size) {
+    FOR_USERS(use, p, mem) {
+        TB_Node* u = use->n;
+        if (u == next && use->slot == 0) continue;
+        if (u->type == TB_LOAD && use->slot == 0 && mem_alias(p, f, addr, size, u->inputs[1], mem_size(f, u->dt)) == ALIAS_NO) continue;
+
+        return true;
+    }
+
+    return false;
+}
+
 static TB_Node* ideal_store(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
+    TB_Node* addr = n->inputs[1];
+    int size = mem_size(f, n->inputs[2]->dt);
+
+    if (mem_is_write_only(p, addr)) {
+        return n->inputs[0];
+    }
+
     // god i need a pattern matcher
     //   (store (store X A Y) A Z) => (store X A Z)
-    /*if (n->inputs[0]->type == TB_STORE &&
-        n->inputs[0]->inputs[1] == n->inputs[1] &&
-        n->inputs[2]->dt.raw == n->inputs[0]->inputs[2]->dt.raw &&
-        is_same_align(n, n->inputs[0])) {
-        set_input(p, n, n->inputs[0]->inputs[0], 0);
-        return n;
-    }*/
+    //
+    // as long as nothing reads A in between, the stores between us don't matter.
+    TB_Node* next = n;
+    TB_Node* mem = n->inputs[0];
+    FOREACH_N(i, 0, 8) {
+        if (mem->type != TB_STORE || mem_is_observed(p, f, mem, next, addr, size)) {
+            break;
+        }
+
+        if (mem_alias(p, f, addr, size, mem->inputs[1], mem_size(f, mem->inputs[2]->dt)) == ALIAS_MUST) {
+            subsume_node(p, f, mem, mem->inputs[0]);
+            return n;
+        }
+
+        next = mem, mem = mem->inputs[0];
+    }
 
     return NULL;
 }
 
+static TB_Node* ideal_memset(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
+    return mem_is_write_only(p, n->inputs[1]) ? n->inputs[0] : NULL;
+}
+
 static TB_Node* ideal_memcpy(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
-    return NULL;
+    return mem_is_write_only(p, n->inputs[1]) ? n->inputs[0] : NULL;
+}
+
+// these walk the memory chain so they're the pricey peepholes, -Treport gets to see them
+static TB_Node* ideal_mem(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
+    TB_Node* k = NULL;
+    CUIK_TIMED_BLOCK("mem opt") {
+        switch (n->type) {
+            case TB_LOAD:   k = ideal_load(p, f, n);   break;
+            case TB_STORE:  k = ideal_store(p, f, n);  break;
+            case TB_MEMSET: k = ideal_memset(p, f, n); break;
+            case TB_MEMCPY: k = ideal_memcpy(p, f, n); break;
+            default: break;
+        }
+    }
+    return k;
 }
@@ -18,8 +18,8 @@ thread_local TB_Arena* tmp_arena;
 
 // helps us do some matching later
 static TB_Node* unsafe_get_region(TB_Node* n);
-static void add_user(TB_Passes* restrict p, TB_Node* n, TB_Node* in, int slot, User* recycled);
-static User* remove_user(TB_Passes* restrict p, TB_Node* n, int slot);
+static void add_user(TB_Passes* restrict p, TB_Node* n, TB_Node* in, int slot);
+static void remove_user(TB_Passes* restrict p, TB_Node* n, int slot);
 
 // transmutations let us generate new nodes from old ones
 void tb_transmute_to_poison(TB_Passes* restrict p, TB_Node* n);
@@ -35,8 +35,15 @@ TB_Node* make_poison(TB_Function* f, TB_Passes* restrict p, TB_DataType dt);
 TB_Node* make_int_node(TB_Function* f, TB_Passes* restrict p, TB_DataType dt, uint64_t x);
 TB_Node* make_proj_node(TB_Function* f, TB_Passes* restrict p, TB_DataType dt, TB_Node* src, int i);
 
+static void remove_input(TB_Passes* restrict p, TB_Function* f, TB_Node* n, size_t i);
 static void remove_pred(TB_Passes* restrict p, TB_Function* f, TB_Node* src, TB_Node* dst);
 
+// recomputes the postorder & dominators after the CFG has been edited
+static void recompute_cfg(TB_Function* f, TB_Passes* restrict p);
+
+// nodes which can't be moved around by the scheduler
+static bool is_pinned(TB_Node* n);
+
 void verify_tmp_arena(TB_Passes* p) {
     // once passes are run on a thread, they're pinned to it.
     TB_Module* m = p->f->super.module;
@@ -91,8 +98,7 @@ static bool is_empty_bb(TB_Passes* restrict p, TB_Node* end) {
     }
 
     TB_Node* bb = end->inputs[0];
-    for (User* use = find_users(p, bb); use; use = use->next) {
-        TB_Node* n = use->n;
+    FOR_USERS(use, p, bb) {
         if (use->n != end) return false;
     }
 
@@ -108,18 +114,84 @@ static bool is_if_branch(TB_Node* n, uint64_t* falsey) {
     return false;
 }
 
+// same reachability as fill_all but without recursion, graphs made from
+// machine generated code can get pretty deep.
+static DynArray(TB_Node*) walk_all_nodes(TB_Node* root, size_t node_count) {
+    Set visited = set_create(node_count);
+    DynArray(TB_Node*) stack = dyn_array_create(TB_Node*, 64);
+    DynArray(TB_Node*) nodes = dyn_array_create(TB_Node*, node_count);
+
+    dyn_array_put(stack, root);
+    while (dyn_array_length(stack) > 0) {
+        TB_Node* n = dyn_array_pop(stack);
+        if (!set_first_time(&visited, n->gvn)) {
+            continue;
+        }
+        dyn_array_put(nodes, n);
+
+        FOREACH_REVERSE_N(i, 0, n->input_count) if (n->inputs[i]) {
+            dyn_array_put(stack, n->inputs[i]);
+        }
+
+        switch (n->type) {
+            case TB_START: case TB_REGION: {
+                TB_NodeRegion* r = TB_NODE_GET_EXTRA(n);
+                dyn_array_put(stack, r->end);
+                break;
+            }
+
+            case TB_BRANCH: {
+                TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
+                FOREACH_N(i, 0, br->succ_count) dyn_array_put(stack, br->succ[i]);
+                break;
+            }
+
+            // dead projections can still be referenced by the tuple
+            case TB_CALL: case TB_SYSCALL: {
+                size_t proj_count = (n->extra_count - sizeof(TB_NodeCall)) / sizeof(TB_Node*);
+                TB_NodeCall* c = TB_NODE_GET_EXTRA(n);
+                FOREACH_N(i, 0, proj_count) if (c->projs[i]) {
+                    dyn_array_put(stack, c->projs[i]);
+                }
+                break;
+            }
+
+            case TB_MULPAIR: {
+                TB_NodeMulPair* mp = TB_NODE_GET_EXTRA(n);
+                if (mp->lo) dyn_array_put(stack, mp->lo);
+                if (mp->hi) dyn_array_put(stack, mp->hi);
+                break;
+            }
+
+            default: break;
+        }
+    }
+
+    dyn_array_destroy(stack);
+    set_free(&visited);
+    return nodes;
+}
+
 // unity build with all the passes
 #include "lattice.h"
 #include "cse.h"
 #include "dce.h"
 #include "fold.h"
 #include "mem_opt.h"
-#include "loop.h"
+#include "peeps.h"
 #include "branches.h"
 #include "print.h"
+#include "sroa.h"
 #include "mem2reg.h"
-#include "gcm.h"
 #include "libcalls.h"
+#include "inline.h"
+#include "lto.h"
+#include "profile.h"
+#include "sccp.h"
+#include "gvn.h"
+#include "loop.h"
+#include "vectorize.h"
+#include "gcm.h"
 
 static void recompute_cfg(TB_Function* f, TB_Passes* restrict p) {
     CUIK_TIMED_BLOCK("recompute order") {
@@ -128,31 +200,26 @@ static void recompute_cfg(TB_Function* f, TB_Passes* restrict p) {
     }
 
     CUIK_TIMED_BLOCK("doms") {
-        FOREACH_N(i, 0, p->order.count) {
-            TB_NodeRegion* r = TB_NODE_GET_EXTRA(p->order.traversal[i]);
-            r->dom_depth = -1; // unresolved
-            r->dom = NULL;
-        }
-
-        // entry dominates itself
-        TB_NodeRegion* r = TB_NODE_GET_EXTRA(f->start_node);
-        r->dom_depth = 0;
-        r->dom = f->start_node;
-
         tb_compute_dominators(f, p->order);
     }
 }
 
+// n was the last node allocated and nothing points to it yet, we can take back the
+// memory and the id.
+static void free_fresh_node(TB_Function* f, TB_Node* n) {
+    assert(n->gvn == f->node_count - 1);
+    f->node_count -= 1;
+    tb_arena_free(f->arena, n, tb_node_size(n));
+}
+
 TB_Node* make_poison(TB_Function* f, TB_Passes* restrict p, TB_DataType dt) {
     TB_Node* n = tb_alloc_node(f, TB_POISON, dt, 1, 0);
 
     // try CSE, if we succeed, just delete the node and use the old copy
     TB_Node* k = nl_hashset_put2(&p->cse_nodes, n, cse_hash, cse_compare);
     if (k != NULL) {
-        // try free?
         log_debug("%s: early CSE on poison", f->super.name);
-        tb_arena_free(f->arena, n->inputs, sizeof(TB_Node*));
-        tb_arena_free(f->arena, n, sizeof(TB_Node) + n->extra_count);
+        free_fresh_node(f, n);
         return k;
     } else {
         return n;
@@ -168,10 +235,8 @@ TB_Node* make_int_node(TB_Function* f, TB_Passes* restrict p, TB_DataType dt, ui
     // try CSE, if we succeed, just delete the node and use the old copy
     TB_Node* k = nl_hashset_put2(&p->cse_nodes, n, cse_hash, cse_compare);
     if (k != NULL) {
-        // try free?
         log_debug("%s: early CSE on integer %lld", f->super.name, x);
-        tb_arena_free(f->arena, n->inputs, sizeof(TB_Node*));
-        tb_arena_free(f->arena, n, sizeof(TB_Node) + n->extra_count);
+        free_fresh_node(f, n);
         return k;
     } else {
         return n;
@@ -215,7 +280,7 @@ static void remove_pred(TB_Passes* restrict p, TB_Function* f, TB_Node* src, TB_
             remove_input(p, f, dst, i);
 
             // update PHIs
-            for (User* use = find_users(p, dst); use; use = use->next) {
+            FOR_USERS(use, p, dst) {
                 if (use->n->type == TB_PHI && use->slot == 0) {
                     remove_input(p, f, use->n, i + 1);
                 }
@@ -250,86 +315,78 @@ void tb_pass_kill_node(TB_Passes* restrict p, TB_Node* n) {
         n->inputs[i] = NULL;
     }
 
-    nl_map_remove(p->users, n);
+    if (n->gvn < p->users_cap) {
+        p->users[n->gvn].count = 0;
+    }
 
     n->input_count = 0;
     n->type = TB_NULL;
 }
 
-static User* remove_user(TB_Passes* restrict p, TB_Node* n, int slot) {
+static void remove_user(TB_Passes* restrict p, TB_Node* n, int slot) {
     // early out: there was no previous input
-    if (n->inputs[slot] == NULL) return NULL;
+    if (n->inputs[slot] == NULL) return;
 
     TB_Node* old = n->inputs[slot];
-    User* old_use = find_users(p, old);
-    if (old_use == NULL) return NULL;
-
-    // remove old user (this must pass unless our users go desync'd)
-    for (User* prev = NULL; old_use; prev = old_use, old_use = old_use->next) {
-        if (old_use->slot == slot && old_use->n == n) {
-            // remove
-            if (prev) prev->next = old_use->next;
-            else if (old_use->next == NULL) {
-                nl_map_remove(p->users, old);
-            } else {
-                nl_map_put(p->users, old, old_use->next);
-            }
-
-            return old_use;
+    User* users = find_users(p, old);
+    size_t count = user_count(p, old);
+    if (count == 0) return;
+
+    // remove old user (this must pass unless our users go desync'd), we walk
+    // backwards since the newest users are the likeliest to go away.
+    FOREACH_REVERSE_N(i, 0, count) {
+        if (users[i].slot == slot && users[i].n == n) {
+            users[i] = users[count - 1];
+            p->users[old->gvn].count -= 1;
+            return;
         }
     }
 
     log_error("Failed to remove non-existent user %p from %p (slot %d)", old, n, slot);
     log_error("Users:");
-    nl_map_for(i, p->users) {
-        log_error("  %p %s", p->users[i].k, tb_node_get_name(p->users[i].k));
-        for (User* u = p->users[i].v; u; u = u->next) {
-            log_error("    %p %d", u->n, u->slot);
-        }
+    FOREACH_N(i, 0, count) {
+        log_error("  %p %s %d", users[i].n, tb_node_get_name(users[i].n), users[i].slot);
     }
 
     assert(0 && "we tried to remove something which didn't exist? (user list has desync'd)");
-    return NULL;
 }
 
 void set_input(TB_Passes* restrict p, TB_Node* n, TB_Node* in, int slot) {
-    // recycle the user
-    User* old_use = remove_user(p, n, slot);
+    remove_user(p, n, slot);
 
     n->inputs[slot] = in;
     if (in != NULL) {
-        add_user(p, n, in, slot, old_use);
+        add_user(p, n, in, slot);
     }
 }
 
-static void add_user(TB_Passes* restrict p, TB_Node* n, TB_Node* in, int slot, User* recycled) {
-    // just generate a new user list (if the slots don't match)
-    ptrdiff_t search = nl_map_get(p->users, in);
-    if (search < 0) {
-        User* use = recycled ? recycled : TB_ARENA_ALLOC(tmp_arena, User);
-        use->next = NULL;
-        use->n = n;
-        use->slot = slot;
+static void add_user(TB_Passes* restrict p, TB_Node* n, TB_Node* in, int slot) {
+    // new nodes might be past the end of the table
+    if (in->gvn >= p->users_cap) {
+        size_t old_cap = p->users_cap;
+        p->users_cap = tb_next_pow2(in->gvn + 1);
+        p->users = tb_platform_heap_realloc(p->users, p->users_cap * sizeof(UseList));
+        memset(&p->users[old_cap], 0, (p->users_cap - old_cap) * sizeof(UseList));
+    }
 
-        nl_map_put(p->users, in, use);
-    } else {
-        User* old = p->users[search].v;
+    UseList* l = &p->users[in->gvn];
+    if (l->count == l->cap) {
+        // the old array just leaks into the tmp arena, it's cleared on tb_pass_exit
+        uint32_t new_cap = l->cap ? l->cap * 2 : 4;
+        User* data = tb_arena_alloc(tmp_arena, new_cap * sizeof(User));
+        if (l->count) {
+            memcpy(data, l->data, l->count * sizeof(User));
+        }
 
-        User* use = recycled ? recycled : TB_ARENA_ALLOC(tmp_arena, User);
-        use->next = old;
-        use->n = n;
-        use->slot = slot;
-        p->users[search].v = use;
+        l->data = data;
+        l->cap = new_cap;
     }
-}
 
-User* find_users(TB_Passes* restrict p, TB_Node* n) {
-    ptrdiff_t search = nl_map_get(p->users, n);
-    return search >= 0 ? p->users[search].v : NULL;
+    l->data[l->count++] = (User){ n, slot };
 }
 
 static void tb_pass_mark_users_raw(TB_Passes* restrict p, TB_Node* n) {
-    for (User* use = find_users(p, n); use; use = use->next) {
+    FOR_USERS(use, p, n) {
         tb_pass_mark(p, use->n);
     }
 }
@@ -340,12 +397,12 @@ void tb_pass_ensure_empty(TB_Passes* restrict p) {
     }
 
     CUIK_TIMED_BLOCK("clear visited") {
-        nl_hashset_clear(&p->visited);
+        set_clear(&p->visited);
     }
 }
 
 void tb_pass_mark_users(TB_Passes* restrict p, TB_Node* n) {
-    for (User* use = find_users(p, n); use; use = use->next) {
+    FOR_USERS(use, p, n) {
         tb_pass_mark(p, use->n);
         TB_NodeTypeEnum type = use->n->type;
 
@@ -380,19 +437,18 @@ void tb_pass_mark_users(TB_Passes* restrict p, TB_Node* n) {
 }
 
 bool tb_pass_mark(TB_Passes* restrict p, TB_Node* n) {
-    if (!nl_hashset_put(&p->visited, n)) {
+    if (!set_first_time(&p->visited, n->gvn)) {
         return false;
     }
 
     // log_debug("  %p: push %s", n, tb_node_get_name(n));
 
     dyn_array_put(p->worklist, n);
-    nl_hashset_put(&p->visited, n);
     return true;
 }
 
 static void fill_all(TB_Passes* restrict p, TB_Node* n) {
-    if (!nl_hashset_put(&p->visited, n)) {
+    if (!set_first_time(&p->visited, n->gvn)) {
         return;
     }
     dyn_array_put(p->worklist, n);
@@ -415,6 +471,18 @@ static void fill_all(TB_Passes* restrict p, TB_Node* n) {
                 fill_all(p, br->succ[i]);
             }
         }
+    } else if (n->type == TB_CALL || n->type == TB_SYSCALL) {
+        // dead projections can still be referenced by the tuple, they need
+        // proper ids like the rest.
+        size_t proj_count = (n->extra_count - sizeof(TB_NodeCall)) / sizeof(TB_Node*);
+        TB_NodeCall* c = TB_NODE_GET_EXTRA(n);
+        FOREACH_N(i, 0, proj_count) if (c->projs[i]) {
+            fill_all(p, c->projs[i]);
+        }
+    } else if (n->type == TB_MULPAIR) {
+        TB_NodeMulPair* mp = TB_NODE_GET_EXTRA(n);
+        if (mp->lo) fill_all(p, mp->lo);
+        if (mp->hi) fill_all(p, mp->hi);
     }
 }
 
@@ -482,6 +550,12 @@ void print_node_sexpr(TB_Function* f, TB_Node* n, int depth) {
 // Returns NULL or a modified node (could be the same node, we can stitch it back into
 // place)
 static TB_Node* idealize(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
+    // generated from peeps.txt
+    TB_Node* k = peep_ideal(p, f, n);
+    if (k != NULL) {
+        return k;
+    }
+
     switch (n->type) {
         case TB_NOT:
         case TB_NEG:
@@ -511,13 +585,10 @@ static TB_Node* idealize(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
 
         // memory
         case TB_LOAD:
-        return ideal_load(p, f, n);
-
         case TB_STORE:
-        return ideal_store(p, f, n);
-
+        case TB_MEMSET:
         case TB_MEMCPY:
-        return ideal_memcpy(p, f, n);
+        return ideal_mem(p, f, n);
 
         // division
         case TB_SDIV:
@@ -539,9 +610,6 @@ static TB_Node* idealize(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
         case TB_CALL:
         return ideal_libcall(p, f, n);
 
-        case TB_SELECT:
-        return ideal_select(p, f, n);
-
         // control flow
         case TB_PHI:
         return ideal_phi(p, f, n);
@@ -556,38 +624,17 @@ static TB_Node* idealize(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
 
 // May return one of the inputs, this is used
 static TB_Node* identity(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
-    switch (n->type) {
-        // integer ops
-        case TB_AND:
-        case TB_OR:
-        case TB_XOR:
-        case TB_ADD:
-        case TB_SUB:
-        case TB_MUL:
-        case TB_SHL:
-        case TB_SHR:
-        case TB_SAR:
-        case TB_CMP_EQ:
-        case TB_CMP_NE:
-        case TB_CMP_SLT:
-        case TB_CMP_SLE:
-        case TB_CMP_ULT:
-        case TB_CMP_ULE:
-        return identity_int_binop(p, f, n);
+    // generated from peeps.txt
+    TB_Node* k = peep_identity(p, f, n);
+    if (k != n) {
+        return k;
+    }
 
+    switch (n->type) {
         case TB_SIGN_EXT:
         case TB_ZERO_EXT:
         return identity_extension(p, f, n);
 
-        case TB_MEMBER_ACCESS:
-        if (TB_NODE_GET_EXTRA_T(n, TB_NodeMember)->offset == 0) {
-            return n->inputs[1];
-        }
-        return n;
-
-        case TB_LOAD:
-        return identity_load(p, f, n);
-
         // dumb phis
         case TB_PHI: {
             TB_Node* same = n->inputs[1];
@@ -651,7 +698,7 @@ static TB_Node* ideal_region(TB_Passes* restrict p, TB_Function* f, TB_Node* n)
 static bool peephole(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
     // must've dead sometime between getting scheduled and getting
     // here.
-    if (find_users(p, n) == NULL) {
+    if (user_count(p, n) == 0) {
         return false;
     }
 
@@ -724,16 +771,13 @@ static bool peephole(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
 }
 
 static void subsume_node(TB_Passes* restrict p, TB_Function* f, TB_Node* n, TB_Node* new_n) {
-    User* use = find_users(p, n);
-    while (use != NULL) {
-        tb_assert(use->n->inputs[use->slot] == n, "Mismatch between def-use and use-def data");
-
-        // set_input will delete 'use' so we can't use it afterwards
-        TB_Node* use_n = use->n;
-        User* next = use->next;
+    // set_input removes the use from n's list, we pull from the back so it's cheap
+    size_t count;
+    while (count = user_count(p, n), count > 0) {
+        User use = find_users(p, n)[count - 1];
+        tb_assert(use.n->inputs[use.slot] == n, "Mismatch between def-use and use-def data");
 
-        set_input(p, use->n, new_n, use->slot);
-        use = next;
+        set_input(p, use.n, new_n, use.slot);
     }
 
     tb_pass_mark_users(p, new_n);
@@ -741,6 +785,10 @@ static void subsume_node(TB_Passes* restrict p, TB_Function* f, TB_Node* n, TB_N
 }
 
 static void generate_use_lists(TB_Passes* restrict p, TB_Function* f) {
+    p->users_cap = f->node_count;
+    p->users = tb_platform_heap_alloc(p->users_cap * sizeof(UseList));
+    memset(p->users, 0, p->users_cap * sizeof(UseList));
+
     dyn_array_for(i, p->worklist) {
         TB_Node* n = p->worklist[i];
         nl_hashset_put2(&p->cse_nodes, n, cse_hash, cse_compare);
@@ -751,7 +799,7 @@ static void generate_use_lists(TB_Passes* restrict p, TB_Function* f) {
         }
 
         FOREACH_N(i, 0, n->input_count) if (n->inputs[i]) {
-            add_user(p, n, n->inputs[i], i, NULL);
+            add_user(p, n, n->inputs[i], i);
         }
     }
 }
@@ -771,14 +819,32 @@ TB_Passes* tb_pass_enter(TB_Function* f, TB_Arena* arena) {
     // generate dominators
     p->order = tb_function_get_postorder(f);
     tb_compute_dominators(f, p->order);
-    p->visited = nl_hashset_alloc(f->node_count);
+    p->visited = set_create(f->node_count);
 
     // generate work list (put everything)
     CUIK_TIMED_BLOCK("gen worklist") {
         fill_all(p, f->start_node);
+
+        // unused params are still referenced by the function
+        FOREACH_N(i, 0, f->param_count) if (f->params[i]) {
+            fill_all(p, f->params[i]);
+        }
     }
 
-    f->node_count = dyn_array_length(p->worklist);
+    // dead nodes leave holes in the ids, we compact them down to the live ones
+    // so the side tables stay dense.
+    CUIK_TIMED_BLOCK("renumber") {
+        size_t count = dyn_array_length(p->worklist);
+        FOREACH_N(i, 0, count) {
+            p->worklist[i]->gvn = i;
+        }
+
+        f->node_count = count;
+        set_clear(&p->visited);
+        FOREACH_N(i, 0, count) {
+            set_put(&p->visited, i);
+        }
+    }
     DO_IF(TB_OPTDEBUG_PEEP)(log_debug("%s: starting passes with %d nodes", f->super.name, f->node_count));
 
     // find all outgoing edges
@@ -798,7 +864,7 @@ bool tb_pass_peephole(TB_Passes* p) {
         while (dyn_array_length(p->worklist) > 0) CUIK_TIMED_BLOCK("iter") {
             // pull from worklist
             TB_Node* n = dyn_array_pop(p->worklist);
-            nl_hashset_remove(&p->visited, n);
+            set_remove(&p->visited, n->gvn);
 
             if (peephole(p, f, n)) {
                 changes = true;
@@ -815,10 +881,10 @@ void tb_pass_exit(TB_Passes* p) {
     TB_Function* f = p->f;
 
     nl_hashset_free(p->cse_nodes);
-    nl_hashset_free(p->visited);
+    set_free(&p->visited);
 
     tb_function_free_postorder(&p->order);
     tb_arena_clear(tmp_arena);
-    nl_map_free(p->users);
+    tb_platform_heap_free(p->users);
     dyn_array_destroy(p->worklist);
 }
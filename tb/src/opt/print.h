@@ -20,6 +20,8 @@ static ptrdiff_t find_print_label(PrinterCtx* ctx, TB_Node* n) {
     return -1;
 }
 
+int get_ordinal(PrinterCtx* ctx, TB_Node* n);
+
 static void print_ref_to_node(PrinterCtx* ctx, TB_Node* n) {
     if (n == NULL) {
         printf("_");
@@ -62,26 +64,16 @@ static void print_ref_to_node(PrinterCtx* ctx, TB_Node* n) {
                 printf("%016"PRIx64, num->words[i]);
             }
         }
-    } else if (n->type == TB_PHI || n->type == TB_LOAD) {
-        ptrdiff_t search = nl_map_get(ctx->ordinals, n);
-        if (search < 0) {
-            // alloc new ID
-            int id = ctx->count++;
-            nl_map_put(ctx->ordinals, n, id);
-
-            printf("v%d", id);
-        } else {
-            printf("v%d", ctx->ordinals[search].v);
-        }
     } else {
-        ptrdiff_t search = nl_map_get(ctx->ordinals, n);
-        assert(search >= 0);
-        printf("v%d", ctx->ordinals[search].v);
+        // forward references (phis, loads and anything the scheduler placed in
+        // a later block) just get their ID early
+        printf("v%d", get_ordinal(ctx, n));
     }
 }
 
 static void print_type(TB_DataType dt) {
     assert(dt.width < 8 && "Vector width too big!");
+    if (dt.width) printf("v%d", 1 << dt.width);
 
     switch (dt.type) {
         case TB_INT: {
@@ -233,7 +225,12 @@ static void print_node(PrinterCtx* ctx, TB_Node* n, TB_Node* parent) {
             break;
         }
 
-        case TB_CALL: break;
+        case TB_CALL: {
+            TB_Heat heat = TB_NODE_GET_EXTRA_T(n, TB_NodeCall)->heat;
+            if (heat == TB_HEAT_HOT) printf(" !hot");
+            if (heat == TB_HEAT_COLD) printf(" !cold");
+            break;
+        }
 
         case TB_LOCAL: {
             TB_NodeLocal* l = TB_NODE_GET_EXTRA(n);
@@ -276,7 +273,7 @@ static void print_effect(PrinterCtx* ctx, TB_Node* n) {
 
     // has control dependencies on this node, we put these after
     if (n->type != TB_CALL) {
-        for (User* use = find_users(ctx->opt, n); use; use = use->next) {
+        FOR_USERS(use, ctx->opt, n) {
             if (use->slot == 0 && (use->n->type == TB_PHI || use->n->type == TB_PROJ)) {
                 print_node(ctx, use->n, n);
             }
@@ -323,6 +320,7 @@ static void print_effect(PrinterCtx* ctx, TB_Node* n) {
                     print_ref_to_node(ctx, br->succ[0]);
                     printf(" else ");
                     print_ref_to_node(ctx, br->succ[1]);
+                    if (br->probs) printf(" (%.0f%% taken)", br->probs[0] * 100.0f);
                     printf("\n");
                 } else {
                     printf("  br ");
@@ -371,7 +369,7 @@ static void print_effect(PrinterCtx* ctx, TB_Node* n) {
         }
     }
 
-    for (User* use = find_users(ctx->opt, n); use; use = use->next) {
+    FOR_USERS(use, ctx->opt, n) {
         if (use->slot == 0 && (use->n->type == TB_LOAD || (n->type == TB_CALL && use->n->type == TB_PROJ))) {
             print_node(ctx, use->n, n);
         }
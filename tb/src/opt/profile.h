@@ -0,0 +1,442 @@
+// Instrumented PGO, both halves run on the fresh IR (before any other pass) so
+// they see the same graph and walk it in the same order:
+//
+//   tb_module_profile_instrument: every function gets a counter for its entry, each
+//     successor of a multi-way branch and each call. Branch counters are bumped right
+//     before the branch, the slot is picked with selects on the key so we don't need
+//     to split any edges. AOT builds get a dumper which main registers with atexit,
+//     the JIT reads the counters straight out of the global.
+//
+//   tb_module_profile_use: maps the counters back onto the same nodes, branches get
+//     probabilities (block layout), calls and functions get a TB_Heat (inlining and
+//     the order of .text).
+//
+// the raw profile is a header followed by the counters (host endian):
+//   "TBPROF01" u32 func_count u32 counter_count
+//   per function: u32 name_len (including the NUL), name, u64 checksum, u32 first, u32 count
+//   u64 counters[counter_count]
+#define PROFILE_MAGIC     "TBPROF01"
+#define PROFILE_HOT_RATIO 100 // hot means within 1% of the hottest counter
+
+typedef struct {
+    DynArray(TB_Node*) nodes; // the whole graph in walk order
+    DynArray(TB_Node*) sites; // multi-way branches & calls
+
+    // entry counter + one per branch successor & call
+    size_t counter_count;
+    // the shape of the sites, a mismatch means the function changed
+    uint64_t checksum;
+} ProfileSites;
+
+typedef struct {
+    uint64_t checksum;
+    uint32_t count;
+    const uint64_t* counters;
+} ProfileRecord;
+
+static size_t profile_site_counters(TB_Node* n) {
+    if (n->type == TB_CALL) return 1;
+    if (n->type == TB_BRANCH) {
+        size_t succ_count = TB_NODE_GET_EXTRA_T(n, TB_NodeBranch)->succ_count;
+        return succ_count > 1 ? succ_count : 0;
+    }
+    return 0;
+}
+
+// FNV-1a
+static uint64_t profile_hash(uint64_t h, uint64_t x) {
+    FOREACH_N(i, 0, 8) {
+        h ^= (x >> (i * 8)) & 0xFF;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static ProfileSites profile_sites(TB_Function* f) {
+    ProfileSites s = {
+        .nodes = walk_all_nodes(f->start_node, f->node_count),
+        .counter_count = 1,
+        .checksum = 0xcbf29ce484222325ull,
+    };
+
+    dyn_array_for(i, s.nodes) {
+        size_t k = profile_site_counters(s.nodes[i]);
+        if (k == 0) continue;
+
+        dyn_array_put(s.sites, s.nodes[i]);
+        s.counter_count += k;
+        s.checksum = profile_hash(s.checksum, s.nodes[i]->type);
+        s.checksum = profile_hash(s.checksum, k);
+    }
+
+    s.checksum = profile_hash(s.checksum, s.counter_count);
+    return s;
+}
+
+static void profile_sites_free(ProfileSites* s) {
+    dyn_array_destroy(s->nodes);
+    dyn_array_destroy(s->sites);
+}
+
+// counters[idx] += 1, at the builder's current control
+static void profile_bump(TB_Function* f, TB_Global* counters, TB_Node* idx) {
+    TB_Node* addr = tb_inst_array_access(f, tb_inst_get_symbol_address(f, &counters->super), idx, sizeof(uint64_t));
+    TB_Node* val  = tb_inst_load(f, TB_TYPE_I64, addr, sizeof(uint64_t), false);
+    val = tb_inst_add(f, val, tb_inst_uint(f, TB_TYPE_I64, 1), TB_ARITHMATIC_NONE);
+    tb_inst_store(f, TB_TYPE_I64, addr, val, sizeof(uint64_t), false);
+}
+
+static void profile_put(DynArray(uint8_t)* buf, const void* src, size_t size) {
+    size_t old = dyn_array_length(*buf);
+    dyn_array_put_uninit(*buf, size);
+    memcpy(&(*buf)[old], src, size);
+}
+
+static TB_External* profile_extern(TB_Module* m, const char* name) {
+    return tb_extern_create(m, -1, name, TB_EXTERNAL_SO_LOCAL);
+}
+
+static TB_Node* profile_call(TB_Function* f, TB_FunctionPrototype* proto, TB_External* target, size_t param_count, TB_Node** params) {
+    TB_MultiOutput out = tb_inst_call(f, proto, tb_inst_get_symbol_address(f, &target->super), param_count, params);
+    return out.count ? out.single : NULL;
+}
+
+// void __tb_profile_dump(void) {
+//     FILE* fp = fopen(path, "wb");
+//     if (fp) { fwrite(meta, 1, meta_size, fp); fwrite(counters, 8, counter_count, fp); fclose(fp); }
+// }
+static TB_Function* profile_make_dumper(TB_Module* m, const char* path, TB_Global* meta, size_t counter_count) {
+    TB_PrototypeParam ptr = { TB_TYPE_PTR }, i64 = { TB_TYPE_I64 }, i32 = { TB_TYPE_I32 };
+    TB_PrototypeParam fwrite_params[] = { ptr, i64, i64, ptr };
+    TB_PrototypeParam fopen_params[]  = { ptr, ptr };
+
+    TB_FunctionPrototype* void_proto   = tb_prototype_create(m, TB_STDCALL, 0, NULL, 0, NULL, false);
+    TB_FunctionPrototype* fopen_proto  = tb_prototype_create(m, TB_STDCALL, 2, fopen_params, 1, &ptr, false);
+    TB_FunctionPrototype* fwrite_proto = tb_prototype_create(m, TB_STDCALL, 4, fwrite_params, 1, &i64, false);
+    TB_FunctionPrototype* fclose_proto = tb_prototype_create(m, TB_STDCALL, 1, &ptr, 1, &i32, false);
+
+    TB_Function* f = tb_function_create(m, -1, "__tb_profile_dump", TB_LINKAGE_PRIVATE, TB_COMDAT_NONE);
+    tb_function_set_prototype(f, void_proto, NULL);
+
+    TB_Node* fp = profile_call(f, fopen_proto, profile_extern(m, "fopen"), 2, (TB_Node*[]){ tb_inst_cstring(f, path), tb_inst_cstring(f, "wb") });
+
+    TB_Node* opened = tb_inst_region(f);
+    TB_Node* failed = tb_inst_region(f);
+    tb_inst_if(f, tb_inst_cmp_ne(f, fp, tb_inst_uint(f, TB_TYPE_PTR, 0)), opened, failed);
+
+    tb_inst_set_control(f, failed);
+    tb_inst_ret(f, 0, NULL);
+
+    tb_inst_set_control(f, opened);
+    TB_External* fwrite_sym = profile_extern(m, "fwrite");
+    profile_call(f, fwrite_proto, fwrite_sym, 4, (TB_Node*[]){
+            tb_inst_get_symbol_address(f, &meta->super), tb_inst_uint(f, TB_TYPE_I64, 1),
+            tb_inst_uint(f, TB_TYPE_I64, m->profile_meta_size), fp
+        });
+    profile_call(f, fwrite_proto, fwrite_sym, 4, (TB_Node*[]){
+            tb_inst_get_symbol_address(f, &m->profile_counters->super), tb_inst_uint(f, TB_TYPE_I64, sizeof(uint64_t)),
+            tb_inst_uint(f, TB_TYPE_I64, counter_count), fp
+        });
+    profile_call(f, fclose_proto, profile_extern(m, "fclose"), 1, &fp);
+    tb_inst_ret(f, 0, NULL);
+    return f;
+}
+
+void tb_module_profile_instrument(TB_Module* m, const char* path, bool is_jit) {
+    TB_Arena* arena = get_permanent_arena(m);
+
+    TB_Global* counters = tb_global_create(m, -1, "__tb_profile_counters", NULL, TB_LINKAGE_PRIVATE);
+    m->profile_counters = counters;
+
+    DynArray(uint8_t) meta = dyn_array_create(uint8_t, 256);
+    profile_put(&meta, PROFILE_MAGIC, 8);
+    profile_put(&meta, &(uint32_t){ 0 }, sizeof(uint32_t));
+    profile_put(&meta, &(uint32_t){ 0 }, sizeof(uint32_t));
+
+    TB_Function* main_fn = NULL;
+    TB_Node* main_entry = NULL;
+    uint32_t func_count = 0, counter_count = 0;
+    CUIK_TIMED_BLOCK("profile instrument") {
+        TB_FOR_FUNCTIONS(f, m) {
+            if (f->start_node == NULL || f->super.name == NULL || f->super.name[0] == 0) {
+                continue;
+            }
+
+            ProfileSites s = profile_sites(f);
+            uint32_t first = counter_count;
+
+            uint32_t name_len = strlen(f->super.name) + 1;
+            profile_put(&meta, &name_len, sizeof(uint32_t));
+            profile_put(&meta, f->super.name, name_len);
+            profile_put(&meta, &s.checksum, sizeof(uint64_t));
+            profile_put(&meta, &first, sizeof(uint32_t));
+            profile_put(&meta, &(uint32_t){ s.counter_count }, sizeof(uint32_t));
+
+            // the builder chains the first effects straight onto the START so
+            // anything which takes it as an input (other than the params) has to
+            // move after the entry counter.
+            f->active_control_node = f->start_node;
+            profile_bump(f, counters, tb_inst_uint(f, TB_TYPE_I64, first));
+
+            TB_Node* entry = f->active_control_node;
+            dyn_array_for(i, s.nodes) {
+                TB_Node* n = s.nodes[i];
+                if (n->type == TB_PROJ && n->inputs[0] == f->start_node) continue;
+
+                FOREACH_N(j, 0, n->input_count) {
+                    if (n->inputs[j] == f->start_node) n->inputs[j] = entry;
+                }
+            }
+
+            uint32_t next = first + 1;
+            dyn_array_for(i, s.sites) {
+                TB_Node* n = s.sites[i];
+                f->active_control_node = n->inputs[0];
+
+                if (n->type == TB_BRANCH) {
+                    // key == keys[j] goes to succ[1 + j], anything else is succ[0]
+                    TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
+                    TB_Node* key = n->inputs[1];
+
+                    TB_Node* idx = tb_inst_uint(f, TB_TYPE_I64, next);
+                    FOREACH_N(j, 1, br->succ_count) {
+                        TB_Node* cond = tb_inst_cmp_eq(f, key, tb_inst_uint(f, key->dt, br->keys[j - 1]));
+                        idx = tb_inst_select(f, cond, tb_inst_uint(f, TB_TYPE_I64, next + j), idx);
+                    }
+
+                    profile_bump(f, counters, idx);
+                    next += br->succ_count;
+                } else {
+                    profile_bump(f, counters, tb_inst_uint(f, TB_TYPE_I64, next));
+                    next += 1;
+                }
+
+                n->inputs[0] = f->active_control_node;
+            }
+            f->active_control_node = NULL;
+
+            if (!is_jit && strcmp(f->super.name, "main") == 0) {
+                main_fn = f;
+                main_entry = entry;
+            }
+
+            DO_IF(TB_OPTDEBUG_PROFILE)(log_debug("%s: %zu counters", f->super.name, s.counter_count));
+            profile_sites_free(&s);
+
+            func_count += 1;
+            counter_count = next;
+        }
+    }
+
+    memcpy(&meta[8], &func_count, sizeof(uint32_t));
+    memcpy(&meta[12], &counter_count, sizeof(uint32_t));
+
+    // the JIT reads this back out in tb_module_profile_write
+    m->profile_meta_size = dyn_array_length(meta);
+    m->profile_meta = tb_arena_alloc(arena, m->profile_meta_size);
+    memcpy(m->profile_meta, meta, m->profile_meta_size);
+    dyn_array_destroy(meta);
+
+    size_t counters_size = (counter_count ? counter_count : 1) * sizeof(uint64_t);
+    tb_global_set_storage(m, &m->data, counters, counters_size, sizeof(uint64_t), 0);
+
+    // atexit(__tb_profile_dump) at the top of main
+    if (main_fn != NULL) {
+        TB_Global* meta_g = tb_global_create(m, -1, "__tb_profile_meta", NULL, TB_LINKAGE_PRIVATE);
+        tb_global_set_storage(m, &m->rdata, meta_g, m->profile_meta_size, 8, 1);
+        memcpy(tb_global_add_region(m, meta_g, 0, m->profile_meta_size), m->profile_meta, m->profile_meta_size);
+
+        TB_Function* dumper = profile_make_dumper(m, path, meta_g, counter_count);
+
+        TB_PrototypeParam ptr = { TB_TYPE_PTR }, i32 = { TB_TYPE_I32 };
+        TB_FunctionPrototype* atexit_proto = tb_prototype_create(m, TB_STDCALL, 1, &ptr, 1, &i32, false);
+
+        // right after the entry counter
+        TB_Function* f = main_fn;
+        DynArray(TB_Node*) nodes = walk_all_nodes(f->start_node, f->node_count);
+
+        f->active_control_node = main_entry;
+        profile_call(f, atexit_proto, profile_extern(m, "atexit"), 1, (TB_Node*[]){ tb_inst_get_symbol_address(f, &dumper->super) });
+
+        TB_Node* after = f->active_control_node;
+        dyn_array_for(i, nodes) {
+            TB_Node* n = nodes[i];
+            if (n == main_entry) continue;
+
+            FOREACH_N(j, 0, n->input_count) {
+                if (n->inputs[j] == main_entry) n->inputs[j] = after;
+            }
+        }
+        f->active_control_node = NULL;
+        dyn_array_destroy(nodes);
+    }
+}
+
+static bool profile_write(TB_Module* m, const char* path, const uint64_t* counters, size_t counter_count) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    bool ok = fwrite(m->profile_meta, 1, m->profile_meta_size, file) == m->profile_meta_size &&
+        fwrite(counters, sizeof(uint64_t), counter_count, file) == counter_count;
+
+    fclose(file);
+    return ok;
+}
+
+bool tb_module_profile_write(TB_Module* m, const char* path) {
+    TB_Global* counters = m->profile_counters;
+    if (counters == NULL || counters->address == NULL) {
+        return false;
+    }
+
+    uint32_t counter_count;
+    memcpy(&counter_count, &m->profile_meta[12], sizeof(uint32_t));
+    return profile_write(m, path, counters->address, counter_count);
+}
+
+static bool profile_read(const uint8_t* data, size_t size, size_t* pos, void* dst, size_t n) {
+    if (*pos + n > size) return false;
+    memcpy(dst, &data[*pos], n);
+    *pos += n;
+    return true;
+}
+
+bool tb_module_profile_use(TB_Module* m, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = tb_platform_heap_alloc(size > 0 ? size : 1);
+    bool ok = size > 16 && fread(data, 1, size, file) == (size_t) size;
+    fclose(file);
+
+    // parse the header, names point into the file
+    NL_Strmap(ProfileRecord) records = NULL;
+    uint32_t func_count = 0, counter_count = 0;
+    size_t pos = 8;
+    ok = ok && memcmp(data, PROFILE_MAGIC, 8) == 0;
+    ok = ok && profile_read(data, size, &pos, &func_count, sizeof(uint32_t));
+    ok = ok && profile_read(data, size, &pos, &counter_count, sizeof(uint32_t));
+
+    const char** names = NULL;
+    ProfileRecord* recs = NULL;
+    uint32_t* firsts = NULL;
+    if (ok) {
+        names  = tb_platform_heap_alloc(func_count * sizeof(const char*) + 1);
+        recs   = tb_platform_heap_alloc(func_count * sizeof(ProfileRecord) + 1);
+        firsts = tb_platform_heap_alloc(func_count * sizeof(uint32_t) + 1);
+    }
+
+    FOREACH_N(i, 0, ok ? func_count : 0) {
+        uint32_t name_len;
+        ok = profile_read(data, size, &pos, &name_len, sizeof(uint32_t));
+        if (!ok || name_len == 0 || pos + name_len > (size_t) size || data[pos + name_len - 1] != 0) {
+            ok = false;
+            break;
+        }
+
+        names[i] = (const char*) &data[pos];
+        pos += name_len;
+
+        ok = profile_read(data, size, &pos, &recs[i].checksum, sizeof(uint64_t)) &&
+            profile_read(data, size, &pos, &firsts[i], sizeof(uint32_t)) &&
+            profile_read(data, size, &pos, &recs[i].count, sizeof(uint32_t)) &&
+            (uint64_t) firsts[i] + recs[i].count <= counter_count;
+        if (!ok) break;
+    }
+
+    // the counters might not be aligned in the file
+    uint64_t* counters = NULL;
+    if (ok && pos + (size_t) counter_count * sizeof(uint64_t) <= (size_t) size) {
+        counters = tb_platform_heap_alloc(counter_count * sizeof(uint64_t) + 1);
+        memcpy(counters, &data[pos], counter_count * sizeof(uint64_t));
+    } else {
+        ok = false;
+    }
+
+    uint64_t max_count = 0;
+    if (ok) {
+        nl_map_create(records, func_count);
+        FOREACH_N(i, 0, func_count) {
+            recs[i].counters = &counters[firsts[i]];
+
+            // static functions from different TUs can share a name, the checksum
+            // might tell them apart but if not we'd rather not guess.
+            if (nl_map_get_cstr(records, names[i]) < 0) {
+                nl_map_put_cstr(records, names[i], recs[i]);
+            }
+        }
+
+        FOREACH_N(i, 0, counter_count) {
+            if (counters[i] > max_count) max_count = counters[i];
+        }
+    }
+
+    if (ok) CUIK_TIMED_BLOCK("profile use") {
+        m->has_profile = true;
+
+        TB_FOR_FUNCTIONS(f, m) {
+            if (f->start_node == NULL || f->super.name == NULL) {
+                continue;
+            }
+
+            ptrdiff_t search = nl_map_get_cstr(records, f->super.name);
+            if (search < 0) {
+                continue;
+            }
+
+            ProfileSites s = profile_sites(f);
+            ProfileRecord* r = &records[search].v;
+            if (r->checksum != s.checksum || r->count != s.counter_count) {
+                DO_IF(TB_OPTDEBUG_PROFILE)(log_debug("%s: profile is out of date", f->super.name));
+                profile_sites_free(&s);
+                continue;
+            }
+
+            const uint64_t* c = r->counters;
+            f->heat = c[0] == 0 ? TB_HEAT_COLD : c[0] * PROFILE_HOT_RATIO >= max_count ? TB_HEAT_HOT : TB_HEAT_UNKNOWN;
+
+            size_t next = 1;
+            dyn_array_for(i, s.sites) {
+                TB_Node* n = s.sites[i];
+                if (n->type == TB_BRANCH) {
+                    TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
+
+                    uint64_t total = 0;
+                    FOREACH_N(j, 0, br->succ_count) total += c[next + j];
+
+                    // if it never ran we don't know anything about the odds
+                    if (total > 0) {
+                        br->probs = tb_arena_alloc(f->arena, br->succ_count * sizeof(float));
+                        FOREACH_N(j, 0, br->succ_count) {
+                            br->probs[j] = (float) ((double) c[next + j] / (double) total);
+                        }
+                    }
+                    next += br->succ_count;
+                } else {
+                    TB_NodeCall* call = TB_NODE_GET_EXTRA(n);
+                    uint64_t count = c[next++];
+                    call->heat = count == 0 ? TB_HEAT_COLD : count * PROFILE_HOT_RATIO >= max_count ? TB_HEAT_HOT : TB_HEAT_UNKNOWN;
+                }
+            }
+
+            DO_IF(TB_OPTDEBUG_PROFILE)(log_debug("%s: entered %"PRIu64" times", f->super.name, c[0]));
+            profile_sites_free(&s);
+        }
+    }
+
+    nl_map_free(records);
+    tb_platform_heap_free(counters);
+    tb_platform_heap_free(firsts);
+    tb_platform_heap_free(recs);
+    tb_platform_heap_free(names);
+    tb_platform_heap_free(data);
+    return ok;
+}
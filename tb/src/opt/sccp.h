@@ -0,0 +1,742 @@
+// Sparse conditional constant propagation (Wegman & Zadeck)
+//
+// it's the optimistic version, everything starts as NONE (unreachable or no value
+// yet) and only falls down the lattice once something proves it has to. Unlike the
+// peepholes this lets constants flow around loops and through phis which have dead
+// predecessors, which in turn kill more branches.
+//
+// the results are kept in TB_Passes (indexed by TB_Node.gvn) until the next
+// SCCP run so later passes and isel can ask about known bits.
+#define SCCP_MAX_ENUM 64
+
+static bool sccp_tracked(TB_Passes* restrict p, TB_Node* n) {
+    return n->gvn < p->lattice_count && p->lattice_nodes[n->gvn] == n;
+}
+
+static bool sccp_int_type(TB_DataType dt) {
+    return dt.type == TB_INT && dt.width == 0 && dt.data > 0 && dt.data <= 64;
+}
+
+// nodes which weren't part of the analysis are assumed to be anything
+static Lattice sccp_get(TB_Passes* restrict p, TB_Node* n) {
+    return sccp_tracked(p, n) ? p->lattice[n->gvn] : lattice_top(n->dt);
+}
+
+static LatticeInt sccp_get_int(TB_Passes* restrict p, TB_Node* n) {
+    Lattice l = sccp_get(p, n);
+    if (l.tag != LATTICE_INT) l = lattice_top(n->dt);
+    return l._int;
+}
+
+static bool sccp_is_ctrl(TB_Passes* restrict p, TB_Node* n) {
+    return sccp_get(p, n).tag != LATTICE_NONE;
+}
+
+static Lattice sccp_int(TB_DataType dt, int64_t min, int64_t max, uint64_t zeros, uint64_t ones) {
+    // fall back to the full range if we overflowed the type
+    Lattice top = lattice_top(dt);
+    if (min > max || min < top._int.min || max > top._int.max) {
+        min = top._int.min, max = top._int.max;
+    }
+
+    return lattice_int_normalize(dt, (LatticeInt){ min, max, zeros, ones });
+}
+
+static Lattice sccp_bool(int x) {
+    return x < 0 ? lattice_top(TB_TYPE_BOOL) : lattice_int_const(TB_TYPE_BOOL, x);
+}
+
+static uint64_t sccp_low_mask(int bits) {
+    return bits >= 64 ? UINT64_MAX : (UINT64_C(1) << bits) - 1;
+}
+
+// number of low bits we know on both sides
+static int sccp_low_known(LatticeInt a, LatticeInt b) {
+    uint64_t unknown = ~((a.known_zeros | a.known_ones) & (b.known_zeros | b.known_ones));
+    return unknown ? tb_ffs64(unknown) - 1 : 64;
+}
+
+static int sccp_trailing_zeros(LatticeInt a) {
+    return ~a.known_zeros ? tb_ffs64(~a.known_zeros) - 1 : 64;
+}
+
+// is x (a constant of type dt) within the set?
+static bool sccp_int_has(TB_DataType dt, LatticeInt a, uint64_t x) {
+    uint64_t mask = lattice_int_mask(dt);
+    int64_t sx = lattice_sxt(dt, x & mask);
+    return (x & a.known_zeros) == 0 && (~x & a.known_ones & mask) == 0 && sx >= a.min && sx <= a.max;
+}
+
+// 1 if true, 0 if false and -1 if we don't know
+static int sccp_compare(TB_NodeTypeEnum type, TB_DataType dt, Lattice a, Lattice b) {
+    if (a.tag == LATTICE_POINTER && b.tag == LATTICE_POINTER) {
+        LatticeTrifecta x = a._ptr.trifecta, y = b._ptr.trifecta;
+        if (x == LATTICE_UNKNOWN || y == LATTICE_UNKNOWN) return -1;
+        if (x == LATTICE_KNOWN_NOT_NULL && y == LATTICE_KNOWN_NOT_NULL) return -1;
+
+        bool eq = x == y;
+        if (type == TB_CMP_EQ) return eq;
+        if (type == TB_CMP_NE) return !eq;
+        return -1;
+    }
+
+    if (a.tag != LATTICE_INT || b.tag != LATTICE_INT) return -1;
+    LatticeInt aa = a._int, bb = b._int;
+
+    // unsigned compares are just signed ones when both are positive
+    bool positive = aa.min >= 0 && bb.min >= 0;
+    uint64_t mask = lattice_int_mask(dt);
+    if (lattice_is_const(&a) && lattice_is_const(&b)) {
+        uint64_t x = aa.min & mask, y = bb.min & mask;
+        switch (type) {
+            case TB_CMP_EQ:  return x == y;
+            case TB_CMP_NE:  return x != y;
+            case TB_CMP_ULT: return x < y;
+            case TB_CMP_ULE: return x <= y;
+            case TB_CMP_SLT: return aa.min < bb.min;
+            case TB_CMP_SLE: return aa.min <= bb.min;
+            default: return -1;
+        }
+    }
+
+    switch (type) {
+        case TB_CMP_EQ:
+        case TB_CMP_NE: {
+            bool conflict = (aa.known_ones & bb.known_zeros) || (aa.known_zeros & bb.known_ones);
+            bool disjoint = aa.max < bb.min || bb.max < aa.min;
+            if (conflict || disjoint) return type == TB_CMP_NE;
+            return -1;
+        }
+
+        case TB_CMP_ULT: if (!positive) return -1; // fallthrough
+        case TB_CMP_SLT:
+        if (aa.max < bb.min) return 1;
+        if (aa.min >= bb.max) return 0;
+        return -1;
+
+        case TB_CMP_ULE: if (!positive) return -1; // fallthrough
+        case TB_CMP_SLE:
+        if (aa.max <= bb.min) return 1;
+        if (aa.min > bb.max) return 0;
+        return -1;
+
+        default: return -1;
+    }
+}
+
+static Lattice sccp_int_binop(TB_Node* n, TB_NodeTypeEnum type, LatticeInt a, LatticeInt b) {
+    TB_DataType dt = n->dt;
+    int bits = dt.data;
+    uint64_t mask = lattice_int_mask(dt);
+    Lattice top = lattice_top(dt);
+
+    bool both_const = a.min == a.max && b.min == b.max;
+    uint64_t x = a.min & mask, y = b.min & mask;
+
+    switch (type) {
+        case TB_AND: {
+            int64_t min = top._int.min, max = top._int.max;
+            if (a.min >= 0 && b.min >= 0) min = 0, max = a.max < b.max ? a.max : b.max;
+            else if (a.min >= 0) min = 0, max = a.max;
+            else if (b.min >= 0) min = 0, max = b.max;
+            return sccp_int(dt, min, max, a.known_zeros | b.known_zeros, a.known_ones & b.known_ones);
+        }
+
+        case TB_OR:
+        return sccp_int(dt, top._int.min, top._int.max, a.known_zeros & b.known_zeros, a.known_ones | b.known_ones);
+
+        case TB_XOR: {
+            uint64_t zeros = (a.known_zeros & b.known_zeros) | (a.known_ones & b.known_ones);
+            uint64_t ones  = (a.known_zeros & b.known_ones) | (a.known_ones & b.known_zeros);
+            return sccp_int(dt, top._int.min, top._int.max, zeros, ones);
+        }
+
+        case TB_ADD:
+        case TB_SUB: {
+            if (both_const) {
+                return lattice_int_const(dt, type == TB_ADD ? x + y : x - y);
+            }
+
+            // the low bits are known if there's no unknown carry coming in
+            int k = sccp_low_known(a, b);
+            uint64_t low = sccp_low_mask(k);
+            uint64_t r = (type == TB_ADD ? a.known_ones + b.known_ones : a.known_ones - b.known_ones) & low;
+
+            // 64bit ranges might overflow the math itself
+            int64_t min = top._int.min, max = top._int.max;
+            if (bits < 64) {
+                if (type == TB_ADD) min = a.min + b.min, max = a.max + b.max;
+                else min = a.min - b.max, max = a.max - b.min;
+            }
+            return sccp_int(dt, min, max, ~r & low, r);
+        }
+
+        case TB_MUL: {
+            if (both_const) {
+                return lattice_int_const(dt, x * y);
+            }
+
+            int64_t min = top._int.min, max = top._int.max;
+            if (bits <= 31) {
+                int64_t c[4] = { a.min * b.min, a.min * b.max, a.max * b.min, a.max * b.max };
+                min = max = c[0];
+                FOREACH_N(i, 1, 4) {
+                    if (c[i] < min) min = c[i];
+                    if (c[i] > max) max = c[i];
+                }
+            }
+
+            int tz = sccp_trailing_zeros(a) + sccp_trailing_zeros(b);
+            return sccp_int(dt, min, max, sccp_low_mask(tz), 0);
+        }
+
+        case TB_SHL:
+        case TB_SHR:
+        case TB_SAR: {
+            if (b.min != b.max || y >= bits) {
+                return top;
+            }
+
+            if (type == TB_SHL) {
+                return sccp_int(dt, top._int.min, top._int.max, (a.known_zeros << y) | sccp_low_mask(y), a.known_ones << y);
+            } else if (type == TB_SHR) {
+                uint64_t high = mask & ~(mask >> y);
+                return sccp_int(dt, top._int.min, top._int.max, (a.known_zeros >> y) | high, a.known_ones >> y);
+            } else {
+                uint64_t zeros = (uint64_t) (lattice_sxt(dt, a.known_zeros) >> y);
+                uint64_t ones  = (uint64_t) (lattice_sxt(dt, a.known_ones) >> y);
+                return sccp_int(dt, a.min >> y, a.max >> y, zeros, ones);
+            }
+        }
+
+        case TB_UDIV:
+        case TB_UMOD: {
+            if (b.min != b.max || y == 0) return top;
+            if (both_const) {
+                return lattice_int_const(dt, type == TB_UDIV ? x / y : x % y);
+            }
+
+            // x % y < y
+            if (type == TB_UMOD && lattice_sxt(dt, y) > 0) {
+                return sccp_int(dt, 0, lattice_sxt(dt, y) - 1, 0, 0);
+            }
+            return top;
+        }
+
+        case TB_SDIV:
+        case TB_SMOD: {
+            if (!both_const || y == 0) return top;
+
+            // INT_MIN / -1 traps, we shouldn't fold it
+            if (a.min == top._int.min && b.min == -1) return top;
+            return lattice_int_const(dt, type == TB_SDIV ? a.min / b.min : a.min % b.min);
+        }
+
+        default:
+        return top;
+    }
+}
+
+static Lattice sccp_ext(TB_Passes* restrict p, TB_Node* n) {
+    TB_Node* src = n->inputs[1];
+    if (!sccp_int_type(n->dt) || !sccp_int_type(src->dt)) {
+        return lattice_top(n->dt);
+    }
+
+    TB_DataType dt = n->dt;
+    Lattice top = lattice_top(dt);
+    uint64_t mask = lattice_int_mask(dt), src_mask = lattice_int_mask(src->dt);
+    LatticeInt a = sccp_get_int(p, src);
+
+    if (n->type == TB_TRUNCATE) {
+        bool fits = a.min >= top._int.min && a.max <= top._int.max;
+        return sccp_int(dt, fits ? a.min : top._int.min, fits ? a.max : top._int.max, a.known_zeros, a.known_ones);
+    } else if (n->type == TB_ZERO_EXT) {
+        // negative values turn into big positive ones
+        int64_t min = a.min, max = a.max;
+        if (min < 0) min = 0, max = (int64_t) src_mask;
+        return sccp_int(dt, min, max, a.known_zeros | (mask & ~src_mask), a.known_ones);
+    } else {
+        uint64_t zeros = (uint64_t) lattice_sxt(src->dt, a.known_zeros);
+        uint64_t ones  = (uint64_t) lattice_sxt(src->dt, a.known_ones);
+        return sccp_int(dt, a.min, a.max, zeros, ones);
+    }
+}
+
+// the region which our branch projection leads to
+static TB_Node* sccp_proj_region(TB_Passes* restrict p, TB_Node* proj) {
+    TB_Node* region = NULL;
+    FOR_USERS(use, p, proj) {
+        if (use->n->type != TB_REGION || region != NULL) return NULL;
+        region = use->n;
+    }
+    return region;
+}
+
+static ptrdiff_t sccp_succ_index(TB_NodeBranch* br, TB_Node* region) {
+    ptrdiff_t j = -1;
+    FOREACH_N(i, 0, br->succ_count) if (br->succ[i] == region) {
+        // branches with duplicate successors would need the edges told apart
+        if (j >= 0) return -1;
+        j = i;
+    }
+    return j;
+}
+
+static bool sccp_is_key(TB_NodeBranch* br, uint64_t mask, uint64_t x) {
+    FOREACH_N(i, 1, br->succ_count) {
+        if ((br->keys[i - 1] & mask) == (x & mask)) return true;
+    }
+    return false;
+}
+
+// can the key send us down succ[j]?
+static bool sccp_can_take(TB_NodeBranch* br, TB_Node* key, Lattice k, size_t j) {
+    if (k.tag == LATTICE_POINTER && k._ptr.trifecta != LATTICE_UNKNOWN) {
+        bool is_null = k._ptr.trifecta == LATTICE_KNOWN_NULL;
+        if (j > 0) {
+            return is_null ? br->keys[j - 1] == 0 : br->keys[j - 1] != 0;
+        }
+
+        // null goes to the default only if nobody else wants it
+        return is_null ? !sccp_is_key(br, UINT64_MAX, 0) : true;
+    }
+
+    if (k.tag != LATTICE_INT || !sccp_int_type(key->dt)) {
+        return true;
+    }
+
+    TB_DataType dt = key->dt;
+    uint64_t mask = lattice_int_mask(dt);
+    if (j > 0) {
+        return sccp_int_has(dt, k._int, br->keys[j - 1]);
+    }
+
+    // the default is dead if every possible key matches some case, we only try
+    // this on small sets (bools are the common ones)
+    uint64_t span = (uint64_t) k._int.max - (uint64_t) k._int.min;
+    if (span >= SCCP_MAX_ENUM) {
+        return true;
+    }
+
+    FOREACH_N(i, 0, span + 1) {
+        uint64_t x = (uint64_t) k._int.min + i;
+        if (sccp_int_has(dt, k._int, x) && !sccp_is_key(br, mask, x)) return true;
+    }
+    return false;
+}
+
+// projections are matched up with the successors they lead into, this fills
+// projs[j] with the one for br->succ[j]. If it can't make sense of it we
+// don't touch the branch (duplicate successors would need the edges told apart).
+static bool sccp_match_projs(TB_Passes* restrict p, TB_Node* n, TB_Node** projs) {
+    TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
+    memset(projs, 0, br->succ_count * sizeof(TB_Node*));
+
+    FOR_USERS(use, p, n) {
+        if (use->n->type != TB_PROJ) return false;
+
+        TB_Node* region = sccp_proj_region(p, use->n);
+        ptrdiff_t j = region ? sccp_succ_index(br, region) : -1;
+        if (j < 0 || projs[j] != NULL) return false;
+
+        projs[j] = use->n;
+    }
+
+    FOREACH_N(i, 0, br->succ_count) {
+        if (projs[i] == NULL) return false;
+    }
+    return true;
+}
+
+static Lattice sccp_branch_proj(TB_Passes* restrict p, TB_Node* n) {
+    TB_Node* br_n = n->inputs[0];
+    TB_NodeBranch* br = TB_NODE_GET_EXTRA(br_n);
+
+    // unconditional or one we couldn't match up
+    if (br_n->input_count < 2 || sccp_get(p, br_n).tag == LATTICE_ANY) {
+        return (Lattice){ LATTICE_CTRL };
+    }
+
+    ptrdiff_t j = sccp_succ_index(br, sccp_proj_region(p, n));
+    if (j < 0) {
+        return (Lattice){ LATTICE_CTRL };
+    }
+
+    TB_Node* key = br_n->inputs[1];
+    Lattice k = sccp_get(p, key);
+    if (k.tag == LATTICE_NONE) {
+        return (Lattice){ LATTICE_NONE };
+    }
+
+    return sccp_can_take(br, key, k, j) ? (Lattice){ LATTICE_CTRL } : (Lattice){ LATTICE_NONE };
+}
+
+static Lattice sccp_phi(TB_Passes* restrict p, TB_Node* n) {
+    TB_Node* region = n->inputs[0];
+    Lattice l = { LATTICE_NONE };
+    FOREACH_N(i, 1, n->input_count) {
+        if (sccp_is_ctrl(p, region->inputs[i - 1])) {
+            Lattice in = sccp_get(p, n->inputs[i]);
+            l = lattice_meet(&l, &in);
+        }
+    }
+    return l;
+}
+
+static Lattice sccp_transfer(TB_Passes* restrict p, TB_Node* n) {
+    switch (n->type) {
+        case TB_START:
+        return (Lattice){ LATTICE_CTRL };
+
+        case TB_REGION:
+        FOREACH_N(i, 0, n->input_count) {
+            if (sccp_is_ctrl(p, n->inputs[i])) return (Lattice){ LATTICE_CTRL };
+        }
+        return (Lattice){ LATTICE_NONE };
+
+        case TB_PHI:
+        if (!sccp_is_ctrl(p, n->inputs[0])) return (Lattice){ LATTICE_NONE };
+        return sccp_phi(p, n);
+
+        case TB_INTEGER_CONST: {
+            TB_NodeInt* num = TB_NODE_GET_EXTRA(n);
+            if (n->dt.type == TB_PTR && num->num_words == 1) {
+                return (Lattice){ LATTICE_POINTER, ._ptr = { num->words[0] ? LATTICE_KNOWN_NOT_NULL : LATTICE_KNOWN_NULL } };
+            } else if (sccp_int_type(n->dt) && num->num_words == 1) {
+                return lattice_int_const(n->dt, num->words[0]);
+            }
+            return lattice_top(n->dt);
+        }
+
+        case TB_LOCAL:
+        case TB_SYMBOL:
+        return (Lattice){ LATTICE_POINTER, ._ptr = { LATTICE_KNOWN_NOT_NULL } };
+
+        case TB_NULL:
+        case TB_POISON:
+        return (Lattice){ LATTICE_ANY };
+
+        default: break;
+    }
+
+    // anything fed by a value which hasn't been reached isn't reached either
+    FOREACH_N(i, 0, n->input_count) {
+        if (n->inputs[i] && sccp_get(p, n->inputs[i]).tag == LATTICE_NONE) {
+            return (Lattice){ LATTICE_NONE };
+        }
+    }
+
+    switch (n->type) {
+        // keep the pessimistic answer for the odd ones
+        case TB_BRANCH:
+        return sccp_get(p, n).tag == LATTICE_ANY ? (Lattice){ LATTICE_ANY } : (Lattice){ LATTICE_CTRL };
+
+        case TB_PROJ:
+        if (n->inputs[0]->type == TB_BRANCH) {
+            return sccp_branch_proj(p, n);
+        }
+        return lattice_top(n->dt);
+
+        case TB_INT2PTR: {
+            Lattice a = sccp_get(p, n->inputs[1]);
+            if (lattice_is_const(&a)) {
+                return (Lattice){ LATTICE_POINTER, ._ptr = { a._int.min ? LATTICE_KNOWN_NOT_NULL : LATTICE_KNOWN_NULL } };
+            }
+            return lattice_top(n->dt);
+        }
+
+        case TB_SELECT: {
+            Lattice c = sccp_get(p, n->inputs[1]);
+            if (lattice_is_const(&c)) {
+                return sccp_get(p, n->inputs[c._int.min ? 2 : 3]);
+            }
+
+            Lattice a = sccp_get(p, n->inputs[2]);
+            Lattice b = sccp_get(p, n->inputs[3]);
+            Lattice l = lattice_meet(&a, &b);
+            return l.tag == LATTICE_INT ? lattice_int_normalize(n->dt, l._int) : l;
+        }
+
+        case TB_CMP_EQ: case TB_CMP_NE:
+        case TB_CMP_ULT: case TB_CMP_ULE:
+        case TB_CMP_SLT: case TB_CMP_SLE: {
+            TB_DataType cmp_dt = TB_NODE_GET_EXTRA_T(n, TB_NodeCompare)->cmp_dt;
+            if (cmp_dt.type == TB_INT && !sccp_int_type(cmp_dt)) {
+                return sccp_bool(-1);
+            }
+
+            Lattice a = sccp_get(p, n->inputs[1]);
+            Lattice b = sccp_get(p, n->inputs[2]);
+            return sccp_bool(sccp_compare(n->type, cmp_dt, a, b));
+        }
+
+        case TB_TRUNCATE:
+        case TB_ZERO_EXT:
+        case TB_SIGN_EXT:
+        return sccp_ext(p, n);
+
+        case TB_NOT: {
+            if (!sccp_int_type(n->dt)) return lattice_top(n->dt);
+
+            LatticeInt a = sccp_get_int(p, n->inputs[1]);
+            return sccp_int(n->dt, ~a.max, ~a.min, a.known_ones, a.known_zeros);
+        }
+
+        case TB_NEG: {
+            if (!sccp_int_type(n->dt)) return lattice_top(n->dt);
+
+            LatticeInt a = sccp_get_int(p, n->inputs[1]);
+            if (a.min == a.max) {
+                return lattice_int_const(n->dt, -(uint64_t) a.min);
+            }
+
+            Lattice top = lattice_top(n->dt);
+            if (a.min == top._int.min) return top;
+            return sccp_int(n->dt, -a.max, -a.min, 0, 0);
+        }
+
+        case TB_AND: case TB_OR: case TB_XOR:
+        case TB_ADD: case TB_SUB: case TB_MUL:
+        case TB_SHL: case TB_SHR: case TB_SAR:
+        case TB_UDIV: case TB_SDIV: case TB_UMOD: case TB_SMOD: {
+            if (!sccp_int_type(n->dt)) return lattice_top(n->dt);
+
+            LatticeInt a = sccp_get_int(p, n->inputs[1]);
+            LatticeInt b = sccp_get_int(p, n->inputs[2]);
+            return sccp_int_binop(n, n->type, a, b);
+        }
+
+        default:
+        return lattice_top(n->dt);
+    }
+}
+
+static void sccp_push(DynArray(TB_Node*)* ws, uint8_t* queued, TB_Passes* restrict p, TB_Node* n) {
+    if (sccp_tracked(p, n) && !queued[n->gvn]) {
+        queued[n->gvn] = 1;
+        dyn_array_put(*ws, n);
+    }
+}
+
+static void sccp_solve(TB_Passes* restrict p, size_t count, TB_Node** nodes) {
+    uint8_t* queued = tb_arena_alloc(tmp_arena, p->lattice_count);
+    memset(queued, 0, p->lattice_count);
+
+    // pop in the same order as the walk (defs tend to come before uses)
+    DynArray(TB_Node*) ws = dyn_array_create(TB_Node*, count);
+    FOREACH_REVERSE_N(i, 0, count) {
+        sccp_push(&ws, queued, p, nodes[i]);
+    }
+
+    while (dyn_array_length(ws) > 0) {
+        TB_Node* n = dyn_array_pop(ws);
+        queued[n->gvn] = 0;
+
+        Lattice* old = &p->lattice[n->gvn];
+        Lattice new_l = sccp_transfer(p, n);
+
+        // only ever move down the lattice, it's what guarentees we terminate
+        new_l = lattice_meet(old, &new_l);
+        if (new_l.tag == LATTICE_INT) {
+            // phis in loops could walk their ranges one step at a time, we'd
+            // rather jump straight to the full range and let the known bits speak.
+            if (n->type == TB_PHI && old->tag == LATTICE_INT && (new_l._int.min != old->_int.min || new_l._int.max != old->_int.max)) {
+                Lattice top = lattice_top(n->dt);
+                new_l._int.min = top._int.min, new_l._int.max = top._int.max;
+            }
+            new_l = lattice_int_normalize(n->dt, new_l._int);
+        }
+
+        if (lattice_equal(old, &new_l)) {
+            continue;
+        }
+
+        *old = new_l;
+        FOR_USERS(use, p, n) {
+            TB_Node* u = use->n;
+            sccp_push(&ws, queued, p, u);
+
+            // phis read their region's predecessors and branch projections
+            // read the key, neither is their direct input.
+            if (u->type == TB_REGION || u->type == TB_BRANCH) {
+                FOR_USERS(use2, p, u) {
+                    sccp_push(&ws, queued, p, use2->n);
+                }
+            }
+        }
+    }
+
+    dyn_array_destroy(ws);
+}
+
+// drops the dead successors of a live branch, returns true if it changed.
+static bool sccp_rewrite_branch(TB_Passes* restrict p, TB_Function* f, TB_Node* n) {
+    TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
+    if (n->input_count < 2) {
+        return false;
+    }
+
+    size_t succ_count = br->succ_count;
+    TB_Node** projs = tb_arena_alloc(tmp_arena, succ_count * sizeof(TB_Node*));
+    if (!sccp_match_projs(p, n, projs)) {
+        return false;
+    }
+
+    size_t live = 0;
+    ptrdiff_t last_live = -1;
+    FOREACH_N(i, 0, succ_count) {
+        if (sccp_is_ctrl(p, projs[i])) live++, last_live = i;
+    }
+
+    if (live == succ_count || live == 0) {
+        return false;
+    }
+
+    // if the default is dead, the last live case can take over for it
+    size_t def = sccp_is_ctrl(p, projs[0]) ? 0 : last_live;
+    br->succ[0] = br->succ[def];
+    TB_NODE_GET_EXTRA_T(projs[def], TB_NodeProj)->index = 0;
+
+    size_t k = 1;
+    FOREACH_N(i, 1, succ_count) if (i != def && sccp_is_ctrl(p, projs[i])) {
+        br->succ[k] = br->succ[i];
+        br->keys[k - 1] = br->keys[i - 1];
+        TB_NODE_GET_EXTRA_T(projs[i], TB_NodeProj)->index = k;
+        k++;
+    }
+    br->succ_count = k;
+
+    // only one way out, it's a goto now
+    if (k == 1) {
+        set_input(p, n, NULL, 1);
+        n->input_count = 1;
+    }
+
+    tb_pass_mark(p, n);
+    return true;
+}
+
+static bool sccp_rewrite_cfg(TB_Passes* restrict p, TB_Function* f, size_t count, TB_Node** nodes) {
+    bool changes = false;
+
+    // cut the dead edges out of live branches
+    FOREACH_N(i, 0, count) {
+        TB_Node* n = nodes[i];
+        if (n->type == TB_BRANCH && sccp_is_ctrl(p, n)) {
+            changes |= sccp_rewrite_branch(p, f, n);
+        }
+    }
+
+    // detach dead predecessors from the live regions (and their phis)
+    FOREACH_N(i, 0, count) {
+        TB_Node* n = nodes[i];
+        if (n->type != TB_REGION || !sccp_is_ctrl(p, n)) continue;
+
+        FOREACH_REVERSE_N(j, 0, n->input_count) if (!sccp_is_ctrl(p, n->inputs[j])) {
+            DO_IF(TB_OPTDEBUG_SCCP)(printf("sccp: dead edge %p -> %p\n", n->inputs[j], n));
+            remove_input(p, f, n, j);
+
+            FOR_USERS(use, p, n) {
+                if (use->n->type == TB_PHI && use->slot == 0) {
+                    remove_input(p, f, use->n, j + 1);
+                    tb_pass_mark(p, use->n);
+                }
+            }
+
+            tb_pass_mark(p, n);
+            changes = true;
+        }
+    }
+
+    // kill everything which didn't get reached
+    FOREACH_N(i, 0, count) {
+        TB_Node* n = nodes[i];
+        if (n->type != TB_NULL && p->lattice[n->gvn].tag == LATTICE_NONE) {
+            tb_pass_kill_node(p, n);
+            changes = true;
+        }
+    }
+
+    return changes;
+}
+
+static bool sccp_rewrite_consts(TB_Passes* restrict p, TB_Function* f, size_t count, TB_Node** nodes) {
+    bool changes = false;
+    FOREACH_N(i, 0, count) {
+        TB_Node* n = nodes[i];
+        Lattice* l = &p->lattice[n->gvn];
+        if (n->type == TB_INTEGER_CONST || n->type == TB_NULL || !lattice_is_const(l) || !sccp_int_type(n->dt)) {
+            continue;
+        }
+
+        DO_IF(TB_OPTDEBUG_SCCP)(printf("sccp: %p (%s) is %"PRId64"\n", n, tb_node_get_name(n), l->_int.min));
+        TB_Node* k = make_int_node(f, p, n->dt, l->_int.min & lattice_int_mask(n->dt));
+        subsume_node(p, f, n, k);
+        changes = true;
+    }
+
+    return changes;
+}
+
+bool tb_pass_sccp(TB_Passes* p) {
+    verify_tmp_arena(p);
+
+    TB_Function* f = p->f;
+    bool changes = false;
+    CUIK_TIMED_BLOCK("sccp") {
+        DynArray(TB_Node*) nodes = walk_all_nodes(f->start_node, f->node_count);
+        size_t count = dyn_array_length(nodes);
+
+        // nodes missing from lattice_nodes (made after this run) are untracked
+        p->lattice_count = f->node_count;
+        p->lattice_nodes = tb_arena_alloc(tmp_arena, p->lattice_count * sizeof(TB_Node*));
+        p->lattice = tb_arena_alloc(tmp_arena, p->lattice_count * sizeof(Lattice));
+        memset(p->lattice_nodes, 0, p->lattice_count * sizeof(TB_Node*));
+        FOREACH_N(i, 0, count) {
+            p->lattice_nodes[nodes[i]->gvn] = nodes[i];
+            p->lattice[nodes[i]->gvn] = (Lattice){ LATTICE_NONE };
+        }
+
+        // branches we can't rewrite are pessimistically reachable (ANY) so
+        // none of their successors die.
+        FOREACH_N(i, 0, count) {
+            TB_Node* n = nodes[i];
+            if (n->type == TB_BRANCH && n->input_count >= 2) {
+                size_t succ_count = TB_NODE_GET_EXTRA_T(n, TB_NodeBranch)->succ_count;
+                TB_Node** projs = tb_arena_alloc(tmp_arena, succ_count * sizeof(TB_Node*));
+                if (!sccp_match_projs(p, n, projs)) {
+                    p->lattice[n->gvn] = (Lattice){ LATTICE_ANY };
+                }
+            }
+        }
+
+        sccp_solve(p, count, nodes);
+
+        // if the exit isn't reachable (the function never returns) we'd be
+        // leaving STOP hanging, the CFG is left alone in that case.
+        if (sccp_is_ctrl(p, f->stop_node)) {
+            changes |= sccp_rewrite_cfg(p, f, count, nodes);
+        }
+
+        changes |= sccp_rewrite_consts(p, f, count, nodes);
+        if (changes) {
+            recompute_cfg(f, p);
+        }
+
+        dyn_array_destroy(nodes);
+    }
+
+    return changes;
+}
+
+bool tb_pass_known_bits(TB_Passes* p, TB_Node* n, uint64_t* known_zeros, uint64_t* known_ones) {
+    if (!sccp_tracked(p, n) || p->lattice[n->gvn].tag != LATTICE_INT) {
+        return false;
+    }
+
+    LatticeInt* i = &p->lattice[n->gvn]._int;
+    *known_zeros = i->known_zeros;
+    *known_ones = i->known_ones;
+    return true;
+}
@@ -0,0 +1,536 @@
+// Scalar replacement of aggregates, locals which are only ever accessed at known
+// offsets (member accesses, constant array indices) get split into one local per
+// field so mem2reg can promote them.
+//
+//   vec3 p = { a, b, c };    =>   float p_x = a, p_y = b, p_z = c;
+//   vec3 q = p;                   float q_x = p_x, q_y = p_y, q_z = p_z;
+//
+// memsets and memcpys on the aggregate are broken up into stores per field, if the
+// aggregate is ever copied out we also need fields for the bytes nobody names directly
+// (padding, untouched members) so those get filled in with integer slices.
+#define SROA_MAX_SLICES 16
+
+typedef struct {
+    // load, store, memset or memcpy
+    TB_Node* n;
+    // in char units
+    int64_t offset, size;
+    // memcpy: are we the source
+    bool is_src;
+    // load/store: covers several slices
+    bool wide;
+} SROA_Access;
+
+typedef struct {
+    int64_t offset, size;
+    TB_DataType dt;
+    TB_Node* local;
+} SROA_Slice;
+
+typedef struct {
+    TB_Node* base;
+    int64_t limit;
+    int char_bits;
+
+    DynArray(SROA_Access) accesses;
+    DynArray(SROA_Slice) slices;
+} SROA_Ctx;
+
+static TB_DataType sroa_access_dt(TB_Node* n) {
+    return n->type == TB_LOAD ? n->dt : n->inputs[2]->dt;
+}
+
+static int sroa_access_cmp(const void* a, const void* b) {
+    const SROA_Access* aa = a;
+    const SROA_Access* bb = b;
+    return aa->size < bb->size ? -1 : aa->size > bb->size;
+}
+
+static bool sroa_collect(TB_Passes* restrict p, SROA_Ctx* restrict ctx, TB_Node* addr, int64_t offset, int depth) {
+    if (depth > 8) return false;
+
+    FOR_USERS(use, p, addr) {
+        TB_Node* n = use->n;
+        if (use->slot != 1 && !(n->type == TB_MEMCPY && use->slot == 2)) {
+            return false;
+        }
+
+        uint64_t idx;
+        switch (n->type) {
+            case TB_MEMBER_ACCESS:
+            if (!sroa_collect(p, ctx, n, offset + TB_NODE_GET_EXTRA_T(n, TB_NodeMember)->offset, depth + 1)) return false;
+            break;
+
+            case TB_ARRAY_ACCESS:
+            if (!get_int_const(n->inputs[2], &idx)) return false;
+            if (!sroa_collect(p, ctx, n, offset + (int64_t) idx * TB_NODE_GET_EXTRA_T(n, TB_NodeArray)->stride, depth + 1)) return false;
+            break;
+
+            case TB_LOAD:
+            case TB_STORE: {
+                int bits = mem_size(p->f, sroa_access_dt(n));
+                if (bits == 0 || bits % ctx->char_bits) return false;
+
+                dyn_array_put(ctx->accesses, (SROA_Access){ n, offset, bits / ctx->char_bits });
+                break;
+            }
+
+            case TB_MEMSET:
+            case TB_MEMCPY: {
+                uint64_t size;
+                if (!get_int_const(n->inputs[3], &size)) return false;
+
+                // copying into ourselves is more trouble than it's worth
+                bool is_src = use->slot == 2;
+                if (n->type == TB_MEMCPY && mem_root(n->inputs[is_src ? 1 : 2]) == ctx->base) return false;
+                // the fill value has to be known so we can make the per field stores
+                if (n->type == TB_MEMSET && !get_int_const(n->inputs[2], &idx)) return false;
+
+                dyn_array_put(ctx->accesses, (SROA_Access){ n, offset, size, is_src });
+                break;
+            }
+
+            default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// -1 if the range only partially overlaps some slice, otherwise the
+// index where a slice starting at 'offset' goes.
+static ptrdiff_t sroa_find_slice(SROA_Ctx* restrict ctx, int64_t offset, int64_t size, bool* exact) {
+    *exact = false;
+
+    size_t i = 0, count = dyn_array_length(ctx->slices);
+    for (; i < count; i++) {
+        SROA_Slice* s = &ctx->slices[i];
+        if (s->offset + s->size <= offset) continue;
+        if (offset + size <= s->offset) break;
+
+        if (s->offset == offset && s->size == size) {
+            *exact = true;
+            return i;
+        }
+        return -1;
+    }
+
+    return i;
+}
+
+static bool sroa_add_slice(SROA_Ctx* restrict ctx, int64_t offset, int64_t size, TB_DataType dt) {
+    bool exact;
+    ptrdiff_t i = sroa_find_slice(ctx, offset, size, &exact);
+    if (i < 0) {
+        return false;
+    } else if (exact) {
+        // same bytes, different types get a cast
+        return true;
+    }
+
+    if (dyn_array_length(ctx->slices) >= SROA_MAX_SLICES) {
+        return false;
+    }
+
+    // keep it sorted by offset
+    dyn_array_put_uninit(ctx->slices, 1);
+    size_t count = dyn_array_length(ctx->slices);
+    memmove(&ctx->slices[i + 1], &ctx->slices[i], (count - i - 1) * sizeof(SROA_Slice));
+    ctx->slices[i] = (SROA_Slice){ offset, size, dt };
+    return true;
+}
+
+// fill the gaps between the named fields with integers so a copy carries every byte
+static bool sroa_fill_gaps(SROA_Ctx* restrict ctx, int64_t start, int64_t end) {
+    int64_t offset = start;
+    while (offset < end) {
+        // skip the slices in the way
+        bool skipped = false;
+        dyn_array_for(i, ctx->slices) {
+            SROA_Slice* s = &ctx->slices[i];
+            if (s->offset <= offset && offset < s->offset + s->size) {
+                offset = s->offset + s->size, skipped = true;
+                break;
+            }
+        }
+        if (skipped) continue;
+
+        // biggest naturally aligned integer which fits before the next slice
+        int64_t limit = end;
+        dyn_array_for(i, ctx->slices) {
+            if (ctx->slices[i].offset > offset && ctx->slices[i].offset < limit) limit = ctx->slices[i].offset;
+        }
+
+        int64_t size = 8;
+        while (size > 1 && (offset % size != 0 || offset + size > limit)) size /= 2;
+
+        if (!sroa_add_slice(ctx, offset, size, TB_TYPE_INTN(size * ctx->char_bits))) {
+            return false;
+        }
+        offset += size;
+    }
+
+    return true;
+}
+
+static uint32_t sroa_align(uint32_t align, int64_t offset) {
+    while (align > 1 && offset % align != 0) align /= 2;
+    return align;
+}
+
+static TB_Node* sroa_offset(TB_Passes* restrict p, TB_Function* f, TB_Node* base, int64_t offset) {
+    if (offset == 0) return base;
+
+    TB_Node* n = tb_alloc_node(f, TB_MEMBER_ACCESS, TB_TYPE_PTR, 2, sizeof(TB_NodeMember));
+    set_input(p, n, base, 1);
+    TB_NODE_SET_EXTRA(n, TB_NodeMember, .offset = offset);
+    tb_pass_mark(p, n);
+    return n;
+}
+
+static TB_Node* sroa_load(TB_Passes* restrict p, TB_Function* f, TB_Node* mem, TB_Node* addr, TB_DataType dt, uint32_t align) {
+    TB_Node* n = tb_alloc_node(f, TB_LOAD, dt, 2, sizeof(TB_NodeMemAccess));
+    set_input(p, n, mem, 0);
+    set_input(p, n, addr, 1);
+    TB_NODE_SET_EXTRA(n, TB_NodeMemAccess, .align = align);
+    tb_pass_mark(p, n);
+    return n;
+}
+
+static TB_Node* sroa_store(TB_Passes* restrict p, TB_Function* f, TB_Node* mem, TB_Node* addr, TB_Node* val, uint32_t align) {
+    TB_Node* n = tb_alloc_node(f, TB_STORE, TB_TYPE_CONTROL, 3, sizeof(TB_NodeMemAccess));
+    set_input(p, n, mem, 0);
+    set_input(p, n, addr, 1);
+    set_input(p, n, val, 2);
+    TB_NODE_SET_EXTRA(n, TB_NodeMemAccess, .align = align);
+    tb_pass_mark(p, n);
+    return n;
+}
+
+// memset byte splatted across the slice
+static TB_Node* sroa_fill_value(TB_Passes* restrict p, TB_Function* f, TB_DataType dt, uint8_t byte) {
+    if (dt.type == TB_FLOAT) {
+        TB_Node* n;
+        if (dt.data == TB_FLT_32) {
+            n = tb_alloc_node(f, TB_FLOAT32_CONST, dt, 1, sizeof(TB_NodeFloat32));
+            TB_NODE_SET_EXTRA(n, TB_NodeFloat32, .value = 0.0f);
+        } else {
+            n = tb_alloc_node(f, TB_FLOAT64_CONST, dt, 1, sizeof(TB_NodeFloat64));
+            TB_NODE_SET_EXTRA(n, TB_NodeFloat64, .value = 0.0);
+        }
+        tb_pass_mark(p, n);
+        return n;
+    }
+
+    uint64_t x = byte * 0x0101010101010101ull;
+    if (dt.type == TB_INT && dt.data < 64) {
+        x &= (1ull << dt.data) - 1;
+    }
+    return make_int_node(f, p, dt, x);
+}
+
+// breaks up a memset/memcpy into per slice stores, returns the new end of the chain
+static TB_Node* sroa_split_op(TB_Passes* restrict p, TB_Function* f, SROA_Ctx* restrict ctx, SROA_Access* a) {
+    TB_Node* n = a->n;
+    TB_Node* mem = n->inputs[0];
+    uint32_t align = TB_NODE_GET_EXTRA_T(n, TB_NodeMemAccess)->align;
+
+    uint64_t byte = 0;
+    if (n->type == TB_MEMSET) {
+        get_int_const(n->inputs[2], &byte);
+    }
+
+    dyn_array_for(i, ctx->slices) {
+        SROA_Slice* s = &ctx->slices[i];
+        if (s->offset < a->offset || s->offset + s->size > a->offset + a->size) continue;
+
+        int64_t delta = s->offset - a->offset;
+        uint32_t s_align = TB_NODE_GET_EXTRA_T(s->local, TB_NodeLocal)->align;
+        if (n->type == TB_MEMSET) {
+            mem = sroa_store(p, f, mem, s->local, sroa_fill_value(p, f, s->dt, byte), s_align);
+        } else if (a->is_src) {
+            // aggregate -> somewhere else
+            TB_Node* val = sroa_load(p, f, n->inputs[0], s->local, s->dt, s_align);
+            TB_Node* dst = sroa_offset(p, f, n->inputs[1], delta);
+            mem = sroa_store(p, f, mem, dst, val, sroa_align(align, delta));
+        } else {
+            // somewhere else -> aggregate, the loads all read the memory from before the copy
+            TB_Node* src = sroa_offset(p, f, n->inputs[2], delta);
+            TB_Node* val = sroa_load(p, f, n->inputs[0], src, s->dt, sroa_align(align, delta));
+            mem = sroa_store(p, f, mem, s->local, val, s_align);
+        }
+    }
+
+    return mem;
+}
+
+static TB_Node* sroa_unary(TB_Passes* restrict p, TB_Function* f, int type, TB_DataType dt, TB_Node* src) {
+    TB_Node* n = tb_alloc_node(f, type, dt, 2, 0);
+    set_input(p, n, src, 1);
+    tb_pass_mark(p, n);
+    return n;
+}
+
+static TB_Node* sroa_binop(TB_Passes* restrict p, TB_Function* f, int type, TB_Node* a, TB_Node* b) {
+    TB_Node* n = tb_alloc_node(f, type, a->dt, 3, sizeof(TB_NodeBinopInt));
+    set_input(p, n, a, 1);
+    set_input(p, n, b, 2);
+    TB_NODE_SET_EXTRA(n, TB_NodeBinopInt, .ab = 0);
+    tb_pass_mark(p, n);
+    return n;
+}
+
+// reinterpret between same sized ints, floats and pointers
+static TB_Node* sroa_cast(TB_Passes* restrict p, TB_Function* f, TB_Node* v, TB_DataType dt) {
+    if (TB_DATA_TYPE_EQUALS(v->dt, dt)) {
+        return v;
+    }
+
+    TB_DataType int_dt = TB_TYPE_INTN(mem_size(f, dt));
+    if (v->dt.type == TB_PTR) {
+        v = sroa_unary(p, f, TB_PTR2INT, int_dt, v);
+    } else if (dt.type == TB_PTR && v->dt.type == TB_FLOAT) {
+        v = sroa_unary(p, f, TB_BITCAST, int_dt, v);
+    }
+
+    if (TB_DATA_TYPE_EQUALS(v->dt, dt)) {
+        return v;
+    } else if (dt.type == TB_PTR) {
+        return sroa_unary(p, f, TB_INT2PTR, dt, v);
+    } else {
+        return sroa_unary(p, f, TB_BITCAST, dt, v);
+    }
+}
+
+// wide integer load stitched together out of the slices (little endian)
+static TB_Node* sroa_rewrite_load(TB_Passes* restrict p, TB_Function* f, SROA_Ctx* restrict ctx, SROA_Access* a) {
+    TB_Node* n = a->n;
+    TB_Node* result = NULL;
+
+    dyn_array_for(i, ctx->slices) {
+        SROA_Slice* s = &ctx->slices[i];
+        if (s->offset < a->offset || s->offset + s->size > a->offset + a->size) continue;
+
+        uint32_t s_align = TB_NODE_GET_EXTRA_T(s->local, TB_NodeLocal)->align;
+        TB_Node* piece = sroa_load(p, f, n->inputs[0], s->local, s->dt, s_align);
+        if (!a->wide) {
+            return sroa_cast(p, f, piece, n->dt);
+        }
+
+        piece = sroa_cast(p, f, piece, TB_TYPE_INTN(s->size * ctx->char_bits));
+        if (s->size != a->size) {
+            piece = sroa_unary(p, f, TB_ZERO_EXT, n->dt, piece);
+        }
+
+        int64_t shift = (s->offset - a->offset) * ctx->char_bits;
+        if (shift) {
+            piece = sroa_binop(p, f, TB_SHL, piece, make_int_node(f, p, n->dt, shift));
+        }
+
+        result = result ? sroa_binop(p, f, TB_OR, result, piece) : piece;
+    }
+
+    return result;
+}
+
+// returns the new end of the chain
+static TB_Node* sroa_rewrite_store(TB_Passes* restrict p, TB_Function* f, SROA_Ctx* restrict ctx, SROA_Access* a) {
+    TB_Node* n = a->n;
+    TB_Node* mem = n->inputs[0];
+    TB_Node* val = n->inputs[2];
+
+    dyn_array_for(i, ctx->slices) {
+        SROA_Slice* s = &ctx->slices[i];
+        if (s->offset < a->offset || s->offset + s->size > a->offset + a->size) continue;
+
+        TB_Node* piece = val;
+        if (a->wide) {
+            int64_t shift = (s->offset - a->offset) * ctx->char_bits;
+            if (shift) {
+                piece = sroa_binop(p, f, TB_SHR, piece, make_int_node(f, p, val->dt, shift));
+            }
+
+            if (s->size != a->size) {
+                piece = sroa_unary(p, f, TB_TRUNCATE, TB_TYPE_INTN(s->size * ctx->char_bits), piece);
+            }
+        }
+
+        uint32_t s_align = TB_NODE_GET_EXTRA_T(s->local, TB_NodeLocal)->align;
+        mem = sroa_store(p, f, mem, s->local, sroa_cast(p, f, piece, s->dt), s_align);
+    }
+
+    return mem;
+}
+
+static void sroa_kill_tree(TB_Passes* restrict p, TB_Node* n) {
+    while (user_count(p, n) > 0) {
+        sroa_kill_tree(p, find_users(p, n)[0].n);
+    }
+    tb_pass_kill_node(p, n);
+}
+
+static bool sroa_split(TB_Passes* restrict p, TB_Function* f, SROA_Ctx* restrict ctx) {
+    TB_Node* base = ctx->base;
+    if (!sroa_collect(p, ctx, base, 0, 0)) {
+        return false;
+    }
+
+    // the directly named fields first, smaller accesses go first so the ones which
+    // straddle several fields (small structs get copied with a single integer
+    // load/store) can get stitched together out of them.
+    size_t access_count = dyn_array_length(ctx->accesses);
+    qsort(ctx->accesses, access_count, sizeof(SROA_Access), sroa_access_cmp);
+
+    bool has_copy_out = false, has_bulk = false;
+    dyn_array_for(i, ctx->accesses) {
+        SROA_Access* a = &ctx->accesses[i];
+        if (a->offset < 0 || a->offset + a->size > ctx->limit) {
+            return false;
+        }
+
+        if (a->n->type == TB_LOAD || a->n->type == TB_STORE) {
+            TB_DataType dt = sroa_access_dt(a->n);
+            if (!sroa_add_slice(ctx, a->offset, a->size, dt)) {
+                if (dt.type != TB_INT) return false;
+                a->wide = true;
+            }
+        } else {
+            has_copy_out |= a->is_src;
+        }
+    }
+
+    // a copy out of the aggregate needs every byte accounted for, same
+    // goes for the wide accesses.
+    dyn_array_for(i, ctx->accesses) {
+        SROA_Access* a = &ctx->accesses[i];
+        if ((a->wide || (has_copy_out && a->n->type == TB_MEMCPY && a->is_src)) && !sroa_fill_gaps(ctx, a->offset, a->offset + a->size)) {
+            return false;
+        }
+    }
+
+    // nothing to promote, mem_opt will take care of these
+    size_t slice_count = dyn_array_length(ctx->slices);
+    if (slice_count == 0) {
+        return false;
+    }
+
+    // bulk ops and wide accesses have to cover whole slices
+    dyn_array_for(i, ctx->accesses) {
+        SROA_Access* a = &ctx->accesses[i];
+
+        uint64_t byte = 0;
+        if (a->n->type == TB_MEMSET) {
+            get_int_const(a->n->inputs[2], &byte);
+        } else if (a->n->type != TB_MEMCPY && !a->wide) {
+            // a plain access is still worth splitting for if it needs a cast
+            bool exact;
+            ptrdiff_t j = sroa_find_slice(ctx, a->offset, a->size, &exact);
+            if (a->n->inputs[1] != base || !TB_DATA_TYPE_EQUALS(ctx->slices[j].dt, sroa_access_dt(a->n))) {
+                has_bulk = true;
+            }
+            continue;
+        }
+
+        has_bulk = true;
+        dyn_array_for(j, ctx->slices) {
+            SROA_Slice* s = &ctx->slices[j];
+            int64_t end = a->offset + a->size, s_end = s->offset + s->size;
+            if (s_end <= a->offset || end <= s->offset) continue;
+
+            if (s->offset < a->offset || s_end > end) return false;
+            if (s->dt.type == TB_FLOAT && (byte & 0xFF) != 0) return false;
+        }
+    }
+
+    // mem2reg can already promote it as is
+    if (slice_count == 1 && !has_bulk) {
+        return false;
+    }
+
+    // it's all good, make the new locals
+    uint32_t align = TB_NODE_GET_EXTRA_T(base, TB_NodeLocal)->align;
+    dyn_array_for(i, ctx->slices) {
+        SROA_Slice* s = &ctx->slices[i];
+
+        s->local = tb_alloc_node(f, TB_LOCAL, TB_TYPE_PTR, 1, sizeof(TB_NodeLocal));
+        TB_NODE_SET_EXTRA(s->local, TB_NodeLocal, .size = s->size, .align = sroa_align(align, s->offset));
+        tb_pass_mark(p, s->local);
+        dyn_array_put(p->locals, s->local);
+    }
+
+    dyn_array_for(i, ctx->accesses) {
+        SROA_Access* a = &ctx->accesses[i];
+
+        bool exact = false;
+        ptrdiff_t j = -1;
+        if (a->n->type == TB_LOAD || a->n->type == TB_STORE) {
+            j = sroa_find_slice(ctx, a->offset, a->size, &exact);
+        }
+
+        if (exact && TB_DATA_TYPE_EQUALS(ctx->slices[j].dt, sroa_access_dt(a->n))) {
+            // same field, same type, just needs the new address
+            set_input(p, a->n, ctx->slices[j].local, 1);
+            tb_pass_mark(p, a->n);
+        } else if (a->n->type == TB_LOAD) {
+            subsume_node(p, f, a->n, sroa_rewrite_load(p, f, ctx, a));
+        } else if (a->n->type == TB_STORE) {
+            subsume_node(p, f, a->n, sroa_rewrite_store(p, f, ctx, a));
+        } else {
+            subsume_node(p, f, a->n, sroa_split_op(p, f, ctx, a));
+        }
+    }
+
+    // the old address computations are dead now
+    sroa_kill_tree(p, base);
+    return true;
+}
+
+bool tb_pass_sroa(TB_Passes* p) {
+    cuikperf_region_start("sroa", NULL);
+    verify_tmp_arena(p);
+
+    size_t count = dyn_array_length(p->locals);
+    if (count == 0) {
+        cuikperf_region_end();
+        return false;
+    }
+
+    TB_Function* f = p->f;
+    ICodeGen* cg = tb__find_code_generator(f->super.module);
+
+    // the list gets edited as we split, walk a copy
+    TB_Node** locals = tb_arena_alloc(tmp_arena, count * sizeof(TB_Node*));
+    memcpy(locals, p->locals, count * sizeof(TB_Node*));
+
+    SROA_Ctx ctx = {
+        .char_bits = cg->minimum_addressable_size,
+        .accesses = dyn_array_create(SROA_Access, 16),
+        .slices = dyn_array_create(SROA_Slice, 16),
+    };
+
+    bool progress = false;
+    FOREACH_N(i, 0, count) {
+        // nobody's using it anymore (everything got folded away)
+        if (user_count(p, locals[i]) == 0) {
+            tb_pass_kill_node(p, locals[i]);
+            progress = true;
+            continue;
+        }
+
+        ctx.base = locals[i];
+        ctx.limit = TB_NODE_GET_EXTRA_T(ctx.base, TB_NodeLocal)->size;
+        dyn_array_clear(ctx.accesses);
+        dyn_array_clear(ctx.slices);
+
+        if (sroa_split(p, f, &ctx)) {
+            DO_IF(TB_OPTDEBUG_MEM2REG)(log_debug("%s: %p split into %zu locals", f->super.name, locals[i], dyn_array_length(ctx.slices)));
+            progress = true;
+        }
+    }
+
+    dyn_array_destroy(ctx.accesses);
+    dyn_array_destroy(ctx.slices);
+    cuikperf_region_end();
+    return progress;
+}
@@ -0,0 +1,475 @@
+// Loop vectorization, this only handles simple counted loops (the same shape loop_unroll
+// looks for) where every iteration does lane-wise work over arrays indexed by the
+// induction variable:
+//
+//   header:                        body:
+//     i = phi(init, i + 1)           a[i] = b[i] + c[i]
+//     if (i < n) body                goto header
+//     else exit
+//
+// the scalar loop sticks around to do the leftovers (and everything if the arrays
+// overlap), we just put a packed loop in front of it:
+//
+//   vec.pre:
+//     vend = init + ((n - init) & -VF)
+//     if (init < n && VF <= n - init && no overlap) vec.body else vec.rem
+//   vec.body:
+//     vi = phi(init, vi + VF)
+//     a[vi:VF] = b[vi:VF] + c[vi:VF]
+//     if (vi + VF != vend) vec.body else vec.rem
+//   vec.rem:
+//     i0 = phi(init, vend)
+//     goto header                    (where i = phi(i0, i + 1))
+//
+// NOTE(NeGate): everything is 128bit for now, the x64 emitter doesn't know VEX so
+// AVX2 only buys us pmulld.
+#define TB_VECTOR_BYTES     16
+#define TB_VECTOR_MAX_BASES 4
+
+typedef struct {
+    NL_HashSet* body;
+    TB_Node* iv;
+    TB_Node* vi;
+    TB_FeatureSet_X64 features;
+
+    // the extensions on the index are only fine if i + 1 doesn't wrap
+    TB_ArithmeticBehavior ab;
+
+    int elem_size, log2_lanes;
+
+    // the body region is 0 and the stores count up from there, a load can
+    // only go under the stores which come after it.
+    LoopMap chain;
+
+    // every array we touch, the overlap checks are built from these
+    size_t base_count;
+    TB_Node* bases[TB_VECTOR_MAX_BASES];
+    TB_Node* base_arr[TB_VECTOR_MAX_BASES];
+    bool stored[TB_VECTOR_MAX_BASES];
+} Vectorizer;
+
+static int vec_elem_size(TB_DataType dt) {
+    if (dt.width != 0) return 0;
+    if (dt.type == TB_FLOAT) return dt.data == TB_FLT_64 ? 8 : 4;
+    if (dt.type == TB_INT && (dt.data == 8 || dt.data == 16 || dt.data == 32 || dt.data == 64)) return dt.data / 8;
+    return 0;
+}
+
+// array(base, i) with the stride of one element, the base can't change in the loop
+static bool vec_array(Vectorizer* v, TB_Node* n, bool is_store) {
+    if (n->type != TB_ARRAY_ACCESS || TB_NODE_GET_EXTRA_T(n, TB_NodeArray)->stride != v->elem_size) {
+        return false;
+    }
+
+    TB_Node* idx = n->inputs[2];
+    if (idx != v->iv) {
+        bool ok = (idx->type == TB_SIGN_EXT && (v->ab & TB_ARITHMATIC_NSW)) || (idx->type == TB_ZERO_EXT && (v->ab & TB_ARITHMATIC_NUW));
+        if (!ok || idx->inputs[1] != v->iv) return false;
+    }
+
+    TB_Node* base = n->inputs[1];
+    if (!loop_is_invariant(v->body, base, 0)) {
+        return false;
+    }
+
+    size_t i = 0;
+    while (i < v->base_count && v->bases[i] != base) i++;
+
+    if (i == v->base_count) {
+        if (i == TB_VECTOR_MAX_BASES) return false;
+
+        v->bases[i] = base;
+        v->base_arr[i] = n;
+        v->stored[i] = false;
+        v->base_count++;
+    }
+
+    v->stored[i] |= is_store;
+    return true;
+}
+
+// can n be computed lane by lane, limit is the first store a load isn't allowed to go under
+static bool vec_check(Vectorizer* v, TB_Node* n, int limit, int depth) {
+    if (depth > 64 || vec_elem_size(n->dt) != v->elem_size) {
+        return false;
+    }
+
+    // gets broadcast
+    if (loop_is_invariant(v->body, n, 0)) {
+        return true;
+    }
+
+    switch (n->type) {
+        case TB_LOAD: {
+            ptrdiff_t search = nl_map_get(v->chain, n->inputs[0]);
+            return search >= 0 && v->chain[search].v < limit && vec_array(v, n->inputs[1], false);
+        }
+
+        case TB_AND: case TB_OR: case TB_XOR: case TB_ADD: case TB_SUB:
+        case TB_FADD: case TB_FSUB: case TB_FMUL: case TB_FDIV:
+        break;
+
+        // there's no packed multiply on bytes or qwords, pmulld is SSE4.1
+        case TB_MUL: {
+            if (n->dt.data == 32 && (v->features & (TB_FEATURE_X64_SSE41 | TB_FEATURE_X64_AVX2)) == 0) return false;
+            if (n->dt.data != 16 && n->dt.data != 32) return false;
+            break;
+        }
+
+        default: return false;
+    }
+
+    return vec_check(v, n->inputs[1], limit, depth + 1) && vec_check(v, n->inputs[2], limit, depth + 1);
+}
+
+static TB_Node* vec_binop(TB_Passes* p, TB_Function* f, int type, TB_DataType dt, TB_Node* a, TB_Node* b) {
+    TB_Node* n = tb_alloc_node(f, type, dt, 3, sizeof(TB_NodeBinopInt));
+    set_input(p, n, a, 1);
+    set_input(p, n, b, 2);
+    tb_pass_mark(p, n);
+    return n;
+}
+
+static TB_Node* vec_cmp(TB_Passes* p, TB_Function* f, int type, TB_DataType dt, TB_Node* a, TB_Node* b) {
+    TB_Node* n = tb_alloc_node(f, type, TB_TYPE_BOOL, 3, sizeof(TB_NodeCompare));
+    set_input(p, n, a, 1);
+    set_input(p, n, b, 2);
+    TB_NODE_SET_EXTRA(n, TB_NodeCompare, .cmp_dt = dt);
+    tb_pass_mark(p, n);
+    return n;
+}
+
+static TB_Node* vec_region(TB_Passes* p, TB_Function* f, int input_count, const char* tag) {
+    TB_Node* n = tb_alloc_node(f, TB_REGION, TB_TYPE_CONTROL, input_count, sizeof(TB_NodeRegion));
+    TB_NodeRegion* r = TB_NODE_GET_EXTRA(n);
+    r->dom_depth = -1; // unresolved
+    DO_IF(TB_OPTDEBUG_LOOP)(r->tag = lil_name(f, tag));
+    tb_pass_mark(p, n);
+    return n;
+}
+
+// if (cond) yes else no, it's a goto to yes if there's no cond
+static TB_Node* vec_branch(TB_Passes* p, TB_Function* f, TB_Node* bb, TB_Node* ctrl, TB_Node* cond, TB_Node* yes, TB_Node* no) {
+    size_t succ_count = cond ? 2 : 1;
+    TB_Node* n = tb_alloc_node(f, TB_BRANCH, TB_TYPE_TUPLE, succ_count, sizeof(TB_NodeBranch) + (succ_count - 1) * sizeof(int64_t));
+    TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
+    br->succ_count = succ_count;
+    br->succ = alloc_from_node_arena(f, succ_count * sizeof(TB_Node*));
+    br->succ[0] = yes;
+
+    set_input(p, n, ctrl, 0);
+    if (cond) {
+        set_input(p, n, cond, 1);
+        br->succ[1] = no;
+        br->keys[0] = 0;
+    }
+
+    TB_NODE_GET_EXTRA_T(bb, TB_NodeRegion)->end = n;
+    tb_pass_mark(p, n);
+    return n;
+}
+
+// the phi moves go at the end of the predecessor so an if can't lead straight into a
+// block with phis, we give the edge its own block (which is just a goto).
+static TB_Node* vec_edge(TB_Passes* p, TB_Function* f, TB_Node* br, int i, TB_Node* target) {
+    TB_Node* bb = vec_region(p, f, 1, "vec.edge");
+    set_input(p, bb, make_proj_node(f, p, TB_TYPE_CONTROL, br, i), 0);
+    TB_NODE_GET_EXTRA_T(br, TB_NodeBranch)->succ[i] = bb;
+
+    TB_Node* k = vec_branch(p, f, bb, bb, NULL, target, NULL);
+    return make_proj_node(f, p, TB_TYPE_CONTROL, k, 0);
+}
+
+// the bounds of an array within [init, end)
+static TB_Node* vec_array_at(TB_Passes* p, TB_Function* f, Vectorizer* v, TB_Node* arr, TB_Node* i) {
+    TB_Node* idx = arr->inputs[2];
+    if (idx != v->iv) {
+        TB_Node* ext = tb_alloc_node(f, idx->type, idx->dt, 2, 0);
+        set_input(p, ext, i, 1);
+        tb_pass_mark(p, ext);
+        i = ext;
+    }
+
+    TB_Node* n = tb_alloc_node(f, TB_ARRAY_ACCESS, arr->dt, 3, sizeof(TB_NodeArray));
+    set_input(p, n, arr->inputs[1], 1);
+    set_input(p, n, i, 2);
+    TB_NODE_SET_EXTRA(n, TB_NodeArray, .stride = v->elem_size);
+    tb_pass_mark(p, n);
+    return n;
+}
+
+// the packed copy of n (anything vec_check said yes to), the map starts out with
+// the body's control and the induction variable.
+static TB_Node* vec_build(TB_Passes* p, TB_Function* f, Vectorizer* v, InlineMap* map, TB_Node* n) {
+    ptrdiff_t search = nl_map_get(*map, n);
+    if (search >= 0) {
+        return (*map)[search].v;
+    }
+
+    TB_Node* k;
+    TB_DataType dt = TB_TYPE_VEC(n->dt, v->log2_lanes);
+    if (n->type == TB_ARRAY_ACCESS) {
+        k = vec_array_at(p, f, v, n, v->vi);
+    } else if (loop_is_invariant(v->body, n, 0)) {
+        k = tb_alloc_node(f, TB_VBROADCAST, dt, 2, 0);
+        set_input(p, k, n, 1);
+    } else if (n->type == TB_LOAD) {
+        k = tb_alloc_node(f, TB_LOAD, dt, 2, sizeof(TB_NodeMemAccess));
+        set_input(p, k, inline_lookup(*map, n->inputs[0]), 0);
+        set_input(p, k, vec_build(p, f, v, map, n->inputs[1]), 1);
+        memcpy(k->extra, n->extra, sizeof(TB_NodeMemAccess));
+    } else {
+        k = tb_alloc_node(f, n->type, dt, 3, n->extra_count);
+        set_input(p, k, vec_build(p, f, v, map, n->inputs[1]), 1);
+        set_input(p, k, vec_build(p, f, v, map, n->inputs[2]), 2);
+        memcpy(k->extra, n->extra, n->extra_count);
+    }
+
+    tb_pass_mark(p, k);
+    nl_map_put(*map, n, k);
+    return k;
+}
+
+static bool loop_vectorize(TB_Passes* p, TB_Function* f, NL_HashSet* blocks, TB_Node* header) {
+    if (header->input_count != 2) {
+        return false;
+    }
+
+    size_t latch = loop_is_backedge(blocks, header, header->inputs[1]) ? 1 : 0;
+    size_t entry = 1 - latch;
+    TB_Node* entry_proj = header->inputs[entry];
+    TB_Node* latch_proj = header->inputs[latch];
+    if (loop_is_backedge(blocks, header, entry_proj) ||
+        entry_proj->type != TB_PROJ || entry_proj->inputs[0]->type != TB_BRANCH ||
+        latch_proj->type != TB_PROJ) {
+        return false;
+    }
+
+    // the header is just i = phi(init, i + 1) and the exit test
+    uint64_t falsey;
+    TB_Node* br = TB_NODE_GET_EXTRA_T(header, TB_NodeRegion)->end;
+    if (!is_if_branch(br, &falsey) || br->inputs[0] != header || falsey > 1) {
+        return false;
+    }
+
+    TB_Node* iv = NULL;
+    FOR_USERS(use, p, header) {
+        if (use->n == br) continue;
+        if (use->n->type != TB_PHI || use->slot != 0 || iv != NULL) return false;
+        iv = use->n;
+    }
+
+    int64_t step;
+    if (iv == NULL || !loop_iv_step(header, iv, latch, &step) || step != 1) {
+        return false;
+    }
+
+    // i < n
+    TB_Node* cmp = br->inputs[1];
+    if ((cmp->type != TB_CMP_SLT && cmp->type != TB_CMP_ULT) || cmp->inputs[1] != iv ||
+        TB_NODE_GET_EXTRA_T(cmp, TB_NodeCompare)->cmp_dt.raw != iv->dt.raw) {
+        return false;
+    }
+
+    // the body is one block which goes back to the header
+    TB_Node* latch_br = latch_proj->inputs[0];
+    TB_Node* bb = tb_get_parent_region(latch_br);
+    if (bb == header || bb->input_count != 1 || latch_br->type != TB_BRANCH || latch_br->input_count != 1) {
+        return false;
+    }
+
+    // succ[1] is taken when the cond matches the key, so that's where the body goes
+    TB_Node* projs[2];
+    if (!sccp_match_projs(p, br, projs) || bb->inputs[0] != projs[falsey]) {
+        return false;
+    }
+
+    NL_HashSet body = nl_hashset_alloc(4);
+    nl_hashset_put(&body, header);
+    nl_hashset_put(&body, bb);
+
+    TB_Node* init = iv->inputs[1 + entry];
+    TB_Node* bound = cmp->inputs[2];
+
+    Vectorizer v = {
+        .body = &body, .iv = iv,
+        .features = f->super.module->features.x64,
+        .ab = TB_NODE_GET_EXTRA_T(iv->inputs[1 + latch], TB_NodeBinopInt)->ab,
+    };
+    nl_map_create(v.chain, 8);
+
+    // the only effects are stores, anything else hanging off the control chain
+    // (besides the loads) means we don't know what's going on.
+    DynArray(TB_Node*) stores = NULL;
+    bool ok = loop_is_invariant(&body, bound, 0);
+    for (TB_Node* n = latch_br->inputs[0]; ok && n != bb; n = n->inputs[0]) {
+        if (n->type != TB_STORE) {
+            ok = false;
+            break;
+        }
+        dyn_array_put(stores, n);
+    }
+
+    size_t store_count = dyn_array_length(stores);
+    if (!ok || store_count == 0) {
+        goto fail;
+    }
+
+    FOREACH_N(i, 0, store_count / 2) {
+        SWAP(TB_Node*, stores[i], stores[store_count - 1 - i]);
+    }
+
+    FOREACH_N(i, 0, store_count + 1) {
+        TB_Node* n = i ? stores[i - 1] : bb;
+        TB_Node* next = i < store_count ? stores[i] : latch_br;
+        FOR_USERS(use, p, n) {
+            if (use->slot != 0 || (use->n != next && use->n->type != TB_LOAD)) goto fail;
+        }
+        nl_map_put(v.chain, n, i);
+    }
+
+    v.elem_size = vec_elem_size(stores[0]->inputs[2]->dt);
+    if (v.elem_size == 0) {
+        goto fail;
+    }
+
+    FOREACH_N(i, 0, store_count) {
+        if (!vec_array(&v, stores[i]->inputs[1], true) || !vec_check(&v, stores[i]->inputs[2], i + 1, 0)) goto fail;
+    }
+
+    int lanes = TB_VECTOR_BYTES / v.elem_size;
+    v.log2_lanes = tb_ffs(lanes) - 1;
+
+    DO_IF(TB_OPTDEBUG_LOOP)(printf("loop %p: vectorized by %d (%zu stores, %zu arrays)\n", header, lanes, store_count, v.base_count));
+
+    TB_Node* vpre  = vec_region(p, f, 1, "vec.pre");
+    TB_Node* vbody = vec_region(p, f, 2, "vec.body");
+    TB_Node* vrem  = vec_region(p, f, 2, "vec.rem");
+
+    // vend = init + ((n - init) & -VF)
+    TB_DataType dt = iv->dt;
+    TB_Node* trips = vec_binop(p, f, TB_SUB, dt, bound, init);
+    TB_Node* mask  = make_int_node(f, p, dt, (uint64_t) -lanes & lattice_int_mask(dt));
+    TB_Node* vend  = vec_binop(p, f, TB_ADD, dt, init, vec_binop(p, f, TB_AND, dt, trips, mask));
+
+    // init < n && VF <= n - init
+    TB_Node* guard = vec_cmp(p, f, cmp->type, dt, init, bound);
+    guard = vec_binop(p, f, TB_AND, TB_TYPE_BOOL, guard, vec_cmp(p, f, TB_CMP_ULE, dt, make_int_node(f, p, dt, lanes), trips));
+
+    // nothing we store into overlaps with the other arrays, the ranges are [init, vend)
+    TB_Node* lo[TB_VECTOR_MAX_BASES];
+    TB_Node* hi[TB_VECTOR_MAX_BASES];
+    FOREACH_N(i, 0, v.base_count) {
+        lo[i] = vec_array_at(p, f, &v, v.base_arr[i], init);
+        hi[i] = vec_array_at(p, f, &v, v.base_arr[i], vend);
+    }
+
+    FOREACH_N(i, 0, v.base_count) FOREACH_N(j, i + 1, v.base_count) {
+        if (!v.stored[i] && !v.stored[j]) continue;
+
+        TB_Node* below = vec_cmp(p, f, TB_CMP_ULE, TB_TYPE_PTR, hi[i], lo[j]);
+        TB_Node* above = vec_cmp(p, f, TB_CMP_ULE, TB_TYPE_PTR, hi[j], lo[i]);
+        guard = vec_binop(p, f, TB_AND, TB_TYPE_BOOL, guard, vec_binop(p, f, TB_OR, TB_TYPE_BOOL, below, above));
+    }
+
+    TB_Node* gbr = vec_branch(p, f, vpre, vpre, guard, vbody, vrem);
+
+    // vi = phi(init, vi + VF)
+    TB_Node* vi = tb_alloc_node(f, TB_PHI, dt, 3, 0);
+    TB_Node* vnext = vec_binop(p, f, TB_ADD, dt, vi, make_int_node(f, p, dt, lanes));
+    TB_NODE_SET_EXTRA(vnext, TB_NodeBinopInt, .ab = v.ab);
+    set_input(p, vi, vbody, 0);
+    set_input(p, vi, init, 1);
+    set_input(p, vi, vnext, 2);
+    tb_pass_mark(p, vi);
+    v.vi = vi;
+
+    InlineMap map = NULL;
+    nl_map_create(map, 32);
+    nl_map_put(map, bb, vbody);
+    nl_map_put(map, iv, vi);
+
+    FOREACH_N(i, 0, store_count) {
+        TB_Node* st = stores[i];
+        TB_Node* k = tb_alloc_node(f, TB_STORE, TB_TYPE_CONTROL, 3, sizeof(TB_NodeMemAccess));
+        set_input(p, k, inline_lookup(map, st->inputs[0]), 0);
+        set_input(p, k, vec_build(p, f, &v, &map, st->inputs[1]), 1);
+        set_input(p, k, vec_build(p, f, &v, &map, st->inputs[2]), 2);
+        memcpy(k->extra, st->extra, sizeof(TB_NodeMemAccess));
+        tb_pass_mark(p, k);
+        nl_map_put(map, st, k);
+    }
+
+    TB_Node* more = vec_cmp(p, f, TB_CMP_NE, dt, vnext, vend);
+    TB_Node* vbr = vec_branch(p, f, vbody, inline_lookup(map, stores[store_count - 1]), more, vbody, vrem);
+
+    set_input(p, vbody, vec_edge(p, f, gbr, 0, vbody), 0);
+    set_input(p, vbody, vec_edge(p, f, vbr, 0, vbody), 1);
+    set_input(p, vrem, vec_edge(p, f, gbr, 1, vrem), 0);
+    set_input(p, vrem, vec_edge(p, f, vbr, 1, vrem), 1);
+
+    // the scalar loop picks up where we left off
+    TB_Node* i0 = tb_alloc_node(f, TB_PHI, dt, 3, 0);
+    set_input(p, i0, vrem, 0);
+    set_input(p, i0, init, 1);
+    set_input(p, i0, vend, 2);
+    tb_pass_mark(p, i0);
+
+    TB_Node* rbr = vec_branch(p, f, vrem, vrem, NULL, header, NULL);
+
+    // the preheader goes into vec.pre now
+    int index = TB_NODE_GET_EXTRA_T(entry_proj, TB_NodeProj)->index;
+    TB_NODE_GET_EXTRA_T(entry_proj->inputs[0], TB_NodeBranch)->succ[index] = vpre;
+    set_input(p, vpre, entry_proj, 0);
+
+    set_input(p, header, make_proj_node(f, p, TB_TYPE_CONTROL, rbr, 0), entry);
+    set_input(p, iv, i0, 1 + entry);
+    tb_pass_mark(p, header);
+    tb_pass_mark(p, iv);
+
+    nl_map_free(map);
+    nl_map_free(v.chain);
+    dyn_array_destroy(stores);
+    nl_hashset_free(body);
+    return true;
+
+    fail:
+    nl_map_free(v.chain);
+    dyn_array_destroy(stores);
+    nl_hashset_free(body);
+    return false;
+}
+
+bool tb_pass_vectorize(TB_Passes* p) {
+    verify_tmp_arena(p);
+
+    TB_Function* f = p->f;
+    if (f->super.module->target_arch != TB_ARCH_X86_64) {
+        return false;
+    }
+
+    bool changes = false;
+    CUIK_TIMED_BLOCK("vectorize") {
+        NL_HashSet blocks = loop_reachable_blocks(p);
+
+        DynArray(TB_Node*) headers = NULL;
+        FOREACH_N(i, 0, p->order.count) {
+            if (loop_is_header(&blocks, p->order.traversal[i])) dyn_array_put(headers, p->order.traversal[i]);
+        }
+
+        // the new blocks need dominators before the next loop can look at them
+        dyn_array_for(i, headers) {
+            if (headers[i]->type == TB_REGION && loop_vectorize(p, f, &blocks, headers[i])) {
+                recompute_cfg(f, p);
+                nl_hashset_free(blocks);
+                blocks = loop_reachable_blocks(p);
+                changes = true;
+            }
+        }
+
+        dyn_array_destroy(headers);
+        nl_hashset_free(blocks);
+    }
+
+    return changes;
+}
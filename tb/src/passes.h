@@ -4,17 +4,29 @@
 #define TB_OPTDEBUG_PEEP 0
 #define TB_OPTDEBUG_LOOP 0
 #define TB_OPTDEBUG_MEM2REG 0
+#define TB_OPTDEBUG_INLINE 0
+#define TB_OPTDEBUG_SCCP 0
+#define TB_OPTDEBUG_GVN 0
+#define TB_OPTDEBUG_LAYOUT 0
+#define TB_OPTDEBUG_LTO 0
+#define TB_OPTDEBUG_PROFILE 0
 
 #define DO_IF(cond) CONCAT(DO_IF_, cond)
 #define DO_IF_0(...)
 #define DO_IF_1(...) __VA_ARGS__
 
-typedef struct User User;
-struct User {
-    User* next;
+typedef struct Lattice Lattice;
+
+typedef struct User {
     TB_Node* n;
     int slot;
-};
+} User;
+
+// all the users of a node, unordered (removals swap with the last)
+typedef struct {
+    uint32_t count, cap;
+    User* data;
+} UseList;
 
 struct TB_Passes {
     TB_Function* f;
@@ -24,7 +36,7 @@ struct TB_Passes {
     TB_ThreadInfo* pinned_thread;
 
     DynArray(TB_Node*) worklist;
-    NL_HashSet visited;
+    Set visited; // indexed by TB_Node.gvn
 
     TB_PostorderWalk order;
 
@@ -34,12 +46,22 @@ struct TB_Passes {
     // this is used to do CSE
     NL_HashSet cse_nodes;
 
+    // results from the last SCCP run, indexed by TB_Node.gvn. lattice_nodes
+    // tells us which nodes were actually part of the run.
+    size_t lattice_count;
+    TB_Node** lattice_nodes;
+    Lattice* lattice;
+
+    // set by tb_pass_loop, the scheduler will hoist loop invariant code
+    bool licm;
+
     // debug shit:
     TB_Node* error_n;
 
     // outgoing edges are incrementally updated every time we
-    // run a rewrite rule
-    NL_Map(TB_Node*, User*) users;
+    // run a rewrite rule, indexed by TB_Node.gvn
+    size_t users_cap;
+    UseList* users;
 };
 
 extern thread_local TB_Arena* tmp_arena;
@@ -47,6 +69,21 @@ extern thread_local TB_Arena* tmp_arena;
 void tb_pass_ensure_empty(TB_Passes* p);
 
 void verify_tmp_arena(TB_Passes* p);
-User* find_users(TB_Passes* restrict p, TB_Node* n);
 void set_input(TB_Passes* restrict p, TB_Node* n, TB_Node* in, int slot);
 
+static User* find_users(TB_Passes* restrict p, TB_Node* n) {
+    return n->gvn < p->users_cap ? p->users[n->gvn].data : NULL;
+}
+
+static size_t user_count(TB_Passes* restrict p, TB_Node* n) {
+    return n->gvn < p->users_cap ? p->users[n->gvn].count : 0;
+}
+
+// walks the newest users first, the body can't add or remove users of n (take
+// a copy first if you need to).
+#define FOR_USERS(u, p, n) \
+    for (User *u ## _first = find_users(p, n), *u = u ## _first ? u ## _first + user_count(p, n) : NULL; u != u ## _first && (--u, true);)
+
+// known bits of n from the last SCCP run, false if we don't know anything
+bool tb_pass_known_bits(TB_Passes* p, TB_Node* n, uint64_t* known_zeros, uint64_t* known_ones);
+
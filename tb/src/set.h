@@ -97,21 +97,25 @@ static ptrdiff_t set_pop_any(Set* s) {
     return -1;
 }
 
-static bool set_first_time(Set* s, size_t index) {
+static void set_grow(Set* s, size_t index) {
     size_t slots = (s->capacity + 63) / 64;
-    lldiv_t d = lldiv(index, 64);
 
-    if (d.quot >= slots) {
-        s->capacity = index * 2;
-        size_t new_slots = (s->capacity + 63) / 64;
+    s->capacity = (index + 1) * 2;
+    size_t new_slots = (s->capacity + 63) / 64;
 
-        s->data = realloc(s->data, new_slots * sizeof(uint64_t));
-        if (s->data == NULL) {
-            fprintf(stderr, "TB error: Set out of memory!");
-            abort();
-        }
+    s->data = tb_platform_heap_realloc(s->data, new_slots * sizeof(uint64_t));
+    if (s->data == NULL) {
+        fprintf(stderr, "TB error: Set out of memory!");
+        abort();
+    }
+
+    memset(s->data + slots, 0, (new_slots - slots) * sizeof(uint64_t));
+}
 
-        memset(s->data + slots, 0, (new_slots - slots) * sizeof(uint64_t));
+static bool set_first_time(Set* s, size_t index) {
+    lldiv_t d = lldiv(index, 64);
+    if (index >= s->capacity) {
+        set_grow(s, index);
     }
 
     if ((s->data[d.quot] & (1ull << d.rem)) == 0) {
@@ -124,17 +128,8 @@ static bool set_first_time(Set* s, size_t index) {
 
 static void set_put(Set* s, size_t index) {
     lldiv_t d = lldiv(index, 64);
-    if (d.quot >= s->capacity) {
-        size_t old = s->capacity;
-
-        s->capacity = d.quot * 2;
-        s->data = realloc(s->data, s->capacity * sizeof(uint64_t));
-        if (s->data == NULL) {
-            fprintf(stderr, "TB error: Set out of memory!");
-            abort();
-        }
-
-        memset(s->data + old, 0, (s->capacity - old) * sizeof(uint64_t));
+    if (index >= s->capacity) {
+        set_grow(s, index);
     }
 
     s->data[d.quot] |= (1ull << d.rem);
@@ -142,14 +137,14 @@ static void set_put(Set* s, size_t index) {
 
 static void set_remove(Set* s, size_t index) {
     lldiv_t d = lldiv(index, 64);
-    if (d.quot < s->capacity) {
+    if (index < s->capacity) {
         s->data[d.quot] &= ~(1ull << d.rem);
     }
 }
 
 static bool set_get(Set* s, size_t index) {
     lldiv_t d = lldiv(index, 64);
-    if (d.quot >= s->capacity) {
+    if (index >= s->capacity) {
         return false;
     }
 
@@ -9,23 +9,35 @@ TB_ThreadInfo* tb_thread_info(TB_Module* m) {
     // we can't assume the user has merely on TB_Module
     // per thread.
     TB_ThreadInfo* info = chain;
+    TB_ThreadInfo* dead = NULL;
     while (info != NULL) {
-        if (info->owner == m) {
+        TB_Module* owner = atomic_load_explicit(&info->owner, memory_order_acquire);
+        if (owner == m) {
             return info;
+        } else if (owner == NULL && dead == NULL) {
+            dead = info;
         }
         info = info->next;
     }
 
-    info = tb_platform_heap_alloc(sizeof(TB_ThreadInfo));
-    *info = (TB_ThreadInfo){ .owner = m };
+    if (dead != NULL) {
+        // recycle one from a destroyed module, it's already on our chain
+        info = dead;
+        info->next_in_module = NULL;
+        info->code = NULL;
+        atomic_store_explicit(&info->owner, m, memory_order_relaxed);
+    } else {
+        info = tb_platform_heap_alloc(sizeof(TB_ThreadInfo));
+        *info = (TB_ThreadInfo){ .owner = m };
 
-    // add new thread info
-    tb_arena_create(&info->perm_arena, TB_ARENA_LARGE_CHUNK_SIZE);
-    tb_arena_create(&info->tmp_arena, TB_ARENA_LARGE_CHUNK_SIZE);
+        // thread local so it doesn't need to synchronize
+        info->next = chain;
+        chain = info;
+    }
 
-    // thread local so it doesn't need to synchronize
-    info->next = chain;
-    chain = info;
+    // add new thread info
+    tb_arena_create(&info->perm_arena, TB_ARENA_LARGE_CHUNK_SIZE, "tb perm");
+    tb_arena_create(&info->tmp_arena, TB_ARENA_LARGE_CHUNK_SIZE, "tb tmp");
 
     // link to the TB_Module* (we need to this to free later)
     TB_ThreadInfo* old_top;
@@ -101,7 +113,11 @@ TB_Module* tb_module_create(TB_Arch arch, TB_System sys, const TB_FeatureSet* fe
     }
     memset(m, 0, sizeof(TB_Module));
 
+    // never 0 so it can't match a fresh thread's cache
+    static _Atomic uint64_t next_uid = 1;
+    m->uid = atomic_fetch_add(&next_uid, 1);
     m->is_jit = is_jit;
+    m->isel_mode = TB_ISEL_COMPLEX;
 
     m->target_abi = (sys == TB_SYSTEM_WINDOWS) ? TB_ABI_WIN64 : TB_ABI_SYSTEMV;
     m->target_arch = arch;
@@ -154,13 +170,24 @@ TB_FunctionOutput* tb_pass_codegen(TB_Passes* p, bool emit_asm) {
     TB_FunctionOutput* func_out = (TB_FunctionOutput*) &region->data[region->size];
     region->size += sizeof(TB_FunctionOutput);
 
+    // the cache doesn't keep the assembly listing around
+    TB_CacheKey* key = m->codegen_cache != NULL && !emit_asm ? tb__cg_cache_key(f) : NULL;
+
     CUIK_TIMED_BLOCK_ARGS("compile", f->super.name) {
         *func_out = (TB_FunctionOutput){ .parent = f, .linkage = f->linkage, .code_region = region };
 
-        uint8_t* local_buffer = &region->data[region->size];
-        size_t local_capacity = region->capacity - region->size;
-
-        code_gen->compile_function(p, func_out, &m->features, local_buffer, local_capacity, emit_asm);
+        if (key != NULL && tb__cg_cache_load(m, key, func_out, region)) {
+            atomic_fetch_add(&m->codegen_cache_hits, 1);
+        } else {
+            uint8_t* local_buffer = &region->data[region->size];
+            size_t local_capacity = region->capacity - region->size;
+
+            code_gen->compile_function(p, func_out, &m->features, local_buffer, local_capacity, emit_asm);
+            if (key != NULL) {
+                atomic_fetch_add(&m->codegen_cache_misses, 1);
+                tb__cg_cache_store(m, key, func_out);
+            }
+        }
 
         // if the func_out is placed into a different region, let's abide by that
         if (func_out->code_region != region) {
@@ -171,6 +198,10 @@ TB_FunctionOutput* tb_pass_codegen(TB_Passes* p, bool emit_asm) {
         }
     }
 
+    if (key != NULL) {
+        tb__cg_cache_free(key);
+    }
+
     atomic_fetch_add(&m->compiled_function_count, 1);
     region->size += func_out->code_size;
 
@@ -198,6 +229,10 @@ TB_API TB_Arena* tb_function_get_arena(TB_Function* f) {
     return f->arena;
 }
 
+TB_API size_t tb_function_get_node_count(TB_Function* f) {
+    return f->node_count;
+}
+
 size_t tb_module_get_function_count(TB_Module* m) {
     return m->symbol_count[TB_SYMBOL_FUNCTION];
 }
@@ -229,7 +264,10 @@ void tb_module_destroy(TB_Module* m) {
 
         tb_arena_destroy(&info->tmp_arena);
         tb_arena_destroy(&info->perm_arena);
-        tb_platform_heap_free(info);
+
+        // NOTE(NeGate): we can't free the info itself, it's still linked into
+        // the thread local chain of whichever thread made it.
+        atomic_store_explicit(&info->owner, NULL, memory_order_release);
         info = next;
     }
 
@@ -238,10 +276,20 @@ void tb_module_destroy(TB_Module* m) {
 }
 
 TB_SourceFile* tb_get_source_file(TB_Module* m, const char* path) {
+    // most lookups are for the same file as the last one, the module ID is
+    // used since the TB_Module* could be reused after a destroy.
+    static thread_local uint64_t last_uid;
+    static thread_local TB_SourceFile* last_file;
+
+    size_t len = strlen(path);
+    if (last_uid == m->uid && last_file->len == len && memcmp(last_file->path, path, len) == 0) {
+        return last_file;
+    }
+
     mtx_lock(&m->lock);
 
     NL_Slice key = {
-        .length = strlen(path),
+        .length = len,
         .data = (const uint8_t*) path,
     };
 
@@ -253,6 +301,7 @@ TB_SourceFile* tb_get_source_file(TB_Module* m, const char* path) {
         file->len = key.length;
 
         memcpy(file->path, key.data, key.length);
+        file->path[key.length] = 0;
         key.data = file->path;
 
         nl_map_put(m->files, key, file);
@@ -260,6 +309,9 @@ TB_SourceFile* tb_get_source_file(TB_Module* m, const char* path) {
         file = m->files[search].v;
     }
     mtx_unlock(&m->lock);
+
+    last_uid = m->uid;
+    last_file = file;
     return file;
 }
 
@@ -300,7 +352,7 @@ void tb_function_set_prototype(TB_Function* f, TB_FunctionPrototype* p, TB_Arena
 
     if (arena == NULL) {
         f->arena = tb_platform_heap_alloc(sizeof(TB_Arena));
-        tb_arena_create(f->arena, TB_ARENA_SMALL_CHUNK_SIZE);
+        tb_arena_create(f->arena, TB_ARENA_SMALL_CHUNK_SIZE, "tb function");
     } else {
         f->arena = arena;
     }
@@ -449,6 +501,10 @@ void tb_module_set_tls_index(TB_Module* m, ptrdiff_t len, const char* name) {
     }
 }
 
+void tb_module_set_isel_mode(TB_Module* m, TB_ISelMode mode) {
+    m->isel_mode = mode;
+}
+
 void tb_symbol_bind_ptr(TB_Symbol* s, void* ptr) {
     s->address = ptr;
 }
@@ -95,21 +95,23 @@ static void* alloc_from_node_arena(TB_Function* f, size_t necessary_size) {
 
 TB_Node* tb_alloc_node(TB_Function* f, int type, TB_DataType dt, int input_count, size_t extra) {
     assert(input_count < UINT16_MAX && "too many inputs!");
-    f->node_count += 1;
-
     if (type == TB_REGION) {
         f->control_node_count += 1;
     }
 
-    TB_Node* n = alloc_from_node_arena(f, sizeof(TB_Node) + extra);
+    // the inputs live right after the extra data, only nodes which grow
+    // later (phis and regions) will move them out of line.
+    size_t inputs_offset = tb_node_inputs_offset(extra);
+    TB_Node* n = alloc_from_node_arena(f, sizeof(TB_Node) + inputs_offset + input_count*sizeof(TB_Node*));
     n->type = type;
     n->dt = dt;
     n->input_count = input_count;
     n->extra_count = extra;
+    n->gvn = f->node_count++;
     n->attribs = NULL;
 
     if (input_count > 0) {
-        n->inputs = alloc_from_node_arena(f, input_count * sizeof(TB_Node*));
+        n->inputs = (TB_Node**) &n->extra[inputs_offset];
         memset(n->inputs, 0, input_count * sizeof(TB_Node*));
     } else {
         n->inputs = NULL;
@@ -409,7 +411,7 @@ TB_Node* tb_inst_safepoint(TB_Function* f, TB_Node* poke_site, size_t param_coun
 }
 
 TB_Node* tb_inst_syscall(TB_Function* f, TB_DataType dt, TB_Node* syscall_num, size_t param_count, TB_Node** params) {
-    TB_Node* n = tb_alloc_node(f, TB_SYSCALL, TB_TYPE_TUPLE, 2 + param_count, sizeof(TB_NodeCall) + sizeof(TB_Node*));
+    TB_Node* n = tb_alloc_node(f, TB_SYSCALL, TB_TYPE_TUPLE, 2 + param_count, sizeof(TB_NodeCall) + 2*sizeof(TB_Node*));
     n->inputs[0] = f->active_control_node;
     n->inputs[1] = syscall_num;
     memcpy(n->inputs, params, param_count * sizeof(TB_Node*));
@@ -746,6 +748,13 @@ TB_Node* tb_inst_fdiv(TB_Function* f, TB_Node* a, TB_Node* b) {
     return tb_bin_farith(f, TB_FDIV, a, b);
 }
 
+TB_Node* tb_inst_vbroadcast(TB_Function* f, TB_Node* src, int log2_lanes) {
+    assert(src->dt.width == 0 && log2_lanes > 0);
+    assert(src->dt.type == TB_INT || src->dt.type == TB_FLOAT);
+
+    return tb_unary(f, TB_VBROADCAST, TB_TYPE_VEC(src->dt, log2_lanes), src);
+}
+
 TB_Node* tb_inst_va_start(TB_Function* f, TB_Node* a) {
     assert(a->type == TB_LOCAL);
 
@@ -924,6 +933,10 @@ void tb_inst_goto(TB_Function* f, TB_Node* target) {
 }
 
 void tb_inst_if(TB_Function* f, TB_Node* cond, TB_Node* if_true, TB_Node* if_false) {
+    tb_inst_if_hint(f, cond, if_true, if_false, TB_BRANCH_HINT_NONE);
+}
+
+void tb_inst_if_hint(TB_Function* f, TB_Node* cond, TB_Node* if_true, TB_Node* if_false, TB_BranchHint hint) {
     // generate control projections
     TB_Node* n = tb_alloc_node(f, TB_BRANCH, TB_TYPE_TUPLE, 2, sizeof(TB_NodeBranch) + sizeof(int64_t));
     n->inputs[0] = f->active_control_node; // control edge
@@ -942,6 +955,13 @@ void tb_inst_if(TB_Function* f, TB_Node* cond, TB_Node* if_true, TB_Node* if_fal
     TB_NodeBranch* br = TB_NODE_GET_EXTRA(n);
     br->keys[0] = 0;
 
+    if (hint != TB_BRANCH_HINT_NONE) {
+        float p = hint == TB_BRANCH_HINT_LIKELY ? TB_PROB_LIKELY : 1.0f - TB_PROB_LIKELY;
+        br->probs = alloc_from_node_arena(f, 2 * sizeof(float));
+        br->probs[0] = p;
+        br->probs[1] = 1.0f - p;
+    }
+
     TB_Node** succ = add_successors(f, n, 2);
     succ[0] = if_true;
     succ[1] = if_false;
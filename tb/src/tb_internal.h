@@ -295,6 +295,17 @@ typedef struct TB_FunctionOutput {
     TB_SymbolPatch* last_patch;
 } TB_FunctionOutput;
 
+// frozen copy of a function's graph made by tb_module_inline, callers clone from
+// this since the real graph might be getting mutated by the callee's own passes.
+typedef struct TB_InlineBody {
+    TB_Node* start;
+    TB_Node* stop;
+
+    size_t cost;
+    size_t node_count;
+    TB_Node** nodes;
+} TB_InlineBody;
+
 struct TB_Function {
     TB_Symbol super;
     TB_Linkage linkage;
@@ -312,8 +323,16 @@ struct TB_Function {
 
     TB_Node* active_control_node;
 
+    // NULL unless the last tb_module_inline decided we're worth inlining
+    TB_InlineBody* inline_body;
+
+    // cold functions get placed after the rest of the code
+    TB_Heat heat;
+
     size_t safepoint_count;
     size_t control_node_count;
+
+    // next TB_Node.gvn, tb_pass_enter compacts them down to the live nodes
     size_t node_count;
 
     // IR allocation
@@ -336,7 +355,9 @@ struct TB_Function {
 // Thread local module state
 typedef struct TB_ThreadInfo TB_ThreadInfo;
 struct TB_ThreadInfo {
-    TB_Module* owner;
+    // NULL once the module is destroyed, the info stays on the thread's
+    // chain (other threads can't unlink it) and gets reused for the next module.
+    _Atomic(TB_Module*) owner;
     TB_ThreadInfo* next;
     TB_ThreadInfo* next_in_module;
 
@@ -387,6 +408,8 @@ typedef struct {
 } SmallConst;
 
 struct TB_Module {
+    // unique for the whole run, unlike the pointer
+    uint64_t uid;
     bool is_jit;
 
     atomic_flag is_tls_defined;
@@ -415,6 +438,20 @@ struct TB_Module {
     size_t comdat_function_count; // compiled function count
     _Atomic size_t compiled_function_count;
 
+    TB_ISelMode isel_mode;
+
+    // tb_module_profile_instrument: the counters and the raw profile header
+    // that goes in front of them.
+    TB_Global* profile_counters;
+    size_t profile_meta_size;
+    uint8_t* profile_meta;
+    // tb_module_profile_use found something
+    bool has_profile;
+
+    // directory for the function-level codegen cache (NULL if disabled)
+    char* codegen_cache;
+    _Atomic size_t codegen_cache_hits, codegen_cache_misses;
+
     // symbol table
     _Atomic size_t symbol_count[TB_SYMBOL_MAX];
     _Atomic(TB_Symbol*) first_symbol_of_tag[TB_SYMBOL_MAX];
@@ -595,6 +632,7 @@ typedef struct {
 } TB_PostorderWalk;
 
 void tb_compute_dominators(TB_Function* f, TB_PostorderWalk order);
+TB_API bool tb_is_dominated_by(TB_Node* expected_dom, TB_Node* bb);
 
 // Allocates from the heap and requires freeing with tb_function_free_postorder
 TB_API TB_PostorderWalk tb_function_get_postorder(TB_Function* f);
@@ -620,8 +658,21 @@ inline static bool tb_is_power_of_two(uint64_t x) {
 #define TB_UNLIKELY(x) __builtin_expect(!!(x), 0)
 #endif
 
+// probability of the true case on a branch hinted as likely (the same as
+// the builtin expect in most compilers, it's supposed to be really strong)
+#define TB_PROB_LIKELY 0.98f
+
 TB_Node* tb_alloc_node(TB_Function* f, int type, TB_DataType dt, int input_count, size_t extra);
 
+// where the inline inputs start relative to TB_Node.extra
+static size_t tb_node_inputs_offset(size_t extra) {
+    return (extra + sizeof(TB_Node*) - 1) & ~(sizeof(TB_Node*) - 1);
+}
+
+static size_t tb_node_size(TB_Node* n) {
+    return sizeof(TB_Node) + tb_node_inputs_offset(n->extra_count) + n->input_count*sizeof(TB_Node*);
+}
+
 ////////////////////////////////
 // EXPORTER HELPER
 ////////////////////////////////
@@ -652,6 +703,15 @@ uint64_t tb__sxt(uint64_t src, uint64_t src_bits, uint64_t dst_bits);
 
 char* tb__tb_arena_strdup(TB_Module* m, ptrdiff_t len, const char* src);
 
+// codegen cache (codegen_cache.c), the key is NULL if the function can't be cached.
+// loading fills in the function output with the code placed at the end of the region
+// (or a new region if it doesn't fit).
+typedef struct TB_CacheKey TB_CacheKey;
+TB_CacheKey* tb__cg_cache_key(TB_Function* f);
+bool tb__cg_cache_load(TB_Module* m, TB_CacheKey* k, TB_FunctionOutput* out, TB_CodeRegion* region);
+bool tb__cg_cache_store(TB_Module* m, TB_CacheKey* k, TB_FunctionOutput* out);
+void tb__cg_cache_free(TB_CacheKey* k);
+
 static TB_Arena* get_temporary_arena(TB_Module* m) {
     return &tb_thread_info(m)->tmp_arena;
 }
@@ -0,0 +1,319 @@
+// Local register allocator for TB_ISEL_FAST
+//
+// there's no liveness or live intervals here, it's one forward walk over the
+// instructions which allocates every block on its own. Values which cross blocks
+// live in their stack slot and only visit registers in between (reloaded on the
+// first use, written back before the block's jumps), the ones which never leave the
+// block just sit in registers unless we run out. It only hands out the caller saved
+// registers so the prologue never has to save anything.
+enum {
+    FAST_GLOBAL = 1, // seen in more than one block (or used before defined)
+    FAST_DIRTY  = 2, // the register has a newer value than the stack slot
+};
+
+typedef struct {
+    DynArray(LiveInterval) intervals;
+    int stack_usage;
+
+    // new instructions go after this one
+    Inst* prev;
+
+    // per virtual register
+    int* block;
+    int* uses; // remaining uses, only meaningful for the block-local values
+    int* reg;  // -1 if it's not in a register
+    uint8_t* flags;
+
+    // per physical register
+    int owner[CG_REGISTER_CLASSES][16];
+    uint32_t pool[CG_REGISTER_CLASSES];  // the registers we're allowed to hand out
+    uint32_t fixed[CG_REGISTER_CLASSES]; // written by the isel, waiting to be read
+} FastRA;
+
+static bool fast_is_phys(FastRA* restrict ra, RegIndex r) {
+    return ra->intervals[r].reg >= 0;
+}
+
+static void fast_move(FastRA* restrict ra, TB_X86_DataType dt, RegIndex dst, RegIndex src) {
+    Inst* inst = tb_arena_alloc(tmp_arena, sizeof(Inst) + (2 * sizeof(RegIndex)));
+    *inst = (Inst){ .type = MOV, .flags = INST_SPILL, .dt = dt, .out_count = 1, 1 };
+    inst->operands[0] = dst;
+    inst->operands[1] = src;
+    inst->time = ra->prev->time;
+    inst->next = ra->prev->next;
+    ra->prev->next = inst;
+    ra->prev = inst;
+}
+
+// the virtual register's interval doubles as its home slot
+static RegIndex fast_home(FastRA* restrict ra, RegIndex v) {
+    LiveInterval* it = &ra->intervals[v];
+    if (it->spill <= 0) {
+        int size = spill_size(it->dt);
+        ra->stack_usage = align_up(ra->stack_usage + size, size);
+        it->spill = ra->stack_usage;
+    }
+    return v;
+}
+
+static void fast_evict(FastRA* restrict ra, int rc, int r) {
+    RegIndex v = ra->owner[rc][r];
+    if (v < 0) return;
+
+    bool needed = (ra->flags[v] & FAST_GLOBAL) || ra->uses[v] > 0;
+    if ((ra->flags[v] & FAST_DIRTY) && needed) {
+        REG_ALLOC_LOG printf("  #   v%d: spill %s\n", v, reg_name(rc, r));
+        fast_move(ra, ra->intervals[v].dt, fast_home(ra, v), (rc ? FIRST_XMM : FIRST_GPR) + r);
+    }
+
+    ra->flags[v] &= ~FAST_DIRTY;
+    ra->reg[v] = -1;
+    ra->owner[rc][r] = -1;
+}
+
+static void fast_free(FastRA* restrict ra, RegIndex v) {
+    int r = ra->reg[v];
+    if (r >= 0) {
+        ra->owner[ra->intervals[v].reg_class][r] = -1;
+        ra->reg[v] = -1;
+    }
+}
+
+// write back everything the other blocks might read
+static void fast_flush(FastRA* restrict ra) {
+    FOREACH_N(rc, 0, CG_REGISTER_CLASSES) FOREACH_N(r, 0, 16) {
+        RegIndex v = ra->owner[rc][r];
+        if (v >= 0 && (ra->flags[v] & (FAST_GLOBAL | FAST_DIRTY)) == (FAST_GLOBAL | FAST_DIRTY)) {
+            fast_move(ra, ra->intervals[v].dt, fast_home(ra, v), (rc ? FIRST_XMM : FIRST_GPR) + r);
+            ra->flags[v] &= ~FAST_DIRTY;
+        }
+    }
+}
+
+static int fast_pick(FastRA* restrict ra, int rc, uint32_t blocked) {
+    uint32_t avail = ra->pool[rc] & ~ra->fixed[rc] & ~blocked;
+
+    // empty registers first, then the clean ones since they don't need a store
+    FOREACH_N(r, 0, 16) if ((avail >> r) & 1) {
+        if (ra->owner[rc][r] < 0) return r;
+    }
+
+    FOREACH_N(r, 0, 16) if ((avail >> r) & 1) {
+        if ((ra->flags[ra->owner[rc][r]] & FAST_DIRTY) == 0) {
+            fast_evict(ra, rc, r);
+            return r;
+        }
+    }
+
+    FOREACH_N(r, 0, 16) if ((avail >> r) & 1) {
+        fast_evict(ra, rc, r);
+        return r;
+    }
+
+    tb_panic("fast regalloc: ran out of registers");
+}
+
+static void fast_assign(FastRA* restrict ra, RegIndex v, int r) {
+    ra->owner[ra->intervals[v].reg_class][r] = v;
+    ra->reg[v] = r;
+}
+
+static int fast_regalloc(Ctx* restrict ctx, TB_Function* f, int stack_usage) {
+    FastRA ra = { .intervals = ctx->intervals, .stack_usage = stack_usage };
+    size_t interval_count = dyn_array_length(ra.intervals);
+
+    uint64_t callee_saved[CG_REGISTER_CLASSES];
+    mark_callee_saved_constraints(ctx, callee_saved);
+    FOREACH_N(rc, 0, CG_REGISTER_CLASSES) {
+        ra.pool[rc] = ~callee_saved[rc] & 0xFFFF;
+    }
+    ra.pool[REG_CLASS_GPR] &= ~((1u << RSP) | (1u << RBP));
+    memset(ra.owner, 0xFF, sizeof(ra.owner));
+
+    ra.block = tb_arena_alloc(tmp_arena, interval_count * sizeof(int));
+    ra.uses  = tb_arena_alloc(tmp_arena, interval_count * sizeof(int));
+    ra.reg   = tb_arena_alloc(tmp_arena, interval_count * sizeof(int));
+    ra.flags = tb_arena_alloc(tmp_arena, interval_count * sizeof(uint8_t));
+    FOREACH_N(i, 0, interval_count) {
+        ra.block[i] = -1, ra.uses[i] = 0, ra.reg[i] = -1, ra.flags[i] = 0;
+    }
+
+    // find which values never leave their block, anything used before it's
+    // defined is coming around a backedge so it counts as leaving.
+    CUIK_TIMED_BLOCK("classify") {
+        int block = 0;
+        for (Inst* inst = ctx->first; inst; inst = inst->next) {
+            if (inst->type == INST_LABEL) {
+                block++;
+                continue;
+            }
+
+            int in_start = inst->out_count, in_end = inst->out_count + inst->in_count;
+            FOREACH_N(i, 0, in_end + inst->tmp_count) {
+                RegIndex v = inst->operands[i];
+                if (fast_is_phys(&ra, v)) continue;
+
+                bool is_use = i >= in_start && i < in_end;
+                if (ra.block[v] < 0) {
+                    ra.block[v] = block;
+                    if (is_use) ra.flags[v] |= FAST_GLOBAL;
+                } else if (ra.block[v] != block) {
+                    ra.flags[v] |= FAST_GLOBAL;
+                }
+
+                if (is_use) ra.uses[v] += 1;
+            }
+        }
+    }
+
+    CUIK_TIMED_BLOCK("allocate") {
+        Inst* prev = NULL;
+        for (Inst* inst = ctx->first; inst; prev = inst, inst = inst->next) {
+            ra.prev = prev;
+
+            if (inst->type == INST_LABEL) {
+                // fallthrough from the previous block, then everything starts over
+                if (prev != NULL) {
+                    fast_flush(&ra);
+                }
+
+                FOREACH_N(rc, 0, CG_REGISTER_CLASSES) {
+                    FOREACH_N(r, 0, 16) if (ra.owner[rc][r] >= 0) {
+                        fast_free(&ra, ra.owner[rc][r]);
+                    }
+                    ra.fixed[rc] = 0;
+                }
+                continue;
+            }
+
+            if (inst->type >= JMP && inst->type <= JG) {
+                fast_flush(&ra);
+                continue;
+            }
+
+            RegIndex* ops = inst->operands;
+            int out_end = inst->out_count;
+            int in_end = out_end + inst->in_count;
+            int tmp_end = in_end + inst->tmp_count;
+
+            // physical registers written by this instruction, the inputs can't go there
+            uint32_t writes[CG_REGISTER_CLASSES] = { 0 };
+            uint32_t clobbers[CG_REGISTER_CLASSES] = { 0 };
+            FOREACH_N(i, 0, tmp_end) if ((i < out_end || i >= in_end) && fast_is_phys(&ra, ops[i])) {
+                LiveInterval* it = &ra.intervals[ops[i]];
+                if (i < out_end) writes[it->reg_class] |= 1u << it->reg;
+                clobbers[it->reg_class] |= 1u << it->reg;
+            }
+
+            // inputs
+            uint32_t used[CG_REGISTER_CLASSES] = { 0 };
+            uint32_t reads[CG_REGISTER_CLASSES] = { 0 };
+            int lhs_reg = -1, lhs_vreg = -1;
+            FOREACH_N(i, out_end, in_end) {
+                RegIndex v = ops[i];
+                LiveInterval* it = &ra.intervals[v];
+                int rc = it->reg_class;
+
+                if (it->reg >= 0) {
+                    used[rc] |= 1u << it->reg;
+                    reads[rc] |= 1u << it->reg;
+                    continue;
+                }
+
+                int r = ra.reg[v];
+                if (r < 0) {
+                    r = fast_pick(&ra, rc, used[rc] | writes[rc]);
+                    fast_move(&ra, it->dt, (rc ? FIRST_XMM : FIRST_GPR) + r, fast_home(&ra, v));
+                    fast_assign(&ra, v, r);
+                }
+
+                if (i == out_end) {
+                    lhs_reg = r, lhs_vreg = v;
+                }
+
+                used[rc] |= 1u << r;
+                ra.uses[v] -= 1;
+                ops[i] = (rc ? FIRST_XMM : FIRST_GPR) + r;
+            }
+
+            // the physical inputs have been read
+            FOREACH_N(rc, 0, CG_REGISTER_CLASSES) {
+                ra.fixed[rc] &= ~reads[rc];
+            }
+
+            // save anything living in the registers which get stomped on
+            FOREACH_N(rc, 0, CG_REGISTER_CLASSES) FOREACH_N(r, 0, 16) if ((clobbers[rc] >> r) & 1) {
+                fast_evict(&ra, rc, r);
+            }
+
+            // the block-local inputs might've died here
+            FOREACH_N(rc, 0, CG_REGISTER_CLASSES) FOREACH_N(r, 0, 16) if ((used[rc] >> r) & 1) {
+                RegIndex v = ra.owner[rc][r];
+                if (v >= 0 && (ra.flags[v] & FAST_GLOBAL) == 0 && ra.uses[v] <= 0) {
+                    fast_free(&ra, v);
+                }
+            }
+
+            // outputs, only the first input is allowed to share a register with
+            // them since x86 ops read it as the destination anyways.
+            uint32_t defined[CG_REGISTER_CLASSES] = { 0 };
+            FOREACH_N(i, 0, out_end) {
+                RegIndex v = ops[i];
+                LiveInterval* it = &ra.intervals[v];
+                int rc = it->reg_class;
+
+                if (it->reg >= 0) {
+                    ra.fixed[rc] |= 1u << it->reg;
+                    continue;
+                }
+
+                uint32_t blocked = used[rc] | writes[rc] | clobbers[rc] | defined[rc];
+                int r = ra.reg[v];
+                if (r >= 0 && (blocked >> r) & 1 && !(r == lhs_reg && v == lhs_vreg)) {
+                    fast_free(&ra, v);
+                    r = -1;
+                }
+
+                if (r < 0) {
+                    uint32_t taken = writes[rc] | clobbers[rc] | defined[rc];
+                    if (lhs_reg >= 0 && ra.intervals[lhs_vreg].reg_class == rc && ra.owner[rc][lhs_reg] < 0 && !((taken >> lhs_reg) & 1)) {
+                        r = lhs_reg;
+                    } else {
+                        r = fast_pick(&ra, rc, blocked);
+                    }
+
+                    // partial writes (SETcc) need the rest of the old value
+                    if (inst->dt < it->dt && it->spill > 0 && rc == REG_CLASS_GPR) {
+                        fast_move(&ra, it->dt, (rc ? FIRST_XMM : FIRST_GPR) + r, v);
+                    }
+                    fast_assign(&ra, v, r);
+                }
+
+                ra.flags[v] |= FAST_DIRTY;
+                defined[rc] |= 1u << r;
+                ops[i] = (rc ? FIRST_XMM : FIRST_GPR) + r;
+            }
+
+            // temporaries just need a register for the instruction
+            FOREACH_N(i, in_end, tmp_end) if (!fast_is_phys(&ra, ops[i])) {
+                RegIndex v = ops[i];
+                int rc = ra.intervals[v].reg_class;
+                int r = fast_pick(&ra, rc, used[rc] | writes[rc] | clobbers[rc] | defined[rc]);
+
+                defined[rc] |= 1u << r;
+                ops[i] = (rc ? FIRST_XMM : FIRST_GPR) + r;
+            }
+
+            // dead definitions don't need to stick around
+            FOREACH_N(rc, 0, CG_REGISTER_CLASSES) FOREACH_N(r, 0, 16) if ((defined[rc] >> r) & 1) {
+                RegIndex v = ra.owner[rc][r];
+                if (v >= 0 && (ra.flags[v] & FAST_GLOBAL) == 0 && ra.uses[v] <= 0) {
+                    fast_free(&ra, v);
+                }
+            }
+        }
+    }
+
+    ctx->intervals = ra.intervals;
+    return ra.stack_usage;
+}
@@ -77,8 +77,8 @@ typedef struct {
     TB_Passes* p;
 
     // Scheduling
-    NL_HashSet* visited; // reusing the TB_Passes one.
-    int* uses;           // the indices match the visited set.
+    Set* visited; // reusing the TB_Passes one.
+    int* uses;    // indexed by TB_Node.gvn
 
     // Regalloc
     DynArray(LiveInterval) intervals;
@@ -128,6 +128,7 @@ static bool is_terminator(int type);
 static bool wont_spill_around(int type);
 static int classify_reg_class(TB_DataType dt);
 static int isel(Ctx* restrict ctx, TB_Node* n);
+static int liveness(Ctx* restrict ctx, TB_Function* f);
 
 static void emit_code(Ctx* restrict ctx, TB_FunctionOutput* restrict func_out);
 static void mark_callee_saved_constraints(Ctx* restrict ctx, uint64_t callee_saved[CG_REGISTER_CLASSES]);
@@ -242,7 +243,7 @@ static Inst* inst_move(TB_DataType dt, RegIndex dst, RegIndex src) {
     int machine_dt = legalize(dt);
 
     Inst* i = tb_arena_alloc(tmp_arena, sizeof(Inst) + (2 * sizeof(RegIndex)));
-    *i = (Inst){ .type = machine_dt >= TB_X86_TYPE_SSE_SS ? FP_MOV : MOV, .dt = machine_dt, .out_count = 1, 1 };
+    *i = (Inst){ .type = machine_dt >= TB_X86_TYPE_PBYTE ? FP_MOV : MOV, .dt = machine_dt, .out_count = 1, 1 };
     i->operands[0] = dst;
     i->operands[1] = src;
     return i;
@@ -379,6 +380,9 @@ static Inst* inst_op_zero(TB_DataType dt, RegIndex dst) {
 // Register allocation
 ////////////////////////////////
 #include "reg_alloc.h"
+#include "fast_alloc.h"
+#include "../codegen/layout.h"
+#include "graph_alloc.h"
 
 #define DEF(n, dt) alloc_vreg(ctx, n, dt)
 static int alloc_vreg(Ctx* restrict ctx, TB_Node* n, TB_DataType dt) {
@@ -470,73 +474,58 @@ static int liveness(Ctx* restrict ctx, TB_Function* f) {
     }
 
     // generate global live sets
-    DynArray(TB_Node*) worklist = dyn_array_create(TB_Node*, ctx->order.count);
-
-    // all nodes go into the worklist
-    FOREACH_N(i, 0, ctx->order.count) {
-        dyn_array_put(worklist, ctx->order.traversal[i]);
-    }
-
+    //
+    // it's a backwards problem so we walk in postorder (successors before
+    // predecessors) until nothing changes, with a worklist the big loops kept
+    // getting walked once for every predecessor that changed.
     Set tmp_out = set_create_in_arena(arena, interval_count);
-    while (dyn_array_length(worklist)) CUIK_TIMED_BLOCK("global iter") {
-        TB_Node* bb = dyn_array_pop(worklist);
-        TB_NodeRegion* r = TB_NODE_GET_EXTRA(bb);
-        MachineBB* mbb = &nl_map_get_checked(seq_bb, bb);
-
-        // walk all successors
-        set_clear(&tmp_out);
-        if (r->end->type == TB_BRANCH) {
-            TB_NodeBranch* br = TB_NODE_GET_EXTRA(r->end);
-            FOREACH_N(i, 0, br->succ_count) {
-                // union with successor's lives
-                MachineBB* succ = &nl_map_get_checked(seq_bb, br->succ[i]);
-                set_union(&tmp_out, &succ->live_in);
+    CUIK_TIMED_BLOCK("global iter") for (bool changes = true; changes;) {
+        changes = false;
+
+        FOREACH_N(j, 0, ctx->order.count) {
+            TB_Node* bb = ctx->order.traversal[j];
+            TB_NodeRegion* r = TB_NODE_GET_EXTRA(bb);
+            MachineBB* mbb = &nl_map_get_checked(seq_bb, bb);
+
+            // walk all successors
+            set_clear(&tmp_out);
+            if (r->end->type == TB_BRANCH) {
+                TB_NodeBranch* br = TB_NODE_GET_EXTRA(r->end);
+                FOREACH_N(i, 0, br->succ_count) {
+                    // union with successor's lives
+                    MachineBB* succ = &nl_map_get_checked(seq_bb, br->succ[i]);
+                    set_union(&tmp_out, &succ->live_in);
+                }
             }
-        }
 
-        bool changes = false;
+            Set* restrict live_out = &mbb->live_out;
+            Set* restrict live_in = &mbb->live_in;
+            Set* restrict kill = &mbb->kill;
+            Set* restrict gen = &mbb->gen;
 
-        // copy to live_out but also check for changes, if
-        // there's changes we need to put the successors in
-        // the worklist.
-        Set* restrict live_out = &mbb->live_out;
-        FOREACH_N(i, 0, (interval_count + 63) / 64) {
-            if (live_out->data[i] != tmp_out.data[i]) {
-                live_out->data[i] = tmp_out.data[i];
-                changes = true;
-            }
-        }
+            // live_in = (live_out - live_kill) U live_gen
+            //
+            // if live_in changes, the predecessors need to see it
+            FOREACH_N(i, 0, (interval_count + 63) / 64) {
+                uint64_t new_in = (tmp_out.data[i] & ~kill->data[i]) | gen->data[i];
+                changes |= (live_in->data[i] != new_in);
 
-        if (changes && r->end->type == TB_BRANCH) {
-            TB_NodeBranch* br = TB_NODE_GET_EXTRA(r->end);
-            FOREACH_N(i, 0, br->succ_count) {
-                dyn_array_put(worklist, br->succ[i]);
+                live_out->data[i] = tmp_out.data[i];
+                live_in->data[i] = new_in;
             }
         }
-
-        Set* restrict live_in = &mbb->live_in;
-        Set* restrict kill = &mbb->kill;
-        Set* restrict gen = &mbb->gen;
-
-        // live_in = (live_out - live_kill) U live_gen
-        FOREACH_N(i, 0, (interval_count + 63) / 64) {
-            live_in->data[i] = (live_out->data[i] & ~kill->data[i]) | gen->data[i];
-        }
     }
 
-    dyn_array_destroy(worklist);
     ctx->machine_bbs = seq_bb;
 
     assert(epilogue >= 0);
     return epilogue;
 }
 
-static void visit_uses(TB_Passes* passes, NL_HashSet* visited, int* uses, TB_Node* n) {
-    size_t index = nl_hashset_lookup(visited, n);
-    if (index & NL_HASHSET_HIGH_BIT) {
+static void visit_uses(TB_Passes* passes, Set* visited, int* uses, TB_Node* n) {
+    if (!set_first_time(visited, n->gvn)) {
         return;
     }
-    visited->data[index & NL_HASHSET_INDEX_BITS] = n;
 
     FOREACH_REVERSE_N(i, 0, n->input_count) if (n->inputs[i]) {
         tb_assert(n->inputs[i], "empty input... in this economy?");
@@ -544,23 +533,11 @@ static void visit_uses(TB_Passes* passes, NL_HashSet* visited, int* uses, TB_Nod
     }
 
     // track use count
-    size_t use_count = 0;
-    for (User* use = find_users(passes, n); use; use = use->next) {
-        use_count++;
-    }
-
-    // we don't have to worry about resizing here which is really nice
-    uses[index & NL_HASHSET_INDEX_BITS] = use_count;
+    uses[n->gvn] = user_count(passes, n);
 }
 
 static int* lookup_use_count(Ctx* restrict ctx, TB_Node* n) {
-    size_t i = nl_hashset_lookup(ctx->visited, n);
-    if (i == SIZE_MAX || (i & NL_HASHSET_HIGH_BIT) == 0) {
-        return NULL;
-    }
-
-    i &= NL_HASHSET_INDEX_BITS;
-    return &ctx->uses[i];
+    return set_get(ctx->visited, n->gvn) ? &ctx->uses[n->gvn] : NULL;
 }
 
 static void use(Ctx* restrict ctx, TB_Node* n) {
@@ -611,7 +588,7 @@ static void isel_region(Ctx* restrict ctx, TB_Node* control, TB_Node* next) {
 }
 
 static void fence(Ctx* restrict ctx, TB_Node* self) {
-    for (User* use = find_users(ctx->p, self->inputs[0]); use; use = use->next) {
+    FOR_USERS(use, ctx->p, self->inputs[0]) {
         TB_Node* n = use->n;
 
         // make sure to not queue 'next' node
@@ -635,24 +612,24 @@ static void fence_last(Ctx* restrict ctx, TB_Node* self, TB_Node* ignore) {
 
         TB_NodeRegion* r = TB_NODE_GET_EXTRA(self);
         if (r->end->type == TB_BRANCH) {
+            // only the last successor gets its phi moves here, GCM splits the
+            // other edges into blocks with phis (see split_phi_edges).
             TB_NodeBranch* br = TB_NODE_GET_EXTRA(r->end);
-            FOREACH_N(i, 0, br->succ_count) {
-                dst = br->succ[i];
+            dst = br->succ[br->succ_count - 1];
 
-                // find predecessor index and do that edge
-                FOREACH_N(j, 0, dst->input_count) {
-                    TB_Node* pred = tb_get_parent_region(dst->inputs[j]);
+            // find predecessor index and do that edge
+            FOREACH_N(j, 0, dst->input_count) {
+                TB_Node* pred = tb_get_parent_region(dst->inputs[j]);
 
-                    if (pred == self) {
-                        index = j;
-                        break;
-                    }
+                if (pred == self) {
+                    index = j;
+                    break;
                 }
             }
         }
 
         assert(index >= 0);
-        for (User* use = find_users(ctx->p, dst); use; use = use->next) {
+        FOR_USERS(use, ctx->p, dst) {
             TB_Node* n = use->n;
             if (n->type != TB_PHI) continue;
 
@@ -677,7 +654,7 @@ static void fence_last(Ctx* restrict ctx, TB_Node* self, TB_Node* ignore) {
         }
     }
 
-    for (User* use = find_users(ctx->p, self); use; use = use->next) {
+    FOR_USERS(use, ctx->p, self) {
         TB_Node* n = use->n;
 
         // make sure to not queue 'next' node
@@ -743,39 +720,37 @@ static void compile_function(TB_Passes* restrict p, TB_FunctionOutput* restrict
     };
 
     // BB scheduling:
-    //   we run through BBs in a reverse postorder walk, currently
-    //   there's no reodering based on branch weights (since we don't
-    //   do those but if we did that would go here.
+    //   we start from a reverse postorder walk and then reorder it based on
+    //   branch probabilities so hot paths fall through and cold blocks end up
+    //   at the end (see codegen/layout.h). debug builds just keep the RPO.
     CUIK_TIMED_BLOCK("postorder") {
         ctx.order = tb_function_get_postorder(f);
         assert(ctx.order.traversal[ctx.order.count - 1] == f->start_node && "Codegen must always schedule entry BB first");
     }
 
+    if (f->super.module->isel_mode != TB_ISEL_FAST) {
+        CUIK_TIMED_BLOCK("block layout") {
+            block_layout(f, &ctx.order);
+        }
+    }
+
     nl_map_create(ctx.values, f->node_count);
 
     CUIK_TIMED_BLOCK("init regalloc") {
         init_regalloc(&ctx);
     }
 
-    // codegen will steal the visited set to store it's use counts, by this
-    // point the number of nodes doesn't change so we can statically allocate
+    // codegen will steal the visited set to mark which nodes have use counts, by
+    // this point the number of nodes doesn't change so we can statically allocate
     // a uses array for it.
     CUIK_TIMED_BLOCK("uses") {
         tb_pass_ensure_empty(p);
 
-        // don't care about clearing the memory it doesn't matter... unless it bites
-        // me when it makes some other bug harder to spot lmao
         ctx.visited = &p->visited;
-        ctx.uses = tb_arena_alloc(tmp_arena, (1ull << ctx.visited->exp) * sizeof(int));
-        FOREACH_N(i, 0, 1ull << ctx.visited->exp) {
-            ctx.uses[i] = -1;
-        }
-
+        ctx.uses = tb_arena_alloc(tmp_arena, f->node_count * sizeof(int));
         FOREACH_REVERSE_N(i, 0, ctx.order.count) {
             visit_uses(p, ctx.visited, ctx.uses, TB_NODE_GET_EXTRA_T(ctx.order.traversal[i], TB_NodeRegion)->end);
         }
-
-        assert(ctx.visited->count <= f->node_count);
     }
 
     // allocate more stuff now that we've run stats on the IR
@@ -827,14 +802,24 @@ static void compile_function(TB_Passes* restrict p, TB_FunctionOutput* restrict
 
     EMITA(&ctx.emit, "%s:\n", f->super.name);
     {
-        int end;
-        CUIK_TIMED_BLOCK("data flow") {
-            end = liveness(&ctx, f);
-        }
+        if (f->super.module->isel_mode == TB_ISEL_FAST) {
+            // no global liveness, every block is allocated on its own
+            CUIK_TIMED_BLOCK("fast regalloc") {
+                ctx.stack_usage = fast_regalloc(&ctx, f, ctx.stack_usage);
+            }
+        } else if (f->super.module->isel_mode == TB_ISEL_COLORING) {
+            // it runs liveness itself, once per round of spilling
+            CUIK_TIMED_BLOCK("graph regalloc") {
+                ctx.stack_usage = graph_regalloc(&ctx, f, ctx.stack_usage);
+            }
+        } else {
+            int end;
+            CUIK_TIMED_BLOCK("data flow") {
+                end = liveness(&ctx, f);
+            }
 
-        // we can in theory have other regalloc solutions and eventually will put
-        // graph coloring here.
-        ctx.stack_usage = linear_scan(&ctx, f, ctx.stack_usage, end);
+            ctx.stack_usage = linear_scan(&ctx, f, ctx.stack_usage, end);
+        }
 
         // Arch-specific: convert instruction buffer into actual instructions
         CUIK_TIMED_BLOCK("emit code") {
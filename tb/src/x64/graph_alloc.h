@@ -0,0 +1,963 @@
+// Graph coloring register allocator for TB_ISEL_COLORING
+//
+// Iterated register coalescing (George & Appel, "Iterated Register Coalescing", 1996),
+// it's slower than linear scan but the phi copies and the rest of the moves get
+// coalesced away instead of the allocator splitting around them. The graph comes
+// from the same block liveness as linear scan, anything which doesn't color gets
+// rewritten into short lived temporaries (reload before each use, store after each
+// def) and we go again. Constants and addresses aren't stored at all, they're
+// recomputed right before each use.
+enum {
+    GRAPH_INITIAL,    // not in the graph (memory or never referenced)
+    GRAPH_PRECOLORED,
+    GRAPH_SIMPLIFY,
+    GRAPH_FREEZE,
+    GRAPH_SPILL,
+    GRAPH_SELECT,     // on the select stack
+    GRAPH_COALESCED,
+    GRAPH_COLORED,
+    GRAPH_SPILLED,
+};
+
+enum {
+    MOVE_WORKLIST,
+    MOVE_ACTIVE,
+    MOVE_COALESCED,
+    MOVE_CONSTRAINED,
+    MOVE_FROZEN,
+};
+
+typedef struct {
+    RegIndex dst, src;
+    int state;
+} GraphMove;
+
+typedef struct {
+    int count, cap;
+    int* items;
+} GraphList;
+
+typedef struct {
+    float score;
+    RegIndex n;
+} GraphSpill;
+
+// open addressing, the key is both nodes packed with the smaller one on top
+typedef struct {
+    int exp, count;
+    uint64_t* keys;
+} GraphEdges;
+
+typedef struct {
+    Ctx* ctx;
+    int stack_usage;
+
+    // spill temporaries start here, they don't get spilled again
+    int first_temp;
+
+    int k[CG_REGISTER_CLASSES];
+    uint32_t usable[CG_REGISTER_CLASSES];
+    uint64_t callee_saved[CG_REGISTER_CLASSES];
+
+    // per node
+    int node_count;
+    uint8_t* state;
+    int* degree;
+    int* alias;
+    int* color;
+    int* def_count;
+    float* cost;
+    Inst** def;
+    GraphList* adj; // precolored nodes don't keep one
+    GraphList* move_list;
+
+    GraphEdges edges;
+    DynArray(GraphMove) moves;
+
+    // nodes go stale in these when their state changes, we just skip them
+    DynArray(RegIndex) simplify;
+    DynArray(RegIndex) freeze;
+    DynArray(GraphSpill) spill; // binary heap, cheapest on top
+    DynArray(RegIndex) select;
+    DynArray(RegIndex) spilled;
+    DynArray(int) move_worklist;
+
+    // dedups neighbors in the Briggs test
+    int* mark;
+    int mark_id;
+} GraphRA;
+
+static void graph_list_put(GraphList* l, int x) {
+    if (l->count == l->cap) {
+        l->items = ra_grow(l->items, l->count, &l->cap, sizeof(int));
+    }
+    l->items[l->count++] = x;
+}
+
+////////////////////////////////
+// Interference graph
+////////////////////////////////
+static uint64_t* graph_edge_slot(GraphEdges* e, uint64_t key) {
+    size_t mask = (1ull << e->exp) - 1;
+    size_t i = (key * 11400714819323198485ull) >> (64 - e->exp);
+    while (e->keys[i] != 0 && e->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    return &e->keys[i];
+}
+
+static uint64_t graph_edge_key(RegIndex a, RegIndex b) {
+    return a < b ? ((uint64_t) a << 32ull) | b : ((uint64_t) b << 32ull) | a;
+}
+
+static bool graph_has_edge(GraphRA* restrict ra, RegIndex a, RegIndex b) {
+    return *graph_edge_slot(&ra->edges, graph_edge_key(a, b)) != 0;
+}
+
+static bool graph_put_edge(GraphRA* restrict ra, RegIndex a, RegIndex b) {
+    GraphEdges* e = &ra->edges;
+
+    // keep it at most half full
+    if (e->count * 2 >= (1 << e->exp)) {
+        GraphEdges old = *e;
+        e->exp += 1;
+        e->keys = tb_arena_alloc(tmp_arena, (1ull << e->exp) * sizeof(uint64_t));
+        memset(e->keys, 0, (1ull << e->exp) * sizeof(uint64_t));
+        FOREACH_N(i, 0, 1ull << old.exp) if (old.keys[i] != 0) {
+            *graph_edge_slot(e, old.keys[i]) = old.keys[i];
+        }
+    }
+
+    uint64_t key = graph_edge_key(a, b);
+    uint64_t* slot = graph_edge_slot(e, key);
+    if (*slot != 0) {
+        return false;
+    }
+
+    *slot = key;
+    e->count++;
+    return true;
+}
+
+// spilled values are memory operands from then on
+static bool graph_is_node(GraphRA* restrict ra, RegIndex r) {
+    return ra->ctx->intervals[r].spill <= 0;
+}
+
+static void graph_add_edge(GraphRA* restrict ra, RegIndex u, RegIndex v) {
+    LiveInterval* a = &ra->ctx->intervals[u];
+    LiveInterval* b = &ra->ctx->intervals[v];
+    if (u == v || a->reg_class != b->reg_class || a->spill > 0 || b->spill > 0) {
+        return;
+    }
+
+    // the reserved registers (RSP, RBP) aren't colors so they can't block anyone
+    int rc = a->reg_class;
+    if (a->reg >= 0 && (b->reg >= 0 || (ra->usable[rc] & (1u << a->reg)) == 0)) return;
+    if (b->reg >= 0 && (ra->usable[rc] & (1u << b->reg)) == 0) return;
+
+    if (graph_put_edge(ra, u, v)) {
+        if (a->reg < 0) graph_list_put(&ra->adj[u], v), ra->degree[u]++;
+        if (b->reg < 0) graph_list_put(&ra->adj[v], u), ra->degree[v]++;
+    }
+}
+
+static bool graph_is_move(GraphRA* restrict ra, Inst* inst) {
+    if ((inst->type != MOV && inst->type != FP_MOV) || (inst->flags & ~INST_SPILL) != 0) return false;
+    if (inst->out_count != 1 || inst->in_count != 1 || inst->tmp_count != 0) return false;
+
+    RegIndex dst = inst->operands[0], src = inst->operands[1];
+    return graph_is_node(ra, dst) && graph_is_node(ra, src) &&
+        ra->ctx->intervals[dst].reg_class == ra->ctx->intervals[src].reg_class;
+}
+
+// constants and addresses which are cheaper to redo than to reload
+static bool graph_can_remat(Inst* def) {
+    if (def->out_count != 1 || def->tmp_count != 0) return false;
+
+    // the only inputs these get are the frame registers, anything else might be dead by the use
+    FOREACH_N(i, 1, 1 + def->in_count) {
+        if (def->operands[i] != RSP && def->operands[i] != RBP) return false;
+    }
+
+    if (def->type == INST_ZERO) {
+        return true;
+    }
+
+    switch (def->type) {
+        case MOV:    return def->flags == INST_IMM;
+        case MOVABS: return def->flags == INST_ABS;
+        case FP_MOV: return def->flags == INST_GLOBAL; // only the float constants look like this
+        case LEA:    return def->flags == INST_GLOBAL || def->flags == INST_MEM;
+        default:     return false;
+    }
+}
+
+static void graph_build(GraphRA* restrict ra, int* depths) {
+    Ctx* restrict ctx = ra->ctx;
+    int n = ra->node_count;
+
+    // a value defined more than once in a block stays live from the first one, the
+    // others might only write part of it (SETcc) or read it without saying so (the
+    // two address ops). linear scan does the same with its ranges.
+    int* first_def_block = tb_arena_alloc(tmp_arena, n * sizeof(int));
+    int* first_def_time = tb_arena_alloc(tmp_arena, n * sizeof(int));
+    memset(first_def_block, 0xFF, n * sizeof(int));
+
+    Set live = set_create_in_arena(tmp_arena, n);
+    DynArray(Inst*) insts = dyn_array_create(Inst*, 64);
+
+    int block_id = 0;
+    for (Inst* label = ctx->first; label; block_id++) {
+        assert(label->type == INST_LABEL);
+        MachineBB* mbb = &nl_map_get_checked(ctx->machine_bbs, label->n);
+
+        // spill costs get scaled by the loop nest
+        int depth = depths[label->n->gvn];
+        float weight = 1 << (3 * (depth < 6 ? depth : 6));
+
+        dyn_array_clear(insts);
+        Inst* inst = label->next;
+        for (; inst && inst->type != INST_LABEL; inst = inst->next) {
+            dyn_array_put(insts, inst);
+
+            FOREACH_N(i, 0, inst->out_count) {
+                RegIndex v = inst->operands[i];
+                if (first_def_block[v] != block_id) {
+                    first_def_block[v] = block_id;
+                    first_def_time[v] = inst->time;
+                }
+
+                ra->def_count[v] += 1;
+                ra->def[v] = inst;
+            }
+        }
+        label = inst;
+
+        set_copy(&live, &mbb->live_out);
+        FOREACH_REVERSE_N(j, 0, dyn_array_length(insts)) {
+            Inst* inst = insts[j];
+            RegIndex* ops = inst->operands;
+            int out_end = inst->out_count;
+            int in_end = out_end + inst->in_count;
+            int tmp_end = in_end + inst->tmp_count;
+
+            FOREACH_N(i, 0, tmp_end) {
+                ra->cost[ops[i]] += weight;
+            }
+
+            // the move's source doesn't interfere with the destination, that's
+            // what lets them get coalesced.
+            if (graph_is_move(ra, inst)) {
+                set_remove(&live, ops[1]);
+
+                int m = dyn_array_length(ra->moves);
+                dyn_array_put(ra->moves, (GraphMove){ ops[0], ops[1], MOVE_WORKLIST });
+                dyn_array_put(ra->move_worklist, m);
+                graph_list_put(&ra->move_list[ops[0]], m);
+                graph_list_put(&ra->move_list[ops[1]], m);
+            }
+
+            // outputs and temporaries interfere with everything live after them (and each other)
+            FOREACH_N(i, 0, tmp_end) if (i < out_end || i >= in_end) {
+                FOREACH_SET(l, live) {
+                    graph_add_edge(ra, ops[i], l);
+                }
+
+                FOREACH_N(k, 0, i) if (k < out_end || k >= in_end) {
+                    graph_add_edge(ra, ops[i], ops[k]);
+                }
+            }
+
+            // the first input gets copied into the output before we read the rest
+            // so those can't share with it, non-call temporaries can't share with any input.
+            bool is_call = (inst->type == CALL || inst->type == SYSCALL);
+            FOREACH_N(i, out_end, in_end) {
+                FOREACH_N(k, 0, out_end) if (i > out_end && ops[i] != ops[out_end]) {
+                    graph_add_edge(ra, ops[k], ops[i]);
+                }
+
+                FOREACH_N(k, in_end, tmp_end) if (!is_call) {
+                    graph_add_edge(ra, ops[k], ops[i]);
+                }
+            }
+
+            // the clobber list leaves out the argument and return registers but the
+            // call still trashes them, nothing live across it can sit in one.
+            if (is_call) {
+                FOREACH_N(rc, 0, CG_REGISTER_CLASSES) {
+                    uint32_t clobbers = ra->usable[rc] & ~ra->callee_saved[rc];
+                    FOREACH_N(reg, 0, 16) if (clobbers & (1u << reg)) {
+                        RegIndex r = (rc ? FIRST_XMM : FIRST_GPR) + reg;
+                        FOREACH_SET(l, live) {
+                            graph_add_edge(ra, r, l);
+                        }
+                    }
+                }
+            }
+
+            FOREACH_N(i, 0, out_end) {
+                RegIndex v = ops[i];
+                if (first_def_block[v] != block_id || first_def_time[v] >= inst->time) {
+                    set_remove(&live, v);
+                }
+            }
+
+            FOREACH_N(i, out_end, in_end) if (graph_is_node(ra, ops[i])) {
+                set_put(&live, ops[i]);
+            }
+        }
+    }
+
+    dyn_array_destroy(insts);
+
+    FOREACH_N(v, 0, n) {
+        if (v >= ra->first_temp) {
+            ra->cost[v] = (float) INT_MAX;
+        } else if (ra->def_count[v] == 1 && graph_can_remat(ra->def[v])) {
+            ra->cost[v] *= 0.5f;
+        }
+    }
+}
+
+////////////////////////////////
+// Simplify & coalesce
+////////////////////////////////
+static RegIndex graph_alias(GraphRA* restrict ra, RegIndex n) {
+    RegIndex root = n;
+    while (ra->state[root] == GRAPH_COALESCED) {
+        root = ra->alias[root];
+    }
+
+    // the phi copies make long chains, point them all at the end
+    while (n != root) {
+        RegIndex next = ra->alias[n];
+        ra->alias[n] = root;
+        n = next;
+    }
+    return root;
+}
+
+static int graph_k(GraphRA* restrict ra, RegIndex n) {
+    return ra->k[ra->ctx->intervals[n].reg_class];
+}
+
+// the adjacency list minus the nodes which are out of the graph
+#define FOREACH_ADJACENT(it, ra, n) \
+for (int _j = 0, it; _j < (ra)->adj[n].count; _j++) \
+if (it = (ra)->adj[n].items[_j], (ra)->state[it] != GRAPH_SELECT && (ra)->state[it] != GRAPH_COALESCED)
+
+static bool graph_move_related(GraphRA* restrict ra, RegIndex n) {
+    FOREACH_N(i, 0, ra->move_list[n].count) {
+        int state = ra->moves[ra->move_list[n].items[i]].state;
+        if (state == MOVE_WORKLIST || state == MOVE_ACTIVE) return true;
+    }
+    return false;
+}
+
+static void graph_enable_moves(GraphRA* restrict ra, RegIndex n) {
+    FOREACH_N(i, 0, ra->move_list[n].count) {
+        int m = ra->move_list[n].items[i];
+        if (ra->moves[m].state == MOVE_ACTIVE) {
+            ra->moves[m].state = MOVE_WORKLIST;
+            dyn_array_put(ra->move_worklist, m);
+        }
+    }
+}
+
+// cheapest per neighbor it frees up
+static float graph_spill_score(GraphRA* restrict ra, RegIndex n) {
+    return ra->cost[n] / ra->degree[n];
+}
+
+static void graph_spill_push(GraphRA* restrict ra, RegIndex n) {
+    size_t i = dyn_array_length(ra->spill);
+    GraphSpill s = { graph_spill_score(ra, n), n };
+    dyn_array_put(ra->spill, s);
+
+    while (i > 0 && ra->spill[(i - 1) / 2].score > s.score) {
+        ra->spill[i] = ra->spill[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    ra->spill[i] = s;
+}
+
+static GraphSpill graph_spill_pop(GraphRA* restrict ra) {
+    GraphSpill top = ra->spill[0];
+    GraphSpill last = dyn_array_pop(ra->spill);
+
+    size_t count = dyn_array_length(ra->spill), i = 0;
+    for (;;) {
+        size_t child = i*2 + 1;
+        if (child >= count) break;
+        if (child + 1 < count && ra->spill[child + 1].score < ra->spill[child].score) child++;
+        if (ra->spill[child].score >= last.score) break;
+
+        ra->spill[i] = ra->spill[child];
+        i = child;
+    }
+
+    if (count > 0) ra->spill[i] = last;
+    return top;
+}
+
+static void graph_push(GraphRA* restrict ra, RegIndex n, int state) {
+    ra->state[n] = state;
+    switch (state) {
+        case GRAPH_SIMPLIFY: dyn_array_put(ra->simplify, n); break;
+        case GRAPH_FREEZE:   dyn_array_put(ra->freeze, n);   break;
+        case GRAPH_SPILL:    graph_spill_push(ra, n);        break;
+        default: tb_unreachable();
+    }
+}
+
+static RegIndex graph_pop(GraphRA* restrict ra, DynArray(RegIndex) list, int state) {
+    while (dyn_array_length(list)) {
+        RegIndex n = dyn_array_pop(list);
+        if (ra->state[n] == state) return n;
+    }
+    return -1;
+}
+
+static void graph_decrement_degree(GraphRA* restrict ra, RegIndex m) {
+    if (ra->state[m] == GRAPH_PRECOLORED) return;
+
+    int d = ra->degree[m]--;
+    if (d == graph_k(ra, m)) {
+        graph_enable_moves(ra, m);
+        FOREACH_ADJACENT(t, ra, m) {
+            graph_enable_moves(ra, t);
+        }
+
+        if (ra->state[m] == GRAPH_SPILL) {
+            graph_push(ra, m, graph_move_related(ra, m) ? GRAPH_FREEZE : GRAPH_SIMPLIFY);
+        }
+    }
+}
+
+static void graph_simplify(GraphRA* restrict ra, RegIndex n) {
+    ra->state[n] = GRAPH_SELECT;
+    dyn_array_put(ra->select, n);
+
+    FOREACH_ADJACENT(m, ra, n) {
+        graph_decrement_degree(ra, m);
+    }
+}
+
+static void graph_add_worklist(GraphRA* restrict ra, RegIndex u) {
+    if (ra->state[u] == GRAPH_FREEZE && !graph_move_related(ra, u) && ra->degree[u] < graph_k(ra, u)) {
+        graph_push(ra, u, GRAPH_SIMPLIFY);
+    }
+}
+
+// George: every neighbor of v either won't matter or already interferes with r
+static bool graph_george(GraphRA* restrict ra, RegIndex v, RegIndex r) {
+    int k = graph_k(ra, v);
+    FOREACH_ADJACENT(t, ra, v) {
+        if (ra->degree[t] >= k && ra->state[t] != GRAPH_PRECOLORED && !graph_has_edge(ra, t, r)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Briggs: the combined node has less than K neighbors of significant degree
+static bool graph_briggs(GraphRA* restrict ra, RegIndex u, RegIndex v) {
+    int k = graph_k(ra, u), count = 0;
+    ra->mark_id++;
+
+    RegIndex both[2] = { u, v };
+    FOREACH_N(i, 0, 2) {
+        FOREACH_ADJACENT(t, ra, both[i]) {
+            if (ra->mark[t] == ra->mark_id) continue;
+            ra->mark[t] = ra->mark_id;
+
+            if (ra->state[t] == GRAPH_PRECOLORED || ra->degree[t] >= k) {
+                if (++count >= k) return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void graph_combine(GraphRA* restrict ra, RegIndex u, RegIndex v) {
+    ra->state[v] = GRAPH_COALESCED;
+    ra->alias[v] = u;
+    ra->cost[u] += ra->cost[v];
+
+    // the finished moves don't need to tag along
+    FOREACH_N(i, 0, ra->move_list[v].count) {
+        int m = ra->move_list[v].items[i];
+        if (ra->moves[m].state == MOVE_WORKLIST || ra->moves[m].state == MOVE_ACTIVE) {
+            graph_list_put(&ra->move_list[u], m);
+        }
+    }
+    graph_enable_moves(ra, v);
+
+    FOREACH_ADJACENT(t, ra, v) {
+        graph_add_edge(ra, t, u);
+        graph_decrement_degree(ra, t);
+    }
+
+    if (ra->state[u] == GRAPH_FREEZE && ra->degree[u] >= graph_k(ra, u)) {
+        graph_push(ra, u, GRAPH_SPILL);
+    }
+}
+
+static void graph_coalesce(GraphRA* restrict ra, int m) {
+    RegIndex x = graph_alias(ra, ra->moves[m].dst);
+    RegIndex y = graph_alias(ra, ra->moves[m].src);
+
+    RegIndex u = x, v = y;
+    if (ra->state[y] == GRAPH_PRECOLORED) {
+        u = y, v = x;
+    }
+
+    // the reserved registers don't take part
+    int rc = ra->ctx->intervals[u].reg_class;
+    bool reserved = ra->state[u] == GRAPH_PRECOLORED && (ra->usable[rc] & (1u << ra->color[u])) == 0;
+
+    if (u == v) {
+        ra->moves[m].state = MOVE_COALESCED;
+        graph_add_worklist(ra, u);
+    } else if (reserved || ra->state[v] == GRAPH_PRECOLORED || graph_has_edge(ra, u, v)) {
+        ra->moves[m].state = MOVE_CONSTRAINED;
+        graph_add_worklist(ra, u);
+        graph_add_worklist(ra, v);
+    } else if (ra->state[u] == GRAPH_PRECOLORED ? graph_george(ra, v, u) : graph_briggs(ra, u, v)) {
+        ra->moves[m].state = MOVE_COALESCED;
+        graph_combine(ra, u, v);
+        graph_add_worklist(ra, u);
+    } else {
+        ra->moves[m].state = MOVE_ACTIVE;
+    }
+}
+
+static void graph_freeze_moves(GraphRA* restrict ra, RegIndex u) {
+    FOREACH_N(i, 0, ra->move_list[u].count) {
+        GraphMove* m = &ra->moves[ra->move_list[u].items[i]];
+        if (m->state != MOVE_WORKLIST && m->state != MOVE_ACTIVE) continue;
+
+        RegIndex x = graph_alias(ra, m->dst), y = graph_alias(ra, m->src);
+        RegIndex v = y == graph_alias(ra, u) ? x : y;
+        m->state = MOVE_FROZEN;
+
+        if (ra->state[v] == GRAPH_FREEZE && !graph_move_related(ra, v) && ra->degree[v] < graph_k(ra, v)) {
+            graph_push(ra, v, GRAPH_SIMPLIFY);
+        }
+    }
+}
+
+// nodes only lose neighbors and gain cost while they wait here so the scores can
+// only go up, anything which is stale on top just goes back in.
+static bool graph_select_spill(GraphRA* restrict ra) {
+    while (dyn_array_length(ra->spill)) {
+        GraphSpill s = graph_spill_pop(ra);
+        if (ra->state[s.n] != GRAPH_SPILL) continue;
+
+        if (graph_spill_score(ra, s.n) > s.score) {
+            graph_spill_push(ra, s.n);
+            continue;
+        }
+
+        graph_push(ra, s.n, GRAPH_SIMPLIFY);
+        graph_freeze_moves(ra, s.n);
+        return true;
+    }
+
+    return false;
+}
+
+////////////////////////////////
+// Coloring
+////////////////////////////////
+static bool graph_has_color(GraphRA* restrict ra, RegIndex n) {
+    return ra->state[n] == GRAPH_COLORED || ra->state[n] == GRAPH_PRECOLORED;
+}
+
+static int graph_pick_color(GraphRA* restrict ra, RegIndex n, uint32_t ok) {
+    // moves which didn't get coalesced might still line up
+    FOREACH_N(i, 0, ra->move_list[n].count) {
+        GraphMove* m = &ra->moves[ra->move_list[n].items[i]];
+        RegIndex x = graph_alias(ra, m->dst), y = graph_alias(ra, m->src);
+        RegIndex other = x == n ? y : x;
+
+        if (graph_has_color(ra, other) && (ok & (1u << ra->color[other]))) {
+            return ra->color[other];
+        }
+    }
+
+    int hint = ra->ctx->intervals[n].hint;
+    if (hint >= 0 && hint < ra->node_count) {
+        hint = graph_alias(ra, hint);
+        if (graph_has_color(ra, hint) && (ok & (1u << ra->color[hint]))) {
+            return ra->color[hint];
+        }
+    }
+
+    // callee saved registers cost a save & restore
+    int rc = ra->ctx->intervals[n].reg_class;
+    uint32_t cheap = ok & ~ra->callee_saved[rc];
+    return tb_ffs(cheap ? cheap : ok) - 1;
+}
+
+static void graph_assign_colors(GraphRA* restrict ra) {
+    while (dyn_array_length(ra->select)) {
+        RegIndex n = dyn_array_pop(ra->select);
+        int rc = ra->ctx->intervals[n].reg_class;
+
+        uint32_t ok = ra->usable[rc];
+        FOREACH_N(i, 0, ra->adj[n].count) {
+            RegIndex w = graph_alias(ra, ra->adj[n].items[i]);
+            if (graph_has_color(ra, w)) {
+                ok &= ~(1u << ra->color[w]);
+            }
+        }
+
+        if (ok == 0) {
+            REG_ALLOC_LOG printf("  #   v%d: spill\n", n);
+            ra->state[n] = GRAPH_SPILLED;
+            dyn_array_put(ra->spilled, n);
+        } else {
+            ra->color[n] = graph_pick_color(ra, n, ok);
+            ra->state[n] = GRAPH_COLORED;
+        }
+    }
+}
+
+////////////////////////////////
+// Spilling
+////////////////////////////////
+static Inst* graph_insert_after(Inst* prev, Inst* inst) {
+    inst->time = prev->time;
+    inst->next = prev->next;
+    prev->next = inst;
+    return inst;
+}
+
+static Inst* graph_move(GraphRA* restrict ra, RegIndex dst, RegIndex src, RegIndex v) {
+    Inst* inst = tb_arena_alloc(tmp_arena, sizeof(Inst) + (2 * sizeof(RegIndex)));
+    *inst = (Inst){ .type = MOV, .flags = INST_SPILL, .dt = ra->ctx->intervals[v].dt, .out_count = 1, 1 };
+    inst->operands[0] = dst;
+    inst->operands[1] = src;
+    return inst;
+}
+
+static Inst* graph_remat(GraphRA* restrict ra, Inst* def, RegIndex dst) {
+    size_t size = sizeof(Inst) + ((def->out_count + def->in_count) * sizeof(RegIndex));
+    Inst* inst = tb_arena_alloc(tmp_arena, size);
+    memcpy(inst, def, size);
+    inst->operands[0] = dst;
+
+    // XOR would stomp on the flags, we might be between a compare and its user
+    if (inst->type == INST_ZERO && ra->ctx->intervals[dst].reg_class == REG_CLASS_GPR) {
+        inst->type = MOV;
+        inst->flags = INST_IMM;
+        inst->imm = 0;
+    }
+    return inst;
+}
+
+static RegIndex graph_new_temp(GraphRA* restrict ra, RegIndex v) {
+    LiveInterval* it = &ra->ctx->intervals[v];
+    LiveInterval t = { .reg_class = it->reg_class, .dt = it->dt, .reg = -1, .hint = -1, .assigned = -1, .start = INT_MAX, .split_kid = -1 };
+
+    RegIndex i = dyn_array_length(ra->ctx->intervals);
+    dyn_array_put(ra->ctx->intervals, t);
+    return i;
+}
+
+static void graph_rewrite(GraphRA* restrict ra) {
+    Ctx* restrict ctx = ra->ctx;
+    int n = ra->node_count;
+
+    // constants & addresses don't get a slot, values which don't interfere can share one.
+    Inst** remat = tb_arena_alloc(tmp_arena, n * sizeof(Inst*));
+    memset(remat, 0, n * sizeof(Inst*));
+
+    // slots used by the spilled neighbors, marked with the index of whoever's looking
+    size_t spill_count = dyn_array_length(ra->spilled);
+    int* conflict = tb_arena_alloc(tmp_arena, spill_count * sizeof(int));
+    int* slot_of = tb_arena_alloc(tmp_arena, n * sizeof(int));
+    memset(conflict, 0xFF, spill_count * sizeof(int));
+    memset(slot_of, 0xFF, n * sizeof(int));
+
+    DynArray(SpillSlot) slots = dyn_array_create(SpillSlot, 16);
+    dyn_array_for(i, ra->spilled) {
+        RegIndex v = ra->spilled[i];
+        if (ra->def_count[v] == 1 && graph_can_remat(ra->def[v])) {
+            REG_ALLOC_LOG printf("  #   v%d: rematerialize\n", v);
+            remat[v] = ra->def[v];
+            continue;
+        }
+
+        FOREACH_N(j, 0, ra->adj[v].count) {
+            RegIndex u = ra->adj[v].items[j];
+            if (slot_of[u] >= 0) conflict[slot_of[u]] = i;
+        }
+
+        int size = spill_size(ctx->intervals[v].dt);
+        ptrdiff_t slot = -1;
+        dyn_array_for(j, slots) {
+            if (slots[j].size == size && conflict[j] != i) {
+                slot = j;
+                break;
+            }
+        }
+
+        if (slot < 0) {
+            ra->stack_usage = align_up(ra->stack_usage + size, size);
+
+            slot = dyn_array_length(slots);
+            dyn_array_put(slots, (SpillSlot){ size, ra->stack_usage, 0 });
+        }
+
+        slot_of[v] = slot;
+        ctx->intervals[v].spill = slots[slot].offset;
+    }
+    dyn_array_destroy(slots);
+
+    // the reloads and stores go through fresh temporaries, they're short enough
+    // that they'll always color.
+    int* def_block = tb_arena_alloc(tmp_arena, n * sizeof(int));
+    memset(def_block, 0xFF, n * sizeof(int));
+
+    int block_id = 0;
+    for (Inst *prev = NULL, *inst = ctx->first; inst; prev = inst, inst = inst->next) {
+        if (inst->type == INST_LABEL) {
+            block_id++;
+            continue;
+        }
+
+        RegIndex* ops = inst->operands;
+        int out_end = inst->out_count;
+        int in_end = out_end + inst->in_count;
+        int tmp_end = in_end + inst->tmp_count;
+
+        // the def doesn't need to happen anymore
+        if (out_end == 1 && ops[0] < n && remat[ops[0]] == inst) {
+            prev->next = inst->next;
+            inst = prev;
+            continue;
+        }
+
+        RegIndex olds[16], news[16];
+        bool loads[16];
+        int count = 0;
+        FOREACH_N(i, 0, tmp_end) {
+            RegIndex v = ops[i];
+            if (v >= n || ra->state[v] != GRAPH_SPILLED) continue;
+
+            int j = 0;
+            while (j < count && olds[j] != v) j++;
+            if (j == count) {
+                assert(count < 16);
+                olds[count] = v, news[count] = graph_new_temp(ra, v), loads[count] = false, count++;
+            }
+
+            // inputs and the later defs in a block need the old value
+            if (i < out_end ? def_block[v] == block_id : i < in_end) {
+                loads[j] = true;
+            }
+            ops[i] = news[j];
+        }
+
+        FOREACH_N(j, 0, count) if (loads[j]) {
+            RegIndex v = olds[j];
+            Inst* load = remat[v] ? graph_remat(ra, remat[v], news[j]) : graph_move(ra, news[j], v, v);
+            prev = graph_insert_after(prev, load);
+        }
+
+        FOREACH_N(i, 0, out_end) {
+            if (ops[i] < n) def_block[ops[i]] = block_id;
+        }
+
+        // store the defs
+        FOREACH_N(j, 0, count) {
+            bool is_def = false;
+            FOREACH_N(i, 0, out_end) if (ops[i] == news[j]) is_def = true;
+
+            if (is_def) {
+                def_block[olds[j]] = block_id;
+                inst = graph_insert_after(inst, graph_move(ra, olds[j], news[j], olds[j]));
+            }
+        }
+    }
+}
+
+////////////////////////////////
+// Driver
+////////////////////////////////
+static void graph_init(GraphRA* restrict ra) {
+    int n = ra->node_count = dyn_array_length(ra->ctx->intervals);
+
+    ra->state     = TB_ARENA_ARR_ALLOC(tmp_arena, n, uint8_t);
+    ra->degree    = TB_ARENA_ARR_ALLOC(tmp_arena, n, int);
+    ra->alias     = TB_ARENA_ARR_ALLOC(tmp_arena, n, int);
+    ra->color     = TB_ARENA_ARR_ALLOC(tmp_arena, n, int);
+    ra->def_count = TB_ARENA_ARR_ALLOC(tmp_arena, n, int);
+    ra->cost      = TB_ARENA_ARR_ALLOC(tmp_arena, n, float);
+    ra->def       = TB_ARENA_ARR_ALLOC(tmp_arena, n, Inst*);
+    ra->adj       = TB_ARENA_ARR_ALLOC(tmp_arena, n, GraphList);
+    ra->move_list = TB_ARENA_ARR_ALLOC(tmp_arena, n, GraphList);
+    ra->mark      = TB_ARENA_ARR_ALLOC(tmp_arena, n, int);
+    FOREACH_N(i, 0, n) {
+        LiveInterval* it = &ra->ctx->intervals[i];
+
+        ra->state[i] = it->reg >= 0 ? GRAPH_PRECOLORED : GRAPH_INITIAL;
+        ra->degree[i] = it->reg >= 0 ? INT_MAX / 2 : 0;
+        ra->alias[i] = i;
+        ra->color[i] = it->reg;
+        ra->def_count[i] = 0;
+        ra->cost[i] = 0.0f;
+        ra->def[i] = NULL;
+        ra->adj[i] = (GraphList){ 0 };
+        ra->move_list[i] = (GraphList){ 0 };
+        ra->mark[i] = 0;
+    }
+
+    ra->edges.exp = 10;
+    ra->edges.count = 0;
+    ra->edges.keys = tb_arena_alloc(tmp_arena, (1ull << ra->edges.exp) * sizeof(uint64_t));
+    memset(ra->edges.keys, 0, (1ull << ra->edges.exp) * sizeof(uint64_t));
+
+    ra->moves = dyn_array_create(GraphMove, 64);
+    ra->simplify = dyn_array_create(RegIndex, 64);
+    ra->freeze = dyn_array_create(RegIndex, 64);
+    ra->spill = dyn_array_create(GraphSpill, 64);
+    ra->select = dyn_array_create(RegIndex, 64);
+    ra->spilled = dyn_array_create(RegIndex, 16);
+    ra->move_worklist = dyn_array_create(int, 64);
+}
+
+static void graph_free(GraphRA* restrict ra) {
+    dyn_array_destroy(ra->moves);
+    dyn_array_destroy(ra->simplify);
+    dyn_array_destroy(ra->freeze);
+    dyn_array_destroy(ra->spill);
+    dyn_array_destroy(ra->select);
+    dyn_array_destroy(ra->spilled);
+    dyn_array_destroy(ra->move_worklist);
+}
+
+static int graph_regalloc(Ctx* restrict ctx, TB_Function* f, int stack_usage) {
+    GraphRA ra = { .ctx = ctx, .stack_usage = stack_usage, .first_temp = dyn_array_length(ctx->intervals) };
+
+    mark_callee_saved_constraints(ctx, ra.callee_saved);
+    FOREACH_N(rc, 0, CG_REGISTER_CLASSES) {
+        ra.usable[rc] = 0xFFFF;
+    }
+    ra.usable[REG_CLASS_GPR] &= ~((1u << RSP) | (1u << RBP));
+    FOREACH_N(rc, 0, CG_REGISTER_CLASSES) {
+        ra.k[rc] = tb_popcount(ra.usable[rc]);
+    }
+
+    int* depths;
+    CUIK_TIMED_BLOCK("loop depths") {
+        depths = block_loop_depths(f);
+    }
+
+    for (int round = 0;; round++) {
+        tb_assert(round < 64, "graph coloring isn't converging");
+
+        if (ctx->machine_bbs) {
+            nl_map_free(ctx->machine_bbs);
+        }
+
+        CUIK_TIMED_BLOCK("data flow") {
+            liveness(ctx, f);
+        }
+
+        graph_init(&ra);
+        CUIK_TIMED_BLOCK("build graph") {
+            graph_build(&ra, depths);
+        }
+
+        CUIK_TIMED_BLOCK("color") {
+            FOREACH_N(i, 0, ra.node_count) {
+                if (ra.state[i] != GRAPH_INITIAL || ra.cost[i] == 0.0f || !graph_is_node(&ra, i)) {
+                    continue;
+                }
+
+                if (ra.degree[i] >= graph_k(&ra, i)) {
+                    graph_push(&ra, i, GRAPH_SPILL);
+                } else if (graph_move_related(&ra, i)) {
+                    graph_push(&ra, i, GRAPH_FREEZE);
+                } else {
+                    graph_push(&ra, i, GRAPH_SIMPLIFY);
+                }
+            }
+
+            for (;;) {
+                RegIndex n;
+                if (n = graph_pop(&ra, ra.simplify, GRAPH_SIMPLIFY), n >= 0) {
+                    graph_simplify(&ra, n);
+                } else if (dyn_array_length(ra.move_worklist)) {
+                    int m = dyn_array_pop(ra.move_worklist);
+                    if (ra.moves[m].state == MOVE_WORKLIST) {
+                        graph_coalesce(&ra, m);
+                    }
+                } else if (n = graph_pop(&ra, ra.freeze, GRAPH_FREEZE), n >= 0) {
+                    graph_push(&ra, n, GRAPH_SIMPLIFY);
+                    graph_freeze_moves(&ra, n);
+                } else if (!graph_select_spill(&ra)) {
+                    break;
+                }
+            }
+
+            graph_assign_colors(&ra);
+        }
+
+        if (dyn_array_length(ra.spilled) == 0) {
+            break;
+        }
+
+        CUIK_TIMED_BLOCK("rewrite") {
+            graph_rewrite(&ra);
+        }
+        graph_free(&ra);
+    }
+
+    // write back the colors
+    uint64_t used[CG_REGISTER_CLASSES] = { 0 };
+    FOREACH_N(i, 0, ra.node_count) {
+        LiveInterval* it = &ctx->intervals[i];
+        if (it->reg >= 0 || (ra.state[i] != GRAPH_COLORED && ra.state[i] != GRAPH_COALESCED)) {
+            continue;
+        }
+
+        it->assigned = ra.color[graph_alias(&ra, i)];
+        used[it->reg_class] |= 1ull << it->assigned;
+    }
+    graph_free(&ra);
+
+    // save the callee saved registers we ended up using
+    Inst* epilogue = ctx->first;
+    while (epilogue->next && epilogue->next->type != INST_EPILOGUE) {
+        epilogue = epilogue->next;
+    }
+
+    FOREACH_N(rc, 0, CG_REGISTER_CLASSES) {
+        FOREACH_N(reg, 0, 16) if ((used[rc] & ra.callee_saved[rc]) & (1ull << reg)) {
+            int size = rc ? 16 : 8;
+            int vreg = (rc ? FIRST_XMM : FIRST_GPR) + reg;
+            ra.stack_usage = align_up(ra.stack_usage + size, size);
+
+            LiveInterval it = {
+                .spill = ra.stack_usage,
+                .dt = ctx->intervals[vreg].dt,
+                .assigned = -1,
+                .reg = -1,
+                .split_kid = -1,
+            };
+
+            int slot = dyn_array_length(ctx->intervals);
+            dyn_array_put(ctx->intervals, it);
+
+            graph_insert_after(ctx->first, graph_move(&ra, slot, vreg, vreg));
+            graph_insert_after(epilogue, graph_move(&ra, vreg, slot, vreg));
+        }
+    }
+
+    return ra.stack_usage;
+}
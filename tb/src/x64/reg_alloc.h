@@ -46,26 +46,51 @@ struct LiveInterval {
     // spill point, -1 if there's none
     int spill, split_kid;
 
+    // stack slot shared by all the split pieces of a value, 0 if it's
+    // never been spilled
+    int slot;
+
     // help speed up some of the main allocation loop
     int active_range;
 
-    // we're gonna have so much memory to clean up...
-    DynArray(LiveRange) ranges;
-    DynArray(UsePos) uses;
+    // both are sorted backwards (the earliest is at the end) and live in the
+    // tmp arena, splitting just slices them up.
+    int range_count, range_cap;
+    int use_count, use_cap;
+    LiveRange* ranges;
+    UsePos* uses;
 };
 
 typedef DynArray(RegIndex) IntervalList;
 
+typedef struct {
+    RegIndex src, dst;
+} SplitMove;
+
+typedef struct {
+    int size, offset, end;
+} SpillSlot;
+
 typedef struct {
     TB_ABI abi;
 
     DynArray(LiveInterval) intervals;
-    DynArray(RegIndex) inactive;
-    IntervalList unhandled;
     Inst* first;
 
+    // binary heap, the earliest start is on top
+    IntervalList unhandled;
+
+    // bucketed by the assigned register so we only look at the
+    // ones which could actually block a register.
+    IntervalList inactive[CG_REGISTER_CLASSES][16];
+
     int stack_usage;
 
+    // once the value in a slot is dead it can be handed out again, nothing
+    // we split from here on happens before free_before.
+    DynArray(SpillSlot) slots;
+    int free_before;
+
     // time when the physical registers will be free again
     int* free_pos;
     int* block_pos;
@@ -76,29 +101,62 @@ typedef struct {
     Set active_set[CG_REGISTER_CLASSES];
     RegIndex active[CG_REGISTER_CLASSES][16];
 
-    Inst* cache;
+    // the last instruction at or before every even timestamp, the
+    // moves we insert aren't in here but they're never far behind.
+    int inst_at_count;
+    Inst** inst_at;
+
+    // sorted by start time
+    int block_count;
+    MachineBB** blocks;
+
+    // once allocation is done every value's split pieces are laid out in
+    // order, chain_end is one past the last piece of the chain at each spot.
+    int piece_count;
+    int* piece_pos;
+    int* pieces;
+    int* chain_end;
 } LSRA;
 
 static LiveRange* last_range(LiveInterval* i) {
-    return &i->ranges[dyn_array_length(i->ranges) - 1];
+    return &i->ranges[i->range_count - 1];
 }
 
 ////////////////////////////////
 // Generate intervals
 ////////////////////////////////
+static void* ra_grow(void* old, int count, int* cap, size_t elem_size) {
+    int new_cap = *cap ? *cap * 2 : 4;
+    void* ptr = tb_arena_alloc(tmp_arena, new_cap * elem_size);
+    if (count > 0) {
+        memcpy(ptr, old, count * elem_size);
+    }
+
+    *cap = new_cap;
+    return ptr;
+}
+
 static void add_use_pos(LiveInterval* interval, int t, int kind) {
-    UsePos u = { t, kind };
-    dyn_array_put(interval->uses, u);
+    if (interval->use_count == interval->use_cap) {
+        interval->uses = ra_grow(interval->uses, interval->use_count, &interval->use_cap, sizeof(UsePos));
+    }
+
+    interval->uses[interval->use_count++] = (UsePos){ t, kind };
 }
 
 static void add_range(LiveInterval* interval, int start, int end) {
-    size_t count = dyn_array_length(interval->ranges);
-    if (count > 0 && interval->ranges[count - 1].start == end) {
-        // coalesce
-        interval->ranges[count - 1].start = start;
+    int count = interval->range_count;
+    if (count > 0 && interval->ranges[count - 1].start <= end) {
+        // coalesce, we're walking backwards so it's touching (or overlapping) the last one
+        LiveRange* last = &interval->ranges[count - 1];
+        if (start < last->start) last->start = start;
+        if (end > last->end) last->end = end;
     } else {
-        LiveRange r = { start, end };
-        dyn_array_put(interval->ranges, r);
+        if (count == interval->range_cap) {
+            interval->ranges = ra_grow(interval->ranges, count, &interval->range_cap, sizeof(LiveRange));
+        }
+
+        interval->ranges[interval->range_count++] = (LiveRange){ start, end };
     }
 
     if (start < interval->start) interval->start = start;
@@ -127,11 +185,13 @@ static void reverse_bb_walk(LSRA* restrict ra, MachineBB* bb, Inst* inst) {
         assert(*ops >= 0);
         LiveInterval* interval = &ra->intervals[*ops++];
 
-        if (interval->ranges == NULL) {
+        if (interval->range_count == 0) {
             add_range(interval, inst->time, inst->time);
-        } else {
+        } else if (!set_get(&bb->live_in, interval - ra->intervals)) {
+            // it's not live before the def (the phi temporaries get defined in
+            // several blocks so they might be)
             interval->start = inst->time;
-            interval->ranges[dyn_array_length(interval->ranges) - 1].start = inst->time;
+            last_range(interval)->start = inst->time;
         }
 
         add_use_pos(interval, inst->time, dst_use_reg ? USE_REG : USE_OUT);
@@ -141,7 +201,9 @@ static void reverse_bb_walk(LSRA* restrict ra, MachineBB* bb, Inst* inst) {
         assert(*ops >= 0);
         LiveInterval* interval = &ra->intervals[*ops++];
 
-        add_range(interval, bb->start, inst->time);
+        // the first input gets copied into the output before we read the rest
+        // so they can't end here (they'd be free to share the output's register)
+        add_range(interval, bb->start, inst->time + (i > 0 && inst->out_count > 0));
         add_use_pos(interval, inst->time, USE_REG);
     }
 
@@ -158,25 +220,25 @@ static void reverse_bb_walk(LSRA* restrict ra, MachineBB* bb, Inst* inst) {
     }
 }
 
+// returns the first time both are live, b is either active or inactive so
+// anything before its active_range is behind us.
 static int interval_intersect(LiveInterval* a, LiveInterval* b) {
     if (!(b->start <= a->end && a->start <= b->end)) {
         return -1; // don't intersect at all
     }
 
-    FOREACH_N(i, 0, dyn_array_length(a->ranges)) {
+    // both lists are sorted backwards so we walk them together from the end
+    int i = a->range_count - 1, j = b->active_range;
+    while (i >= 0 && j >= 0) {
         LiveRange a_range = a->ranges[i];
+        LiveRange b_range = b->ranges[j];
 
-        FOREACH_N(j, 0, dyn_array_length(b->ranges)) {
-            LiveRange b_range = b->ranges[j];
-
-            // if the end is greater than the start, then we've overshot
-            if (a_range.start >= b_range.end) {
-                break;
-            }
-
-            if (a_range.end >= b_range.start) {
-                return b_range.start > a_range.start ? b_range.start : a_range.start;
-            }
+        if (a_range.start >= b_range.end) {
+            j -= 1; // b's range is done before a's starts
+        } else if (b_range.start > a_range.end) {
+            i -= 1; // a's range is done before b's starts
+        } else {
+            return b_range.start > a_range.start ? b_range.start : a_range.start;
         }
     }
 
@@ -188,30 +250,18 @@ FOREACH_N(_i, 0, ((set).capacity + 63) / 64) \
 for (uint64_t bits = (set).data[_i], it = _i*64; bits; bits >>= 1, it++) if (bits & 1)
 
 static int next_use(LiveInterval* interval, int time) {
-    FOREACH_N(i, 0, dyn_array_length(interval->uses)) {
-        if (interval->uses[i].pos > time) {
-            return interval->uses[i].pos;
-        }
-    }
-
-    return INT_MAX;
-}
-
-// if < 0, then it's -x - 1 where x is the nearest starting point
-static int covers(LiveInterval* it, int start, int end) {
-    size_t i = 0, count = dyn_array_length(it->ranges);
-    for (; i < count; i++) {
-        // if the end is greater than the start, then we've overshot
-        if (start > it->ranges[i].end) {
-            return -1;
-        }
-
-        if (end >= it->ranges[i].start) {
-            return i;
+    // uses are sorted backwards, the ones at or after time are at the front
+    int lo = 0, hi = interval->use_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (interval->uses[mid].pos >= time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
 
-    return -1;
+    return lo > 0 ? interval->uses[lo - 1].pos : INT_MAX;
 }
 
 static LiveInterval* get_active(LSRA* restrict ra, int rc, int reg) {
@@ -222,43 +272,235 @@ static LiveInterval* get_active(LSRA* restrict ra, int rc, int reg) {
     return &ra->intervals[ra->active[rc][reg]];
 }
 
-static void insert_split_move(LSRA* restrict ra, int t, int old_reg, int new_reg) {
-    Inst *prev, *inst;
-    TB_X86_DataType dt = ra->intervals[old_reg].dt;
+////////////////////////////////
+// Unhandled heap
+////////////////////////////////
+static bool unhandled_before(LSRA* restrict ra, RegIndex a, RegIndex b) {
+    LiveInterval *x = &ra->intervals[a], *y = &ra->intervals[b];
+    if (x->start != y->start) {
+        return x->start < y->start;
+    }
 
-    // invalidate
-    if (ra->cache->time >= t) {
-        ra->cache = ra->first;
+    // fixed intervals go first, then the newest splits
+    if ((x->reg >= 0) != (y->reg >= 0)) {
+        return x->reg >= 0;
     }
 
-    prev = ra->cache, inst = prev->next;
-    CUIK_TIMED_BLOCK("walk") {
-        while (inst != NULL) {
-            if (inst->time > t) {
-                ra->cache = prev;
-                break;
+    return a > b;
+}
+
+static void unhandled_push(LSRA* restrict ra, RegIndex ri) {
+    dyn_array_put(ra->unhandled, ri);
+
+    RegIndex* heap = ra->unhandled;
+    size_t i = dyn_array_length(heap) - 1;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!unhandled_before(ra, heap[i], heap[parent])) break;
+
+        SWAP(RegIndex, heap[i], heap[parent]);
+        i = parent;
+    }
+}
+
+static RegIndex unhandled_pop(LSRA* restrict ra) {
+    RegIndex* heap = ra->unhandled;
+    RegIndex top = heap[0];
+    RegIndex last = dyn_array_pop(ra->unhandled);
+
+    // sift the last element down from the root
+    size_t count = dyn_array_length(heap);
+    if (count > 0) {
+        size_t i = 0;
+        for (;;) {
+            size_t kid = i*2 + 1;
+            if (kid >= count) break;
+            if (kid + 1 < count && unhandled_before(ra, heap[kid + 1], heap[kid])) kid += 1;
+            if (!unhandled_before(ra, heap[kid], last)) break;
+
+            heap[i] = heap[kid];
+            i = kid;
+        }
+        heap[i] = last;
+    }
+
+    return top;
+}
+
+////////////////////////////////
+// Splitting
+////////////////////////////////
+// packed values need the whole XMM register saved
+static int spill_size(TB_X86_DataType dt) {
+    return (dt >= TB_X86_TYPE_PBYTE && dt <= TB_X86_TYPE_PQWORD) || dt >= TB_X86_TYPE_SSE_PS ? 16 : 8;
+}
+
+static int get_spill_slot(LSRA* restrict ra, LiveInterval* interval) {
+    if (interval->slot == 0) {
+        // one of the later pieces might've been spilled first
+        LiveInterval* last = interval;
+        while (last->slot == 0 && last->split_kid >= 0) {
+            last = &ra->intervals[last->split_kid];
+        }
+
+        int offset = last->slot;
+        if (offset == 0) {
+            // last is the final piece so the value is dead after its end, we can
+            // take any slot which died before anything we'd split from here.
+            int size = spill_size(interval->dt);
+            SpillSlot* slot = NULL;
+            dyn_array_for(i, ra->slots) {
+                if (ra->slots[i].size == size && ra->slots[i].end < ra->free_before) {
+                    slot = &ra->slots[i];
+                    break;
+                }
             }
 
-            prev = inst, inst = inst->next;
+            if (slot != NULL) {
+                slot->end = last->end;
+                offset = slot->offset;
+            } else {
+                ra->stack_usage = align_up(ra->stack_usage + size, size);
+                offset = ra->stack_usage;
+
+                SpillSlot s = { size, offset, last->end };
+                dyn_array_put(ra->slots, s);
+            }
+        }
+
+        for (LiveInterval* it = interval; it->slot == 0;) {
+            it->slot = offset;
+            if (it->split_kid < 0) break;
+            it = &ra->intervals[it->split_kid];
         }
     }
 
-    // folded spill
-    if (inst && inst->type == MOV && inst->flags == 0 && inst->operands[0] == old_reg) {
-        inst->operands[0] = new_reg;
-        return;
+    return interval->slot;
+}
+
+// last block starting at or before t
+static MachineBB* find_block(LSRA* restrict ra, int t) {
+    int lo = 0, hi = ra->block_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ra->blocks[mid]->start <= t) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo > 0 ? ra->blocks[lo - 1] : NULL;
+}
+
+// last instruction at or before t
+static Inst* find_insert_point(LSRA* restrict ra, int t) {
+    int i = t / 2;
+    if (i >= ra->inst_at_count) {
+        i = ra->inst_at_count - 1;
     }
 
+    Inst* prev = ra->inst_at[i];
+    while (prev->next && prev->next->time <= t) {
+        prev = prev->next;
+    }
+
+    return prev;
+}
+
+static Inst* insert_move_after(LSRA* restrict ra, Inst* prev, int t, int old_reg, int new_reg) {
     Inst* new_inst = tb_arena_alloc(tmp_arena, sizeof(Inst) + (2 * sizeof(RegIndex)));
-    *new_inst = (Inst){ .type = MOV, .flags = INST_SPILL, .dt = dt, .out_count = 1, 1 };
+    *new_inst = (Inst){ .type = MOV, .flags = INST_SPILL, .dt = ra->intervals[old_reg].dt, .out_count = 1, 1 };
     new_inst->operands[0] = new_reg;
     new_inst->operands[1] = old_reg;
-    new_inst->time = prev->time + 1;
+    new_inst->time = t > prev->time ? t : prev->time;
     new_inst->next = prev->next;
     prev->next = new_inst;
+    return new_inst;
+}
+
+static int move_rank(LSRA* restrict ra, int old_reg, int new_reg) {
+    if (ra->intervals[new_reg].spill > 0) return 0;
+    if (ra->intervals[old_reg].spill > 0) return 2;
+    return 1;
+}
+
+static void insert_split_move(LSRA* restrict ra, int t, int old_reg, int new_reg) {
+    Inst* prev = find_insert_point(ra, t);
+    Inst* inst = prev->next;
+
+    // folded spill
+    if (inst && inst->type == MOV && inst->flags == 0 && inst->operands[0] == old_reg) {
+        inst->operands[0] = new_reg;
+        return;
+    }
+
+    // the moves at the same spot go spills, then register moves, then reloads so
+    // nothing gets loaded into a register before the old value is saved.
+    int rank = move_rank(ra, old_reg, new_reg);
+    prev = find_insert_point(ra, t - 1);
+    while (prev->next && prev->next->time <= t) {
+        Inst* next = prev->next;
+        if (next->time == t && (next->flags & INST_SPILL) && move_rank(ra, next->operands[1], next->operands[0]) > rank) {
+            break;
+        }
+        prev = next;
+    }
+
+    // unless our source is only getting loaded here
+    for (Inst* next = prev->next; next && next->time == t; next = next->next) {
+        if ((next->flags & INST_SPILL) && next->operands[0] == old_reg) {
+            prev = next;
+            break;
+        }
+    }
+
+    insert_move_after(ra, prev, t, old_reg, new_reg);
+}
+
+static void index_split_pieces(LSRA* restrict ra) {
+    int count = ra->piece_count = dyn_array_length(ra->intervals);
+    ra->piece_pos = TB_ARENA_ARR_ALLOC(tmp_arena, count, int);
+    ra->pieces = TB_ARENA_ARR_ALLOC(tmp_arena, count, int);
+    ra->chain_end = TB_ARENA_ARR_ALLOC(tmp_arena, count, int);
+
+    // kids get placed by walking down from their root
+    FOREACH_N(i, 0, count) ra->piece_pos[i] = -1;
+    FOREACH_N(i, 0, count) {
+        if (ra->intervals[i].split_kid >= 0) ra->piece_pos[ra->intervals[i].split_kid] = 0;
+    }
+
+    int n = 0;
+    FOREACH_N(i, 0, count) {
+        if (ra->piece_pos[i] >= 0 || ra->intervals[i].split_kid < 0) continue;
+
+        int first = n;
+        for (int j = i; j >= 0; j = ra->intervals[j].split_kid) {
+            ra->piece_pos[j] = n;
+            ra->pieces[n++] = j;
+        }
+
+        FOREACH_N(j, first, n) ra->chain_end[j] = n;
+    }
 }
 
 static LiveInterval* split_interval_at(LSRA* restrict ra, LiveInterval* interval, int pos) {
+    ptrdiff_t i = interval - ra->intervals;
+    if (ra->pieces != NULL && i < ra->piece_count && ra->piece_pos[i] >= 0) {
+        // the pieces end in increasing order, find the first one past pos
+        int lo = ra->piece_pos[i], hi = ra->chain_end[lo] - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (pos > ra->intervals[ra->pieces[mid]].end) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        return &ra->intervals[ra->pieces[lo]];
+    }
+
     // skip past previous intervals
     while (interval->split_kid >= 0 && pos > interval->end) {
         interval = &ra->intervals[interval->split_kid];
@@ -269,33 +511,80 @@ static LiveInterval* split_interval_at(LSRA* restrict ra, LiveInterval* interval
 
 // any uses after `pos` after put into the new interval
 static int split_intersecting(LSRA* restrict ra, int pos, LiveInterval* interval, bool is_spill) {
+    // a move after the terminator would only run on some of the paths out so we
+    // pull it up, if it's in the gap between blocks we don't need one at all since
+    // the resolver puts them on the edges.
+    bool on_edge = false;
+    MachineBB* mbb = find_block(ra, pos);
+    if (mbb != NULL) {
+        if (pos >= mbb->end - 1) {
+            pos = mbb->end + 1, on_edge = true;
+        } else if (mbb->terminator > 0 && pos >= mbb->terminator && mbb->terminator - 1 >= interval->start) {
+            pos = mbb->terminator - 1;
+        }
+    }
+
     if (interval->spill > 0) {
         REG_ALLOC_LOG printf("  \x1b[33m#   v%lld: reload [RBP - %d] at t=%d\x1b[0m\n", interval - ra->intervals, interval->spill, pos);
-    } else {
-        // allocate stack slot
-        int size = 8;
-        ra->stack_usage = align_up(ra->stack_usage + size, size);
-
-        REG_ALLOC_LOG printf("  \x1b[33m#   v%lld: spill %s to [RBP - %d] at t=%d\x1b[0m\n", interval - ra->intervals, reg_name(interval->reg_class, interval->assigned), ra->stack_usage, pos);
+    } else if (is_spill) {
+        REG_ALLOC_LOG printf("  \x1b[33m#   v%lld: spill %s to [RBP - %d] at t=%d\x1b[0m\n", interval - ra->intervals, reg_name(interval->reg_class, interval->assigned), get_spill_slot(ra, interval), pos);
     }
 
     // split lifetime
-    LiveInterval it = *interval;
     if (is_spill) {
-        it.spill = ra->stack_usage;
-    } else {
-        it.spill = -1;
-        it.reg = -1;
+        get_spill_slot(ra, interval);
     }
+
+    LiveInterval it = *interval;
+    it.spill = is_spill ? interval->slot : -1;
     it.assigned = it.reg = -1;
     it.start = pos;
     it.end = interval->end;
-    it.uses = NULL;
-    it.ranges = NULL;
     it.n = NULL;
-    it.split_kid = -1;
+    it.split_kid = interval->split_kid;
     interval->end = pos;
 
+    // split uses, the ones after pos are at the front
+    int k = 0;
+    while (k < interval->use_count && interval->uses[k].pos > pos) k++;
+
+    it.use_count = it.use_cap = k;
+    if (k > 0) {
+        interval->uses += k;
+        interval->use_count -= k;
+    }
+    interval->use_cap = interval->use_count;
+
+    // split ranges, the new interval keeps the front of the array and we copy the
+    // rest out (it's the part we've already walked past so it's usually small).
+    int r = 0;
+    while (r < interval->range_count && interval->ranges[r].start > pos) r++;
+
+    bool in_hole = true;
+    if (r < interval->range_count && interval->ranges[r].end > pos) {
+        in_hole = false;
+
+        // intersects pos, we need to split the range
+        int rest = interval->range_count - r;
+        LiveRange* ranges = TB_ARENA_ARR_ALLOC(tmp_arena, rest, LiveRange);
+        memcpy(ranges, &interval->ranges[r], rest * sizeof(LiveRange));
+        ranges[0].end = pos;
+
+        it.ranges[r].start = pos;
+        it.range_count = it.range_cap = r + 1;
+
+        interval->ranges = ranges;
+        interval->range_count = rest;
+    } else {
+        it.range_count = it.range_cap = r;
+        if (r > 0) {
+            interval->ranges += r;
+            interval->range_count -= r;
+        }
+    }
+    interval->range_cap = interval->range_count;
+    interval->active_range = interval->active_range > r ? interval->active_range - r : 0;
+
     int old_reg = interval - ra->intervals;
     int new_reg = dyn_array_length(ra->intervals);
     interval->split_kid = new_reg;
@@ -304,69 +593,19 @@ static int split_intersecting(LSRA* restrict ra, int pos, LiveInterval* interval
     interval = &ra->intervals[old_reg];
 
     if (!is_spill) {
-        // since the split is starting at pos and pos is at the top of the
-        // unhandled list... we can push this to the top wit no problem
-        size_t i = 0, count = dyn_array_length(ra->unhandled);
-        for (; i < count; i++) {
-            if (pos > ra->intervals[ra->unhandled[i]].start) break;
-        }
-
-        // we know where to insert
-        dyn_array_put(ra->unhandled, 0);
-        memmove(&ra->unhandled[i + 1], &ra->unhandled[i], (count - i) * sizeof(RegIndex));
-        ra->unhandled[i] = new_reg;
-    }
-
-    // split uses
-    size_t use_count = dyn_array_length(interval->uses);
-    FOREACH_REVERSE_N(i, 0, use_count) {
-        size_t split_count = use_count - (i + 1);
-        if (interval->uses[i].pos > pos && split_count > 0) {
-            DynArray(UsePos) uses = dyn_array_create(UsePos, split_count);
-            dyn_array_set_length(uses, split_count);
-            memcpy(uses, &interval->uses[i + 1], split_count * sizeof(UsePos));
-
-            dyn_array_set_length(interval->uses, i + 1);
-            it.uses = interval->uses;
-            interval->uses = uses;
-            break;
-        }
+        unhandled_push(ra, new_reg);
     }
 
-    // split ranges
-    for (size_t i = 0; i < dyn_array_length(interval->ranges);) {
-        LiveRange* range = &interval->ranges[i];
-        if (range->start > pos) {
-            dyn_array_put(it.ranges, *range);
-            interval = &ra->intervals[old_reg];
-
-            // remove-shift
-            size_t shift = dyn_array_length(interval->ranges) - (i + 1);
-            if (shift > 0) {
-                memmove(range, range + 1, shift * sizeof(LiveRange));
-            }
-            dyn_array_pop(interval->ranges);
-        } else if (range->end > pos) {
-            // intersects pos, we need to split the range
-            LiveRange r = { pos, range->end };
-            range->end = pos;
-            dyn_array_put(it.ranges, r);
-
-            interval = &ra->intervals[old_reg];
-            continue;
-        }
-
-        i++;
+    // insert move (the control flow aware moves are inserted later), both
+    // halves might just be the same stack slot. In a lifetime hole the register
+    // doesn't hold our value anymore, the resolver picks it up where it's live again.
+    if (!on_edge && !in_hole && (interval->spill <= 0 || interval->spill != it.spill)) {
+        insert_split_move(ra, pos, old_reg, new_reg);
     }
 
-    ra->intervals[new_reg] = it;
-
-    // insert move (the control flow aware moves are inserted later)
-    insert_split_move(ra, pos, old_reg, new_reg);
-
     // reload before next use
     if (is_spill) {
-        FOREACH_REVERSE_N(i, 0, dyn_array_length(it.uses)) {
+        for (int i = it.use_count - 1; i >= 0; i--) {
             if (it.uses[i].kind == USE_REG) {
                 // new split
                 split_intersecting(ra, it.uses[i].pos - 1, &ra->intervals[new_reg], false);
@@ -378,6 +617,9 @@ static int split_intersecting(LSRA* restrict ra, int pos, LiveInterval* interval
     return new_reg;
 }
 
+////////////////////////////////
+// Allocation
+////////////////////////////////
 // returns -1 if no registers are available
 static ptrdiff_t allocate_free_reg(LSRA* restrict ra, LiveInterval* interval) {
     int rc = interval->reg_class;
@@ -396,14 +638,12 @@ static ptrdiff_t allocate_free_reg(LSRA* restrict ra, LiveInterval* interval) {
     }
 
     // for each inactive which intersects current
-    dyn_array_for(i, ra->inactive) {
-        LiveInterval* inactive_it = &ra->intervals[ra->inactive[i]];
-
-        int fp = ra->free_pos[inactive_it->assigned];
-        if (fp > 0) {
-            int p = interval_intersect(interval, inactive_it);
-            if (p >= 0 && p < fp) {
-                ra->free_pos[inactive_it->assigned] = p;
+    FOREACH_N(i, 0, 16) if (ra->free_pos[i] > 0) {
+        IntervalList bucket = ra->inactive[rc][i];
+        dyn_array_for(j, bucket) {
+            int p = interval_intersect(interval, &ra->intervals[bucket[j]]);
+            if (p >= 0 && p < ra->free_pos[i]) {
+                ra->free_pos[i] = p;
             }
         }
     }
@@ -423,7 +663,7 @@ static ptrdiff_t allocate_free_reg(LSRA* restrict ra, LiveInterval* interval) {
         assert(hint->reg_class == rc);
         hint_reg = hint->assigned;
 
-        if (interval->end <= ra->free_pos[hint_reg]) {
+        if (hint_reg >= 0 && interval->end <= ra->free_pos[hint_reg]) {
             highest = hint_reg;
         }
     }
@@ -495,39 +735,38 @@ static ptrdiff_t allocate_free_reg(LSRA* restrict ra, LiveInterval* interval) {
 
 static ptrdiff_t allocate_blocked_reg(LSRA* restrict ra, LiveInterval* interval) {
     int rc = interval->reg_class;
+    int ri = interval - ra->intervals;
     int* use_pos = ra->free_pos;
 
     FOREACH_N(i, 0, 16) ra->block_pos[i] = INT_MAX;
     FOREACH_N(i, 0, 16) use_pos[i] = INT_MAX;
 
-    // mark non-fixed intervals
     FOREACH_SET(i, ra->active_set[rc]) {
         LiveInterval* it = &ra->intervals[ra->active[rc][i]];
-        if (it->reg_class == rc && it->reg < 0) {
-            use_pos[i] = next_use(it, interval->start);
-        }
-    }
-
-    dyn_array_for(i, ra->inactive) {
-        LiveInterval* it = &ra->intervals[ra->inactive[i]];
-        if (it->reg_class == rc && it->reg < 0) {
-            use_pos[i] = next_use(it, interval->start);
-        }
-    }
-
-    // mark fixed intervals
-    FOREACH_SET(i, ra->active_set[rc]) {
-        LiveInterval* it = &ra->intervals[ra->active[rc][i]];
-        if (it->reg_class == rc && it->reg >= 0) {
+        if (it->reg >= 0) {
+            // fixed intervals can't be moved
             use_pos[i] = 0;
             ra->block_pos[i] = 0;
+        } else {
+            use_pos[i] = next_use(it, interval->start);
         }
     }
 
-    dyn_array_for(i, ra->inactive) {
-        LiveInterval* it = &ra->intervals[ra->inactive[i]];
-        if (it->reg_class == rc && it->reg >= 0) {
-            tb_todo();
+    FOREACH_N(i, 0, 16) {
+        IntervalList bucket = ra->inactive[rc][i];
+        dyn_array_for(j, bucket) {
+            LiveInterval* it = &ra->intervals[bucket[j]];
+            if (it->reg >= 0) {
+                // the register is ours until the fixed interval comes back
+                int p = interval_intersect(interval, it);
+                if (p >= 0 && p < ra->block_pos[i]) {
+                    ra->block_pos[i] = p;
+                    if (p < use_pos[i]) use_pos[i] = p;
+                }
+            } else if (use_pos[i] > interval->start && interval_intersect(interval, it) >= 0) {
+                int p = next_use(it, interval->start);
+                if (p < use_pos[i]) use_pos[i] = p;
+            }
         }
     }
 
@@ -544,18 +783,15 @@ static ptrdiff_t allocate_blocked_reg(LSRA* restrict ra, LiveInterval* interval)
     }
 
     int pos = use_pos[highest];
-    int first_use = interval->uses[dyn_array_length(interval->uses) - 1].pos;
+    int first_use = interval->use_count ? interval->uses[interval->use_count - 1].pos : INT_MAX;
 
     bool spilled = false;
     if (first_use > pos) {
-        int size = 8;
-
         // spill interval
-        ra->stack_usage = align_up(ra->stack_usage + size, size);
-        interval->spill = ra->stack_usage;
+        interval->spill = get_spill_slot(ra, interval);
 
         // split at optimal spot before first use that requires a register
-        FOREACH_REVERSE_N(i, 0, dyn_array_length(interval->uses)) {
+        for (int i = interval->use_count - 1; i >= 0; i--) {
             if (interval->uses[i].pos >= pos && interval->uses[i].kind == USE_REG) {
                 split_intersecting(ra, interval->uses[i].pos - 1, interval, false);
                 break;
@@ -566,26 +802,32 @@ static ptrdiff_t allocate_blocked_reg(LSRA* restrict ra, LiveInterval* interval)
     } else {
         int split_pos = (interval->start & ~1) - 1;
 
-        // split active or inactive interval reg
+        // split active or inactive interval reg, the first half ends
+        // before us so it's done with the register.
         LiveInterval* to_split = get_active(ra, rc, highest);
         if (to_split != NULL) {
             split_intersecting(ra, split_pos, to_split, true);
+            set_remove(&ra->active_set[rc], highest);
         }
 
         // split any inactive interval for reg at the end of it's lifetime hole
-        dyn_array_for(i, ra->inactive) {
-            LiveInterval* it = &ra->intervals[ra->inactive[i]];
-            if (it->reg_class == rc && it->assigned == highest) {
+        for (size_t i = 0; i < dyn_array_length(ra->inactive[rc][highest]);) {
+            LiveInterval* it = &ra->intervals[ra->inactive[rc][highest][i]];
+            if (it->reg < 0 && interval_intersect(&ra->intervals[ri], it) >= 0) {
                 split_intersecting(ra, split_pos, it, true);
+                dyn_array_remove(ra->inactive[rc][highest], i);
+                continue;
             }
+            i++;
         }
-    }
 
-    // split active reg if it intersects with fixed interval
-    LiveInterval* fix_interval = &ra->intervals[(rc ? FIRST_XMM : FIRST_GPR) + highest];
-    int p = interval_intersect(interval, fix_interval);
-    if (p >= 0) {
-        split_intersecting(ra, p, fix_interval, true);
+        // the fixed interval wants the register back before we're done
+        int block = ra->block_pos[highest];
+        interval = &ra->intervals[ri]; // might've resized the intervals
+        if (block < interval->end) {
+            interval->assigned = highest;
+            split_intersecting(ra, block - 1, interval, true);
+        }
     }
 
     return spilled ? -1 : highest;
@@ -600,7 +842,7 @@ static void move_to_active(LSRA* restrict ra, LiveInterval* interval, int pos) {
         tb_assert(interval->reg >= 0, "non-fixed interval attempted to force a register out");
 
         LiveInterval* old_interval = &ra->intervals[ra->active[rc][reg]];
-        FOREACH_N(i, 0, dyn_array_length(old_interval->ranges)) {
+        FOREACH_N(i, 0, old_interval->range_count) {
             if (old_interval->ranges[i].end == pos) {
                 old_interval = NULL;
                 break;
@@ -617,9 +859,108 @@ static void move_to_active(LSRA* restrict ra, LiveInterval* interval, int pos) {
     ra->active[rc][reg] = ri;
 }
 
-static void cuiksort_defs(LiveInterval* intervals, ptrdiff_t lo, ptrdiff_t hi, RegIndex* arr);
+////////////////////////////////
+// Resolving
+////////////////////////////////
+static int move_loc(LiveInterval* it) {
+    return it->spill > 0 ? -1 : it->reg_class*16 + it->assigned;
+}
+
+// the moves on an edge all happen at once so we need to order them such that
+// nothing gets overwritten before it's read, cycles get broken by parking one
+// of the values in its stack slot.
+static void resolve_moves(LSRA* restrict ra, Inst* at, SplitMove* moves, size_t count) {
+    while (count > 0) {
+        bool progress = false;
+        for (size_t i = 0; i < count;) {
+            int dst = move_loc(&ra->intervals[moves[i].dst]);
+
+            bool blocked = false;
+            if (dst >= 0) {
+                FOREACH_N(j, 0, count) if (j != i && move_loc(&ra->intervals[moves[j].src]) == dst) {
+                    blocked = true;
+                    break;
+                }
+            }
+
+            if (blocked) {
+                i++;
+            } else {
+                at = insert_move_after(ra, at, at->time, moves[i].src, moves[i].dst);
+                moves[i] = moves[--count];
+                progress = true;
+            }
+        }
+
+        if (!progress) {
+            // everyone's blocked so someone's reading the first move's destination,
+            // they're in the cycle so parking their value frees it up.
+            int dst = move_loc(&ra->intervals[moves[0].dst]);
+            size_t j = 1;
+            while (move_loc(&ra->intervals[moves[j].src]) != dst) j++;
+
+            LiveInterval* src = &ra->intervals[moves[j].src];
+            LiveInterval tmp = {
+                .reg_class = src->reg_class,
+                .dt = src->dt,
+                .spill = get_spill_slot(ra, src),
+                .assigned = -1,
+                .reg = -1,
+                .hint = -1,
+                .split_kid = -1,
+            };
+
+            RegIndex tmp_reg = dyn_array_length(ra->intervals);
+            dyn_array_put(ra->intervals, tmp);
+
+            at = insert_move_after(ra, at, at->time, moves[j].src, tmp_reg);
+            moves[j].src = tmp_reg;
+        }
+    }
+}
+
+static Inst* inst_jmp(TB_Node* target);
+
+// the edge's moves can't go at the end of the predecessor (it's got other successors)
+// or at the start of the successor (it's got other predecessors) so they get their
+// own block, the jumps to the successor are redirected to it.
+static Inst* split_edge(Ctx* restrict ctx, MachineBB* mbb, TB_Node* succ, Inst** stubs) {
+    Inst* last = NULL;
+    bool redirected = false;
+
+    TB_Node* stub = TB_ARENA_ALLOC(tmp_arena, TB_Node);
+    *stub = (TB_Node){ 0 };
+
+    Inst* inst = mbb->first;
+    if (inst->type == INST_LABEL) inst = inst->next;
+    for (; inst && inst->type != INST_LABEL; inst = inst->next) {
+        if (inst->type >= JMP && inst->type <= JG && (inst->flags & INST_NODE) && inst->n == succ) {
+            inst->n = stub;
+            redirected = true;
+        }
+        last = inst;
+    }
+
+    if (!redirected) {
+        // it's the fallthrough so the only path past our jumps is this edge
+        return last;
+    }
+
+    nl_map_put(ctx->emit.labels, stub, 0);
+
+    Inst* label = inst_label(stub);
+    Inst* jmp = inst_jmp(succ);
+    label->time = jmp->time = (*stubs)->time;
+
+    jmp->next = (*stubs)->next;
+    label->next = jmp;
+    (*stubs)->next = label;
+    *stubs = jmp;
+    return label;
+}
+
 static int linear_scan(Ctx* restrict ctx, TB_Function* f, int stack_usage, int end) {
-    LSRA ra = { .abi = f->super.module->target_abi, .first = ctx->first, .cache = ctx->first, .intervals = ctx->intervals, .stack_usage = stack_usage };
+    LSRA ra = { .abi = f->super.module->target_abi, .first = ctx->first, .intervals = ctx->intervals, .stack_usage = stack_usage };
 
     FOREACH_N(i, 0, CG_REGISTER_CLASSES) {
         ra.active_set[i] = set_create_in_arena(tmp_arena, 16);
@@ -637,11 +978,11 @@ static int linear_scan(Ctx* restrict ctx, TB_Function* f, int stack_usage, int e
             int bb_start = mbb->start;
             int bb_end = mbb->end + 2;
 
-            // for anything that's live out, add the entire range
-            Set* live_in = &mbb->live_in;
+            // for anything that's live out, add the entire range (the defs in
+            // here will cut it short)
             Set* live_out = &mbb->live_out;
             FOREACH_N(i, 0, (interval_count + 63) / 64) {
-                uint64_t bits = live_in->data[i] & live_out->data[i];
+                uint64_t bits = live_out->data[i];
                 if (bits == 0) continue;
 
                 FOREACH_N(j, 0, 64) if (bits & (1ull << j)) {
@@ -659,20 +1000,59 @@ static int linear_scan(Ctx* restrict ctx, TB_Function* f, int stack_usage, int e
 
     // we use every fixed interval at the very start to force them into
     // the inactive set.
-    FOREACH_N(i, 0, 32) if (ra.intervals[i].ranges) {
+    FOREACH_N(i, 0, 32) if (ra.intervals[i].range_count) {
         add_range(&ra.intervals[i], 0, 1);
     }
 
-    dyn_array_destroy(ra.intervals[RBP].ranges);
-    dyn_array_destroy(ra.intervals[RSP].ranges);
+    ra.intervals[RBP].range_count = 0;
+    ra.intervals[RSP].range_count = 0;
 
     ra.endpoint = end;
     mark_callee_saved_constraints(ctx, ra.callee_saved);
 
-    // generate unhandled interval list (sorted by starting point)
-    ra.unhandled = dyn_array_create(LiveInterval*, (interval_count * 4) / 3);
-    FOREACH_N(i, 0, interval_count) dyn_array_put(ra.unhandled, i);
-    cuiksort_defs(ctx->intervals, 0, interval_count - 1, ra.unhandled);
+    // index the instructions and blocks by time, the split moves
+    // use this to find their spot.
+    Inst* stubs = NULL;
+    CUIK_TIMED_BLOCK("index insts") {
+        TB_Node* stop_bb = tb_get_parent_region(f->stop_node);
+
+        int last_time = 0;
+        for (Inst* inst = ra.first; inst; inst = inst->next) {
+            last_time = inst->time;
+            ra.block_count += (inst->type == INST_LABEL);
+        }
+
+        ra.inst_at_count = last_time/2 + 1;
+        ra.inst_at = TB_ARENA_ARR_ALLOC(tmp_arena, ra.inst_at_count, Inst*);
+        ra.blocks = TB_ARENA_ARR_ALLOC(tmp_arena, ra.block_count, MachineBB*);
+
+        int k = 0, b = 0;
+        Inst *prev = ra.first, *last = NULL;
+        for (Inst* inst = ra.first; inst; inst = inst->next) {
+            while (k*2 < inst->time) ra.inst_at[k++] = prev;
+
+            if (inst->type == INST_LABEL) {
+                ra.blocks[b++] = &nl_map_get_checked(mbbs, inst->n);
+
+                // the critical edge blocks go right before the stop block, whatever
+                // comes before that always ends in a jump.
+                if (inst->n == stop_bb) stubs = prev;
+            }
+            prev = inst;
+        }
+
+        while (k < ra.inst_at_count) ra.inst_at[k++] = prev;
+
+        // if there's no stop block it goes before the epilogue at the end
+        if (stubs == NULL) {
+            for (Inst* inst = ra.first; inst->next; inst = inst->next) stubs = inst;
+        }
+    }
+
+    // generate unhandled interval list (ordered by starting point)
+    ra.unhandled = dyn_array_create(RegIndex, (interval_count * 4) / 3);
+    FOREACH_N(i, 0, interval_count) unhandled_push(&ra, i);
+    ra.slots = dyn_array_create(SpillSlot, 16);
 
     // only need enough to store for the biggest register class
     ra.free_pos  = TB_ARENA_ARR_ALLOC(tmp_arena, 16, int);
@@ -680,23 +1060,19 @@ static int linear_scan(Ctx* restrict ctx, TB_Function* f, int stack_usage, int e
 
     // linear scan main loop
     CUIK_TIMED_BLOCK("reg alloc") {
-        while (dyn_array_length(ra.unhandled)) CUIK_TIMED_BLOCK("pop") {
-            RegIndex ri = dyn_array_pop(ra.unhandled);
+        while (dyn_array_length(ra.unhandled)) {
+            RegIndex ri = unhandled_pop(&ra);
             LiveInterval* interval = &ra.intervals[ri];
 
             // unused interval, skip
-            if (interval->ranges == NULL) continue;
+            if (interval->range_count == 0) continue;
 
             int time = interval->start;
             int rc = interval->reg_class;
 
-            int before_next_time = interval->start;
-            if (dyn_array_length(ra.unhandled)) {
-                int before = ra.intervals[ra.unhandled[dyn_array_length(ra.unhandled) - 1]].start - 1;
-                if (before > before_next_time) {
-                    before_next_time = before;
-                }
-            }
+            // splits can get pulled up to the start of the block
+            MachineBB* mbb = find_block(&ra, time);
+            ra.free_before = mbb ? mbb->start : 0;
 
             if (interval->reg >= 0) {
                 REG_ALLOC_LOG printf("  # %-5s t=[%-4d - %4d)\n", reg_name(interval->reg_class, interval->reg), time, interval->end);
@@ -720,7 +1096,8 @@ static int linear_scan(Ctx* restrict ctx, TB_Function* f, int stack_usage, int e
                 RegIndex active_i = ra.active[rc][reg];
                 LiveInterval* it = &ra.intervals[active_i];
 
-                if (time >= it->end) {
+                // splitting in a lifetime hole leaves the end past the last range
+                if (time >= it->end || time >= it->ranges[0].end) {
                     REG_ALLOC_LOG printf("  #   expired %s (v%d)\n", reg_name(rc, reg), active_i);
                     set_remove(&ra.active_set[rc], reg);
                 } else {
@@ -734,38 +1111,45 @@ static int linear_scan(Ctx* restrict ctx, TB_Function* f, int stack_usage, int e
                             REG_ALLOC_LOG printf("  #   active %s is going quiet for now (until t=%d, v%d)\n", reg_name(rc, reg), hole_end, active_i);
 
                             set_remove(&ra.active_set[rc], reg);
-                            dyn_array_put(ra.inactive, active_i);
+                            dyn_array_put(ra.inactive[rc][reg], active_i);
                             break;
                         }
                     }
                 }
             }
 
-            for (size_t i = 0; i < dyn_array_length(ra.inactive);) {
-                RegIndex inactive_i = ra.inactive[i];
-                LiveInterval* it = &ra.intervals[inactive_i];
+            FOREACH_N(reg, 0, 16) {
+                for (size_t i = 0; i < dyn_array_length(ra.inactive[rc][reg]);) {
+                    RegIndex inactive_i = ra.inactive[rc][reg][i];
+                    LiveInterval* it = &ra.intervals[inactive_i];
 
-                int hole_end = it->ranges[it->active_range].start;
-                int active_end = it->ranges[it->active_range].end;
+                    if (time >= it->end || time >= it->ranges[0].end) {
+                        REG_ALLOC_LOG printf("  #   inactive %s has expired (v%d)\n", reg_name(rc, reg), inactive_i);
+                        dyn_array_remove(ra.inactive[rc][reg], i);
+                        continue;
+                    }
+
+                    // we might've passed entire ranges while it was inactive
+                    while (time >= it->ranges[it->active_range].end) {
+                        it->active_range -= 1;
+                    }
 
-                if (time > hole_end) {
-                    // inactive -> active
-                    REG_ALLOC_LOG printf("  #   inactive %s is active again (until t=%d, v%d)\n", reg_name(it->reg_class, it->assigned), active_end, inactive_i);
+                    int hole_end = it->ranges[it->active_range].start;
+                    int active_end = it->ranges[it->active_range].end;
 
-                    // set active
-                    move_to_active(&ra, it, hole_end);
-                    dyn_array_remove(ra.inactive, i);
-                    interval = &ra.intervals[ri]; // might've resized the intervals
+                    if (time > hole_end) {
+                        // inactive -> active
+                        REG_ALLOC_LOG printf("  #   inactive %s is active again (until t=%d, v%d)\n", reg_name(rc, reg), active_end, inactive_i);
 
-                    // expire
-                    if (time > it->end) {
-                        REG_ALLOC_LOG printf("  #   inactive %s has expired (v%d)\n", reg_name(it->reg_class, it->assigned), inactive_i);
-                        set_remove(&ra.active_set[rc], it->assigned);
+                        // set active
+                        dyn_array_remove(ra.inactive[rc][reg], i);
+                        move_to_active(&ra, it, hole_end);
+                        interval = &ra.intervals[ri]; // might've resized the intervals
+                        continue;
                     }
-                    continue;
-                }
 
-                i++;
+                    i++;
+                }
             }
 
             ptrdiff_t reg = interval->reg;
@@ -788,7 +1172,7 @@ static int linear_scan(Ctx* restrict ctx, TB_Function* f, int stack_usage, int e
             // add to active set
             if (reg >= 0) {
                 interval->assigned = reg;
-                interval->active_range = dyn_array_length(interval->ranges) - 1;
+                interval->active_range = interval->range_count - 1;
                 move_to_active(&ra, interval, interval->start);
             }
 
@@ -811,8 +1195,34 @@ static int linear_scan(Ctx* restrict ctx, TB_Function* f, int stack_usage, int e
         }
     }
 
-    // move resolver
+    // the resolver's moves go all over the place, they don't get to share slots
+    ra.free_before = 0;
+    index_split_pieces(&ra);
+
+    // the source of a split move might've been split again further up after the
+    // move was inserted, it's whichever piece is live at the move now.
+    CUIK_TIMED_BLOCK("split moves") {
+        for (Inst *prev = ra.first, *inst = prev->next; inst; inst = inst->next) {
+            if (inst->flags & INST_SPILL) {
+                LiveInterval* src = split_interval_at(&ra, &ra.intervals[inst->operands[1]], inst->time);
+                LiveInterval* dst = &ra.intervals[inst->operands[0]];
+                inst->operands[1] = src - ra.intervals;
+
+                // both halves ended up in the same stack slot
+                if (src->spill > 0 && src->spill == dst->spill) {
+                    prev->next = inst->next;
+                    continue;
+                }
+            }
+            prev = inst;
+        }
+    }
+
+    // move resolver:
+    //   if the value's location changes across an edge we need a move
+    //   on it, all the moves on the same edge form a parallel copy.
     CUIK_TIMED_BLOCK("move resolver") {
+        DynArray(SplitMove) moves = dyn_array_create(SplitMove, 16);
         FOREACH_N(i, 0, ctx->order.count) {
             MachineBB* mbb = &nl_map_get_checked(mbbs, ctx->order.traversal[i]);
             TB_NodeRegion* r = TB_NODE_GET_EXTRA(ctx->order.traversal[i]);
@@ -822,36 +1232,59 @@ static int linear_scan(Ctx* restrict ctx, TB_Function* f, int stack_usage, int e
             }
 
             TB_NodeBranch* br = TB_NODE_GET_EXTRA(r->end);
-            FOREACH_REVERSE_N(i, 0, br->succ_count) {
-                TB_Node* bb = br->succ[i];
+            FOREACH_N(j, 0, br->succ_count) {
+                TB_Node* bb = br->succ[j];
                 MachineBB* target = &nl_map_get_checked(mbbs, bb);
 
+                // switch cases can share a successor, we only need to do it once
+                bool dup = false;
+                FOREACH_N(k, 0, j) if (br->succ[k] == bb) {
+                    dup = true;
+                    break;
+                }
+                if (dup) continue;
+
                 // for all live-ins, we should check if we need to insert a move
-                FOREACH_SET(i, target->live_in) {
-                    LiveInterval* interval = &ra.intervals[i];
+                dyn_array_clear(moves);
+                FOREACH_SET(k, target->live_in) {
+                    LiveInterval* interval = &ra.intervals[k];
 
                     // if the value changes across the edge, insert move
                     LiveInterval* start = split_interval_at(&ra, interval, mbb->end);
                     LiveInterval* end = split_interval_at(&ra, interval, target->start);
+                    if (start == end) continue;
 
-                    if (start != end) {
-                        if (start->spill > 0) {
-                            assert(end->spill <= 0 && "TODO: both can't be spills yet");
-                            insert_split_move(&ra, target->start + 1, start - ra.intervals, end - ra.intervals);
-                        } else {
-                            insert_split_move(&ra, mbb->terminator - 1, start - ra.intervals, end - ra.intervals);
-                        }
+                    if (start->spill > 0 && end->spill > 0) {
+                        assert(start->spill == end->spill && "split pieces should share a stack slot");
+                        continue;
+                    } else if (start->spill <= 0 && end->spill <= 0 && start->assigned == end->assigned) {
+                        continue;
                     }
+
+                    SplitMove m = { start - ra.intervals, end - ra.intervals };
+                    dyn_array_put(moves, m);
                 }
 
-                // the moves are inserted either at the end of block from or at the beginning of block to,
-                // depending on the control flow
-                // resolver.find_insert_position(from, to)
+                if (dyn_array_length(moves) == 0) {
+                    continue;
+                }
+
+                // the moves go at the end of the predecessor if we're the only way out,
+                // at the start of the successor if we're the only way in and otherwise
+                // it's a critical edge.
+                Inst* at;
+                if (br->succ_count == 1) {
+                    at = find_insert_point(&ra, (mbb->terminator ? mbb->terminator : mbb->end) - 1);
+                } else if (bb->input_count == 1) {
+                    at = ra.inst_at[target->start / 2];
+                } else {
+                    at = split_edge(ctx, mbb, bb, &stubs);
+                }
 
-                // insert all moves in correct order (without overwriting registers that are used later)
-                // resolver.resolve_mappings()
+                resolve_moves(&ra, at, moves, dyn_array_length(moves));
             }
         }
+        dyn_array_destroy(moves);
     }
 
     // resolve all split interval references
@@ -868,41 +1301,12 @@ static int linear_scan(Ctx* restrict ctx, TB_Function* f, int stack_usage, int e
         }
     }
 
-    ctx->intervals = ra.intervals;
-    return ra.stack_usage;
-}
-
-////////////////////////////////
-// Sorting unhandled list
-////////////////////////////////
-static size_t partition(LiveInterval* intervals, ptrdiff_t lo, ptrdiff_t hi, RegIndex* arr) {
-    int pivot = intervals[arr[(hi - lo) / 2 + lo]].start; // middle
-
-    ptrdiff_t i = lo - 1, j = hi + 1;
-    for (;;) {
-        // Move the left index to the right at least once and while the element at
-        // the left index is less than the pivot
-        do { i += 1; } while (intervals[arr[i]].start > pivot);
-
-        // Move the right index to the left at least once and while the element at
-        // the right index is greater than the pivot
-        do { j -= 1; } while (intervals[arr[j]].start < pivot);
-
-        // If the indices crossed, return
-        if (i >= j) return j;
-
-        // Swap the elements at the left and right indices
-        SWAP(RegIndex, arr[i], arr[j]);
+    FOREACH_N(rc, 0, CG_REGISTER_CLASSES) FOREACH_N(reg, 0, 16) {
+        if (ra.inactive[rc][reg]) dyn_array_destroy(ra.inactive[rc][reg]);
     }
-}
+    dyn_array_destroy(ra.unhandled);
+    dyn_array_destroy(ra.slots);
 
-static void cuiksort_defs(LiveInterval* intervals, ptrdiff_t lo, ptrdiff_t hi, RegIndex* arr) {
-    if (lo >= 0 && hi >= 0 && lo < hi) {
-        // get pivot
-        size_t p = partition(intervals, lo, hi, arr);
-
-        // sort both sides
-        cuiksort_defs(intervals, lo, p, arr);
-        cuiksort_defs(intervals, p + 1, hi, arr);
-    }
+    ctx->intervals = ra.intervals;
+    return ra.stack_usage;
 }
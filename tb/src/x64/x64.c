@@ -75,6 +75,12 @@ static TB_X86_DataType legalize_int(TB_DataType dt, uint64_t* out_mask) {
     assert(dt.type == TB_INT || dt.type == TB_PTR);
     if (dt.type == TB_PTR) return *out_mask = 0, TB_X86_TYPE_QWORD;
 
+    // packed integers, we only do the 128bit ones
+    if (dt.width) {
+        assert(dt.data >= 8 && dt.data <= 64 && (dt.data << dt.width) == 128 && "TODO: only 128bit vectors");
+        return *out_mask = 0, TB_X86_TYPE_PBYTE + (tb_ffs(dt.data) - 4);
+    }
+
     TB_X86_DataType t = TB_X86_TYPE_NONE;
     int bits = 0;
 
@@ -120,7 +126,26 @@ static TB_X86_DataType legalize(TB_DataType dt) {
 }
 
 static int classify_reg_class(TB_DataType dt) {
-    return dt.type == TB_FLOAT ? REG_CLASS_XMM : REG_CLASS_GPR;
+    return dt.type == TB_FLOAT || dt.width ? REG_CLASS_XMM : REG_CLASS_GPR;
+}
+
+// packed integer op for a lane by lane TB op
+static InstType isel_vector_op(Ctx* restrict ctx, TB_NodeTypeEnum type, TB_DataType dt) {
+    // 0 for bytes up to 3 for qwords
+    int lane = tb_ffs(dt.data) - 4;
+    switch (type) {
+        case TB_AND: return PAND;
+        case TB_OR:  return POR;
+        case TB_XOR: return PXOR;
+        case TB_ADD: return lane == 3 ? PADDQ : PADDB + lane;
+        case TB_SUB: return PSUBB + lane;
+        case TB_MUL: {
+            assert((lane == 1 || lane == 2) && "TODO: packed multiply on bytes and qwords");
+            assert((lane == 1 || (ctx->module->features.x64 & (TB_FEATURE_X64_SSE41 | TB_FEATURE_X64_AVX2))) && "pmulld needs SSE4.1");
+            return lane == 1 ? PMULLW : PMULLD;
+        }
+        default: tb_todo();
+    }
 }
 
 static bool wont_spill_around(int t) {
@@ -145,10 +170,14 @@ static bool try_for_imm32(Ctx* restrict ctx, TB_Node* n, int32_t* out_x) {
 
     if (n->type == TB_INTEGER_CONST) {
         TB_NodeInt* i = TB_NODE_GET_EXTRA(n);
-        if (i->num_words == 1 && fits_into_int32(i->words[0] & mask)) {
+        uint64_t x = i->words[0] & mask;
+
+        // 64bit ops sign extend the imm32 so something like 0xFFFFFFFF doesn't fit
+        bool is_64bit = prev->type != TB_SIGN_EXT && (prev->dt.type != TB_INT || prev->dt.data > 32);
+        if (i->num_words == 1 && (is_64bit ? (int32_t) x == (int64_t) x : fits_into_int32(x))) {
             if (prev != n) use(ctx, prev);
 
-            *out_x = i->words[0] & mask;
+            *out_x = x;
             return true;
         }
     }
@@ -187,6 +216,11 @@ static Inst* inst_jcc(TB_Node* target, Cond cc) {
 
 // store(binop(load(a), b))
 static int can_folded_store(Ctx* restrict ctx, TB_Node* addr, TB_Node* src) {
+    // there's no packed op with a memory destination
+    if (src->dt.width) {
+        return -1;
+    }
+
     switch (src->type) {
         default: return -1;
 
@@ -540,7 +574,9 @@ static int isel(Ctx* restrict ctx, TB_Node* n) {
                 x &= (1ull << bits_in_type) - 1;
             }
 
-            if (!fits_into_int32(x)) {
+            // a 64bit mov sign extends the imm32
+            bool fits = bits_in_type > 32 ? (int32_t) x == (int64_t) x : fits_into_int32(x);
+            if (!fits) {
                 // movabs reg, imm64
                 SUBMIT(inst_op_abs(MOVABS, n->dt, dst, x));
             } else if (x == 0) {
@@ -573,6 +609,15 @@ static int isel(Ctx* restrict ctx, TB_Node* n) {
             InstType op = ops[type - TB_AND];
 
             dst = DEF(n, n->dt);
+            if (n->dt.width) {
+                int lhs = isel(ctx, n->inputs[1]);
+                int rhs = isel(ctx, n->inputs[2]);
+                hint_reg(ctx, dst, lhs);
+
+                SUBMIT(inst_move(n->dt, dst, lhs));
+                SUBMIT(inst_op_rrr(isel_vector_op(ctx, type, n->dt), n->dt, dst, dst, rhs));
+                break;
+            }
 
             int lhs = isel(ctx, n->inputs[1]);
             hint_reg(ctx, dst, lhs);
@@ -598,7 +643,12 @@ static int isel(Ctx* restrict ctx, TB_Node* n) {
             hint_reg(ctx, dst, lhs);
 
             int32_t x;
-            if (try_for_imm32(ctx, n->inputs[2], &x)) {
+            if (n->dt.width) {
+                int rhs = isel(ctx, n->inputs[2]);
+
+                SUBMIT(inst_move(n->dt, dst, lhs));
+                SUBMIT(inst_op_rrr(isel_vector_op(ctx, type, n->dt), n->dt, dst, dst, rhs));
+            } else if (try_for_imm32(ctx, n->inputs[2], &x)) {
                 use(ctx, n->inputs[2]);
 
                 SUBMIT(inst_move(n->dt, dst, lhs));
@@ -681,10 +731,9 @@ static int isel(Ctx* restrict ctx, TB_Node* n) {
             // division is scaled up to 32bit
             if (dt.data < 32) dt.data = 32;
 
-            // mov rax, lhs
+            // both sides are selected before RAX gets written, the divisor
+            // might need RAX for its own division.
             int lhs = isel(ctx, n->inputs[1]);
-            SUBMIT(inst_op_rr(op, dt, RAX, lhs));
-
             int rhs = isel(ctx, n->inputs[2]);
             if (n->dt.data < 32) {
                 // add cast
@@ -693,6 +742,9 @@ static int isel(Ctx* restrict ctx, TB_Node* n) {
                 rhs = new_rhs;
             }
 
+            // mov rax, lhs
+            SUBMIT(inst_op_rr(op, dt, RAX, lhs));
+
             // if signed:
             //   cqo/cdq (sign extend RAX into RDX)
             // else:
@@ -800,6 +852,28 @@ static int isel(Ctx* restrict ctx, TB_Node* n) {
             SUBMIT(inst_op_rrr(ops[type - TB_FADD], n->dt, dst, dst, rhs));
             break;
         }
+        case TB_VBROADCAST: {
+            TB_DataType src_dt = n->inputs[1]->dt;
+            dst = DEF(n, n->dt);
+
+            int src = isel(ctx, n->inputs[1]);
+            if (src_dt.type == TB_FLOAT) {
+                // shufps/shufpd with lane 0 in every slot
+                SUBMIT(inst_move(n->dt, dst, src));
+                SUBMIT(inst_op_rri(FP_SHUF, n->dt, dst, dst, 0));
+            } else {
+                // movd/movq into the low lane, widen it up to a dword and spread that around
+                SUBMIT(inst_op_rr(MOV_I2F, src_dt.data > 32 ? TB_TYPE_I64 : TB_TYPE_I32, dst, src));
+                if (src_dt.data <= 8) {
+                    SUBMIT(inst_op_rrr(PUNPCKLBW, n->dt, dst, dst, dst));
+                }
+                if (src_dt.data <= 16) {
+                    SUBMIT(inst_op_rrr(PUNPCKLWD, n->dt, dst, dst, dst));
+                }
+                SUBMIT(inst_op_rri(PSHUFD, n->dt, dst, dst, src_dt.data > 32 ? 0x44 : 0));
+            }
+            break;
+        }
         case TB_UINT2FLOAT:
         case TB_INT2FLOAT: {
             TB_DataType src_dt = n->inputs[1]->dt;
@@ -916,6 +990,13 @@ static int isel(Ctx* restrict ctx, TB_Node* n) {
 
             TB_DataType dt = n->dt;
 
+            // if SCCP knows the sign bit is clear, zero extension does the same job
+            // (and for 32bit it's just a mov).
+            uint64_t known_zeros, known_ones;
+            if (sign_ext && bits_in_type <= 32 && tb_pass_known_bits(ctx->p, src, &known_zeros, &known_ones)) {
+                if ((known_zeros >> (bits_in_type - 1)) & 1) sign_ext = false;
+            }
+
             int op = MOV;
             if (bits_in_type <= 8) op = sign_ext ? MOVSXB : MOVZXB;
             else if (bits_in_type <= 16) op = sign_ext ? MOVSXW : MOVZXW;
@@ -1464,6 +1545,9 @@ static void print_operand(TB_CGEmitter* restrict e, Val* v, TB_X86_DataType dt)
 static void inst2_print(TB_CGEmitter* restrict e, InstType type, Val* dst, Val* src, TB_X86_DataType dt) {
     if (dt == TB_X86_TYPE_XMMWORD) {
         dt = TB_X86_TYPE_SSE_PD;
+    } else if (dt >= TB_X86_TYPE_PBYTE && dt <= TB_X86_TYPE_PQWORD && inst_table[type].cat == INST_BINOP_SSE) {
+        // moving (or zeroing) packed ints doesn't care about the lanes
+        dt = TB_X86_TYPE_SSE_PS;
     }
 
     if (e->emit_asm) {
@@ -1483,7 +1567,9 @@ static void inst2_print(TB_CGEmitter* restrict e, InstType type, Val* dst, Val*
         EMITA(e, "\n");
     }
 
-    if (dt >= TB_X86_TYPE_SSE_SS && dt <= TB_X86_TYPE_SSE_PD) {
+    if (inst_table[type].cat == INST_BINOP_SSE_INT) {
+        inst2sse_int(e, type, dst, src, dt);
+    } else if (dt >= TB_X86_TYPE_SSE_SS && dt <= TB_X86_TYPE_SSE_PD) {
         inst2sse(e, type, dst, src, dt);
     } else {
         inst2(e, type, dst, src, dt);
@@ -1694,7 +1780,8 @@ static void emit_code(Ctx* restrict ctx, TB_FunctionOutput* restrict func_out) {
                     inst1_print(e, inst->type, &lhs, inst->dt);
                     continue;
                 } else {
-                    if (ternary || inst->type == MOV || inst->type == FP_MOV) {
+                    // unary ops work in place so they need the copy too
+                    if (ternary || inst->type == MOV || inst->type == FP_MOV || cat == INST_UNARY || cat == INST_UNARY_EXT) {
                         if (!is_value_match(&out, &lhs)) {
                             inst2_print(e, mov_op, &out, &lhs, inst->dt);
                         }
@@ -100,6 +100,8 @@ typedef enum {
 
     // SSE
     INST_BINOP_SSE,
+    // packed integer SSE (66 0F), op_i is the escape byte for the 0F 38 ones
+    INST_BINOP_SSE_INT,
 } InstCategory;
 
 typedef struct InstDesc {
@@ -29,7 +29,7 @@ static void emit_memory_operand(TB_CGEmitter* restrict e, uint8_t rx, const Val*
 
         EMIT1(e, mod_rx_rm(mod, rx, needs_index ? RSP : base));
         if (needs_index) {
-            EMIT1(e, mod_rx_rm(scale, (base & 7) == RSP ? RSP : index, base));
+            EMIT1(e, mod_rx_rm(scale, index != GPR_NONE ? index : RSP, base));
         }
 
         if (mod == MOD_INDIRECT_DISP8) {
@@ -100,7 +100,7 @@ static void inst1(TB_CGEmitter* restrict e, InstType type, const Val* r, TB_X86_
 
         EMIT1(e, mod_rx_rm(mod, rx, needs_index ? RSP : base));
         if (needs_index) {
-            EMIT1(e, mod_rx_rm(scale, (base & 7) == RSP ? RSP : index, base));
+            EMIT1(e, mod_rx_rm(scale, index != GPR_NONE ? index : RSP, base));
         }
 
         if (mod == MOD_INDIRECT_DISP8) EMIT1(e, (int8_t)disp);
@@ -142,7 +142,8 @@ static void inst2(TB_CGEmitter* restrict e, InstType type, const Val* a, const V
     if (type == MOVABS) {
         assert(a->type == VAL_GPR && b->type == VAL_ABS);
 
-        EMIT1(e, rex(true, a->reg, 0, 0));
+        // the register is in the opcode so it extends with REX.B
+        EMIT1(e, rex(true, 0, a->reg, 0));
         EMIT1(e, inst->op + (a->reg & 0b111));
         EMIT8(e, b->abs);
         return;
@@ -164,6 +165,11 @@ static void inst2(TB_CGEmitter* restrict e, InstType type, const Val* a, const V
     bool is_gpr_only_dst = (inst->op & 1);
     bool dir_flag = (dir != is_gpr_only_dst) && inst->op != 0x69;
 
+    // CMOVcc uses the bottom bits for the condition code
+    if (type >= CMOVO && type <= CMOVG) {
+        dir_flag = false;
+    }
+
     if (inst->cat != INST_BINOP_EXT3) {
         // Address size prefix
         if (dt == TB_X86_TYPE_WORD && inst->cat != INST_BINOP_EXT2) {
@@ -206,8 +212,10 @@ static void inst2(TB_CGEmitter* restrict e, InstType type, const Val* a, const V
     rex_prefix |= (rx >> 3) << 2;
 
     // if the REX stays as 0x40 then it's default and doesn't need
-    // to be here.
-    if (rex_prefix != 0x40 || dt == TB_X86_TYPE_BYTE || type == MOVZXB) {
+    // to be here (unless we're sign extending SPL, BPL, SIL or DIL, without
+    // it those mean AH, CH, DH and BH).
+    bool high_byte = type == MOVSXB && ((a->type == VAL_GPR && a->reg >= 4) || (b->type == VAL_GPR && b->reg >= 4));
+    if (rex_prefix != 0x40 || dt == TB_X86_TYPE_BYTE || type == MOVZXB || high_byte) {
         EMIT1(e, rex_prefix);
     }
 
@@ -270,6 +278,12 @@ static void inst2sse(TB_CGEmitter* restrict e, InstType type, const Val* a, cons
     bool supports_mem_dst = (type == FP_MOV);
     bool dir = is_value_mem(a);
 
+    // shufps/shufpd take an imm8, we only ever shuffle the destination with itself
+    const Val* imm = NULL;
+    if (b->type == VAL_IMM) {
+        imm = b, b = a;
+    }
+
     bool packed = (dt == TB_X86_TYPE_SSE_PS || dt == TB_X86_TYPE_SSE_PD);
     bool is_double = (dt == TB_X86_TYPE_SSE_PD || dt == TB_X86_TYPE_SSE_SD);
 
@@ -309,4 +323,49 @@ static void inst2sse(TB_CGEmitter* restrict e, InstType type, const Val* a, cons
     EMIT1(e, 0x0F);
     EMIT1(e, inst->op + (supports_mem_dst ? dir : 0));
     emit_memory_operand(e, rx, b);
+
+    if (imm) {
+        EMIT1(e, (uint8_t) imm->imm);
+    }
+}
+
+// packed integer ops are all 66 0F (38) op /r, the destination is always an XMM
+static void inst2sse_int(TB_CGEmitter* restrict e, InstType type, const Val* a, const Val* b, TB_X86_DataType dt) {
+    assert(type < COUNTOF(inst_table));
+    const InstDesc* restrict inst = &inst_table[type];
+    assert(a->type == VAL_XMM);
+
+    // pshufd takes an imm8, we only ever shuffle the destination with itself
+    const Val* imm = NULL;
+    if (b->type == VAL_IMM) {
+        imm = b, b = a;
+    }
+
+    uint8_t rx = a->reg;
+    uint8_t base, index;
+    if (b->type == VAL_MEM) {
+        base  = b->reg;
+        index = b->index != GPR_NONE ? b->index : 0;
+    } else if (b->type == VAL_XMM) {
+        base  = b->reg;
+        index = 0;
+    } else {
+        tb_todo();
+    }
+
+    EMIT1(e, 0x66);
+    if (rx >= 8 || base >= 8 || index >= 8) {
+        EMIT1(e, rex(false, rx, base, index));
+    }
+
+    EMIT1(e, 0x0F);
+    if (inst->op_i) {
+        EMIT1(e, inst->op_i);
+    }
+    EMIT1(e, inst->op);
+    emit_memory_operand(e, rx, b);
+
+    if (imm) {
+        EMIT1(e, (uint8_t) imm->imm);
+    }
 }
@@ -0,0 +1,60 @@
+// Generates a bytecode interpreter of the same shape as sqlite3VdbeExec (one big
+// dispatch loop over a switch with N opcodes and a pile of values live across all
+// of them), it's what the register allocator timings are measured on:
+//
+//   cc tests/gen_vm.c -o gen_vm && ./gen_vm 1000 > vm1000.c
+//   cuik -O1 -Treport report.json vm1000.c
+//
+// the output only depends on N so the numbers can be compared across builds.
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// values kept live across the dispatch loop
+#define V 24
+
+static uint32_t seed = 1;
+static int rng(int n) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+}
+
+int main(int argc, char** argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 250;
+    if (n <= 0) {
+        fprintf(stderr, "usage: %s <opcode count>\n", argv[0]);
+        return 1;
+    }
+
+    static const char* ops[] = { "+", "-", "^", "*", "&", "|" };
+    printf("int vm(int* code, int n, int* mem) {\n ");
+    for (int i = 0; i < V; i++) printf(" int r%d = mem[%d] + n;", i, i);
+    printf("\n  for (int pc = 0; pc < n; pc++) {\n");
+    printf("    switch (code[pc]) {\n");
+    for (int c = 0; c < n; c++) {
+        printf("    case %d: {\n", c);
+        for (int k = 0; k < 6; k++) {
+            int a = rng(V), b = rng(V), d = rng(V);
+            printf("      r%d = r%d %s r%d + mem[(r%d + %d) & 63];\n", d, a, ops[rng(6)], b, a, k);
+        }
+
+        if (c % 3 == 0) {
+            printf("      if (r%d & 1) mem[%d] = r%d; else r%d += mem[%d];\n", c % V, c & 63, (c + 1) % V, (c + 2) % V, (c * 7) & 63);
+        }
+        printf("      break; }\n");
+    }
+    printf("    default: break;\n");
+    printf("    }\n");
+    printf("  }\n");
+    printf("  return r0");
+    for (int i = 1; i < V; i++) printf(" + r%d", i);
+    printf(";\n}\n");
+
+    printf("int main(void) {\n");
+    printf("  int code[500]; int mem[64];\n");
+    printf("  for (int i = 0; i < 64; i++) mem[i] = i * 3;\n");
+    printf("  for (int i = 0; i < 500; i++) code[i] = (i * 7919) %% %d;\n", n);
+    printf("  return vm(code, 500, mem) & 0xFF;\n");
+    printf("}\n");
+    return 0;
+}
@@ -0,0 +1,72 @@
+//#sq: 285
+//#early: 22
+//#switch: 42
+//#addr: 36
+//#fact: 120
+//#nested: 64
+//#even: 1
+#include <stdio.h>
+
+// meant for -O1 and up, every call here is either pasted in by the
+// inliner or (for the recursive ones) has to stay a real call.
+static int sq(int x) { return x * x; }
+
+// multiple returns get merged into the block after the call
+static int early(int x) {
+    if (x < 0) return -x;
+    if (x > 10) return 10;
+    return x * 2;
+}
+
+// the switch is a multi-way branch inside the pasted body
+static int pick(int x) {
+    switch (x & 3) {
+        case 0: return 1;
+        case 1: return x + 5;
+        case 2: return x * 3;
+        default: return 0;
+    }
+}
+
+// the callee's locals get their own stack slots in the caller
+static void bump(int* p, int n) {
+    int tmp[4] = { n, n + 1, n + 2, n + 3 };
+    for (int i = 0; i < 4; i++) *p += tmp[i];
+}
+
+// recursion stays a real call
+static int fact(int n) { return n <= 1 ? 1 : n * fact(n - 1); }
+
+static int add3(int a, int b, int c) { return a + b + c; }
+static int nest(int x) { return add3(sq(x), early(x), pick(x)); }
+
+// mutual recursion, the cycle gets broken somewhere
+static int is_odd(int n);
+static int is_even(int n) { return n == 0 ? 1 : is_odd(n - 1); }
+static int is_odd(int n) { return n == 0 ? 0 : is_even(n - 1); }
+
+int main(void) {
+    int s = 0;
+    for (int i = 0; i < 10; i++) s += sq(i);
+    printf("sq: %d\n", s);
+
+    printf("early: %d\n", early(-4) + early(30) + early(4));
+
+    int w = 0;
+    for (int i = 0; i < 8; i++) w += pick(i);
+    printf("switch: %d\n", w);
+
+    int acc = 0;
+    bump(&acc, 3);
+    bump(&acc, 3);
+    printf("addr: %d\n", acc);
+
+    printf("fact: %d\n", fact(5));
+
+    int t = 0;
+    for (int i = 0; i < 5; i++) t += nest(i);
+    printf("nested: %d\n", t);
+
+    printf("even: %d\n", is_even(10));
+    return 0;
+}
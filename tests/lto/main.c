@@ -0,0 +1,29 @@
+//#scale: 190
+//#counter: 7
+//#escape: 17
+#include <stdio.h>
+
+// build both files together with -lto (and -O1 or up), the calls into util.c
+// should get inlined once everything is internalized.
+int scale(int x, int k);
+int offset(int x, int k);
+int get_counter(void);
+extern int counter;
+
+// offset's address escapes through here so its k can't be folded
+int (*offset_ptr)(int, int);
+
+int unused_a(int x) { return x * 3; }
+
+int main(void) {
+    int r = 0;
+    for (int i = 0; i < 10; i++) r += scale(i, 4);
+    printf("scale: %d\n", r);
+
+    counter += 2;
+    printf("counter: %d\n", get_counter());
+
+    offset_ptr = offset;
+    printf("escape: %d\n", offset(2, 1) + offset(3, 1) + offset_ptr(4, 6));
+    return 0;
+}
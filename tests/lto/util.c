@@ -0,0 +1,15 @@
+// the other half of tests/lto/main.c
+int counter = 5;
+int table[4] = { 1, 2, 3, 4 };
+
+// nothing calls these, -lto should drop them
+int unused_b(int x) { return table[x & 3]; }
+static int unused_c(int x) { return unused_b(x) * 2; }
+
+// every call site passes k = 4, so it becomes a constant
+int scale(int x, int k) { return x * k + 1; }
+
+// same constant at each direct call but the address escapes too
+int offset(int x, int k) { return x + k; }
+
+int get_counter(void) { return counter; }
@@ -0,0 +1,45 @@
+//#loop: 5
+//#loop sum: 25
+//#merge: 30
+#include <stdio.h>
+
+// meant for -O1 and up, loads get forwarded from the stores before them and
+// acyclic merges get a phi, but nothing may be forwarded around a loop.
+static int across_loop(int n) {
+    int a = 5, b = 0;
+    if (a > 3) b = 10; else b = 20;
+    int c = b * 2;
+    while (n > 0) {
+        if (c == 20) a = a; else a = 99;
+        n--;
+    }
+    return a;
+}
+
+static int across_loop_sum(int n) {
+    int a = 5, b = 0;
+    if (a > 3) b = 10; else b = 20;
+    int c = b * 2;
+    while (n > 0) {
+        if (c == 20) a = a; else a = 99;
+        n--;
+    }
+    return a + c;
+}
+
+// the load after the if/else sees a different store on each side
+static int merge(int x) {
+    int v[2];
+    if (x) v[0] = 10; else v[0] = 20;
+    v[1] = 20;
+    return v[0] + v[1];
+}
+
+int gv = 3;
+
+int main(void) {
+    printf("loop: %d\n", across_loop(gv));
+    printf("loop sum: %d\n", across_loop_sum(gv));
+    printf("merge: %d\n", merge(gv));
+    return 0;
+}
@@ -0,0 +1,63 @@
+//#last: 9
+//#flipped: 7
+//#le: 14
+//#switch: 18
+#include <stdio.h>
+
+// meant for -O1 and up, the conditions here get folded into branches with
+// their successors swapped and the phi edge splitting has to follow succ[]
+// rather than the projection numbers.
+static int last_multiple(int n) {
+    int last = 0, i = 0;
+    while (i < 10) {
+        if (i % n == 0) last = i;
+        i++;
+    }
+    return last;
+}
+
+// br (x != 0) with the phi on the "false" side
+static int last_nonzero(int* a, int n) {
+    int last = -1;
+    for (int i = 0; i < n; i++) {
+        if (a[i] != 0) last = i;
+    }
+    return last;
+}
+
+// br (y <= x) gets flipped into br (x < y)
+static int count_le(int* a, int n, int k) {
+    int c = 0, m = 0;
+    for (int i = 0; i < n; i++) {
+        if (a[i] <= k) c++;
+        else m += a[i];
+    }
+    return c + m;
+}
+
+static int classify(int n) {
+    int s = 0;
+    for (int i = 0; i < n; i++) {
+        int v = 1;
+        switch (i & 3) {
+            case 0: v = 4; break;
+            case 1: break;
+            case 2: v = 0; break;
+            default: break;
+        }
+        s += v;
+    }
+    return s;
+}
+
+int gn = 3;
+
+int main(void) {
+    printf("last: %d\n", last_multiple(gn));
+
+    int a[9] = { 1, 0, 2, 0, 0, 3, 0, 4, 0 };
+    printf("flipped: %d\n", last_nonzero(a, 9));
+    printf("le: %d\n", count_le(a, 9, 2));
+    printf("switch: %d\n", classify(12));
+    return 0;
+}
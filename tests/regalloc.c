@@ -0,0 +1,44 @@
+//#args: 64
+//#many: 1576
+//#float: 60
+//#mixed: 107
+#include <stdio.h>
+
+// meant for -O2 (graph coloring), every value passed to these calls is also
+// live after them so it can't stay in the argument register. the callees are
+// recursive so the inliner leaves them alone.
+static int big(int x) { return x <= 0 ? 1 : big(x - 1) + x; }
+
+static int sum4(int a, int b, int c, int d) {
+    return a <= 0 ? b + c + d : sum4(a - 1, b, c, d) + a;
+}
+
+static double halve(double x, int n) { return n <= 0 ? x : halve(x * 0.5, n - 1); }
+
+static long mix(long a, double b, int c) { return c <= 0 ? a + (long) b : mix(a + c, b, c - 1); }
+
+int main(void) {
+    int t = 0;
+    for (int i = 0; i < 4; i++) t = t * 3 + big(i);
+    printf("args: %d\n", t);
+
+    int s = 0;
+    for (int a = 0, b = 10, c = 20, d = 30; a < 8; a++, b += 2, c += 3, d += 4) {
+        s += sum4(a, b, c, d) + a + b + c + d;
+    }
+    printf("many: %d\n", s);
+
+    double f = 0.0;
+    for (double x = 8.0; x < 72.0; x *= 2.0) {
+        f += halve(x, 2) + x * 0.25;
+    }
+    printf("float: %d\n", (int) f);
+
+    long m = 0;
+    for (int i = 0; i < 6; i++) {
+        double d = i * 1.5;
+        m += mix(i, d, i) + i + (long) d;
+    }
+    printf("mixed: %d\n", (int) m);
+    return 0;
+}
@@ -0,0 +1,75 @@
+//#int: 1
+//#float: 1
+//#short: 1
+//#char: 1
+//#overlap: 1
+//#remainder: 1
+#include <stdio.h>
+
+// meant for -O1 and up, each kernel should get the wide loop (plus the scalar
+// one for the remainder) and has to match the plain version for every length.
+#define N 100
+
+static void add_i(int* a, int* b, int* c, int n) { for (int i = 0; i < n; i++) a[i] = b[i] + c[i]; }
+static void mul_f(float* a, float* b, float k, int n) { for (int i = 0; i < n; i++) a[i] = b[i] * k; }
+static void sub_s(short* a, short* b, short* c, int n) { for (int i = 0; i < n; i++) a[i] = b[i] - c[i]; }
+static void xor_c(unsigned char* a, unsigned char* b, int n) { for (int i = 0; i < n; i++) a[i] = b[i] ^ 0x5A; }
+
+static int ia[N], ib[N], ic[N];
+static float fa[N], fb[N];
+static short sa[N], sb[N], sc[N];
+static unsigned char ca[N], cb[N];
+
+static void fill(void) {
+    for (int i = 0; i < N; i++) {
+        ia[i] = i * 7 - 50, ib[i] = i * i, ic[i] = 3 - i;
+        fa[i] = 0.0f, fb[i] = i * 0.5f;
+        sa[i] = 0, sb[i] = i * 300, sc[i] = i - 40;
+        ca[i] = 0, cb[i] = i * 13;
+    }
+}
+
+int main(void) {
+    fill();
+    add_i(ia, ib, ic, N);
+    int ok = 1;
+    for (int i = 0; i < N; i++) ok &= ia[i] == i * i + 3 - i;
+    printf("int: %d\n", ok);
+
+    mul_f(fa, fb, 3.0f, N);
+    ok = 1;
+    for (int i = 0; i < N; i++) ok &= fa[i] == i * 1.5f;
+    printf("float: %d\n", ok);
+
+    sub_s(sa, sb, sc, N);
+    ok = 1;
+    for (int i = 0; i < N; i++) ok &= sa[i] == (short) (i * 300 - (i - 40));
+    printf("short: %d\n", ok);
+
+    xor_c(ca, cb, N);
+    ok = 1;
+    for (int i = 0; i < N; i++) ok &= ca[i] == (unsigned char) ((i * 13) ^ 0x5A);
+    printf("char: %d\n", ok);
+
+    // the destination runs one ahead of a source, so the overlap check has to
+    // pick the scalar loop.
+    fill();
+    add_i(ia + 1, ia, ic, N - 1);
+    ok = 1;
+    int expect = ia[0];
+    for (int i = 1; i < N; i++) {
+        expect += 3 - (i - 1);
+        ok &= ia[i] == expect;
+    }
+    printf("overlap: %d\n", ok);
+
+    // short trip counts and odd lengths only touch the scalar remainder
+    ok = 1;
+    for (int n = 0; n < 11; n++) {
+        fill();
+        add_i(ia, ib, ic, n);
+        for (int i = 0; i < N; i++) ok &= ia[i] == (i < n ? i * i + 3 - i : i * 7 - 50);
+    }
+    printf("remainder: %d\n", ok);
+    return 0;
+}